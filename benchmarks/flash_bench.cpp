@@ -0,0 +1,485 @@
+/**
+ * @file flash_bench.cpp
+ * 
+ * Throughput and latency benchmarks of the servers, clients and queues, over loopback.
+ * Every measurement is printed as one JSON object per line, so that runs can be compared
+ * by scripts, e.g. to catch regressions.
+ * 
+ * Usage: flash_bench [--only=echo|broadcast|queue] [--duration=ms] [--clients=1,8,32]
+ *                    [--window=8] [--payload=32] [--threads=1] [--port=40500]
+*/
+
+#include <flash/log.hpp>
+#include <flash/message.hpp>
+#include <flash/ring_queue.hpp>
+#include <flash/ts_deque.hpp>
+
+#include <flash/tcp/client.hpp>
+#include <flash/tcp/server.hpp>
+#include <flash/udp/client.hpp>
+#include <flash/udp/server.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using clock_type = std::chrono::steady_clock;
+
+enum class BenchMsgTypes : uint32_t {
+    Ping,
+    Broadcast
+};
+
+/**
+ * Settings of a run, from the command line.
+*/
+struct bench_options {
+    std::string m_only;                             // Only run the benchmark of that name.
+    std::chrono::milliseconds m_duration { 2000 };  // Measured time of each echo run.
+    std::vector<size_t> m_clients { 1, 8, 32 };     // Numbers of clients to run with.
+    size_t m_window { 8 };                          // Pings in flight per client.
+    size_t m_payload { 32 };                        // Bytes of every message, besides its timestamp.
+    size_t m_threads { 1 };                         // Networking threads of the servers.
+    uint16_t m_port { 40500 };                      // First port to listen on, one per run.
+};
+
+/**
+ * Builds a flat JSON object, printed as one line.
+*/
+class json_line {
+public:
+    json_line& add(const std::string& key, const std::string& value) {
+        separate(key);
+        m_stream << '"' << value << '"';
+        return *this;
+    }
+
+    json_line& add(const std::string& key, const char* value) {
+        return add(key, std::string { value });
+    }
+
+    template <typename U>
+    json_line& add(const std::string& key, U value) {
+        separate(key);
+        m_stream << value;
+        return *this;
+    }
+
+    void print() {
+        std::cout << '{' << m_stream.str() << "}\n" << std::flush;
+    }
+
+private:
+    void separate(const std::string& key) {
+        if (m_stream.tellp() > 0) m_stream << ',';
+        m_stream << '"' << key << "\":";
+    }
+
+    std::ostringstream m_stream;
+};
+
+/**
+ * Adds the percentiles of the latencies, in microseconds, to a line.
+*/
+void add_percentiles(json_line& line, std::vector<uint64_t>& nanos) {
+    std::sort(nanos.begin(), nanos.end());
+
+    auto percentile = [&nanos](double p) {
+        if (nanos.empty()) return 0.0;
+        size_t index = std::min(nanos.size() - 1, static_cast<size_t>(p * nanos.size()));
+        return nanos[index] / 1000.0;
+    };
+
+    line.add("p50_us", percentile(0.5))
+        .add("p99_us", percentile(0.99))
+        .add("p999_us", percentile(0.999))
+        .add("max_us", nanos.empty() ? 0.0 : nanos.back() / 1000.0);
+}
+
+uint64_t now_nanos() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now().time_since_epoch()).count());
+}
+
+/**
+ * Server that accepts everyone and bounces pings back.
+*/
+template <typename Base>
+class bench_server : public Base {
+public:
+    using Base::Base;
+
+    /**
+     * Waits until the given number of clients are validated.
+     * 
+     * @returns Whether they were, within a few seconds.
+    */
+    bool WaitForClients(size_t count) {
+        clock_type::time_point deadline = clock_type::now() + std::chrono::seconds(5);
+
+        while (m_validated.load(std::memory_order_acquire) < count) {
+            if (clock_type::now() > deadline) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        return true;
+    }
+
+protected:
+    bool OnClientConnect(const boost::asio::ip::address& /* address */) override {
+        return true;
+    }
+
+    void OnClientValidate(flash::UserId /* clientId */) override {
+        m_validated.fetch_add(1, std::memory_order_release);
+    }
+
+    void OnClientDisconnect(flash::UserId /* clientId */) override { }
+
+    void OnMessage(flash::UserId clientId, flash::message<BenchMsgTypes>&& msg) override {
+        if (msg.get_header().m_type == BenchMsgTypes::Ping) this->MessageClient(clientId, std::move(msg));
+    }
+
+private:
+    std::atomic<size_t> m_validated { 0 };
+};
+
+using tcp_server = bench_server<flash::tcp::server<BenchMsgTypes>>;
+using udp_server = bench_server<flash::udp::server<BenchMsgTypes>>;
+
+/**
+ * Pings in flight of one client.
+*/
+struct echo_client {
+    size_t m_inFlight { 0 };
+    clock_type::time_point m_lastActivity;  // When a ping was last sent or received.
+};
+
+/**
+ * Runs a server of the given transport on the side, and its clients from a single thread.
+*/
+template <typename Server, typename Client>
+class transport_bench {
+public:
+    template <typename... Args>
+    transport_bench(const bench_options& options, uint16_t port, Args&&... serverArgs)
+        : m_options { options },
+          m_server { port, std::forward<Args>(serverArgs)... } {
+    }
+
+    ~transport_bench() {
+        m_running.store(false, std::memory_order_release);
+        if (m_updater.joinable()) m_updater.join();
+
+        for (auto& client : m_clients) client->Disconnect();
+        m_server.Stop();
+    }
+
+    /**
+     * Starts the server, and connects the clients to it.
+     * 
+     * @returns Whether every client got connected.
+    */
+    bool Start(size_t clientCount, uint16_t port) {
+        if (!m_server.Start()) return false;
+
+        for (size_t i = 0; i < clientCount; ++i) {
+            m_clients.push_back(std::make_unique<Client>());
+            if (!m_clients.back()->Connect("127.0.0.1", port)) return false;
+        }
+
+        if (!m_server.WaitForClients(clientCount)) return false;
+
+        // Handle the pings on a thread of their own, like a game loop would.
+        m_updater = std::thread([this]() {
+            while (m_running.load(std::memory_order_acquire)) {
+                m_server.Update(-1, false);
+                std::this_thread::yield();
+            }
+        });
+
+        return true;
+    }
+
+    /**
+     * Keeps a window of pings in flight from every client for the duration, and measures
+     * how many come back, and how long they take to.
+    */
+    void Echo(json_line& line) {
+        std::vector<echo_client> states(m_clients.size());
+        std::vector<uint64_t> latencies;
+        std::vector<uint8_t> payload(m_options.m_payload, 0xAB);
+
+        uint64_t sent = 0, received = 0, lost = 0;
+
+        clock_type::time_point start = clock_type::now();
+        clock_type::time_point end = start + m_options.m_duration;
+        for (echo_client& state : states) state.m_lastActivity = start;
+
+        while (true) {
+            clock_type::time_point now = clock_type::now();
+            bool sending = now < end;
+            bool waiting = false;
+            bool idle = true;
+
+            for (size_t i = 0; i < m_clients.size(); ++i) {
+                Client& client = *m_clients[i];
+                echo_client& state = states[i];
+
+                while (!client.Incoming().empty()) {
+                    flash::message<BenchMsgTypes> msg = client.Incoming().pop_front().m_msg;
+
+                    uint64_t sentAt;
+                    msg >> sentAt;
+                    latencies.push_back(now_nanos() - sentAt);
+
+                    --state.m_inFlight;
+                    ++received;
+                    state.m_lastActivity = now;
+                    idle = false;
+                }
+
+                // Over UDP, pings may not come back, give up on them after a while.
+                if (state.m_inFlight > 0 && now - state.m_lastActivity > std::chrono::milliseconds(200)) {
+                    lost += state.m_inFlight;
+                    state.m_inFlight = 0;
+                }
+
+                while (sending && state.m_inFlight < m_options.m_window) {
+                    flash::message<BenchMsgTypes> msg { BenchMsgTypes::Ping };
+                    msg.write(payload.data(), payload.size());
+                    msg << now_nanos();
+                    client.Send(std::move(msg));
+
+                    ++state.m_inFlight;
+                    ++sent;
+                    state.m_lastActivity = now;
+                }
+
+                waiting = waiting || state.m_inFlight > 0;
+            }
+
+            if (!sending && !waiting) break;
+
+            // Leave the networking threads the cores they need.
+            if (idle) std::this_thread::yield();
+        }
+
+        double seconds = std::chrono::duration<double>(m_options.m_duration).count();
+
+        line.add("sent", sent)
+            .add("received", received)
+            .add("lost", lost)
+            .add("msgs_per_sec", received / seconds);
+        add_percentiles(line, latencies);
+    }
+
+    /**
+     * Broadcasts bursts of messages to every client, and measures the time spent queueing
+     * each of them, and until every client got the whole burst.
+    */
+    void Broadcast(json_line& line, size_t burst, size_t bursts) {
+        std::vector<uint8_t> payload(m_options.m_payload, 0xCD);
+        std::vector<uint64_t> queueing, delivery;
+        uint64_t expected = 0, received = 0;
+
+        for (size_t b = 0; b < bursts; ++b) {
+            clock_type::time_point start = clock_type::now();
+
+            for (size_t i = 0; i < burst; ++i) {
+                flash::message<BenchMsgTypes> msg { BenchMsgTypes::Broadcast };
+                msg.write(payload.data(), payload.size());
+
+                uint64_t before = now_nanos();
+                m_server.MessageAllClients(std::move(msg));
+                queueing.push_back(now_nanos() - before);
+            }
+
+            expected += burst * m_clients.size();
+
+            // Wait for the whole burst, or give up on what UDP lost.
+            uint64_t burstReceived = 0;
+            clock_type::time_point deadline = start + std::chrono::milliseconds(500);
+            while (burstReceived < burst * m_clients.size() && clock_type::now() < deadline) {
+                for (auto& client : m_clients) {
+                    while (!client->Incoming().empty()) {
+                        client->Incoming().pop_front();
+                        ++burstReceived;
+                    }
+                }
+
+                std::this_thread::yield();
+            }
+
+            delivery.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count());
+            received += burstReceived;
+        }
+
+        uint64_t deliveryNanos = 0;
+        for (uint64_t nanos : delivery) deliveryNanos += nanos;
+
+        std::sort(queueing.begin(), queueing.end());
+
+        line.add("burst", burst)
+            .add("expected", expected)
+            .add("received", received)
+            .add("deliveries_per_sec", deliveryNanos ? received / (deliveryNanos / 1e9) : 0.0)
+            .add("queue_p50_us", queueing[queueing.size() / 2] / 1000.0)
+            .add("queue_p99_us", queueing[std::min(queueing.size() - 1, queueing.size() * 99 / 100)] / 1000.0);
+
+        // Percentiles of the time to deliver a whole burst.
+        add_percentiles(line, delivery);
+    }
+
+private:
+    const bench_options& m_options;
+    Server m_server;
+    std::vector<std::unique_ptr<Client>> m_clients;
+    std::atomic<bool> m_running { true };
+    std::thread m_updater;
+};
+
+template <typename Server, typename Client, typename... Args>
+void run_transport(const char* name, const bench_options& options, uint16_t& port, Args&&... serverArgs) {
+    for (size_t clients : options.m_clients) {
+        if (options.m_only.empty() || options.m_only == "echo") {
+            json_line line;
+            line.add("benchmark", "echo").add("transport", name).add("clients", clients)
+                .add("window", options.m_window).add("payload", options.m_payload).add("threads", options.m_threads);
+
+            transport_bench<Server, Client> bench { options, port, serverArgs... };
+            if (bench.Start(clients, port)) {
+                bench.Echo(line);
+            } else {
+                line.add("error", "clients could not connect");
+            }
+            line.print();
+            ++port;
+        }
+
+        if (options.m_only.empty() || options.m_only == "broadcast") {
+            json_line line;
+            line.add("benchmark", "broadcast").add("transport", name).add("clients", clients)
+                .add("payload", options.m_payload).add("threads", options.m_threads);
+
+            transport_bench<Server, Client> bench { options, port, serverArgs... };
+            if (bench.Start(clients, port)) {
+                bench.Broadcast(line, 64, 50);
+            } else {
+                line.add("error", "clients could not connect");
+            }
+            line.print();
+            ++port;
+        }
+    }
+}
+
+bool try_take(flash::ts_deque<uint64_t>& queue, uint64_t& value) {
+    if (queue.empty()) return false;
+    value = queue.pop_front();
+    return true;
+}
+
+template <size_t Capacity>
+bool try_take(flash::mpsc_ring_queue<uint64_t, Capacity>& queue, uint64_t& value) {
+    return queue.try_pop_front(value);
+}
+
+/**
+ * Pushes from a number of producers to a single consumer, like the networking threads
+ * do to the incoming queue of a server, and measures the items moved per second.
+*/
+template <typename Queue>
+void run_queue(const char* name, size_t producers, size_t itemsPerProducer) {
+    auto queue = std::make_unique<Queue>();
+    std::atomic<bool> go { false };
+
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&queue, &go, itemsPerProducer]() {
+            while (!go.load(std::memory_order_acquire)) { }
+            for (uint64_t i = 0; i < itemsPerProducer; ++i) queue->push_back(uint64_t { i });
+        });
+    }
+
+    uint64_t total = producers * itemsPerProducer, taken = 0, value;
+
+    clock_type::time_point start = clock_type::now();
+    go.store(true, std::memory_order_release);
+
+    while (taken < total) {
+        if (try_take(*queue, value)) {
+            ++taken;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+    for (auto& thread : threads) thread.join();
+
+    json_line line;
+    line.add("benchmark", "queue").add("queue", name).add("producers", producers)
+        .add("items", total).add("items_per_sec", total / seconds);
+    line.print();
+}
+
+bench_options parse_options(int argc, char** argv) {
+    bench_options options;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t equals = arg.find('=');
+        std::string key = arg.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+
+        if (key == "--only") {
+            options.m_only = value;
+        } else if (key == "--duration") {
+            options.m_duration = std::chrono::milliseconds(std::stoul(value));
+        } else if (key == "--clients") {
+            options.m_clients.clear();
+            std::istringstream list { value };
+            for (std::string count; std::getline(list, count, ',');) options.m_clients.push_back(std::stoul(count));
+        } else if (key == "--window") {
+            options.m_window = std::stoul(value);
+        } else if (key == "--payload") {
+            options.m_payload = std::stoul(value);
+        } else if (key == "--threads") {
+            options.m_threads = std::stoul(value);
+        } else if (key == "--port") {
+            options.m_port = static_cast<uint16_t>(std::stoul(value));
+        } else {
+            std::cerr << "Unknown option: " << arg << "\n";
+        }
+    }
+
+    return options;
+}
+
+int main(int argc, char** argv) {
+    bench_options options = parse_options(argc, argv);
+
+    // Keep connections, and the failed reads of disconnections, out of the output.
+    flash::set_log_level(flash::log_level::error);
+
+    uint16_t port = options.m_port;
+
+    run_transport<tcp_server, flash::tcp::client<BenchMsgTypes>>("tcp", options, port, options.m_threads);
+    run_transport<udp_server, flash::udp::client<BenchMsgTypes>>("udp", options, port, uint32_t { 5000 }, options.m_threads);
+
+    if (options.m_only.empty() || options.m_only == "queue") {
+        for (size_t producers : { 1, 2, 4, 8 }) {
+            run_queue<flash::ts_deque<uint64_t>>("ts_deque", producers, 200000);
+            run_queue<flash::mpsc_ring_queue<uint64_t, 4096>>("mpsc_ring_queue", producers, 200000);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef FLASH_BACKPRESSURE_HPP
+#define FLASH_BACKPRESSURE_HPP
+
+/**
+ * @file backpressure.hpp
+ *
+ * Bounds on the bytes queued to a single client, and what to do once they are reached,
+ * so that a client on a slow link can't make the server queue unbounded memory.
+*/
+
+#include <cstddef>
+#include <cstdint>
+
+namespace flash {
+
+/**
+ * What to do with a message that would take the bytes queued to a client over the high-water mark.
+*/
+enum class backpressure_policy : uint8_t {
+    drop_oldest,  // Drop the oldest queued messages, the least urgent first, to make room for it.
+    latest_wins,  // Replace the queued message of the same type, e.g. for state updates, or else drop the oldest.
+    disconnect    // Drop the client, which is too slow to keep up.
+};
+
+/**
+ * How many bytes may be queued to a single client, and what happens beyond that.
+*/
+struct backpressure_settings {
+    size_t m_highWaterBytes { 0 };                                     // Queued bytes per client from which the policy applies, 0 for no bound.
+    backpressure_policy m_policy { backpressure_policy::drop_oldest };  // What to do beyond the mark.
+};
+
+/**
+ * Bytes queued to a single client, not counting the ones being written.
+*/
+struct queue_usage {
+    size_t m_bytes { 0 };
+    bool m_overHighWater { false };  // Set when going over the high-water mark, until back under half of it.
+
+    /**
+     * Accounts for a message of the given size leaving the queue.
+    */
+    void remove(size_t size, const backpressure_settings& settings) {
+        m_bytes -= size < m_bytes ? size : m_bytes;
+
+        if (m_bytes <= settings.m_highWaterBytes / 2) m_overHighWater = false;
+    }
+
+    /**
+     * @returns Whether a message of the given size would go over the high-water mark.
+    */
+    bool exceeds(size_t size, const backpressure_settings& settings) const {
+        return settings.m_highWaterBytes > 0 && m_bytes + size > settings.m_highWaterBytes;
+    }
+};
+
+} // namespace flash
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef FLASH_BUFFER_POOL_HPP
+#define FLASH_BUFFER_POOL_HPP
+
+/**
+ * @file buffer_pool.hpp
+ * 
+ * Thread-safe pool of byte buffers, so that message bodies can be recycled
+ * instead of allocated and freed for every message.
+*/
+
+#include <flash/byte_buffer.hpp>
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace flash {
+
+/**
+ * Thread-safe pool of message bodies.
+ * 
+ * Buffers keep their capacity while in the pool, so once the pool has warmed up,
+ * taking a buffer of a usual size doesn't allocate. The pool is bounded both in the
+ * number of buffers it keeps and in their capacity, so occasional large messages
+ * don't pin down memory.
+*/
+class buffer_pool {
+public:
+    /// Default maximum number of buffers kept in the pool.
+    static constexpr size_t DEFAULT_MAX_BUFFERS = 4096;
+
+    /// Default maximum capacity of a buffer kept in the pool, in bytes.
+    static constexpr size_t DEFAULT_MAX_CAPACITY = 64 * 1024;
+
+    /**
+     * Constructs an empty pool.
+     * 
+     * @param maxBuffers  the maximum number of buffers to keep.
+     * @param maxCapacity the maximum capacity of a buffer to keep, larger ones are freed.
+    */
+    explicit buffer_pool(size_t maxBuffers = DEFAULT_MAX_BUFFERS, size_t maxCapacity = DEFAULT_MAX_CAPACITY)
+        : m_maxBuffers { maxBuffers }, m_maxCapacity { maxCapacity } { }
+
+    // Don't want to be able to copy the mutex.
+    buffer_pool(const buffer_pool&) = delete;
+    buffer_pool& operator=(const buffer_pool&) = delete;
+
+    /**
+     * Takes a buffer from the pool, or makes a new one if the pool is empty.
+     * 
+     * @param size the size to resize the buffer to.
+     * @returns A buffer of the given size, with unspecified contents.
+    */
+    std::vector<uint8_t> acquire(size_t size) {
+        std::vector<uint8_t> buffer;
+
+        {
+            std::scoped_lock lock { m_mutexPool };
+
+            if (!m_buffers.empty()) {
+                buffer = std::move(m_buffers.back());
+                m_buffers.pop_back();
+            }
+        }
+
+        buffer.resize(size);
+        return buffer;
+    }
+
+    /**
+     * Gives a buffer back to the pool. Buffers without any capacity, e.g. ones that
+     * have been moved from, and buffers that are too large, are simply dropped.
+     * 
+     * @param buffer the buffer to recycle, moved in.
+    */
+    void release(std::vector<uint8_t>&& buffer) {
+        if (buffer.capacity() == 0 || buffer.capacity() > m_maxCapacity) return;
+
+        buffer.clear();
+
+        std::scoped_lock lock { m_mutexPool };
+
+        if (m_buffers.size() < m_maxBuffers) {
+            m_buffers.push_back(std::move(buffer));
+        }
+    }
+
+    /**
+     * @returns The number of buffers currently in the pool.
+    */
+    size_t size() const {
+        std::scoped_lock lock { m_mutexPool };
+        return m_buffers.size();
+    }
+
+protected:
+    size_t m_maxBuffers;   // Maximum number of buffers kept.
+    size_t m_maxCapacity;  // Maximum capacity of a buffer kept.
+
+    std::vector<std::vector<uint8_t>> m_buffers;  // Buffers ready to be taken.
+    mutable std::mutex m_mutexPool;               // Lock around the buffers.
+};
+
+/**
+ * Sizes a message body, taking a buffer from a pool if it doesn't fit inline.
+ * Small bodies are stored inline, so they don't need a buffer.
+ * 
+ * @param pool the pool to take the buffer from, or null to allocate.
+ * @param body the body to size, with unspecified contents after.
+ * @param size the size of the body.
+*/
+template <size_t N>
+void acquire_body(buffer_pool* pool, byte_buffer<N>& body, size_t size) {
+    if (pool && size > byte_buffer<N>::INLINE_CAPACITY) {
+        body = pool->acquire(size);
+    } else {
+        body.resize(size);
+    }
+}
+
+} // namespace flash
+
+#endif
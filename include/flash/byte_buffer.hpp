@@ -0,0 +1,246 @@
+#ifndef FLASH_BYTE_BUFFER_HPP
+#define FLASH_BYTE_BUFFER_HPP
+
+/**
+ * @file byte_buffer.hpp
+ * 
+ * Growable array of bytes with inline storage for small sizes,
+ * e.g. for storing the body of a message.
+*/
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+namespace flash {
+
+/**
+ * Array of bytes that stores up to `N` bytes inline, and spills to the heap when larger.
+ * 
+ * Provides the subset of the `std::vector<uint8_t>` interface used for message bodies,
+ * so small messages such as pings, inputs and acks never touch the allocator.
+ * 
+ * @note Once spilled, the buffer keeps its heap storage until moved from or
+ * released, like a vector keeps its capacity. Pointers into the buffer are
+ * invalidated by moves, even when the storage is inline.
+ * 
+ * @tparam N the number of bytes stored inline.
+*/
+template <size_t N>
+class byte_buffer {
+    static_assert(N > 0, "Inline capacity must be positive.");
+
+public:
+    using value_type = uint8_t;
+    using iterator = uint8_t*;
+    using const_iterator = const uint8_t*;
+
+    /// Number of bytes stored without allocating.
+    static constexpr size_t INLINE_CAPACITY = N;
+
+    byte_buffer() = default;
+
+    /**
+     * Constructs a buffer of the given size, with its bytes set to zero.
+    */
+    explicit byte_buffer(size_t size) { resize(size); }
+
+    /**
+     * Constructs a buffer that takes over the storage of a vector, without copying.
+    */
+    byte_buffer(std::vector<uint8_t>&& heap) { *this = std::move(heap); }
+
+    byte_buffer(const byte_buffer& other) { assign(other.begin(), other.end()); }
+
+    byte_buffer(byte_buffer&& other) noexcept { MoveFrom(other); }
+
+    byte_buffer& operator=(const byte_buffer& other) {
+        if (this != &other) assign(other.begin(), other.end());
+        return *this;
+    }
+
+    byte_buffer& operator=(byte_buffer&& other) noexcept {
+        if (this != &other) MoveFrom(other);
+        return *this;
+    }
+
+    /**
+     * Takes over the storage of a vector, without copying, e.g. one from a `buffer_pool`.
+    */
+    byte_buffer& operator=(std::vector<uint8_t>&& heap) {
+        m_heap = std::move(heap);
+        m_size = 0;
+        return *this;
+    }
+
+    /**
+     * Copies the contents of a vector.
+    */
+    byte_buffer& operator=(const std::vector<uint8_t>& bytes) {
+        assign(bytes.begin(), bytes.end());
+        return *this;
+    }
+
+    /**
+     * @returns Whether the bytes are stored inline rather than on the heap.
+    */
+    bool is_inline() const { return m_heap.capacity() == 0; }
+
+    size_t size() const { return is_inline() ? m_size : m_heap.size(); }
+    size_t capacity() const { return is_inline() ? N : m_heap.capacity(); }
+    bool empty() const { return size() == 0; }
+
+    uint8_t* data() { return is_inline() ? m_inline : m_heap.data(); }
+    const uint8_t* data() const { return is_inline() ? m_inline : m_heap.data(); }
+
+    iterator begin() { return data(); }
+    iterator end() { return data() + size(); }
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + size(); }
+
+    uint8_t& operator[](size_t index) { assert(index < size()); return data()[index]; }
+    const uint8_t& operator[](size_t index) const { assert(index < size()); return data()[index]; }
+
+    /**
+     * Makes sure the buffer can grow to the given size without allocating again.
+    */
+    void reserve(size_t capacity) {
+        if (capacity <= this->capacity()) return;
+
+        if (is_inline()) {
+            Spill(capacity);
+        } else {
+            m_heap.reserve(capacity);
+        }
+    }
+
+    /**
+     * Resizes the buffer. New bytes are set to zero.
+    */
+    void resize(size_t size) {
+        if (is_inline()) {
+            if (size <= N) {
+                if (size > m_size) std::memset(m_inline + m_size, 0, size - m_size);
+                m_size = size;
+                return;
+            }
+
+            Spill(size);
+        }
+
+        m_heap.resize(size);
+    }
+
+    /**
+     * Empties the buffer, keeping its storage.
+    */
+    void clear() {
+        m_size = 0;
+        m_heap.clear();
+    }
+
+    /**
+     * Appends the given bytes, growing geometrically like a vector.
+    */
+    void append(const void* bytes, size_t count) {
+        if (count == 0) return;
+
+        const uint8_t* first = static_cast<const uint8_t*>(bytes);
+
+        if (is_inline()) {
+            if (m_size + count <= N) {
+                std::memcpy(m_inline + m_size, first, count);
+                m_size += count;
+                return;
+            }
+
+            Spill(m_size + count);
+        }
+
+        m_heap.insert(m_heap.end(), first, first + count);
+    }
+
+    void push_back(uint8_t byte) {
+        size_t sz = size();
+        resize(sz + 1);
+        data()[sz] = byte;
+    }
+
+    /**
+     * Replaces the contents with the given number of copies of a byte.
+    */
+    void assign(size_t count, uint8_t byte) {
+        clear();
+        resize(count);
+        std::memset(data(), byte, count);
+    }
+
+    /**
+     * Replaces the contents with the bytes in the given range.
+    */
+    template <typename It, typename = std::enable_if_t<!std::is_integral<It>::value>>
+    void assign(It first, It last) {
+        size_t count = static_cast<size_t>(std::distance(first, last));
+
+        clear();
+        resize(count);
+        std::copy(first, last, data());
+    }
+
+    /**
+     * Gives up the heap storage, e.g. to recycle it in a `buffer_pool`,
+     * and leaves the buffer empty. Returns an empty vector if the storage is inline.
+    */
+    std::vector<uint8_t> release() {
+        std::vector<uint8_t> heap = std::move(m_heap);
+        m_heap = std::vector<uint8_t> {};
+        m_size = 0;
+
+        return heap;
+    }
+
+    friend bool operator==(const byte_buffer& lhs, const byte_buffer& rhs) {
+        return lhs.size() == rhs.size() && std::equal(lhs.begin(), lhs.end(), rhs.begin());
+    }
+
+    friend bool operator!=(const byte_buffer& lhs, const byte_buffer& rhs) { return !(lhs == rhs); }
+
+private:
+    /**
+     * Moves the inline bytes to the heap, with at least the given capacity.
+    */
+    void Spill(size_t capacity) {
+        std::vector<uint8_t> heap;
+        heap.reserve(std::max(capacity, 2 * N));
+        heap.assign(m_inline, m_inline + m_size);
+
+        m_heap = std::move(heap);
+        m_size = 0;
+    }
+
+    void MoveFrom(byte_buffer& other) {
+        if (other.is_inline()) {
+            std::memcpy(m_inline, other.m_inline, other.m_size);
+            m_size = other.m_size;
+            m_heap = std::vector<uint8_t> {};
+        } else {
+            m_heap = std::move(other.m_heap);
+            m_size = 0;
+        }
+
+        other.m_heap = std::vector<uint8_t> {};
+        other.m_size = 0;
+    }
+
+    size_t m_size { 0 };          // Number of bytes, only while inline.
+    std::vector<uint8_t> m_heap;  // Heap storage, only used once spilled.
+    uint8_t m_inline[N];          // Inline storage.
+};
+
+} // namespace flash
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef FLASH_COMPRESSION_HPP
+#define FLASH_COMPRESSION_HPP
+
+/**
+ * @file compression.hpp
+ * 
+ * Optional compression of large message bodies, with a pluggable algorithm.
+ * 
+ * A compressed body is sent with `WIRE_FLAG_COMPRESSED` set in its header, and starts
+ * with the size of the original body (uint32, little-endian), followed by the output
+ * of the compressor. Both sides must be given compressors for the same algorithm.
+ * 
+ * Define `FLASH_WITH_ZLIB` and link against zlib for the built-in `zlib_compressor`.
+*/
+
+#include <flash/message.hpp>
+#include <flash/schema.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#ifdef FLASH_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+namespace flash {
+
+constexpr size_t DEFAULT_COMPRESSION_THRESHOLD = 1024;               // Smaller bodies are sent as they are.
+constexpr size_t MAX_DECOMPRESSED_SIZE_IN_BYTES = 16 * 1024 * 1024;  // Larger bodies are rejected.
+
+/// Prefix of every compressed body: the size of the original body.
+using compressed_body_prefix = schema<uint32_t>;
+
+/**
+ * Interface of a compression algorithm for message bodies, e.g. an adapter around LZ4.
+ * 
+ * The same compressor is used by every networking thread at once, so both functions
+ * must be safe to call concurrently.
+*/
+class compressor {
+public:
+    virtual ~compressor() { }
+
+    /**
+     * Compresses the given bytes, appending the result to `out`.
+     * 
+     * @returns Whether the bytes were compressed.
+    */
+    virtual bool compress(const uint8_t* data, size_t size, std::vector<uint8_t>& out) const = 0;
+
+    /**
+     * Decompresses the given bytes into a buffer of exactly the original size.
+     * 
+     * @returns Whether the bytes were well-formed and decompressed to the original size.
+    */
+    virtual bool decompress(const uint8_t* data, size_t size, uint8_t* out, size_t originalSize) const = 0;
+};
+
+/**
+ * When and how a transport compresses the bodies it sends.
+*/
+struct compression_settings {
+    std::shared_ptr<const compressor> m_compressor;        // Algorithm to use, or null to disable compression.
+    size_t m_threshold { DEFAULT_COMPRESSION_THRESHOLD };  // Size from which bodies are compressed.
+};
+
+/**
+ * Compresses the body of a message that is large enough, unless it doesn't shrink.
+ * The size in the header must be in host byte order, and gets the compressed flag.
+ * 
+ * @returns Whether the body was compressed.
+*/
+template <typename T>
+bool compress_message(const compression_settings& settings, message<T>& msg) {
+    size_t size = msg.get_body().size();
+
+    if (!settings.m_compressor || size < settings.m_threshold || size > MAX_DECOMPRESSED_SIZE_IN_BYTES) {
+        return false;
+    }
+
+    std::vector<uint8_t> compressed(compressed_body_prefix::SIZE);
+    compressed_body_prefix::encode_into(compressed.data(), static_cast<uint32_t>(size));
+
+    if (!settings.m_compressor->compress(msg.get_body().data(), size, compressed) || compressed.size() >= size) {
+        return false;
+    }
+
+    msg.get_body() = std::move(compressed);
+    msg.get_header().m_size = static_cast<uint32_t>(msg.get_body().size()) | WIRE_FLAG_COMPRESSED;
+
+    return true;
+}
+
+/**
+ * Reads the size of the original body from a compressed body.
+ * 
+ * @returns Whether the compressed body is well-formed, and the original size acceptable.
+*/
+inline bool decompressed_size(const uint8_t* data, size_t size, size_t& originalSize) {
+    if (size < compressed_body_prefix::SIZE) return false;
+
+    uint32_t prefix;
+    compressed_body_prefix::decode_from(data, prefix);
+
+    originalSize = prefix;
+    return originalSize <= MAX_DECOMPRESSED_SIZE_IN_BYTES;
+}
+
+/**
+ * Decompresses a compressed body into a buffer of the size given by `decompressed_size`.
+ * 
+ * @returns Whether the body was decompressed.
+*/
+inline bool decompress_body(const compressor& comp, const uint8_t* data, size_t size, uint8_t* out, size_t originalSize) {
+    return comp.decompress(data + compressed_body_prefix::SIZE, size - compressed_body_prefix::SIZE, out, originalSize);
+}
+
+
+#ifdef FLASH_WITH_ZLIB
+/**
+ * Compressor using the deflate algorithm from zlib.
+*/
+class zlib_compressor : public compressor {
+public:
+    /**
+     * @param level the compression level, from 1 (fastest) to 9 (smallest).
+    */
+    explicit zlib_compressor(int level = Z_BEST_SPEED) : m_level { level } { }
+
+    bool compress(const uint8_t* data, size_t size, std::vector<uint8_t>& out) const override {
+        size_t start = out.size();
+        uLongf compressedSize = compressBound(static_cast<uLong>(size));
+        out.resize(start + compressedSize);
+
+        if (compress2(out.data() + start, &compressedSize, data, static_cast<uLong>(size), m_level) != Z_OK) {
+            out.resize(start);
+            return false;
+        }
+
+        out.resize(start + compressedSize);
+        return true;
+    }
+
+    bool decompress(const uint8_t* data, size_t size, uint8_t* out, size_t originalSize) const override {
+        uLongf decompressedSize = static_cast<uLongf>(originalSize);
+
+        return uncompress(out, &decompressedSize, data, static_cast<uLong>(size)) == Z_OK
+            && decompressedSize == originalSize;
+    }
+
+private:
+    int m_level;
+};
+#endif
+
+} // namespace flash
+
+#endif
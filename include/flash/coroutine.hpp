@@ -0,0 +1,88 @@
+#ifndef FLASH_COROUTINE_HPP
+#define FLASH_COROUTINE_HPP
+
+/**
+ * @file coroutine.hpp
+ * 
+ * Support for the C++20 coroutine mode, enabled by defining `FLASH_WITH_COROUTINES`
+ * (configure with `-DFLASH_WITH_COROUTINES=ON`). The TCP connections then run their
+ * read and write loops as `boost::asio::awaitable`s, whose frames asio recycles per
+ * thread, and the servers can be awaited with `co_await server.NextMessages()`.
+*/
+
+// Older versions of asio use std::exchange in awaitable.hpp without including it.
+#include <utility>
+
+#include <boost/asio.hpp>
+
+#if !defined(BOOST_ASIO_HAS_CO_AWAIT)
+#error "FLASH_WITH_COROUTINES requires a C++20 compiler with coroutine support."
+#endif
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include <atomic>
+#include <chrono>
+
+namespace flash {
+
+/**
+ * Lets a coroutine wait for messages that other threads deposit in a queue.
+ * 
+ * Depositing is a single atomic load while no coroutine waits, and wakes it with one
+ * hop onto its executor otherwise, or none when already running there.
+ * Waiting must happen on the executor the waiter was given.
+*/
+class message_waiter {
+public:
+    explicit message_waiter(const boost::asio::any_io_executor& executor) : m_timer { executor } { }
+
+    /**
+     * Wakes the waiting coroutine, if any. Safe to call from any thread, after depositing.
+    */
+    void notify() {
+        if (!m_waiting.load(std::memory_order_seq_cst)) return;
+        if (!m_waiting.exchange(false, std::memory_order_seq_cst)) return;
+
+        boost::asio::dispatch(m_timer.get_executor(), [this]() { m_timer.cancel(); });
+    }
+
+    /**
+     * Waits until something is ready.
+     * 
+     * @param ready checks whether something was deposited.
+    */
+    template <typename Pred>
+    boost::asio::awaitable<void> wait(Pred ready) {
+        while (!ready()) {
+            m_waiting.store(true, std::memory_order_seq_cst);
+
+            // Deposited before the flag was seen, so nobody will notify.
+            if (ready()) {
+                m_waiting.store(false, std::memory_order_relaxed);
+                break;
+            }
+
+            // The wait starts before any cancel posted by notify can run.
+            boost::system::error_code ec;
+            m_timer.expires_at(boost::asio::steady_timer::time_point::max());
+            co_await m_timer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        }
+    }
+
+    /**
+     * @returns The executor that waiting must happen on.
+    */
+    boost::asio::any_io_executor get_executor() { return m_timer.get_executor(); }
+
+private:
+    boost::asio::steady_timer m_timer;      // Never expires, cancelled to wake the coroutine.
+    std::atomic<bool> m_waiting { false };  // Whether a coroutine waits, or is about to.
+};
+
+} // namespace flash
+
+#endif
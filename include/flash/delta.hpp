@@ -0,0 +1,306 @@
+#ifndef FLASH_DELTA_HPP
+#define FLASH_DELTA_HPP
+
+/**
+ * @file delta.hpp
+ * 
+ * Delta encoding of message bodies against the last body acknowledged by the
+ * receiver, e.g. for world snapshots that barely change from one tick to the next.
+ * 
+ * A delta stream is kept per message type. Every frame of a stream carries a sequence
+ * number, and is either a full body or the changes from an earlier frame, the baseline.
+ * The receiver acknowledges the frames it decodes, and the sender only ever uses
+ * acknowledged frames as baselines, so a lost datagram never breaks the stream.
+*/
+
+#include <flash/message.hpp>
+#include <flash/schema.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace flash {
+
+constexpr size_t DELTA_HISTORY_SIZE = 32;  // Number of frames remembered per stream.
+
+/// Prefix of every frame of a delta stream: sequence number, baseline sequence number, kind.
+using delta_frame_prefix = schema<uint16_t, uint16_t, uint8_t>;
+
+constexpr uint8_t DELTA_FRAME_FULL = 0;     // The frame holds the whole body.
+constexpr uint8_t DELTA_FRAME_CHANGES = 1;  // The frame holds the changes from its baseline.
+
+/**
+ * Encodes the bytes of a body that differ from a baseline of the same size, as a series
+ * of runs: the number of bytes to keep (uint16), the number of bytes that follow (uint16),
+ * and these bytes. Unchanged gaps shorter than a run header are folded into the runs.
+ * 
+ * @param baseline the body to encode against.
+ * @param current  the body to encode.
+ * @param size     the size of both bodies.
+ * @param out      the buffer to append the runs to.
+ * @param maxSize  the size at which to give up, e.g. the size of the full body.
+ * 
+ * @returns Whether the changes were encoded in fewer than `maxSize` bytes.
+ * If not, `out` is left with unspecified contents after its original size.
+*/
+inline bool delta_encode(const uint8_t* baseline, const uint8_t* current, size_t size,
+                         std::vector<uint8_t>& out, size_t maxSize) {
+    constexpr size_t RUN_HEADER_SIZE = 2 * sizeof(uint16_t);
+    constexpr size_t MAX_RUN = UINT16_MAX;
+
+    size_t start = out.size();
+    size_t kept = 0;  // Offset of the first byte not covered by a run yet.
+
+    size_t i = 0;
+    while (i < size) {
+        if (baseline[i] == current[i]) {
+            ++i;
+            continue;
+        }
+
+        // Extend the run over changed bytes, and over unchanged gaps that cost less than a new run.
+        size_t end = i + 1;
+        size_t gap = 0;
+
+        while (end + gap < size && end - i + gap < MAX_RUN) {
+            if (baseline[end + gap] != current[end + gap]) {
+                end += gap + 1;
+                gap = 0;
+            } else if (++gap > RUN_HEADER_SIZE) {
+                break;
+            }
+        }
+
+        // Runs are relative to the end of the previous one, and skips are limited too.
+        size_t skip = i - kept;
+        while (skip > MAX_RUN) {
+            uint8_t empty[RUN_HEADER_SIZE];
+            schema<uint16_t, uint16_t>::encode_into(empty, uint16_t { MAX_RUN }, uint16_t { 0 });
+            out.insert(out.end(), empty, empty + RUN_HEADER_SIZE);
+            skip -= MAX_RUN;
+        }
+
+        uint8_t runHeader[RUN_HEADER_SIZE];
+        schema<uint16_t, uint16_t>::encode_into(runHeader, static_cast<uint16_t>(skip), static_cast<uint16_t>(end - i));
+        out.insert(out.end(), runHeader, runHeader + RUN_HEADER_SIZE);
+        out.insert(out.end(), current + i, current + end);
+
+        if (out.size() - start >= maxSize) return false;
+
+        kept = end;
+        i = end;
+    }
+
+    return true;
+}
+
+/**
+ * Applies changes encoded with `delta_encode` to a copy of the baseline.
+ * 
+ * @param baseline  the body that the changes were encoded against.
+ * @param size      the size of the baseline, and of the result.
+ * @param delta     the encoded changes.
+ * @param deltaSize the size of the encoded changes.
+ * @param out       the buffer of `size` bytes to write the result to.
+ * 
+ * @returns Whether the changes were well-formed and fit in the body.
+*/
+inline bool delta_decode(const uint8_t* baseline, size_t size,
+                         const uint8_t* delta, size_t deltaSize, uint8_t* out) {
+    constexpr size_t RUN_HEADER_SIZE = 2 * sizeof(uint16_t);
+
+    if (out != baseline) std::memcpy(out, baseline, size);
+
+    size_t offset = 0;
+    size_t read = 0;
+
+    while (read < deltaSize) {
+        if (deltaSize - read < RUN_HEADER_SIZE) return false;
+
+        uint16_t skip, count;
+        schema<uint16_t, uint16_t>::decode_from(delta + read, skip, count);
+        read += RUN_HEADER_SIZE;
+
+        if (deltaSize - read < count || size - offset < size_t { skip } + count) return false;
+
+        offset += skip;
+        std::memcpy(out + offset, delta + read, count);
+
+        offset += count;
+        read += count;
+    }
+
+    return true;
+}
+
+
+/**
+ * Sending side of the delta streams to a single peer, one stream per message type.
+ * 
+ * Not thread-safe; meant to be used from wherever the datagrams to the peer are queued.
+ * 
+ * @tparam T an enum class containing possible types of messages to be sent.
+*/
+template <typename T>
+class delta_encoder {
+public:
+    /**
+     * Encodes a body as the next frame of the stream for its type.
+     * 
+     * The frame holds the changes from the last acknowledged frame if there is a recent
+     * one of the same size and the changes are smaller than the body, or else the whole body.
+     * 
+     * @param type the type of the message.
+     * @param body the body to encode.
+     * @param size the size of the body.
+     * @param out  the buffer to write the frame to, replacing its contents.
+    */
+    void encode(T type, const uint8_t* body, size_t size, std::vector<uint8_t>& out) {
+        stream& s = m_streams[type];
+        uint16_t seq = s.m_nextSeq++;
+
+        // Remember what was sent, so it can become the baseline once acknowledged.
+        sent_frame& frame = s.m_sent[seq % DELTA_HISTORY_SIZE];
+        frame.m_seq = seq;
+        frame.m_valid = true;
+        frame.m_body.assign(body, body + size);
+
+        out.resize(delta_frame_prefix::SIZE);
+
+        // The receiver only remembers the last frames, so older baselines can't be used.
+        bool baselineKnown = s.m_hasBaseline
+            && static_cast<uint16_t>(seq - s.m_baselineSeq) < DELTA_HISTORY_SIZE;
+
+        if (baselineKnown && s.m_baseline.size() == size
+            && delta_encode(s.m_baseline.data(), body, size, out, size)) {
+
+            delta_frame_prefix::encode_into(out.data(), seq, s.m_baselineSeq, DELTA_FRAME_CHANGES);
+            return;
+        }
+
+        out.resize(delta_frame_prefix::SIZE);
+        out.insert(out.end(), body, body + size);
+        delta_frame_prefix::encode_into(out.data(), seq, seq, DELTA_FRAME_FULL);
+    }
+
+    /**
+     * Handles the acknowledgement of a frame by the peer, which makes it the baseline
+     * of its stream, unless a later frame is the baseline already.
+    */
+    void ack(T type, uint16_t seq) {
+        auto it = m_streams.find(type);
+        if (it == m_streams.end()) return;
+
+        stream& s = it->second;
+        sent_frame& frame = s.m_sent[seq % DELTA_HISTORY_SIZE];
+
+        // Too old, the frame has been overwritten since.
+        if (!frame.m_valid || frame.m_seq != seq) return;
+
+        // Sequence numbers wrap around, so compare them by distance.
+        if (s.m_hasBaseline && static_cast<int16_t>(seq - s.m_baselineSeq) <= 0) return;
+
+        s.m_baseline.assign(frame.m_body.begin(), frame.m_body.end());
+        s.m_baselineSeq = seq;
+        s.m_hasBaseline = true;
+    }
+
+private:
+    struct sent_frame {
+        uint16_t m_seq { 0 };
+        bool m_valid { false };
+        std::vector<uint8_t> m_body;
+    };
+
+    struct stream {
+        uint16_t m_nextSeq { 0 };      // Sequence number of the next frame.
+        bool m_hasBaseline { false };  // Whether any frame has been acknowledged.
+        uint16_t m_baselineSeq { 0 };  // Sequence number of the baseline.
+        std::vector<uint8_t> m_baseline;
+
+        std::array<sent_frame, DELTA_HISTORY_SIZE> m_sent;  // Recently sent frames.
+    };
+
+    std::unordered_map<T, stream> m_streams;
+};
+
+
+/**
+ * Receiving side of the delta streams from a single peer, one stream per message type.
+ * 
+ * Not thread-safe; meant to be used from wherever the datagrams from the peer are received.
+ * 
+ * @tparam T an enum class containing possible types of messages to be sent.
+*/
+template <typename T>
+class delta_decoder {
+public:
+    /**
+     * Decodes a frame of the stream for its type into the original body.
+     * 
+     * @param type  the type of the message.
+     * @param frame the frame, as produced by `delta_encoder::encode`.
+     * @param size  the size of the frame.
+     * @param body  the body to write the result to.
+     * @param seq   set to the sequence number of the frame, to acknowledge it.
+     * 
+     * @returns Whether the frame was decoded. Fails if it is malformed, or if its
+     * baseline is no longer remembered, in which case it should just be dropped.
+    */
+    bool decode(T type, const uint8_t* frame, size_t size, typename message<T>::body_type& body, uint16_t& seq) {
+        if (size < delta_frame_prefix::SIZE) return false;
+
+        uint16_t baselineSeq;
+        uint8_t kind;
+        delta_frame_prefix::decode_from(frame, seq, baselineSeq, kind);
+
+        const uint8_t* payload = frame + delta_frame_prefix::SIZE;
+        size_t payloadSize = size - delta_frame_prefix::SIZE;
+
+        stream& s = m_streams[type];
+        received_frame& slot = s.m_received[seq % DELTA_HISTORY_SIZE];
+
+        if (kind == DELTA_FRAME_FULL) {
+            body.assign(payload, payload + payloadSize);
+
+        } else if (kind == DELTA_FRAME_CHANGES) {
+            const received_frame& baseline = s.m_received[baselineSeq % DELTA_HISTORY_SIZE];
+            if (!baseline.m_valid || baseline.m_seq != baselineSeq) return false;
+
+            body.resize(baseline.m_body.size());
+            if (!delta_decode(baseline.m_body.data(), baseline.m_body.size(), payload, payloadSize, body.data())) {
+                return false;
+            }
+
+        } else {
+            return false;
+        }
+
+        // Remember the frame, in case the sender uses it as a baseline later.
+        slot.m_seq = seq;
+        slot.m_valid = true;
+        slot.m_body.assign(body.begin(), body.end());
+
+        return true;
+    }
+
+private:
+    struct received_frame {
+        uint16_t m_seq { 0 };
+        bool m_valid { false };
+        std::vector<uint8_t> m_body;
+    };
+
+    struct stream {
+        std::array<received_frame, DELTA_HISTORY_SIZE> m_received;  // Recently received frames.
+    };
+
+    std::unordered_map<T, stream> m_streams;
+};
+
+} // namespace flash
+
+#endif
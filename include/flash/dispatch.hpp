@@ -0,0 +1,92 @@
+#ifndef FLASH_DISPATCH_HPP
+#define FLASH_DISPATCH_HPP
+
+/**
+ * @file dispatch.hpp
+ * 
+ * Where the incoming messages of each type are handled: queued for `Update`, on the thread
+ * calling it, or handed to `OnMessage` right away, on the networking thread that received
+ * them, which saves the latency of the hop between threads, e.g. for ping echoes.
+*/
+
+#include <flash/buffer_pool.hpp>
+#include <flash/message.hpp>
+#include <flash/stats.hpp>
+
+#include <flash/iserverext.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <unordered_set>
+
+namespace flash {
+
+/**
+ * Where the incoming messages of a type are handled.
+*/
+enum class dispatch_mode : uint8_t {
+    queued,    // By `Update`, on the calling thread. Default for every message.
+    immediate  // On the networking thread, so the handler must be thread-safe.
+};
+
+/**
+ * Dispatch mode of every message type, queued unless set otherwise.
+ * 
+ * Meant to be filled before a server starts, and only read afterwards,
+ * possibly from several threads at once.
+ * 
+ * @tparam T an enum class containing possible types of messages to be sent.
+*/
+template <typename T>
+class dispatch_map {
+public:
+    /**
+     * Sets the dispatch mode of the messages of the given type.
+    */
+    void set(T type, dispatch_mode mode) {
+        if (mode == dispatch_mode::immediate) {
+            m_immediate.insert(type);
+        } else {
+            m_immediate.erase(type);
+        }
+    }
+
+    /**
+     * @returns The dispatch mode of the messages of the given type.
+    */
+    dispatch_mode get(T type) const {
+        if (m_immediate.empty()) return dispatch_mode::queued;
+
+        return m_immediate.count(type) ? dispatch_mode::immediate : dispatch_mode::queued;
+    }
+
+private:
+    std::unordered_set<T> m_immediate;  // Types dispatched immediately, few if any.
+};
+
+/**
+ * Hands a message straight to `OnMessage`, then recycles its body and counts it
+ * as handled, as `Update` does for queued messages.
+ * 
+ * @param bodyPool the pool to recycle the body into, unless the handler kept it, or null.
+ * @param counters the counters of the server, or null.
+*/
+template <typename T>
+void dispatch_immediately(iserverext<T>& server, UserId clientId, message<T>&& msg,
+                          buffer_pool* bodyPool, server_counters* counters) {
+    std::chrono::steady_clock::time_point start;
+    if (counters) start = std::chrono::steady_clock::now();
+
+    server.OnMessage(clientId, std::move(msg));
+
+    if (bodyPool) bodyPool->release(msg.get_body().release());
+
+    if (counters) {
+        std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+        counters->count_handled(1, elapsed, elapsed);
+    }
+}
+
+} // namespace flash
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef FLASH_GROUPS_HPP
+#define FLASH_GROUPS_HPP
+
+/**
+ * @file groups.hpp
+ * 
+ * Groups of clients that a server messages at once, e.g. the players in a zone of the
+ * world, so that the message is encoded once for the group and sent to its members only,
+ * and the cost of messaging a group grows with its size instead of with the server's.
+*/
+
+#include <flash/message.hpp>
+#include <flash/slot_map.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace flash {
+
+using GroupId = int32_t;
+
+constexpr GroupId INVALID_GROUP_ID = -1;  // Represents some unassigned group ID.
+
+/**
+ * Groups of users, which issues the IDs of the groups.
+ * 
+ * The members of a group are stored contiguously, so that messaging them walks a single
+ * array, and every user knows its groups, so that it leaves them all at once when it
+ * disconnects. A group ID is generation-tagged like a user ID, so that the ID of a
+ * destroyed group never finds the one that took its slot.
+ * 
+ * Not thread-safe. Pointers to the members are invalidated by any change to the groups.
+*/
+class client_groups {
+public:
+    /**
+     * Creates an empty group.
+     * 
+     * @returns The ID of the group, or `INVALID_GROUP_ID` if there are too many groups.
+    */
+    GroupId create() {
+        return m_groups.insert(std::vector<UserId> {});
+    }
+
+    /**
+     * Destroys a group, which its members leave.
+     * 
+     * @returns Whether there was such a group.
+    */
+    bool destroy(GroupId groupId) {
+        std::vector<UserId>* members = m_groups.find(groupId);
+        if (!members) return false;
+
+        for (UserId userId : *members) {
+            Leave(userId, groupId);
+        }
+
+        m_groups.erase(groupId);
+        return true;
+    }
+
+    /**
+     * Adds a user to a group.
+     * 
+     * @returns Whether the user was added, false if there is no such group, or the user was already in it.
+    */
+    bool add(GroupId groupId, UserId userId) {
+        std::vector<UserId>* members = m_groups.find(groupId);
+        if (!members || std::find(members->begin(), members->end(), userId) != members->end()) return false;
+
+        members->push_back(userId);
+        m_memberships[userId].push_back(groupId);
+        return true;
+    }
+
+    /**
+     * Removes a user from a group. The last member takes its place.
+     * 
+     * @returns Whether the user was in the group.
+    */
+    bool remove(GroupId groupId, UserId userId) {
+        std::vector<UserId>* members = m_groups.find(groupId);
+        if (!members || !Erase(*members, userId)) return false;
+
+        Leave(userId, groupId);
+        return true;
+    }
+
+    /**
+     * Removes a user from every group it is in, e.g. once it has disconnected.
+    */
+    void remove_user(UserId userId) {
+        auto memberships = m_memberships.find(userId);
+        if (memberships == m_memberships.end()) return;
+
+        for (GroupId groupId : memberships->second) {
+            Erase(*m_groups.find(groupId), userId);
+        }
+
+        m_memberships.erase(memberships);
+    }
+
+    /**
+     * @returns The members of a group, in no particular order, or null if there is no such group.
+    */
+    const std::vector<UserId>* members(GroupId groupId) const { return m_groups.find(groupId); }
+
+    /**
+     * @returns The groups a user is in, in no particular order.
+    */
+    std::vector<GroupId> groups_of(UserId userId) const {
+        auto memberships = m_memberships.find(userId);
+        return memberships != m_memberships.end() ? memberships->second : std::vector<GroupId> {};
+    }
+
+    size_t size() const { return m_groups.size(); }
+    bool empty() const { return m_groups.empty(); }
+
+private:
+    /**
+     * Removes a value from a vector by moving the last one in its place.
+     * 
+     * @returns Whether the value was there.
+    */
+    template <typename V>
+    static bool Erase(std::vector<V>& values, V value) {
+        auto it = std::find(values.begin(), values.end(), value);
+        if (it == values.end()) return false;
+
+        *it = values.back();
+        values.pop_back();
+        return true;
+    }
+
+    /**
+     * Removes a group from the ones of a user.
+    */
+    void Leave(UserId userId, GroupId groupId) {
+        auto memberships = m_memberships.find(userId);
+        if (memberships == m_memberships.end()) return;
+
+        Erase(memberships->second, groupId);
+        if (memberships->second.empty()) m_memberships.erase(memberships);
+    }
+
+    slot_map<std::vector<UserId>> m_groups;                          // Members of each group.
+    std::unordered_map<UserId, std::vector<GroupId>> m_memberships;  // Groups of each user in any.
+};
+
+} // namespace flash
+
+#endif
@@ -6,7 +6,7 @@
 */
 
 #include <flash/message.hpp>
-#include <flash/ts_deque.hpp>
+#include <flash/queues.hpp>
 
 namespace flash {
 
@@ -16,8 +16,9 @@ namespace flash {
  * 
  * @tparam T an enum class containing possible types of messages to be sent.
  *         Should have an underlying type of uint32_t.
+ * @tparam Q the queue policy, see `flash/queues.hpp`.
 */
-template <typename T>
+template <typename T, typename Q = locking_queues>
 class iclient {
 public:
     virtual ~iclient() { }
@@ -30,7 +31,7 @@ public:
 
     virtual void Send(message<T>&& msg) = 0;
 
-    virtual ts_deque<tagged_message<T>>& Incoming() = 0;
+    virtual typename Q::template incoming<tagged_message<T>>& Incoming() = 0;
 };
 
 } // namespace flash
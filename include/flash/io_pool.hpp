@@ -0,0 +1,137 @@
+#ifndef FLASH_IO_POOL_HPP
+#define FLASH_IO_POOL_HPP
+
+/**
+ * @file io_pool.hpp
+ * 
+ * Pool of asio contexts and the threads that run them, so that the networking
+ * work of a server can be spread across several cores.
+*/
+
+#include <boost/asio.hpp>
+
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace flash {
+
+/**
+ * Owns a number of asio contexts, each run by a number of threads.
+ * 
+ * With one thread per context, everything bound to a context runs on a single
+ * thread, so objects can be sharded across contexts without any locking.
+ * With several threads per context, handlers may run concurrently, so shared
+ * state must be protected, e.g. with a strand.
+*/
+class io_context_pool {
+public:
+    /**
+     * Constructs the contexts. No threads are started until `Run` is called.
+     * 
+     * @param numContexts       the number of asio contexts, at least one.
+     * @param threadsPerContext the number of threads that run each context.
+    */
+    explicit io_context_pool(size_t numContexts = 1, size_t threadsPerContext = 1)
+        : m_threadsPerContext { threadsPerContext > 0 ? threadsPerContext : 1 } {
+
+        if (numContexts == 0) numContexts = 1;
+
+        for (size_t i = 0; i < numContexts; ++i) {
+            m_contexts.push_back(std::make_unique<boost::asio::io_context>(static_cast<int>(m_threadsPerContext)));
+        }
+    }
+
+    ~io_context_pool() { Stop(); }
+
+    // Threads hold references to the contexts, so no copying or moving.
+    io_context_pool(const io_context_pool&) = delete;
+    io_context_pool& operator=(const io_context_pool&) = delete;
+
+    /**
+     * @returns The number of contexts in the pool.
+    */
+    size_t Size() const { return m_contexts.size(); }
+
+    /**
+     * @returns A reference to the context with the given index.
+    */
+    boost::asio::io_context& Get(size_t index) {
+        assert(index < m_contexts.size());
+        return *m_contexts[index];
+    }
+
+    /**
+     * @returns A reference to the next context in round-robin order.
+     * Used to spread new work evenly across the contexts.
+    */
+    boost::asio::io_context& Next() {
+        size_t index = m_next.fetch_add(1, std::memory_order_relaxed) % m_contexts.size();
+        return *m_contexts[index];
+    }
+
+    /**
+     * @returns Whether the threads of the pool are running.
+    */
+    bool IsRunning() const { return !m_threads.empty(); }
+
+    /**
+     * Starts the threads that run the contexts. Each context is kept alive by a work guard,
+     * so that threads of contexts without any pending work don't exit immediately.
+    */
+    void Run() {
+        if (IsRunning()) return;
+
+        for (auto& ctx : m_contexts) {
+            m_workGuards.emplace_back(boost::asio::make_work_guard(*ctx));
+
+            for (size_t i = 0; i < m_threadsPerContext; ++i) {
+                boost::asio::io_context* context = ctx.get();
+                m_threads.emplace_back([context]() { context->run(); });
+            }
+        }
+    }
+
+    /**
+     * Stops the contexts and joins all the threads. Stopping is posted to each context,
+     * so work that was already posted, such as closing sockets, still gets to run.
+     * 
+     * The contexts are restarted afterwards, so the pool can be run again.
+    */
+    void Stop() {
+        if (!IsRunning()) return;
+
+        m_workGuards.clear();
+
+        for (auto& ctx : m_contexts) {
+            boost::asio::io_context* context = ctx.get();
+            boost::asio::post(*context, [context]() { context->stop(); });
+        }
+
+        for (auto& thread : m_threads) {
+            if (thread.joinable()) thread.join();
+        }
+
+        m_threads.clear();
+
+        for (auto& ctx : m_contexts) {
+            ctx->restart();
+        }
+    }
+
+private:
+    size_t m_threadsPerContext;  // Number of threads that run each context.
+
+    std::vector<std::unique_ptr<boost::asio::io_context>> m_contexts;  // The contexts, owned.
+    std::vector<boost::asio::executor_work_guard<
+        boost::asio::io_context::executor_type>> m_workGuards;         // Keep the contexts running.
+    std::vector<std::thread> m_threads;                                // Threads running the contexts.
+
+    std::atomic<size_t> m_next { 0 };  // Round-robin counter for `Next`.
+};
+
+} // namespace flash
+
+#endif
@@ -5,9 +5,13 @@
  * @file iserver.hpp
 */
 
+#include <flash/groups.hpp>
 #include <flash/message.hpp>
+#include <flash/stats.hpp>
 #include <flash/ts_deque.hpp>
 
+#include <vector>
+
 namespace flash {
 
 /**
@@ -30,7 +34,20 @@ public:
     virtual void MessageAllClients(
         message<T>&& msg, UserId ignoreId = INVALID_USER_ID) = 0;
 
+    virtual void MessageClients(
+        const std::vector<UserId>& clientIds, message<T>&& msg) = 0;
+
+    virtual GroupId CreateGroup() = 0;
+    virtual bool DestroyGroup(GroupId groupId) = 0;
+    virtual bool AddToGroup(GroupId groupId, UserId clientId) = 0;
+    virtual bool RemoveFromGroup(GroupId groupId, UserId clientId) = 0;
+
+    virtual void MessageGroup(
+        GroupId groupId, message<T>&& msg, UserId ignoreId = INVALID_USER_ID) = 0;
+
     virtual void Update(size_t maxMessages = -1, bool wait = true) = 0;
+
+    virtual server_stats GetStats() = 0;
 };
 
 } // namespace flash
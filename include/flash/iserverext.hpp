@@ -29,6 +29,17 @@ public:
     virtual void OnClientValidate(UserId clientId) = 0;
     virtual void OnClientDisconnect(UserId clientId) = 0;
     virtual void OnMessage(UserId clientId, message<T>&& msg) = 0;
+
+    /**
+     * Called when the bytes queued to a client go over the high-water mark given to
+     * `SetBackpressure`, right before the policy applies. Called again only once
+     * the queue has gone back under half of the mark. May be called from any
+     * networking thread. Does nothing by default.
+     * 
+     * @param clientId    the ID of the client that can't keep up.
+     * @param queuedBytes the bytes that would be queued to the client.
+    */
+    virtual void OnBackpressure(UserId /*clientId*/, size_t /*queuedBytes*/) { }
 };
 
 } // namespace flash
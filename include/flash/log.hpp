@@ -0,0 +1,231 @@
+#ifndef FLASH_LOG_HPP
+#define FLASH_LOG_HPP
+
+/**
+ * @file log.hpp
+ * 
+ * Logging of the events of the servers and clients, such as connections, timeouts and
+ * errors, through a pluggable logger. By default, records are handed to a background
+ * thread that prints them, so that the networking threads never wait on terminal I/O.
+ * 
+ * Levels below `FLASH_LOG_LEVEL` are compiled out: e.g. define it to 3 to keep only
+ * warnings and errors. Levels below the one set with `set_log_level` are skipped at runtime.
+*/
+
+#include <flash/message.hpp>
+#include <flash/ring_queue.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+
+/// Lowest level compiled in: 0 for trace, up to 4 for errors only, or 5 for nothing.
+#ifndef FLASH_LOG_LEVEL
+#define FLASH_LOG_LEVEL 0
+#endif
+
+/**
+ * Logs a record about the given user, or `flash::INVALID_USER_ID`, if the level is enabled.
+ * The text is only formatted then, and may be a chain of `<<` operands.
+ * 
+ * @param level the name of a `flash::log_level`, e.g. `info`.
+*/
+#define FLASH_LOG(level, user, text)                                                    \
+    do {                                                                                \
+        if constexpr (::flash::log_compiled_in(::flash::log_level::level)) {            \
+            if (::flash::log_enabled(::flash::log_level::level)) {                      \
+                std::ostringstream flashLogStream;                                      \
+                flashLogStream << text;                                                 \
+                ::flash::log(::flash::log_level::level, user, flashLogStream.str());    \
+            }                                                                           \
+        }                                                                               \
+    } while (false)
+
+namespace flash {
+
+/**
+ * Severity of a log record.
+*/
+enum class log_level : uint8_t {
+    trace,
+    debug,
+    info,     // E.g. connections and disconnections, the default.
+    warning,  // E.g. failed validations and dropped messages.
+    error,    // E.g. failed sockets.
+    off
+};
+
+/**
+ * @returns Whether records of the given level are compiled in, see `FLASH_LOG_LEVEL`.
+ * 
+ * Compared through a constant, rather than with the macro in `FLASH_LOG`, which would warn
+ * at every call site that no level is below the default of 0.
+*/
+constexpr bool log_compiled_in(log_level level) {
+    constexpr int lowest = FLASH_LOG_LEVEL;
+    return static_cast<int>(level) >= lowest;
+}
+
+/**
+ * What happened, to whom and when.
+*/
+struct log_record {
+    log_level m_level { log_level::info };
+    std::chrono::system_clock::time_point m_time;  // When it was logged.
+    UserId m_user { INVALID_USER_ID };              // User it is about, if any.
+    std::string m_text;
+};
+
+/**
+ * Destination of the log records, which may be called from any thread.
+*/
+class logger {
+public:
+    virtual ~logger() { }
+
+    virtual void write(log_record&& record) = 0;
+};
+
+/**
+ * Prints the records as they come, warnings and errors to `std::cerr`.
+*/
+class console_logger : public logger {
+public:
+    void write(log_record&& record) override {
+        std::ostringstream line;
+        if (record.m_user != INVALID_USER_ID) line << "[" << record.m_user << "] ";
+        line << record.m_text << '\n';
+
+        (record.m_level >= log_level::warning ? std::cerr : std::cout) << line.str();
+    }
+};
+
+/**
+ * Hands the records to a background thread, through a lock-free ring, which writes them
+ * to another logger. Logging never blocks: when the ring is full, records are dropped,
+ * and how many is logged once there is room again.
+ * 
+ * @tparam Capacity the number of records that may be waiting, a power of two.
+*/
+template <size_t Capacity = 4096>
+class async_logger : public logger {
+public:
+    /**
+     * Starts the background thread.
+     * 
+     * @param sink the logger to write the records to, from the background thread.
+    */
+    explicit async_logger(std::shared_ptr<logger> sink) : m_sink { std::move(sink) } {
+        m_thread = std::thread([this]() { Drain(); });
+    }
+
+    /**
+     * Writes the records still waiting, and stops the background thread.
+    */
+    ~async_logger() override {
+        m_queue.push_back(log_record { log_level::off, {}, INVALID_USER_ID, {} });
+        m_thread.join();
+    }
+
+    async_logger(const async_logger&) = delete;
+    async_logger& operator=(const async_logger&) = delete;
+
+    void write(log_record&& record) override {
+        if (!m_queue.try_push_back(std::move(record))) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    void Drain() {
+        while (true) {
+            m_queue.wait();
+
+            while (!m_queue.empty()) {
+                log_record record = m_queue.pop_front();
+
+                // Only the destructor pushes records that are off.
+                if (record.m_level == log_level::off) return;
+
+                m_sink->write(std::move(record));
+            }
+
+            if (uint64_t dropped = m_dropped.exchange(0, std::memory_order_relaxed)) {
+                std::ostringstream text;
+                text << "[LOG] " << dropped << " Records Dropped.";
+                m_sink->write(log_record { log_level::warning, std::chrono::system_clock::now(), INVALID_USER_ID, text.str() });
+            }
+        }
+    }
+
+    std::shared_ptr<logger> m_sink;                  // Where the records end up.
+    mpsc_ring_queue<log_record, Capacity> m_queue;  // Records waiting for the background thread.
+    std::atomic<uint64_t> m_dropped { 0 };          // Records dropped since the last report.
+    std::thread m_thread;                           // Writes the records to the sink.
+};
+
+/**
+ * @returns The logger used when none was set: an `async_logger` printing to the console.
+*/
+inline logger& default_logger() {
+    static async_logger<> instance { std::make_shared<console_logger>() };
+    return instance;
+}
+
+/**
+ * @returns The logger that is set, or null for the default one.
+*/
+inline std::atomic<logger*>& current_logger() {
+    static std::atomic<logger*> current { nullptr };
+    return current;
+}
+
+/**
+ * @returns The lowest level that is logged.
+*/
+inline std::atomic<log_level>& current_log_level() {
+    static std::atomic<log_level> level { log_level::info };
+    return level;
+}
+
+/**
+ * Sets the logger that every server and client logs to, e.g. to forward the records
+ * to the logging of an application. It must outlive them, and may be called from any thread.
+ * 
+ * @param log the logger, or null for the default one.
+*/
+inline void set_logger(logger* log) {
+    current_logger().store(log, std::memory_order_release);
+}
+
+/**
+ * Sets the lowest level that is logged, `log_level::info` by default.
+*/
+inline void set_log_level(log_level level) {
+    current_log_level().store(level, std::memory_order_relaxed);
+}
+
+/**
+ * @returns Whether records of the given level are logged.
+*/
+inline bool log_enabled(log_level level) {
+    return level >= current_log_level().load(std::memory_order_relaxed);
+}
+
+/**
+ * Logs a record, whatever its level. Prefer `FLASH_LOG`, which checks the level first.
+*/
+inline void log(log_level level, UserId user, std::string&& text) {
+    logger* target = current_logger().load(std::memory_order_acquire);
+
+    (target ? *target : default_logger()).write(log_record { level, std::chrono::system_clock::now(), user, std::move(text) });
+}
+
+} // namespace flash
+
+#endif
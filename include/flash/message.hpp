@@ -8,16 +8,27 @@
  * Provides an interface for pushing and popping fundamental data types.
 */
 
+#include <flash/byte_buffer.hpp>
+
+#include <boost/endian/conversion.hpp>
+
 #include <cassert>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
 #include <memory>
+#include <type_traits>
 #include <vector>
 
+// Bodies up to this many bytes are stored inside the message instead of on the heap.
+// Can be overridden before including any of the headers.
+#ifndef FLASH_MESSAGE_INLINE_SIZE
+#define FLASH_MESSAGE_INLINE_SIZE 64
+#endif
+
 namespace flash {
 
-/// Server ID is 0. Client IDs are positive integers, e.g. starting at 100000.
+/// Server ID is 0. Client IDs are positive integers, issued by the servers, see `flash/slot_map.hpp`.
 using UserId = int32_t;
 
 constexpr UserId INVALID_USER_ID = -1;  // Represents some unassigned user ID.
@@ -37,6 +48,14 @@ struct header {
     uint32_t m_size { 0 };  // Size of the message body associated with this header.
 };
 
+// On the wire, the top four bits of the size in a header are reserved for flags
+// describing how the body is encoded. They are never set in received messages.
+constexpr uint32_t WIRE_SIZE_MASK = 0x0FFFFFFF;
+constexpr uint32_t WIRE_FLAG_CONTROL = 1u << 28;     // Internal frame, never delivered to the user.
+constexpr uint32_t WIRE_FLAG_PACKED = 1u << 29;      // Body holds several whole frames, header included.
+constexpr uint32_t WIRE_FLAG_DELTA = 1u << 30;       // Body is a frame of a delta stream.
+constexpr uint32_t WIRE_FLAG_COMPRESSED = 1u << 31;  // Body is compressed, see `flash/compression.hpp`.
+
 
 /**
  * Message struct that is used to send and receive messages over a network connection.
@@ -44,6 +63,9 @@ struct header {
  * 
  * Supports pushing and popping fundamental data types with the `<<` and `>>` operators.
  * 
+ * Bodies of up to `FLASH_MESSAGE_INLINE_SIZE` bytes are stored inline, so small
+ * messages don't allocate, and larger ones spill to the heap.
+ * 
  * @warning For types larger than a byte, does not handle endianness, so only use byte-sized
  * types if your machines differ in endianness. Most modern machines are little-endian.
  * 
@@ -52,6 +74,9 @@ struct header {
 */
 template <typename T>
 struct message {
+    /// Type of the body, a vector of bytes with inline storage for small messages.
+    using body_type = byte_buffer<FLASH_MESSAGE_INLINE_SIZE>;
+
     /**
      * Constructs an empty message with the given type.
     */
@@ -70,7 +95,7 @@ struct message {
     /**
      * @returns A const reference to the body of the message.
     */
-    const std::vector<uint8_t>& get_body() const { return m_body; }
+    const body_type& get_body() const { return m_body; }
 
     /**
      * @returns A reference to the header of the message.
@@ -80,8 +105,54 @@ struct message {
     /**
      * @returns A reference to the body of the message.
     */
-    std::vector<uint8_t>& get_body() { return m_body; }
+    body_type& get_body() { return m_body; }
     
+    /**
+     * Reserves room for a body of the given size, so that pushing data up to that size
+     * doesn't reallocate, e.g. when building a large snapshot field by field.
+     * 
+     * @param bodySize the expected size of the body in bytes.
+    */
+    void reserve(size_t bodySize) { m_body.reserve(bodySize); }
+
+    /**
+     * Appends a fundamental data type to the message body, the same as `operator<<`.
+     * 
+     * @tparam U the type of the data being written.
+    */
+    template <typename U>
+    message<T>& write(const U& data) {
+        static_assert(std::is_standard_layout<U>::value,
+            "Data is too complex to be pushed into message.");
+
+        return write_bytes(&data, sizeof(U));
+    }
+
+    /**
+     * Appends an array of fundamental data types to the message body, with a single copy.
+     * 
+     * @tparam U the type of the elements being written.
+     * @param data  pointer to the first element.
+     * @param count the number of elements.
+    */
+    template <typename U>
+    message<T>& write(const U* data, size_t count) {
+        static_assert(std::is_standard_layout<U>::value,
+            "Data is too complex to be pushed into message.");
+
+        return write_bytes(data, count * sizeof(U));
+    }
+
+    /**
+     * Appends raw bytes to the message body, with a single copy.
+    */
+    message<T>& write_bytes(const void* data, size_t size) {
+        m_body.append(data, size);
+        m_header.m_size = m_body.size();
+
+        return *this;
+    }
+
     /**
      * Allow easy printing of the message using `std::cout`.
     */
@@ -108,18 +179,7 @@ struct message {
     */
     template <typename U>
     friend message<T>& operator<<(message<T>& msg, const U& data) {
-        static_assert(std::is_standard_layout<U>::value,
-            "Data is too complex to be pushed into message.");
-
-        // Resize the message body to fit the new data.
-        size_t sz = msg.m_body.size();
-        msg.m_body.resize(sz + sizeof(U));
-
-        // Copy the data into the message body from the data.
-        std::memcpy(msg.m_body.data() + sz, &data, sizeof(U));
-        msg.m_header.m_size = msg.m_body.size();
-
-        return msg;
+        return msg.write(data);
     }
 
     /**
@@ -156,10 +216,159 @@ struct message {
 
 private:
     header<T> m_header;
-    std::vector<uint8_t> m_body;  // Body of message as a vector of bytes.
+    body_type m_body;  // Body of message as an array of bytes.
 };
 
 
+/**
+ * Reads the body of a message from front to back, without modifying it.
+ * 
+ * Unlike `operator>>` on the message itself, which pops from the end and shrinks the body,
+ * data is read in the order it was pushed, and the message can be read more than once.
+ * 
+ * Reading past the end of the body fails without touching the destination, and puts the
+ * reader in a failed state, which can be checked once after a series of reads.
+ * 
+ * ```
+ * flash::message_reader reader { msg };
+ * reader >> id >> position;
+ * if (!reader) return;
+ * ```
+ * 
+ * @warning The message must outlive the reader, and must not be modified while being read.
+ * 
+ * @tparam T an enum class containing possible types of messages to be sent.
+*/
+template <typename T>
+class message_reader {
+public:
+    /**
+     * Constructs a reader positioned at the start of the body of the message.
+    */
+    explicit message_reader(const message<T>& msg)
+        : m_data { msg.get_body().data() }, m_size { msg.get_body().size() } { }
+
+    /**
+     * @returns The number of bytes that have been read.
+    */
+    size_t offset() const { return m_offset; }
+
+    /**
+     * @returns The number of bytes left to read.
+    */
+    size_t remaining() const { return m_size - m_offset; }
+
+    /**
+     * @returns Whether every read so far has succeeded.
+    */
+    bool good() const { return !m_failed; }
+
+    explicit operator bool() const { return good(); }
+
+    /**
+     * Reads a fundamental data type from the body.
+     * 
+     * @returns Whether there was enough data left to read.
+    */
+    template <typename U>
+    bool read(U& data) {
+        static_assert(std::is_standard_layout<U>::value,
+            "Data is too complex to be popped from message.");
+
+        return read_bytes(&data, sizeof(U));
+    }
+
+    /**
+     * Reads an array of fundamental data types from the body, with a single copy.
+     * 
+     * @returns Whether there was enough data left to read.
+    */
+    template <typename U>
+    bool read(U* data, size_t count) {
+        static_assert(std::is_standard_layout<U>::value,
+            "Data is too complex to be popped from message.");
+
+        return read_bytes(data, count * sizeof(U));
+    }
+
+    /**
+     * Reads raw bytes from the body.
+     * 
+     * @returns Whether there was enough data left to read.
+    */
+    bool read_bytes(void* data, size_t size) {
+        if (size > remaining()) {
+            m_failed = true;
+            return false;
+        }
+
+        if (size > 0) std::memcpy(data, m_data + m_offset, size);
+        m_offset += size;
+
+        return true;
+    }
+
+    /**
+     * Skips over the given number of bytes.
+     * 
+     * @returns Whether there were enough bytes left to skip.
+    */
+    bool skip(size_t size) {
+        if (size > remaining()) {
+            m_failed = true;
+            return false;
+        }
+
+        m_offset += size;
+        return true;
+    }
+
+    /**
+     * Reads a fundamental data type, can be chained, e.g. `reader >> data1 >> data2;`.
+    */
+    template <typename U>
+    friend message_reader<T>& operator>>(message_reader<T>& reader, U& data) {
+        reader.read(data);
+        return reader;
+    }
+
+private:
+    const uint8_t* m_data;  // Start of the body being read.
+    size_t m_size;          // Size of the body being read.
+    size_t m_offset { 0 };  // Offset of the next byte to read.
+    bool m_failed { false };
+};
+
+
+/**
+ * Immutable, reference-counted message that is ready to be put on the wire,
+ * i.e. with the size in its header already in network byte order.
+ * 
+ * Used to broadcast a message: it is encoded once, and then queued on many
+ * connections by reference instead of copying the body for every recipient.
+ * 
+ * @warning Since the header is in network byte order, `get_header().m_size` should
+ * not be read directly. Use `size()` or the size of the body instead.
+ * 
+ * @tparam T an enum class containing possible types of messages to be sent.
+ *         Should have an underlying type of uint32_t.
+*/
+template <typename T>
+using shared_message = std::shared_ptr<const message<T>>;
+
+/**
+ * Encodes a message for sending to any number of recipients.
+ * 
+ * @param msg the message to encode, moved in.
+ * @returns The shared message, with the header in network byte order.
+*/
+template <typename T>
+shared_message<T> make_shared_message(message<T>&& msg) {
+    msg.get_header().m_size = boost::endian::native_to_big(msg.get_header().m_size);
+    return std::make_shared<const message<T>>(std::move(msg));
+}
+
+
 /**
  * Wrapper around a message that contains the user ID of the sender.
  * 
@@ -0,0 +1,95 @@
+#ifndef FLASH_PERIODIC_TIMER_HPP
+#define FLASH_PERIODIC_TIMER_HPP
+
+/**
+ * @file periodic_timer.hpp
+ * 
+ * Timer that runs some housekeeping at a fixed interval on an asio context,
+ * such as dropping clients that timed out, and keeps a coarse clock for it.
+*/
+
+#include <boost/asio.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+namespace flash {
+
+/**
+ * Runs a function periodically on an asio context until stopped.
+ * 
+ * Also keeps a coarse clock that is updated at every tick, so that hot paths can
+ * timestamp their activity with a relaxed load instead of reading the system clock.
+*/
+class periodic_timer {
+public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * Constructs the timer. Nothing runs until `Start` is called.
+     * 
+     * @param asioContext the context to run the function on.
+    */
+    explicit periodic_timer(boost::asio::io_context& asioContext)
+        : m_timer { asioContext }, m_now { clock::now().time_since_epoch().count() } { }
+
+    periodic_timer(const periodic_timer&) = delete;
+    periodic_timer& operator=(const periodic_timer&) = delete;
+
+    /**
+     * Starts calling the given function at every interval, on the context of the timer.
+     * 
+     * @param interval the time between calls.
+     * @param onTick   the function to call.
+    */
+    void Start(std::chrono::milliseconds interval, std::function<void()> onTick) {
+        m_interval = interval;
+        m_onTick = std::move(onTick);
+        m_now.store(clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+        m_running.store(true, std::memory_order_release);
+
+        Arm();
+    }
+
+    /**
+     * Stops calling the function. Must be called once the context is no longer being run,
+     * since the underlying asio timer is not thread-safe.
+    */
+    void Stop() {
+        m_running.store(false, std::memory_order_release);
+        m_timer.cancel();
+    }
+
+    /**
+     * @returns The time of the last tick, accurate up to the interval. Safe from any thread.
+    */
+    clock::time_point Now() const {
+        return clock::time_point { clock::duration { m_now.load(std::memory_order_relaxed) } };
+    }
+
+private:
+    void Arm() {
+        m_timer.expires_after(m_interval);
+        m_timer.async_wait([this](const boost::system::error_code& ec) {
+            // Cancelled, or stopped in the meantime.
+            if (ec || !m_running.load(std::memory_order_acquire)) return;
+
+            m_now.store(clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+            m_onTick();
+
+            Arm();
+        });
+    }
+
+    boost::asio::steady_timer m_timer;      // Underlying asio timer.
+    std::chrono::milliseconds m_interval { 0 };
+    std::function<void()> m_onTick;         // Function to call at every tick.
+
+    std::atomic<bool> m_running { false };  // Whether the timer should keep rearming.
+    std::atomic<clock::rep> m_now;          // Time of the last tick, in clock ticks since the epoch.
+};
+
+} // namespace flash
+
+#endif
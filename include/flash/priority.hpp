@@ -0,0 +1,178 @@
+#ifndef FLASH_PRIORITY_HPP
+#define FLASH_PRIORITY_HPP
+
+/**
+ * @file priority.hpp
+ * 
+ * Priority classes of outgoing messages, and an outgoing queue with a lane per class,
+ * so that latency-critical messages are not stuck behind bulk transfers.
+*/
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace flash {
+
+/**
+ * Priority class of an outgoing message. Messages of a class are sent before any
+ * of a less urgent class waiting at the same time, and in order within their class.
+*/
+enum class priority : uint8_t {
+    realtime,  // E.g. position updates.
+    normal,    // Default for every message.
+    bulk       // E.g. asset chunks, sent when nothing else is waiting.
+};
+
+constexpr size_t NUM_PRIORITIES = 3;
+
+
+/**
+ * Priority of every message type, normal unless set otherwise.
+ * 
+ * Meant to be filled before a server or client starts, and only read afterwards,
+ * possibly from several threads at once.
+ * 
+ * @tparam T an enum class containing possible types of messages to be sent.
+*/
+template <typename T>
+class priority_map {
+public:
+    /**
+     * Sets the priority of the messages of the given type.
+    */
+    void set(T type, priority p) { m_priorities[type] = p; }
+
+    /**
+     * @returns The priority of the messages of the given type.
+    */
+    priority get(T type) const {
+        if (m_priorities.empty()) return priority::normal;
+
+        auto found = m_priorities.find(type);
+        return found != m_priorities.end() ? found->second : priority::normal;
+    }
+
+private:
+    std::unordered_map<T, priority> m_priorities;
+};
+
+
+/**
+ * Outgoing queue made of one queue per priority class, each from the queue policy,
+ * and consumed from the most urgent non-empty lane first.
+ * 
+ * Has the consumer interface of the outgoing queues it replaces, with a priority
+ * when pushing. With bounded queues, each lane has the full capacity.
+ * 
+ * @tparam Q the queue policy, see `flash/queues.hpp`.
+ * @tparam U the type of the queued elements.
+*/
+template <typename Q, typename U>
+class priority_lanes {
+public:
+    using lane_type = typename Q::template outgoing<U>;
+
+    /**
+     * Moves and pushes an element to the back of the lane of the given priority, if there is space.
+     * 
+     * @returns Whether the element was pushed.
+    */
+    bool try_push_back(U&& value, priority p = priority::normal) {
+        return m_lanes[static_cast<size_t>(p)].try_push_back(std::move(value));
+    }
+
+    /**
+     * @returns Whether every lane is empty.
+    */
+    bool empty() const {
+        for (const auto& lane : m_lanes) {
+            if (!lane.empty()) return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * @returns The number of elements in all lanes.
+    */
+    size_t size() const {
+        size_t count = 0;
+
+        for (const auto& lane : m_lanes) {
+            count += lane.size();
+        }
+
+        return count;
+    }
+
+    /**
+     * @returns A const reference to the front of the most urgent non-empty lane.
+     * 
+     * @note Undefined behavior if every lane is empty.
+    */
+    const U& front() const { return Urgent().front(); }
+
+    /**
+     * Pops the front of the most urgent non-empty lane.
+     * 
+     * @note Undefined behavior if every lane is empty.
+    */
+    U pop_front() { return Urgent().pop_front(); }
+
+    /**
+     * Moves up to the given number of elements into a vector, the most urgent first.
+     * 
+     * @returns The number of elements that were moved.
+    */
+    size_t drain_into(std::vector<U>& out, size_t maxElements = -1) {
+        size_t count = 0;
+
+        for (auto& lane : m_lanes) {
+            if (count == maxElements) break;
+            count += lane.drain_into(out, maxElements - count);
+        }
+
+        return count;
+    }
+
+    /**
+     * @returns The lane of the given priority, e.g. to take from it under other limits.
+    */
+    lane_type& lane(priority p) { return m_lanes[static_cast<size_t>(p)]; }
+
+    /**
+     * Empties every lane.
+    */
+    void clear() {
+        for (auto& lane : m_lanes) {
+            lane.clear();
+        }
+    }
+
+private:
+
+    lane_type& Urgent() {
+        for (auto& lane : m_lanes) {
+            if (!lane.empty()) return lane;
+        }
+
+        return m_lanes.back();
+    }
+
+    const lane_type& Urgent() const {
+        for (const auto& lane : m_lanes) {
+            if (!lane.empty()) return lane;
+        }
+
+        return m_lanes.back();
+    }
+
+    std::array<lane_type, NUM_PRIORITIES> m_lanes;  // Lanes, from the most urgent.
+};
+
+} // namespace flash
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef FLASH_QUEUES_HPP
+#define FLASH_QUEUES_HPP
+
+/**
+ * @file queues.hpp
+ * 
+ * Queue policies that select the containers used for the incoming and outgoing
+ * message queues of the servers, clients and connections.
+*/
+
+#include <flash/ring_queue.hpp>
+#include <flash/ts_deque.hpp>
+
+#include <cstddef>
+
+namespace flash {
+
+/**
+ * Default policy, where every queue is a mutex-protected, unbounded `ts_deque`.
+*/
+struct locking_queues {
+    /// Queue of messages received from the network, consumed by the calling thread.
+    template <typename U> using incoming = ts_deque<U>;
+
+    /// Queue of messages waiting to be written, only touched by the asio thread.
+    template <typename U> using outgoing = ts_deque<U>;
+};
+
+/**
+ * Policy that uses bounded lock-free ring queues instead.
+ * 
+ * Incoming queues may be fed by several connections at once, so they are
+ * multi-producer. Outgoing queues are only ever touched by the asio thread
+ * that owns the socket, so they are single-producer single-consumer.
+ * 
+ * @note When an incoming queue is full, the asio thread yields until the
+ * calling thread catches up. When an outgoing queue is full, the message
+ * is dropped, since the asio thread is the one that would have to drain it.
+ * 
+ * @tparam IncomingCapacity capacity of the incoming queues, a power of two.
+ * @tparam OutgoingCapacity capacity of the outgoing queues, a power of two.
+*/
+template <size_t IncomingCapacity = 8192, size_t OutgoingCapacity = 1024>
+struct lockfree_queues {
+    template <typename U> using incoming = mpsc_ring_queue<U, IncomingCapacity>;
+    template <typename U> using outgoing = spsc_ring_queue<U, OutgoingCapacity>;
+};
+
+} // namespace flash
+
+#endif
@@ -0,0 +1,511 @@
+#ifndef FLASH_RING_QUEUE_HPP
+#define FLASH_RING_QUEUE_HPP
+
+/**
+ * @file ring_queue.hpp
+ * 
+ * Bounded lock-free ring queues, e.g. as a drop-in replacement for `ts_deque`
+ * on the hot message paths between the asio thread and the calling thread.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace flash {
+
+/// Assumed size of a cache line, used to keep producer and consumer state apart.
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+
+/**
+ * Wake-up mechanism shared by the ring queues.
+ * 
+ * Consumers register themselves before going to sleep, so producers only
+ * touch the mutex and condition variable when somebody is actually waiting.
+ * With no waiters, a notification is a fence and a single relaxed load.
+*/
+class ring_signal {
+public:
+    /**
+     * Blocks the current thread until `ready()` returns true.
+    */
+    template <typename Pred>
+    void wait(Pred ready) const {
+        if (ready()) return;
+
+        m_waiters.fetch_add(1, std::memory_order_relaxed);
+
+        // Pairs with the fence in `notify`: either the producer sees our registration,
+        // or we see the element it published when re-checking the predicate.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        {
+            std::unique_lock<std::mutex> ul { m_mutexBlocking };
+            m_cvBlocking.wait(ul, ready);  // Handles spurious wake-ups.
+        }
+
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Wakes up any threads blocked in `wait`, if there are any.
+    */
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_relaxed) == 0) return;
+
+        // Taking the lock guarantees the waiter is either before its predicate
+        // check or already asleep, so the notification cannot be lost.
+        std::scoped_lock lock { m_mutexBlocking };
+        m_cvBlocking.notify_all();
+    }
+
+private:
+    mutable std::atomic<uint32_t> m_waiters { 0 };  // Number of threads inside `wait`.
+
+    mutable std::condition_variable m_cvBlocking;  // Blocking condition variable to wait for non-empty.
+    mutable std::mutex m_mutexBlocking;            // Lock around the blocking condition variable.
+};
+
+
+/**
+ * Bounded single-producer single-consumer lock-free ring queue.
+ * 
+ * Exactly one thread may push and exactly one thread may pop at a time,
+ * which may be the same thread. Indices are free-running and only masked
+ * when indexing the storage, so the capacity must be a power of two.
+ * 
+ * @tparam T        the type of the stored elements.
+ * @tparam Capacity the maximum number of elements, a power of two.
+*/
+template <typename T, size_t Capacity>
+class spsc_ring_queue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+        "Capacity of a ring queue must be a power of two.");
+
+public:
+    spsc_ring_queue() : m_slots { std::make_unique<slot[]>(Capacity) } { }
+
+    ~spsc_ring_queue() { clear(); }
+
+    // Elements are constructed in raw storage, so no copying.
+    spsc_ring_queue(const spsc_ring_queue<T, Capacity>&) = delete;
+    spsc_ring_queue& operator=(const spsc_ring_queue<T, Capacity>&) = delete;
+
+    /**
+     * @returns The maximum number of elements the queue can hold.
+    */
+    static constexpr size_t capacity() { return Capacity; }
+
+    /**
+     * @returns Whether the queue is empty.
+    */
+    bool empty() const {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @returns The number of elements in the queue. Only exact when called
+     * from the producer or the consumer while the other side is idle.
+    */
+    size_t size() const {
+        size_t head = m_head.load(std::memory_order_acquire);
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        return tail - head;
+    }
+
+    /**
+     * @returns A reference to the front of the queue. Consumer only.
+     * 
+     * @note Undefined behavior if the queue is empty.
+    */
+    T& front() { return *element(m_head.load(std::memory_order_relaxed)); }
+
+    /**
+     * @returns A const reference to the front of the queue. Consumer only.
+     * 
+     * @note Undefined behavior if the queue is empty.
+    */
+    const T& front() const { return *element(m_head.load(std::memory_order_relaxed)); }
+
+    /**
+     * Moves and pushes an element to the back of the queue, if there is space.
+     * Producer only.
+     * 
+     * @returns Whether the element was pushed. If not, `value` is left untouched.
+    */
+    bool try_push_back(T&& value) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+
+        if (tail - m_headCache == Capacity) {
+            // Looks full from our stale view, so refresh it from the consumer.
+            m_headCache = m_head.load(std::memory_order_acquire);
+            if (tail - m_headCache == Capacity) return false;
+        }
+
+        new (m_slots[tail & MASK].m_data) T(std::move(value));
+        m_tail.store(tail + 1, std::memory_order_release);
+
+        m_signal.notify();
+        return true;
+    }
+
+    /**
+     * Moves and pushes an element to the back of the queue. Producer only.
+     * 
+     * If the queue is full, yields until the consumer makes space.
+     * 
+     * @warning Never call this from the consumer thread, as it will spin forever
+     * if the queue is full. Use `try_push_back` there instead.
+    */
+    void push_back(T&& value) {
+        while (!try_push_back(std::move(value))) {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * Moves the front of the queue into `value` and pops it, if there is one.
+     * Consumer only.
+     * 
+     * @returns Whether an element was popped.
+    */
+    bool try_pop_front(T& value) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+
+        // The cache may lag behind the head, since `pop_front` does not refresh it.
+        if (static_cast<ptrdiff_t>(m_tailCache - head) <= 0) {
+            // Looks empty from our stale view, so refresh it from the producer.
+            m_tailCache = m_tail.load(std::memory_order_acquire);
+            if (m_tailCache == head) return false;
+        }
+
+        T* elem = element(head);
+        value = std::move(*elem);
+        elem->~T();
+
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Pop the front of the queue, shortening it. Consumer only.
+     * 
+     * @returns The element that was popped off the front.
+     * 
+     * @note If the queue is empty, results in undefined behavior.
+    */
+    T pop_front() {
+        size_t head = m_head.load(std::memory_order_relaxed);
+
+        T* elem = element(head);
+        T value = std::move(*elem);
+        elem->~T();
+
+        m_head.store(head + 1, std::memory_order_release);
+        return value;
+    }
+
+    /**
+     * Moves elements from the front of the queue to the back of `out`,
+     * up to a maximum number. Consumer only.
+     * 
+     * The head is only published once at the end, so the producer sees
+     * the freed space in one go.
+     * 
+     * @returns The number of elements that were moved.
+    */
+    size_t drain_into(std::vector<T>& out, size_t maxElements = -1) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        m_tailCache = m_tail.load(std::memory_order_acquire);
+
+        size_t count = std::min(maxElements, m_tailCache - head);
+
+        for (size_t i = 0; i < count; ++i, ++head) {
+            T* elem = element(head);
+            out.emplace_back(std::move(*elem));
+            elem->~T();
+        }
+
+        m_head.store(head, std::memory_order_release);
+        return count;
+    }
+
+    /**
+     * Calls `f` with a reference to every element from the front, until it returns true,
+     * e.g. to find a queued element and replace it in place. Consumer only.
+     * 
+     * @returns Whether `f` returned true for some element.
+    */
+    template <typename F>
+    bool visit(F&& f) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        m_tailCache = m_tail.load(std::memory_order_acquire);
+
+        for (; head != m_tailCache; ++head) {
+            if (f(*element(head))) return true;
+        }
+
+        return false;
+    }
+
+    /**
+     * Clears the queue. Consumer only.
+    */
+    void clear() {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t tail = m_tail.load(std::memory_order_acquire);
+
+        for (; head != tail; ++head) {
+            element(head)->~T();
+        }
+
+        m_head.store(head, std::memory_order_release);
+    }
+
+    /**
+     * Blocks the current thread until the queue is no longer empty.
+    */
+    void wait() const {
+        m_signal.wait([this]() { return !empty(); });
+    }
+
+private:
+    static constexpr size_t MASK = Capacity - 1;
+
+    struct slot {
+        alignas(T) unsigned char m_data[sizeof(T)];
+    };
+
+    T* element(size_t index) const {
+        return std::launder(reinterpret_cast<T*>(m_slots[index & MASK].m_data));
+    }
+
+    std::unique_ptr<slot[]> m_slots;  // Raw storage for the elements, owned.
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_head { 0 };  // Next element to pop, written by consumer.
+    size_t m_tailCache { 0 };                                   // Consumer's last view of the tail.
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_tail { 0 };  // Next slot to fill, written by producer.
+    size_t m_headCache { 0 };                                   // Producer's last view of the head.
+
+    alignas(CACHE_LINE_SIZE) mutable ring_signal m_signal;      // Wakes up a blocked consumer.
+};
+
+
+/**
+ * Bounded multi-producer single-consumer lock-free ring queue.
+ * 
+ * Any number of threads may push concurrently, but only one thread may pop.
+ * Based on Dmitry Vyukov's bounded queue: every cell carries a sequence number
+ * that tells producers and the consumer whose turn it is to use the cell:
+ * https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue.
+ * 
+ * @tparam T        the type of the stored elements.
+ * @tparam Capacity the maximum number of elements, a power of two.
+*/
+template <typename T, size_t Capacity>
+class mpsc_ring_queue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+        "Capacity of a ring queue must be a power of two.");
+
+public:
+    mpsc_ring_queue() : m_cells { std::make_unique<cell[]>(Capacity) } {
+        for (size_t i = 0; i < Capacity; ++i) {
+            m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~mpsc_ring_queue() { clear(); }
+
+    // Elements are constructed in raw storage, so no copying.
+    mpsc_ring_queue(const mpsc_ring_queue<T, Capacity>&) = delete;
+    mpsc_ring_queue& operator=(const mpsc_ring_queue<T, Capacity>&) = delete;
+
+    /**
+     * @returns The maximum number of elements the queue can hold.
+    */
+    static constexpr size_t capacity() { return Capacity; }
+
+    /**
+     * @returns Whether the queue has no element ready to be popped.
+    */
+    bool empty() const {
+        size_t head = m_head.load(std::memory_order_acquire);
+        return m_cells[head & MASK].m_sequence.load(std::memory_order_acquire) != head + 1;
+    }
+
+    /**
+     * @returns The approximate number of elements in the queue, including
+     * elements that producers have claimed but not finished writing yet.
+    */
+    size_t size() const {
+        size_t head = m_head.load(std::memory_order_acquire);
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+
+    /**
+     * @returns A reference to the front of the queue. Consumer only.
+     * 
+     * @note Undefined behavior if the queue is empty.
+    */
+    T& front() { return *element(m_head.load(std::memory_order_relaxed)); }
+
+    /**
+     * @returns A const reference to the front of the queue. Consumer only.
+     * 
+     * @note Undefined behavior if the queue is empty.
+    */
+    const T& front() const { return *element(m_head.load(std::memory_order_relaxed)); }
+
+    /**
+     * Moves and pushes an element to the back of the queue, if there is space.
+     * Safe to call from any number of threads.
+     * 
+     * @returns Whether the element was pushed. If not, `value` is left untouched.
+    */
+    bool try_push_back(T&& value) {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        cell* target;
+
+        while (true) {
+            target = &m_cells[pos & MASK];
+            size_t seq = target->m_sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+            if (diff == 0) {
+                // The cell is free for this lap, try to claim it.
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+
+            } else if (diff < 0) {
+                // The consumer has not freed the cell from the previous lap, so we are full.
+                return false;
+
+            } else {
+                // Another producer claimed the cell first, catch up.
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        new (target->m_data) T(std::move(value));
+        target->m_sequence.store(pos + 1, std::memory_order_release);
+
+        m_signal.notify();
+        return true;
+    }
+
+    /**
+     * Moves and pushes an element to the back of the queue.
+     * Safe to call from any number of threads.
+     * 
+     * If the queue is full, yields until the consumer makes space.
+     * 
+     * @warning Never call this from the consumer thread, as it will spin forever
+     * if the queue is full. Use `try_push_back` there instead.
+    */
+    void push_back(T&& value) {
+        while (!try_push_back(std::move(value))) {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * Moves the front of the queue into `value` and pops it, if there is one.
+     * Consumer only.
+     * 
+     * @returns Whether an element was popped.
+    */
+    bool try_pop_front(T& value) {
+        if (empty()) return false;
+        value = pop_front();
+        return true;
+    }
+
+    /**
+     * Pop the front of the queue, shortening it. Consumer only.
+     * 
+     * @returns The element that was popped off the front.
+     * 
+     * @note If the queue is empty, results in undefined behavior.
+    */
+    T pop_front() {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        cell& target = m_cells[head & MASK];
+
+        T* elem = element(head);
+        T value = std::move(*elem);
+        elem->~T();
+
+        // Hand the cell back to producers for the next lap.
+        target.m_sequence.store(head + Capacity, std::memory_order_release);
+        m_head.store(head + 1, std::memory_order_release);
+
+        return value;
+    }
+
+    /**
+     * Moves elements that are ready to be popped from the front of the queue
+     * to the back of `out`, up to a maximum number. Consumer only.
+     * 
+     * @returns The number of elements that were moved.
+    */
+    size_t drain_into(std::vector<T>& out, size_t maxElements = -1) {
+        size_t count = 0;
+
+        while (count < maxElements && !empty()) {
+            out.emplace_back(pop_front());
+            ++count;
+        }
+
+        return count;
+    }
+
+    /**
+     * Clears the elements that are ready to be popped. Consumer only.
+    */
+    void clear() {
+        while (!empty()) {
+            pop_front();
+        }
+    }
+
+    /**
+     * Blocks the current thread until the queue is no longer empty.
+    */
+    void wait() const {
+        m_signal.wait([this]() { return !empty(); });
+    }
+
+private:
+    static constexpr size_t MASK = Capacity - 1;
+
+    struct cell {
+        std::atomic<size_t> m_sequence;  // Lap marker telling whose turn it is.
+        alignas(T) unsigned char m_data[sizeof(T)];
+    };
+
+    T* element(size_t index) const {
+        return std::launder(reinterpret_cast<T*>(m_cells[index & MASK].m_data));
+    }
+
+    std::unique_ptr<cell[]> m_cells;  // Storage for the elements, owned.
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_head { 0 };  // Next element to pop, written by consumer.
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_tail { 0 };  // Next cell to claim, shared by producers.
+
+    alignas(CACHE_LINE_SIZE) mutable ring_signal m_signal;      // Wakes up a blocked consumer.
+};
+
+} // namespace flash
+
+#endif
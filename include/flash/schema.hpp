@@ -0,0 +1,217 @@
+#ifndef FLASH_SCHEMA_HPP
+#define FLASH_SCHEMA_HPP
+
+/**
+ * @file schema.hpp
+ * 
+ * Compile-time description of message payloads, generating encoders and decoders
+ * with fixed field offsets and a portable, little-endian wire format.
+ * 
+ * Declare the payload of a message type by specializing `message_schema`:
+ * 
+ * ```
+ * template <>
+ * struct flash::message_schema<MsgType, MsgType::Move> : flash::schema<uint32_t, float, float> { };
+ * 
+ * auto msg = flash::encode_message<MsgType::Move>(id, x, y);
+ * bool ok = flash::decode_message<MsgType::Move>(msg, id, x, y);
+ * ```
+*/
+
+#include <flash/message.hpp>
+
+#include <boost/endian/conversion.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+namespace flash {
+
+/**
+ * Encoding of a single field on the wire, in little-endian byte order.
+ * 
+ * Defined for arithmetic types, enums, and `std::array`s of those. On little-endian
+ * machines, this is a plain copy; the byte swaps only exist on big-endian ones.
+ * 
+ * @tparam U the type of the field.
+*/
+template <typename U, typename = void>
+struct wire_field {
+    static_assert(std::is_arithmetic<U>::value || std::is_enum<U>::value,
+        "Schema fields must be arithmetic types, enums, or std::arrays of those.");
+
+    static constexpr size_t SIZE = sizeof(U);
+
+    static void store(uint8_t* out, const U& value) {
+        if constexpr (boost::endian::order::native == boost::endian::order::little || sizeof(U) == 1) {
+            std::memcpy(out, &value, sizeof(U));
+        } else {
+            uint8_t bytes[sizeof(U)];
+            std::memcpy(bytes, &value, sizeof(U));
+
+            for (size_t i = 0; i < sizeof(U); ++i) out[i] = bytes[sizeof(U) - 1 - i];
+        }
+    }
+
+    static void load(const uint8_t* in, U& value) {
+        if constexpr (boost::endian::order::native == boost::endian::order::little || sizeof(U) == 1) {
+            std::memcpy(&value, in, sizeof(U));
+        } else {
+            uint8_t bytes[sizeof(U)];
+            for (size_t i = 0; i < sizeof(U); ++i) bytes[i] = in[sizeof(U) - 1 - i];
+
+            std::memcpy(&value, bytes, sizeof(U));
+        }
+    }
+};
+
+template <typename U, size_t N>
+struct wire_field<std::array<U, N>> {
+    static constexpr size_t SIZE = N * wire_field<U>::SIZE;
+
+    static void store(uint8_t* out, const std::array<U, N>& values) {
+        if constexpr (boost::endian::order::native == boost::endian::order::little) {
+            std::memcpy(out, values.data(), SIZE);
+        } else {
+            for (size_t i = 0; i < N; ++i) wire_field<U>::store(out + i * wire_field<U>::SIZE, values[i]);
+        }
+    }
+
+    static void load(const uint8_t* in, std::array<U, N>& values) {
+        if constexpr (boost::endian::order::native == boost::endian::order::little) {
+            std::memcpy(values.data(), in, SIZE);
+        } else {
+            for (size_t i = 0; i < N; ++i) wire_field<U>::load(in + i * wire_field<U>::SIZE, values[i]);
+        }
+    }
+};
+
+
+/**
+ * Fixed layout of a message payload made of the given fields, in order, without padding.
+ * 
+ * The offset of every field is a compile-time constant, so encoding and decoding
+ * are straight-line code without any per-field size checks; the only check is
+ * of the whole payload size, made once up front.
+ * 
+ * @tparam Fields the types of the fields.
+*/
+template <typename... Fields>
+struct schema {
+    /// Number of fields in the payload.
+    static constexpr size_t NUM_FIELDS = sizeof...(Fields);
+
+    /// Size of the payload on the wire in bytes.
+    static constexpr size_t SIZE = (wire_field<Fields>::SIZE + ... + 0);
+
+    /**
+     * @returns The offset of the field with the given index in the payload.
+    */
+    template <size_t I>
+    static constexpr size_t offset() {
+        static_assert(I < NUM_FIELDS, "Field index out of range.");
+
+        constexpr size_t sizes[] = { wire_field<Fields>::SIZE... };
+
+        size_t result = 0;
+        for (size_t i = 0; i < I; ++i) result += sizes[i];
+
+        return result;
+    }
+
+    /**
+     * @returns Whether a header announces a body of exactly the schema size,
+     * so a message can be rejected before looking at its body.
+    */
+    template <typename T>
+    static bool validate(const header<T>& hdr) { return hdr.m_size == SIZE; }
+
+    /**
+     * Encodes the fields into a new message of the given type.
+    */
+    template <typename T>
+    static message<T> encode(T type, const Fields&... fields) {
+        message<T> msg { type };
+        msg.get_body().resize(SIZE);
+        msg.get_header().m_size = SIZE;
+
+        encode_into(msg.get_body().data(), fields...);
+        return msg;
+    }
+
+    /**
+     * Encodes the fields into a buffer of at least `SIZE` bytes.
+    */
+    static void encode_into(uint8_t* out, const Fields&... fields) {
+        EncodeFields(out, std::index_sequence_for<Fields...> {}, fields...);
+    }
+
+    /**
+     * Decodes the fields from a message.
+     * 
+     * @returns Whether the body has the schema size. If not, the fields are untouched.
+    */
+    template <typename T>
+    static bool decode(const message<T>& msg, Fields&... fields) {
+        if (msg.get_body().size() != SIZE) return false;
+
+        decode_from(msg.get_body().data(), fields...);
+        return true;
+    }
+
+    /**
+     * Decodes the fields from a buffer of at least `SIZE` bytes.
+    */
+    static void decode_from(const uint8_t* in, Fields&... fields) {
+        DecodeFields(in, std::index_sequence_for<Fields...> {}, fields...);
+    }
+
+private:
+    template <size_t... Is>
+    static void EncodeFields(uint8_t* out, std::index_sequence<Is...>, const Fields&... fields) {
+        (wire_field<Fields>::store(out + offset<Is>(), fields), ...);
+    }
+
+    template <size_t... Is>
+    static void DecodeFields(const uint8_t* in, std::index_sequence<Is...>, Fields&... fields) {
+        (wire_field<Fields>::load(in + offset<Is>(), fields), ...);
+    }
+};
+
+
+/**
+ * Maps a message type to the schema of its payload. Not defined by default:
+ * specialize it, deriving from `schema`, for every message type with a fixed payload.
+ * 
+ * @tparam T    an enum class containing possible types of messages to be sent.
+ * @tparam Type the message type.
+*/
+template <typename T, T Type>
+struct message_schema;
+
+/**
+ * Encodes a message of the given type according to its schema.
+*/
+template <auto Type, typename... Args>
+message<decltype(Type)> encode_message(const Args&... args) {
+    return message_schema<decltype(Type), Type>::encode(Type, args...);
+}
+
+/**
+ * Decodes a message of the given type according to its schema.
+ * 
+ * @returns Whether the message has the type and size of the schema.
+*/
+template <auto Type, typename... Args>
+bool decode_message(const message<decltype(Type)>& msg, Args&... args) {
+    if (msg.get_header().m_type != Type) return false;
+
+    return message_schema<decltype(Type), Type>::decode(msg, args...);
+}
+
+} // namespace flash
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef FLASH_SESSION_HPP
+#define FLASH_SESSION_HPP
+
+/**
+ * @file session.hpp
+ * 
+ * Session tokens, which let a client that lost its connection reattach to its previous
+ * `UserId` in a single round-trip, instead of going through the full handshake again
+ * and resyncing its state under a new ID.
+ * 
+ * With sessions enabled on both sides, the server grants a token to every client it
+ * validates: the ID of the client, and a random secret. The server holds the users it
+ * loses for a grace period, along with what is queued to them. A client that reconnects
+ * presents its token, and gets its ID and the messages queued meanwhile back if the
+ * server still holds its session, or a new session otherwise.
+ * 
+ * Both sides settle on sessions in the handshake: the server sets `SESSION_OFFER_BIT` in
+ * its challenge, and a client that takes up the offer flips `SESSION_RESPONSE_MASK` into
+ * its response. Either side without sessions goes through the plain handshake.
+*/
+
+#include <flash/message.hpp>
+#include <flash/schema.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+
+namespace flash {
+
+/// Default time a server holds a user it lost, for the client to resume its session.
+constexpr std::chrono::milliseconds DEFAULT_SESSION_GRACE { 10000 };
+
+/// Set in the handshake challenge of a server that offers sessions, clear otherwise.
+constexpr uint64_t SESSION_OFFER_BIT = 1;
+
+/// Flipped into the handshake response of a client that takes up the offer.
+constexpr uint64_t SESSION_RESPONSE_MASK = 0x5E55'10E5'5E55'10E5ULL;
+
+/**
+ * Token of a session, as granted by the server to a client.
+*/
+struct session_token {
+    UserId m_id { INVALID_USER_ID };  // ID of the client on the server.
+    uint64_t m_secret { 0 };          // Proves the token was granted, never 0 for a valid token.
+
+    bool valid() const { return m_secret != 0; }
+};
+
+/// Presented by a reconnecting client: ID and secret of its session, or a null secret for none.
+using session_request_schema = schema<int32_t, uint64_t>;
+
+/// Sent by the server once a client is validated: whether the session was resumed, ID and secret.
+using session_grant_schema = schema<uint8_t, int32_t, uint64_t>;
+
+/**
+ * @returns A new secret for a session, never 0, from the random source of the OS, so that
+ * the secrets granted to other clients can't be predicted. Safe to call from any thread.
+*/
+inline uint64_t make_session_secret() {
+    uint64_t secret = 0;
+
+#ifdef __linux__
+    while (secret == 0) {
+        if (getrandom(&secret, sizeof(secret), 0) != ssize_t(sizeof(secret))) secret = 0;
+    }
+#else
+    thread_local std::random_device device;
+
+    while (secret == 0) {
+        secret = (uint64_t(device()) << 32) | uint64_t(device());
+    }
+#endif
+
+    return secret;
+}
+
+/**
+ * Compares a presented secret to the one granted in constant time, so that the time taken
+ * tells nothing about how much of it is right.
+ * 
+ * @returns Whether both are the same, and not 0.
+*/
+inline bool same_session_secret(uint64_t granted, uint64_t presented) {
+    volatile uint64_t difference = granted ^ presented;
+    return (difference | uint64_t(granted == 0)) == 0;
+}
+
+} // namespace flash
+
+#endif
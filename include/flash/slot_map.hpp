@@ -0,0 +1,246 @@
+#ifndef FLASH_SLOT_MAP_HPP
+#define FLASH_SLOT_MAP_HPP
+
+/**
+ * @file slot_map.hpp
+ * 
+ * Table of the users of a server, which issues their IDs as generation-tagged indices
+ * into an array of slots, so that finding a user is a single array access, and keeps
+ * the users themselves contiguous, so that walking them all, e.g. to broadcast, is too.
+*/
+
+#include <flash/message.hpp>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace flash {
+
+/**
+ * Maps user IDs, which it issues, to values stored contiguously.
+ * 
+ * An ID is the index of its slot in the low bits, and the generation of the slot in the
+ * high bits, which is bumped every time the slot is freed, so that the ID of a user that
+ * has gone away never finds the one that took its slot. Freed slots are reused oldest
+ * first, which makes it take as long as possible for an ID to be issued again.
+ * 
+ * Several maps may share the ID space, e.g. one per shard of a server, by taking every
+ * `stride`-th index from a different first one, so that the map of an ID is found from it.
+ * 
+ * Not thread-safe. Pointers to the values are invalidated by `insert` and `erase`.
+ * 
+ * @tparam V the type of the values, which must be movable.
+*/
+template <typename V>
+class slot_map {
+public:
+    /// Low bits of an ID holding the index of its slot, the others up to the sign hold its generation.
+    static constexpr uint32_t INDEX_BITS = 20;
+
+    /// Most values that can be held at once.
+    static constexpr uint32_t MAX_SLOTS = uint32_t(1) << INDEX_BITS;
+
+    /// Generation after which a slot starts over from 1, so that IDs stay positive.
+    static constexpr uint32_t MAX_GENERATION = (uint32_t(1) << (31 - INDEX_BITS)) - 1;
+
+    /**
+     * Constructs an empty map.
+     * 
+     * @param first  the index of the first slot, which must be less than the stride.
+     * @param stride the step between the indices of the slots, e.g. the number of maps sharing the IDs.
+    */
+    explicit slot_map(uint32_t first = 0, uint32_t stride = 1)
+        : m_first { first }, m_stride { stride > 0 ? stride : 1 } { }
+
+    /**
+     * @returns The index of the slot of the ID, e.g. to find which of several maps issued it.
+    */
+    static uint32_t index_of(UserId id) { return static_cast<uint32_t>(id) & (MAX_SLOTS - 1); }
+
+    /**
+     * Stores a value under a new ID.
+     * 
+     * @returns The ID of the value, or `INVALID_USER_ID` if the map is full.
+    */
+    UserId insert(V&& value) {
+        uint32_t position;
+
+        if (m_freeHead != NO_SLOT) {
+            position = m_freeHead;
+            m_freeHead = m_slots[position].m_next;
+            if (m_freeHead == NO_SLOT) m_freeTail = NO_SLOT;
+
+        } else if (m_first + m_slots.size() * m_stride < MAX_SLOTS) {
+            position = static_cast<uint32_t>(m_slots.size());
+            m_slots.push_back(slot {});
+
+        } else {
+            return INVALID_USER_ID;
+        }
+
+        slot& s = m_slots[position];
+        s.m_used = true;
+        s.m_next = static_cast<uint32_t>(m_values.size());
+
+        UserId id = static_cast<UserId>((s.m_generation << INDEX_BITS) | (m_first + position * m_stride));
+        m_ids.push_back(id);
+        m_values.push_back(std::move(value));
+
+        return id;
+    }
+
+    /**
+     * @returns The value stored under the given ID, or null if there is none.
+    */
+    V* find(UserId id) {
+        const slot* s = Slot(id);
+        return s ? &m_values[s->m_next] : nullptr;
+    }
+
+    const V* find(UserId id) const {
+        const slot* s = Slot(id);
+        return s ? &m_values[s->m_next] : nullptr;
+    }
+
+    bool contains(UserId id) const { return Slot(id) != nullptr; }
+
+    /**
+     * Removes the value stored under the given ID, if any, moving the last value in its place.
+     * 
+     * @returns Whether there was a value.
+    */
+    bool erase(UserId id) {
+        const slot* s = Slot(id);
+        if (!s) return false;
+
+        EraseAt(s->m_next);
+        return true;
+    }
+
+    /**
+     * Removes the values for which the predicate returns true.
+     * 
+     * @param pred called with the ID and the value, which it may modify.
+     * @returns The number of values removed.
+    */
+    template <typename Pred>
+    size_t erase_if(Pred pred) {
+        size_t erased = 0;
+
+        for (size_t i = 0; i < m_values.size(); ) {
+            if (pred(m_ids[i], m_values[i])) {
+                EraseAt(static_cast<uint32_t>(i));
+                ++erased;
+            } else {
+                ++i;
+            }
+        }
+
+        return erased;
+    }
+
+    /**
+     * Calls the function with the ID and the value of every value, in storage order.
+     * The function must not insert nor erase.
+    */
+    template <typename F>
+    void for_each(F f) {
+        for (size_t i = 0; i < m_values.size(); ++i) {
+            f(m_ids[i], m_values[i]);
+        }
+    }
+
+    template <typename F>
+    void for_each(F f) const {
+        for (size_t i = 0; i < m_values.size(); ++i) {
+            f(m_ids[i], m_values[i]);
+        }
+    }
+
+    size_t size() const { return m_values.size(); }
+    bool empty() const { return m_values.empty(); }
+
+    /**
+     * Removes every value. The slots keep their generations, so the old IDs stay stale.
+    */
+    void clear() {
+        while (!m_values.empty()) EraseAt(static_cast<uint32_t>(m_values.size() - 1));
+    }
+
+private:
+    static constexpr uint32_t NO_SLOT = uint32_t(-1);
+
+    struct slot {
+        uint32_t m_generation { 1 };  // Tags the IDs of the slot, never 0 so that no ID is 0.
+        uint32_t m_next { NO_SLOT };  // Position of the value while used, next free slot otherwise.
+        bool m_used { false };
+    };
+
+    /**
+     * @returns The position of the slot of the ID among the slots of this map, or `NO_SLOT`.
+    */
+    uint32_t Position(UserId id) const {
+        uint32_t index = index_of(id);
+        if (index < m_first) return NO_SLOT;
+
+        uint32_t offset = index - m_first;
+        if (m_stride == 1) return offset;
+
+        return offset % m_stride == 0 ? offset / m_stride : NO_SLOT;
+    }
+
+    const slot* Slot(UserId id) const {
+        if (id <= 0) return nullptr;
+
+        uint32_t position = Position(id);
+        if (position >= m_slots.size()) return nullptr;
+
+        const slot& s = m_slots[position];
+        if (!s.m_used || s.m_generation != (static_cast<uint32_t>(id) >> INDEX_BITS)) return nullptr;
+
+        return &s;
+    }
+
+    void EraseAt(uint32_t stored) {
+        uint32_t freed = Position(m_ids[stored]);
+
+        // Fill the hole with the last value, so the values stay contiguous.
+        uint32_t last = static_cast<uint32_t>(m_values.size() - 1);
+        if (stored != last) {
+            m_values[stored] = std::move(m_values[last]);
+            m_ids[stored] = m_ids[last];
+            m_slots[Position(m_ids[stored])].m_next = stored;
+        }
+
+        m_values.pop_back();
+        m_ids.pop_back();
+
+        slot& s = m_slots[freed];
+        s.m_used = false;
+        s.m_generation = s.m_generation == MAX_GENERATION ? 1 : s.m_generation + 1;
+        s.m_next = NO_SLOT;
+
+        // Reused last, so that its new ID comes as late as possible.
+        if (m_freeTail != NO_SLOT) {
+            m_slots[m_freeTail].m_next = freed;
+        } else {
+            m_freeHead = freed;
+        }
+        m_freeTail = freed;
+    }
+
+    uint32_t m_first;   // Index of the first slot.
+    uint32_t m_stride;  // Step between the indices of the slots.
+
+    std::vector<slot> m_slots;  // By position, from the low bits of the IDs.
+    std::vector<UserId> m_ids;  // ID of each value, in storage order.
+    std::vector<V> m_values;    // The values, contiguous.
+
+    uint32_t m_freeHead { NO_SLOT };  // Free slot to be reused first.
+    uint32_t m_freeTail { NO_SLOT };  // Free slot to be reused last.
+};
+
+} // namespace flash
+
+#endif
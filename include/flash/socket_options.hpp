@@ -0,0 +1,160 @@
+#ifndef FLASH_SOCKET_OPTIONS_HPP
+#define FLASH_SOCKET_OPTIONS_HPP
+
+/**
+ * @file socket_options.hpp
+ * 
+ * Tuning of the sockets made by the servers and clients, such as disabling Nagle's
+ * algorithm or sizing the kernel buffers, instead of the system defaults.
+*/
+
+#include <flash/log.hpp>
+
+#include <boost/asio.hpp>
+
+#if defined(__linux__)
+#include <linux/filter.h>
+#include <sys/socket.h>
+#endif
+
+#include <cerrno>
+#include <cstring>
+#include <type_traits>
+
+namespace flash {
+
+/**
+ * Options applied to every socket of a server or client. Left at their defaults,
+ * only Nagle's algorithm is disabled, and everything else is up to the system.
+ * 
+ * Options a platform doesn't support are ignored, and failing to apply one is reported
+ * without failing the socket, e.g. busy polling may require elevated privileges.
+*/
+struct socket_options {
+    bool m_noDelay { true };        // Whether to disable Nagle's algorithm, TCP only.
+    int m_sendBufferSize { 0 };     // Size of the kernel send buffer in bytes, 0 for the default.
+    int m_receiveBufferSize { 0 };  // Size of the kernel receive buffer in bytes, 0 for the default.
+    int m_busyPollMicros { 0 };     // Time to busy poll the device on blocking receives, 0 to not. Linux only.
+    int m_dscp { -1 };              // Differentiated services code point (0 to 63) of the packets sent, -1 for the default.
+    bool m_reusePort { false };     // Whether several sockets may bind to the same port, e.g. one per process or thread.
+    bool m_cpuSteering { false };   // With several UDP sockets per server, hand each datagram to the one of its CPU. Linux only.
+};
+
+/// Socket option allowing several sockets to bind to the same address and port.
+#ifdef SO_REUSEPORT
+using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+/// Socket option making blocking receives busy poll the device for up to some microseconds.
+#ifdef SO_BUSY_POLL
+using busy_poll = boost::asio::detail::socket_option::integer<SOL_SOCKET, SO_BUSY_POLL>;
+#endif
+
+/// Socket options setting the type of service, or traffic class, of the packets sent.
+#ifdef IP_TOS
+using type_of_service = boost::asio::detail::socket_option::integer<IPPROTO_IP, IP_TOS>;
+#endif
+
+#ifdef IPV6_TCLASS
+using traffic_class = boost::asio::detail::socket_option::integer<IPPROTO_IPV6, IPV6_TCLASS>;
+#endif
+
+/**
+ * Sets an option on a socket, and reports it if that failed.
+*/
+template <typename Socket, typename Option>
+void set_socket_option(Socket& socket, const Option& option, const char* name) {
+    boost::system::error_code ec;
+    socket.set_option(option, ec);
+
+    if (ec) {
+        FLASH_LOG(warning, INVALID_USER_ID, "[SOCKET] Could not set " << name << ": " << ec.message());
+    }
+}
+
+/**
+ * Applies the options that concern a socket of the given type, which must be open.
+ * 
+ * Options that must precede binding, such as `m_reusePort`, are applied to acceptors and
+ * UDP sockets only. Accepted sockets inherit the buffer sizes of their acceptor, which
+ * matters as the TCP window is negotiated before they are accepted.
+ * 
+ * @tparam Socket a TCP socket, a TCP acceptor or a UDP socket.
+*/
+template <typename Socket>
+void apply_socket_options(Socket& socket, const socket_options& options) {
+    constexpr bool IS_ACCEPTOR = std::is_same_v<Socket, boost::asio::ip::tcp::acceptor>;
+    constexpr bool IS_TCP_SOCKET = std::is_same_v<Socket, boost::asio::ip::tcp::socket>;
+
+    if constexpr (!IS_TCP_SOCKET) {
+#ifdef SO_REUSEPORT
+        if (options.m_reusePort) set_socket_option(socket, reuse_port { true }, "SO_REUSEPORT");
+#endif
+    }
+
+    if (options.m_sendBufferSize > 0) {
+        set_socket_option(socket, boost::asio::socket_base::send_buffer_size { options.m_sendBufferSize }, "SO_SNDBUF");
+    }
+
+    if (options.m_receiveBufferSize > 0) {
+        set_socket_option(socket, boost::asio::socket_base::receive_buffer_size { options.m_receiveBufferSize }, "SO_RCVBUF");
+    }
+
+    // The rest concerns the sockets that carry traffic.
+    if constexpr (!IS_ACCEPTOR) {
+        if constexpr (IS_TCP_SOCKET) {
+            set_socket_option(socket, boost::asio::ip::tcp::no_delay { options.m_noDelay }, "TCP_NODELAY");
+        }
+
+#ifdef SO_BUSY_POLL
+        if (options.m_busyPollMicros > 0) set_socket_option(socket, busy_poll { options.m_busyPollMicros }, "SO_BUSY_POLL");
+#endif
+
+        if (options.m_dscp >= 0) {
+            // The code point takes the upper six bits of the field.
+            int tos = (options.m_dscp & 0x3F) << 2;
+
+            boost::system::error_code ec;
+            bool v6 = socket.local_endpoint(ec).address().is_v6();
+
+            if (v6) {
+#ifdef IPV6_TCLASS
+                set_socket_option(socket, traffic_class { tos }, "IPV6_TCLASS");
+#endif
+            } else {
+#ifdef IP_TOS
+                set_socket_option(socket, type_of_service { tos }, "IP_TOS");
+#endif
+            }
+        }
+    }
+}
+
+/**
+ * Makes the kernel hand each datagram received on the port of a reuse-port group to the
+ * socket whose position in the group is the CPU that received it, modulo the number of
+ * sockets, instead of hashing its addresses. This keeps a flow on one core when the
+ * receive queues of the device are pinned to cores. Linux only, ignored elsewhere.
+ * 
+ * @param socket     any socket of the group, which must be bound.
+ * @param numSockets the number of sockets in the group.
+*/
+template <typename Socket>
+void attach_cpu_steering(Socket& socket, size_t numSockets) {
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU) },  // CPU of the datagram.
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, static_cast<uint32_t>(numSockets) },            // Modulo the sockets.
+        { BPF_RET | BPF_A, 0, 0, 0 }                                                       // Position of the socket.
+    };
+    sock_fprog program { static_cast<unsigned short>(sizeof(code) / sizeof(code[0])), code };
+
+    if (::setsockopt(socket.native_handle(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) != 0) {
+        FLASH_LOG(warning, INVALID_USER_ID, "[SOCKET] Could not set SO_ATTACH_REUSEPORT_CBPF: " << std::strerror(errno));
+    }
+#endif
+}
+
+} // namespace flash
+
+#endif
@@ -0,0 +1,248 @@
+#ifndef FLASH_STATS_HPP
+#define FLASH_STATS_HPP
+
+/**
+ * @file stats.hpp
+ * 
+ * Counters kept by the servers as they run, such as the messages and bytes of every type
+ * and client, and the snapshots of them returned by `GetStats`, e.g. for capacity planning
+ * or to spot the clients that are sent the most.
+*/
+
+#include <flash/message.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+namespace flash {
+
+/// Number of message types counted on their own, from 0. The others are counted together in the last one.
+constexpr size_t MAX_COUNTED_TYPES = 64;
+
+/// Default interval at which the stats are pushed to a callback.
+constexpr std::chrono::milliseconds DEFAULT_STATS_INTERVAL { 1000 };
+
+/**
+ * Messages and bytes received and sent. Rates are the difference between two snapshots
+ * over the time between them.
+*/
+struct traffic_stats {
+    uint64_t m_messagesIn { 0 };
+    uint64_t m_bytesIn { 0 };
+    uint64_t m_messagesOut { 0 };
+    uint64_t m_bytesOut { 0 };
+
+    void count_in(size_t bytes) {
+        ++m_messagesIn;
+        m_bytesIn += bytes;
+    }
+
+    void count_out(size_t bytes, size_t count = 1) {
+        m_messagesOut += count;
+        m_bytesOut += bytes * count;
+    }
+
+    traffic_stats& operator+=(const traffic_stats& other) {
+        m_messagesIn += other.m_messagesIn;
+        m_bytesIn += other.m_bytesIn;
+        m_messagesOut += other.m_messagesOut;
+        m_bytesOut += other.m_bytesOut;
+
+        return *this;
+    }
+};
+
+/**
+ * Messages and bytes received and sent, counted by a single thread, and readable from any.
+*/
+class traffic_counters {
+public:
+    void count_in(size_t bytes) {
+        bump(m_messagesIn, 1);
+        bump(m_bytesIn, bytes);
+    }
+
+    void count_out(size_t bytes) {
+        bump(m_messagesOut, 1);
+        bump(m_bytesOut, bytes);
+    }
+
+    traffic_stats load() const {
+        return traffic_stats {
+            m_messagesIn.load(std::memory_order_relaxed), m_bytesIn.load(std::memory_order_relaxed),
+            m_messagesOut.load(std::memory_order_relaxed), m_bytesOut.load(std::memory_order_relaxed)
+        };
+    }
+
+private:
+    /// With a single writer, no read-modify-write is needed.
+    static void bump(std::atomic<uint64_t>& counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> m_messagesIn { 0 };
+    std::atomic<uint64_t> m_bytesIn { 0 };
+    std::atomic<uint64_t> m_messagesOut { 0 };
+    std::atomic<uint64_t> m_bytesOut { 0 };
+};
+
+/**
+ * Snapshot of the counters of a server.
+*/
+struct server_stats {
+    std::chrono::steady_clock::time_point m_time;  // When the snapshot was taken.
+
+    traffic_stats m_total;                                     // Messages of every type.
+    std::array<traffic_stats, MAX_COUNTED_TYPES> m_byType {};  // Messages by type, headers included.
+    std::unordered_map<UserId, traffic_stats> m_byClient;      // What went over the wire, by connected client.
+
+    size_t m_incomingDepth { 0 };  // Messages waiting for `Update`.
+    size_t m_outgoingDepth { 0 };  // Messages, or datagrams, waiting to be sent.
+
+    uint64_t m_validationFailures { 0 };  // Clients that failed the handshake.
+    uint64_t m_timeouts { 0 };            // Clients dropped for being silent too long.
+    uint64_t m_resumed { 0 };             // Clients that resumed their session after losing it.
+    uint64_t m_malformed { 0 };           // Incoming messages or datagrams ignored as malformed.
+    uint64_t m_dropped { 0 };             // Outgoing messages dropped, by backpressure or full queues.
+
+    uint64_t m_handled { 0 };                      // Messages handled by `Update`.
+    std::chrono::nanoseconds m_handlerTime {};     // Time spent in `OnMessage`.
+    std::chrono::nanoseconds m_maxHandlerTime {};  // Longest `OnMessage` since the previous snapshot.
+
+    uint64_t m_sent { 0 };                     // Messages, or datagrams, handed to the socket.
+    std::chrono::nanoseconds m_sendLag {};     // Time they waited in the outgoing queues.
+    std::chrono::nanoseconds m_maxSendLag {};  // Longest wait since the previous snapshot.
+};
+
+/// Function the stats of a server are pushed to periodically.
+using stats_callback = std::function<void(const server_stats&)>;
+
+/**
+ * Counters of a server, bumped from any thread with relaxed atomics, since they order
+ * nothing and are only ever summed. The counters of each client are kept by the transport.
+*/
+class server_counters {
+public:
+    using clock = std::chrono::steady_clock;
+
+    std::atomic<uint64_t> m_validationFailures { 0 };
+    std::atomic<uint64_t> m_timeouts { 0 };
+    std::atomic<uint64_t> m_resumed { 0 };
+    std::atomic<uint64_t> m_malformed { 0 };
+    std::atomic<uint64_t> m_dropped { 0 };
+
+    /**
+     * Counts a message of the given type and size, header included, that was received.
+    */
+    template <typename T>
+    void count_in(T type, size_t bytes) {
+        counted_type& counted = m_byType[index(type)];
+        counted.m_messagesIn.fetch_add(1, std::memory_order_relaxed);
+        counted.m_bytesIn.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    /**
+     * Counts a message of the given type and size, header included, sent to a number of clients.
+    */
+    template <typename T>
+    void count_out(T type, size_t bytes, size_t count = 1) {
+        counted_type& counted = m_byType[index(type)];
+        counted.m_messagesOut.fetch_add(count, std::memory_order_relaxed);
+        counted.m_bytesOut.fetch_add(bytes * count, std::memory_order_relaxed);
+    }
+
+    /**
+     * Counts a batch of messages handled by `Update`.
+    */
+    void count_handled(size_t count, clock::duration total, clock::duration longest) {
+        m_handled.fetch_add(count, std::memory_order_relaxed);
+        m_handlerNanos.fetch_add(nanos(total), std::memory_order_relaxed);
+        raise(m_maxHandlerNanos, nanos(longest));
+    }
+
+    /**
+     * Counts a batch of messages handed to the socket, and how long they waited to be.
+    */
+    void count_sent(size_t count, clock::duration totalLag, clock::duration longestLag) {
+        m_sent.fetch_add(count, std::memory_order_relaxed);
+        m_sendLagNanos.fetch_add(nanos(totalLag), std::memory_order_relaxed);
+        raise(m_maxSendLagNanos, nanos(longestLag));
+    }
+
+    /**
+     * Fills a snapshot with the counters, and resets the maxima.
+    */
+    void snapshot(server_stats& stats) {
+        stats.m_time = clock::now();
+
+        for (size_t i = 0; i < MAX_COUNTED_TYPES; ++i) {
+            traffic_stats& traffic = stats.m_byType[i];
+            traffic.m_messagesIn = m_byType[i].m_messagesIn.load(std::memory_order_relaxed);
+            traffic.m_bytesIn = m_byType[i].m_bytesIn.load(std::memory_order_relaxed);
+            traffic.m_messagesOut = m_byType[i].m_messagesOut.load(std::memory_order_relaxed);
+            traffic.m_bytesOut = m_byType[i].m_bytesOut.load(std::memory_order_relaxed);
+
+            stats.m_total += traffic;
+        }
+
+        stats.m_validationFailures = m_validationFailures.load(std::memory_order_relaxed);
+        stats.m_timeouts = m_timeouts.load(std::memory_order_relaxed);
+        stats.m_resumed = m_resumed.load(std::memory_order_relaxed);
+        stats.m_malformed = m_malformed.load(std::memory_order_relaxed);
+        stats.m_dropped = m_dropped.load(std::memory_order_relaxed);
+
+        stats.m_handled = m_handled.load(std::memory_order_relaxed);
+        stats.m_handlerTime = std::chrono::nanoseconds { m_handlerNanos.load(std::memory_order_relaxed) };
+        stats.m_maxHandlerTime = std::chrono::nanoseconds { m_maxHandlerNanos.exchange(0, std::memory_order_relaxed) };
+
+        stats.m_sent = m_sent.load(std::memory_order_relaxed);
+        stats.m_sendLag = std::chrono::nanoseconds { m_sendLagNanos.load(std::memory_order_relaxed) };
+        stats.m_maxSendLag = std::chrono::nanoseconds { m_maxSendLagNanos.exchange(0, std::memory_order_relaxed) };
+    }
+
+private:
+    /**
+     * Counters of one message type, on their own cache line, so that threads
+     * counting messages of different types don't contend.
+    */
+    struct alignas(64) counted_type {
+        std::atomic<uint64_t> m_messagesIn { 0 };
+        std::atomic<uint64_t> m_bytesIn { 0 };
+        std::atomic<uint64_t> m_messagesOut { 0 };
+        std::atomic<uint64_t> m_bytesOut { 0 };
+    };
+
+    template <typename T>
+    static size_t index(T type) {
+        return std::min(static_cast<size_t>(type), MAX_COUNTED_TYPES - 1);
+    }
+
+    static uint64_t nanos(clock::duration duration) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+    }
+
+    static void raise(std::atomic<uint64_t>& maximum, uint64_t value) {
+        uint64_t current = maximum.load(std::memory_order_relaxed);
+        while (value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed)) { }
+    }
+
+    std::array<counted_type, MAX_COUNTED_TYPES> m_byType;
+
+    std::atomic<uint64_t> m_handled { 0 };
+    std::atomic<uint64_t> m_handlerNanos { 0 };
+    std::atomic<uint64_t> m_maxHandlerNanos { 0 };
+
+    std::atomic<uint64_t> m_sent { 0 };
+    std::atomic<uint64_t> m_sendLagNanos { 0 };
+    std::atomic<uint64_t> m_maxSendLagNanos { 0 };
+};
+
+} // namespace flash
+
+#endif
@@ -9,10 +9,13 @@
 
 #include <boost/asio.hpp>
 
-#include <iostream>
-
+#include <flash/compression.hpp>
+#include <flash/log.hpp>
 #include <flash/message.hpp>
-#include <flash/ts_deque.hpp>
+#include <flash/priority.hpp>
+#include <flash/queues.hpp>
+#include <flash/session.hpp>
+#include <flash/socket_options.hpp>
 #include <flash/iclient.hpp>
 
 #include <flash/tcp/connection.hpp>
@@ -30,11 +33,16 @@ namespace tcp {
  * Should be inherited for custom functionality.
  * 
  * @tparam T the message type to send and receive.
+ * @tparam Q the queue policy, see `flash/queues.hpp`.
 */
-template <typename T>
-class client : public iclient<T> {
+template <typename T, typename Q = locking_queues>
+class client : public iclient<T, Q> {
 public:
-    client() = default;
+    /**
+     * @param options the options of the socket.
+    */
+    explicit client(const socket_options& options = {}) : m_socketOptions { options } { }
+
     virtual ~client() { }
 
     /**
@@ -52,22 +60,31 @@ public:
             boost::asio::ip::tcp::resolver::results_type endpoints
                 = resolver.resolve(host, std::to_string(port));
 
+            // The context was stopped if the client was connected before.
+            m_asioContext.restart();
+
             // Create a client connection with a new socket.
-            m_connection = std::make_unique<connection<T>>(
-                connection<T>::owner::client,
+            m_connection = std::make_shared<connection<T, Q>>(
+                connection<T, Q>::owner::client,
                 m_asioContext,                               // Provide the connection with the surrounding asio context.
                 boost::asio::ip::tcp::socket(m_asioContext), // Create a new socket.
-                m_qMessagesIn                                // Reference to the client's incoming message queue.
+                m_qMessagesIn,                               // Reference to the client's incoming message queue.
+                nullptr,                                     // No pool, bodies are handed over to the caller.
+                &m_compression                               // How the messages are compressed.
             );
 
+            if (m_sessions) {
+                m_connection->SetSessionToken(m_session);
+            }
+
             // Connect to the server.
-            m_connection->ConnectToServer(endpoints);
+            m_connection->ConnectToServer(endpoints, m_socketOptions);
 
             // Start running the context in its own thread.
             m_threadContext = std::thread([this]() { m_asioContext.run(); });
 
         } catch (std::exception& e) {
-            std::cout << "Client Exception: " << e.what() << '\n';
+            FLASH_LOG(error, INVALID_USER_ID, "Client Exception: " << e.what());
             return false;
         }
 
@@ -78,22 +95,28 @@ public:
      * Disconnects the client from the server.
      * 
      * Stops the asio context and joins the context thread,
-     * also releases the unique pointer to the connection.
+     * also releases the pointer to the connection.
     */
     void Disconnect() final {
-        boost::asio::post(m_asioContext, [this]() { m_asioContext.stop(); });
-
+        // Close the socket before stopping, since pending handlers keep the connection alive.
         if (IsConnected()) {
             m_connection->Disconnect();
         }
 
+        boost::asio::post(m_asioContext, [this]() { m_asioContext.stop(); });
+
         if (m_threadContext.joinable()) {
             m_threadContext.join();
         }
 
-        m_connection.release();
+        DrainContext();
+
+        // Kept to be presented on the next connection.
+        if (m_connection) m_session = m_connection->GetSession();
+
+        m_connection.reset();
 
-        std::cout << "Client Disconnected.\n";
+        FLASH_LOG(info, INVALID_USER_ID, "Client Disconnected.");
     }
 
     /**
@@ -103,31 +126,105 @@ public:
         return m_connection && m_connection->IsConnected();
     }
 
+    /**
+     * Keeps the session the server grants, and presents it when connecting again after
+     * `Disconnect`, so as to get the same ID back, along with the messages the server queued
+     * meanwhile, unless its grace period is over. See `flash/session.hpp`.
+     * The server must enable sessions as well. Must be called before `Connect`.
+    */
+    void EnableSessions() {
+        m_sessions = true;
+    }
+
+    /**
+     * @returns The session granted by the server, e.g. to learn the ID of the client,
+     * or the one being presented while connecting.
+    */
+    session_token GetSession() const {
+        return m_connection ? m_connection->GetSession() : m_session;
+    }
+
+    /**
+     * @returns Whether the server resumed the previous session on the last `Connect`.
+    */
+    bool IsResumed() const {
+        return m_connection && m_connection->IsResumed();
+    }
+
+    /**
+     * Compresses the bodies of outgoing messages from the given size, and decompresses
+     * incoming ones. The server must use a compressor for the same algorithm.
+     * Must be called before `Connect`.
+     * 
+     * @param comp      the compression algorithm, or null to disable compression.
+     * @param threshold the body size from which messages are compressed.
+    */
+    void SetCompression(std::shared_ptr<const compressor> comp, size_t threshold = DEFAULT_COMPRESSION_THRESHOLD) {
+        m_compression = compression_settings { std::move(comp), threshold };
+    }
+
+    /**
+     * Sets the priority class of the messages of the given type, so they are written
+     * before messages of less urgent types that are waiting. Must be called before `Connect`.
+    */
+    void SetPriority(T type, priority p) {
+        m_priorities.set(type, p);
+    }
+
     /**
      * Sends a message to the server.
      * 
      * @param msg the message to send.
     */
     void Send(message<T>&& msg) final {
+        priority p = m_priorities.get(msg.get_header().m_type);
+        Send(std::move(msg), p);
+    }
+
+    /**
+     * Sends a message to the server, with the given priority class rather than the one of its type.
+     * 
+     * @param msg the message to send.
+     * @param p   the priority class of the message.
+    */
+    void Send(message<T>&& msg, priority p) {
         if (IsConnected()) {
-            m_connection->Send(std::move(msg));
+            m_connection->Send(std::move(msg), p);
         }
     }
 
     /**
      * Returns a reference to the incoming message queue.
     */
-    ts_deque<tagged_message<T>>& Incoming() final {
+    typename Q::template incoming<tagged_message<T>>& Incoming() final {
         return m_qMessagesIn;
     }
 
 protected:
     boost::asio::io_context m_asioContext;        // The asio context for the client connection.
     std::thread m_threadContext;                  // Thread that runs the asio context.
-    std::unique_ptr<connection<T>> m_connection;  // Handles data transfer.
+    std::shared_ptr<connection<T, Q>> m_connection;  // Handles data transfer.
+    compression_settings m_compression;              // Compression of the messages, if any.
+    priority_map<T> m_priorities;                    // Priority class of each message type.
+    socket_options m_socketOptions;                  // Options of the socket.
+    bool m_sessions { false };                       // Whether sessions are enabled.
+    session_token m_session;                         // Session of the previous connection, if any.
 
 private:
-    ts_deque<tagged_message<T>> m_qMessagesIn;  // Thread-safe queue of incoming messages.
+    typename Q::template incoming<tagged_message<T>> m_qMessagesIn;  // Thread-safe queue of incoming messages.
+
+    /**
+     * Runs what was left on the context once its thread is joined, e.g. the close and the
+     * stop if the context had run out of work before they were posted, so that none of it
+     * runs on the next connection, where the stop would end the context straight away.
+    */
+    void DrainContext() {
+        m_asioContext.restart();
+
+        while (m_asioContext.poll() > 0) {
+            m_asioContext.restart();
+        }
+    }
 };
 
 } // namespace tcp
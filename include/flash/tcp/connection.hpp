@@ -10,18 +10,36 @@
  * to place the incoming messages.
 */
 
+#include <flash/backpressure.hpp>
+#include <flash/buffer_pool.hpp>
+#include <flash/compression.hpp>
+#include <flash/dispatch.hpp>
+#include <flash/log.hpp>
 #include <flash/message.hpp>
+#include <flash/priority.hpp>
+#include <flash/queues.hpp>
 #include <flash/scramble.hpp>
-#include <flash/ts_deque.hpp>
+#include <flash/session.hpp>
+#include <flash/socket_options.hpp>
+#include <flash/stats.hpp>
 
 #include <flash/iserverext.hpp>
 
+#ifdef FLASH_WITH_COROUTINES
+#include <flash/coroutine.hpp>
+#endif
+
 #include <boost/asio.hpp>
 #include <boost/endian/conversion.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <memory>
-#include <sstream>
+#include <utility>
+#include <vector>
 
 namespace flash {
 
@@ -31,11 +49,34 @@ namespace tcp {
  * Connection class that represents a connection between a client and a server,
  * owned by one of the sides.
  * 
+ * Must be owned by a `std::shared_ptr`: every pending asynchronous operation holds
+ * a reference, so the connection outlives its owner dropping it mid-operation.
+ * All work on the socket happens on the asio context the connection was given,
+ * so it is safe as long as that context is run by a single thread.
+ * 
+ * With `FLASH_WITH_COROUTINES`, the handshake, read and write loops are coroutines
+ * instead of chains of callbacks, see `flash/coroutine.hpp`. They behave the same.
+ * 
+ * With sessions, the server marks its challenge as offering them, and a client that uses
+ * them answers with a distinct response followed by the token of its previous session,
+ * to which the server answers with the session it grants, see `flash/session.hpp`. Either
+ * side without sessions handshakes as usual, so the other one falls back to going without.
+ * 
  * @tparam T an enum class containing possible types of messages to be sent.
+ * @tparam Q the queue policy, see `flash/queues.hpp`.
 */
-template <typename T>
-class connection {
+template <typename T, typename Q = locking_queues>
+class connection : public std::enable_shared_from_this<connection<T, Q>> {
 public:
+    /// Upper bound on the number of messages gathered into a single write.
+    static constexpr size_t MAX_MESSAGES_PER_WRITE = 256;
+
+    /// Bulk messages stop being added to a write from this many bytes, so they can't hold back urgent ones for long.
+    static constexpr size_t MAX_BULK_BYTES_PER_WRITE = 256 * 1024;
+
+    /// Size of the receive buffer. Larger messages are read directly into their body.
+    static constexpr size_t READ_BUFFER_SIZE = 64 * 1024;
+
     /**
      * The type of the connection owner. Behavior is different depending on the owner.
     */
@@ -44,6 +85,14 @@ public:
         client
     };
 
+    /**
+     * Reattaches a server connection, once validated, to the session of the token
+     * its client presented, on the asio context of the connection.
+     * 
+     * @returns Whether the session was resumed, in which case the connection took its ID.
+    */
+    using resume_handler = std::function<bool(const std::shared_ptr<connection>&, const session_token&)>;
+
     /**
      * Constructor for the connection. Sets up the connection with the given parameters.
      * 
@@ -51,19 +100,37 @@ public:
      * @param asioContext a reference to the asio context that the connection will run on.
      * @param socket      the socket that the connection will use.
      * @param qMessagesIn a reference to the queue to deposit incoming messages into.
+     * @param bodyPool    the pool to take the bodies of incoming messages from, if any.
+     * @param compression how to compress outgoing messages and decompress incoming ones, if at all.
+     * @param backpressure how many bytes may be queued to the remote side, if bounded.
+     * @param counters    the counters of the server to count the messages in, if any.
+     * @param dispatch    which messages to hand to the server right away, rather than queue, if any.
     */
     connection(owner ownerType,
                boost::asio::io_context& asioContext,
                boost::asio::ip::tcp::socket&& socket,
-               ts_deque<tagged_message<T>>& qMessagesIn)
+               typename Q::template incoming<tagged_message<T>>& qMessagesIn,
+               buffer_pool* bodyPool = nullptr,
+               const compression_settings* compression = nullptr,
+               const backpressure_settings* backpressure = nullptr,
+               server_counters* counters = nullptr,
+               const dispatch_map<T>* dispatch = nullptr)
                
         : m_ownerType { ownerType }, m_asioContext { asioContext },
-          m_socket { std::move(socket) }, m_qMessagesIn { qMessagesIn } {
+          m_socket { std::move(socket) }, m_qMessagesIn { qMessagesIn },
+          m_bodyPool { bodyPool }, m_compression { compression }, m_backpressure { backpressure },
+          m_counters { counters }, m_dispatch { dispatch } {
+
+        m_bufferIn.resize(READ_BUFFER_SIZE);
+
+        // Accepted sockets arrive open, and count as connected before validation.
+        m_connected.store(m_socket.is_open(), std::memory_order_release);
 
         if (m_ownerType == owner::server) {
             // Server needs to generate random data for client to validate on.
+            // Sessions are not offered unless enabled.
             m_handshakeOut = Scramble(
-                uint64_t(std::chrono::steady_clock::now().time_since_epoch().count()));
+                uint64_t(std::chrono::steady_clock::now().time_since_epoch().count())) & ~SESSION_OFFER_BIT;
 
             // What the client should return to us during the handshake.
             m_handshakeCheck = Scramble(m_handshakeOut);
@@ -105,12 +172,17 @@ public:
 
         if (m_socket.is_open()) {
             m_id = uid;
+            m_server = server;
 
+#ifdef FLASH_WITH_COROUTINES
+            boost::asio::co_spawn(m_asioContext, Serve(this->shared_from_this(), server), boost::asio::detached);
+#else
             // Send the validation challenge to the client.
             WriteValidation();
 
             // Wait asynchronously for the client to respond.
             ReadValidation(server);
+#endif
         }
     }
 
@@ -119,27 +191,113 @@ public:
      * and prompting it to continuously read header messages from the socket.
      * 
      * @param endpoints the results of a resolver operation used to connect to the server.
+     * @param options   the options of the socket, applied once connected.
     */
-    void ConnectToServer(const boost::asio::ip::tcp::resolver::results_type& endpoints) {
+    void ConnectToServer(const boost::asio::ip::tcp::resolver::results_type& endpoints,
+                         const socket_options& options = {}) {
         // Only the client should connect to servers.
         if (m_ownerType != owner::client) return;
 
+        // Count as connected while connecting, so the caller doesn't give up straight away.
+        m_connected.store(true, std::memory_order_release);
+
+#ifdef FLASH_WITH_COROUTINES
+        boost::asio::co_spawn(m_asioContext, Connect(this->shared_from_this(), endpoints, options), boost::asio::detached);
+#else
         boost::asio::async_connect(
             m_socket, endpoints,
-            [this](std::error_code ec, boost::asio::ip::tcp::endpoint endpoint) {
+            [this, self = this->shared_from_this(), options](std::error_code ec, boost::asio::ip::tcp::endpoint endpoint) {
                 if (!ec) {
                     m_id = SERVER_USER_ID;
+                    apply_socket_options(m_socket, options);
                     
                     // Wait for the validation challenge from the server.
                     ReadValidation();
 
                 } else {
-                    std::stringstream ss;
-                    ss << "Connect to server failed: " << ec.message() << "\n";
-                    std::cout << ss.str();
+                    FLASH_LOG(error, INVALID_USER_ID, "Connect to server failed: " << ec.message());
+
+                    Close();
                 }
             }
         );
+#endif
+    }
+
+#ifdef FLASH_WITH_COROUTINES
+    /**
+     * Sets what to notify when messages are added to the incoming queue, so that a coroutine
+     * may await them. Must be called before connecting.
+    */
+    void SetMessageWaiter(message_waiter* waiter) { m_waiter = waiter; }
+#endif
+
+    /**
+     * Enables sessions on a server connection: the challenge offers them, and a client that
+     * takes up the offer presents a token with its response, which is given to the handler,
+     * owned by the caller. Must be called before connecting.
+    */
+    void SetResumeHandler(const resume_handler* handler) {
+        m_resume = handler;
+        m_sessions = true;
+
+        m_handshakeOut |= SESSION_OFFER_BIT;
+        m_handshakeCheck = Scramble(m_handshakeOut);
+    }
+
+    /**
+     * Enables sessions on a client connection, presenting the given token, if valid, to resume
+     * the session it is of, if the server offers sessions. Must be called before connecting.
+    */
+    void SetSessionToken(const session_token& token) {
+        m_sessionId.store(token.m_id, std::memory_order_relaxed);
+        m_sessionSecret.store(token.m_secret, std::memory_order_relaxed);
+        m_sessions = true;
+    }
+
+    /**
+     * @returns The token of the session granted by the server, or the one presented to it
+     * while the handshake is going on. Safe to call from any thread.
+    */
+    session_token GetSession() const {
+        return session_token { m_sessionId.load(std::memory_order_relaxed), m_sessionSecret.load(std::memory_order_relaxed) };
+    }
+
+    /**
+     * @returns Whether the server resumed the session that was presented to it.
+     * Safe to call from any thread.
+    */
+    bool IsResumed() const {
+        return m_resumed.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Takes the ID and the secret of a resumed session. Called by the resume handler, which
+     * then hands the connection what the previous connection of the session has queued.
+    */
+    void Reattach(const session_token& token) {
+        m_id = token.m_id;
+        m_sessionId.store(token.m_id, std::memory_order_relaxed);
+        m_sessionSecret.store(token.m_secret, std::memory_order_relaxed);
+
+        // Nothing is written until the queued messages arrive, so that they go first.
+        m_adopting = true;
+    }
+
+    /**
+     * Closes the connection, and moves the messages waiting to be written to the connection
+     * that resumed its session, along with any sent to this one from then on.
+     * Messages that were being written when the connection was lost are not recovered.
+    */
+    void HandOver(std::shared_ptr<connection> successor) {
+        boost::asio::post(m_asioContext, [this, self = this->shared_from_this(), successor = std::move(successor)]() {
+            m_successor = successor;
+            Close();
+
+            boost::asio::post(successor->m_asioContext, [successor, queued = TakeQueued()]() mutable {
+                successor->Adopt(std::move(queued));
+            });
+        });
     }
 
     /**
@@ -147,38 +305,76 @@ public:
     */
     void Disconnect() {
         if (IsConnected()) {
-            boost::asio::post(m_asioContext, [this]() { m_socket.close(); });
+            boost::asio::post(m_asioContext, [this, self = this->shared_from_this()]() { Close(); });
         }
     }
 
+    /**
+     * @returns The time at which data was last received, or the connection was made.
+     * Safe to call from any thread.
+    */
+    std::chrono::steady_clock::time_point GetLastReceiveTime() const {
+        return std::chrono::steady_clock::time_point {
+            std::chrono::steady_clock::duration { m_lastReceive.load(std::memory_order_relaxed) } };
+    }
+
+    /**
+     * @returns The messages and bytes received and sent so far. Safe to call from any thread.
+    */
+    traffic_stats GetTraffic() const {
+        return m_traffic.load();
+    }
+
+    /**
+     * @returns The number of messages waiting to be written. Safe to call from any thread.
+    */
+    size_t GetQueueDepth() const {
+        return m_qMessagesOut.size();
+    }
+
     /**
      * @returns true if the connection is connected, false otherwise.
     */
     bool IsConnected() const {
-        return m_socket.is_open();
+        return m_connected.load(std::memory_order_acquire);
     }
 
     /**
      * Sends a message to the remote side of the connection.
+     * Large bodies are compressed on the asio context, if compression is enabled.
      * 
      * @param msg the message to send, moved in.
+     * @param p   the priority class of the message.
     */
-    void Send(message<T>&& msg) {
+    void Send(message<T>&& msg, priority p = priority::normal) {
         boost::asio::post(
             m_asioContext,
             
             // Black magic generalized lambda capture from
             // https://stackoverflow.com/questions/8640393/move-capture-in-lambda
 
-            [this, msg = std::move(msg)] () mutable {
-                bool writing = !m_qMessagesOut.empty();
+            [this, self = this->shared_from_this(), msg = std::move(msg), p] () mutable {
+                if (m_compression) compress_message(*m_compression, msg);
+
                 msg.get_header().m_size = boost::endian::native_to_big(msg.get_header().m_size);
-                m_qMessagesOut.push_back(std::move(msg));
+                QueueFrame(frame { std::move(msg), nullptr }, p);
+            }
+        );
+    }
 
-                // If writing is already occurring, no need to start the loop again.
-                if (!writing) {
-                    WriteHeader();
-                }
+    /**
+     * Sends a shared message to the remote side of the connection.
+     * Only the reference is queued, so the same message can be sent on many connections.
+     * 
+     * @param msg the message to send, already encoded with `make_shared_message`,
+     *            and compressed beforehand if need be.
+     * @param p   the priority class of the message.
+    */
+    void Send(const shared_message<T>& msg, priority p = priority::normal) {
+        boost::asio::post(
+            m_asioContext,
+            [this, self = this->shared_from_this(), msg, p]() {
+                QueueFrame(frame { message<T> { static_cast<T>(0) }, msg }, p);
             }
         );
     }
@@ -190,20 +386,297 @@ protected:
     boost::asio::io_context& m_asioContext;  // Shared asio context among connections.
     boost::asio::ip::tcp::socket m_socket;   // Unique socket connected to remote, owned.
 
-    ts_deque<message<T>> m_qMessagesOut;     // Queue of messages to send, owned.
+    /// Whether the socket is open, readable from any thread unlike the socket itself.
+    std::atomic<bool> m_connected { false };
 
-    message<T> m_msgTemporaryIn { static_cast<T>(0) };  // Holds incoming message data.
+    /// Time at which data was last received, in clock ticks, for idle timeouts.
+    std::atomic<std::chrono::steady_clock::rep> m_lastReceive { std::chrono::steady_clock::now().time_since_epoch().count() };
+
+    /**
+     * Message waiting to be written, either owned by the connection or shared with others.
+     * Either way, its header is in network byte order.
+    */
+    struct frame {
+        message<T> m_owned;         // Message owned by this connection, unless shared.
+        shared_message<T> m_shared; // Message shared with other connections, or null.
+
+        std::chrono::steady_clock::time_point m_queued {};  // When it was queued, if counted.
+
+        const message<T>& get() const { return m_shared ? *m_shared : m_owned; }
+    };
+
+    priority_lanes<Q, frame> m_qMessagesOut;  // Queues of messages to send by priority, owned.
+
+    std::vector<frame> m_msgsInFlight;                    // Messages taken from the queue for the current write.
+    std::vector<boost::asio::const_buffer> m_buffersOut;  // Header and body buffers of the messages in flight.
+
+    message<T> m_msgTemporaryIn { static_cast<T>(0) };  // Holds a large incoming message.
+    bool m_msgTemporaryInCompressed { false };          // Whether the large incoming message is compressed.
+    size_t m_msgTemporaryInReceived { 0 };              // Bytes of its body received with the header.
+
+    std::vector<uint8_t> m_bufferIn;  // Receive buffer that messages are parsed out of.
+    size_t m_bufferInStart { 0 };     // Offset of the first unparsed byte in the buffer.
+    size_t m_bufferInEnd { 0 };       // Offset one past the last received byte in the buffer.
 
     /// Queue holding messages received from the remote side, owned by the caller.
     /// This design choice is so that all incoming messages are serialized; this is also
     /// why we have to tag the messages with the connection they came from.
-    ts_deque<tagged_message<T>>& m_qMessagesIn;  
+    typename Q::template incoming<tagged_message<T>>& m_qMessagesIn;
+
+    /// Pool that the bodies of incoming messages are taken from, owned by the caller, or null.
+    buffer_pool* m_bodyPool;
+
+    /// How messages are compressed, owned by the caller, or null if they never are.
+    const compression_settings* m_compression;
+
+    /// How many bytes may be queued, owned by the caller, or null if unbounded.
+    const backpressure_settings* m_backpressure;
+    queue_usage m_queueUsage;  // Bytes queued, but not being written yet.
+
+    /// Server to notify of backpressure, or null.
+    iserverext<T>* m_server { nullptr };
+
+    /// Counters of the server, owned by the caller, or null.
+    server_counters* m_counters;
+    traffic_counters m_traffic;  // Messages and bytes received and sent on this connection.
+
+    /// Which messages are handed to the server on this thread, owned by the caller, or null.
+    const dispatch_map<T>* m_dispatch;
 
     uint64_t m_handshakeOut { 0 };    // Outgoing handshake data (challenge or response)
     uint64_t m_handshakeIn { 0 };     // Incoming handshake data (challenge or response)
     uint64_t m_handshakeCheck { 0 };  // Correct handshake response
+    uint64_t m_handshakeWire { 0 };   // Outgoing handshake data in network byte order
+    bool m_handshaken { false };      // Whether the handshake is over, so messages may be written
+
+    bool m_sessions { false };                                         // Whether sessions are enabled on this side.
+    bool m_sessionAgreed { false };                                    // Whether the handshake says both sides use sessions.
+    const resume_handler* m_resume { nullptr };                        // Resumes sessions, owned by the server, or null.
+    std::array<uint8_t, session_grant_schema::SIZE> m_sessionWire {};  // Session request or grant on the wire.
+    std::atomic<UserId> m_sessionId { INVALID_USER_ID };               // ID of the session, readable from any thread.
+    std::atomic<uint64_t> m_sessionSecret { 0 };                       // Secret of the session, 0 if none.
+    std::atomic<bool> m_resumed { false };                             // Whether the presented session was resumed.
+    bool m_adopting { false };                                         // Whether the messages of a resumed session are on their way.
+    std::shared_ptr<connection> m_successor;                           // Connection that resumed the session of this one, if any.
+
+#ifdef FLASH_WITH_COROUTINES
+    /// Notified of incoming messages, owned by the caller, or null.
+    message_waiter* m_waiter { nullptr };
+#endif
 
 private:
+    /**
+     * What parsing the receive buffer calls for next.
+    */
+    enum class parse_result : uint8_t {
+        read_more,  // Keep reading into the buffer.
+        read_body,  // Read the rest of a large body into `m_msgTemporaryIn`.
+        failed      // The connection was closed.
+    };
+
+    /**
+     * Closes the socket. Must be called on the asio context of the connection.
+    */
+    void Close() {
+        m_connected.store(false, std::memory_order_release);
+
+        boost::system::error_code ec;
+        m_socket.close(ec);
+    }
+
+    /**
+     * Queues a message to be written, and starts writing unless a write is in flight.
+     * Must be called on the asio context of the connection.
+    */
+    void QueueFrame(frame&& msg, priority p) {
+        // The session moved on to another connection, which writes the message instead.
+        if (m_successor) {
+            boost::asio::post(m_successor->m_asioContext, [successor = m_successor, msg = std::move(msg), p]() mutable {
+                successor->QueueFrame(std::move(msg), p);
+            });
+            return;
+        }
+
+        bool writing = !m_msgsInFlight.empty();
+        size_t size = msg.get().size();
+
+        if (m_counters) {
+            m_counters->count_out(msg.get().get_header().m_type, size);
+            msg.m_queued = std::chrono::steady_clock::now();
+        }
+
+        if (m_backpressure && m_queueUsage.exceeds(size, *m_backpressure)) {
+            if (!RelieveBackpressure(msg, size)) return;
+        }
+
+        // We are the consumer of the outgoing queue as well, so never block on it.
+        if (!m_qMessagesOut.try_push_back(std::move(msg), p)) {
+            FLASH_LOG(warning, m_id, "Outgoing Queue Full, Message Dropped.");
+
+            CountDropped();
+            return;
+        }
+
+        if (m_backpressure) m_queueUsage.m_bytes += size;
+
+        // If writing is already occurring, no need to start the loop again.
+        // Messages queued during the handshake wait for it, so they can't interleave with it,
+        // and those queued once the socket is closed wait for the session to be resumed.
+        if (!writing && m_handshaken && !m_adopting && IsConnected()) {
+            WriteMessages();
+        }
+    }
+
+    /**
+     * Marks the handshake as over, and writes the messages queued during it.
+    */
+    void StartWriting() {
+        m_handshaken = true;
+
+        if (!m_adopting && m_msgsInFlight.empty() && !m_qMessagesOut.empty()) {
+            WriteMessages();
+        }
+    }
+
+    /**
+     * Takes every message waiting to be written, with its priority class, in order.
+    */
+    std::vector<std::pair<frame, priority>> TakeQueued() {
+        std::vector<std::pair<frame, priority>> queued;
+
+        for (size_t lane = 0; lane < NUM_PRIORITIES; ++lane) {
+            auto& queue = m_qMessagesOut.lane(static_cast<priority>(lane));
+
+            while (!queue.empty()) {
+                frame msg = queue.pop_front();
+                if (m_backpressure) m_queueUsage.remove(msg.get().size(), *m_backpressure);
+
+                queued.emplace_back(std::move(msg), static_cast<priority>(lane));
+            }
+        }
+
+        return queued;
+    }
+
+    /**
+     * Queues the messages taken from the previous connection of a resumed session ahead of
+     * those queued to this one meanwhile, and starts writing them all.
+    */
+    void Adopt(std::vector<std::pair<frame, priority>>&& adopted) {
+        std::vector<std::pair<frame, priority>> queued = TakeQueued();
+
+        for (auto* batch : { &adopted, &queued }) {
+            for (auto& [msg, p] : *batch) {
+                size_t size = msg.get().size();
+
+                if (!m_qMessagesOut.try_push_back(std::move(msg), p)) {
+                    CountDropped();
+                    continue;
+                }
+
+                if (m_backpressure) m_queueUsage.m_bytes += size;
+            }
+        }
+
+        m_adopting = false;
+
+        if (m_handshaken) {
+            StartWriting();
+        }
+    }
+
+    /**
+     * Applies the backpressure policy to a message that would take the queue over the
+     * high-water mark. Must be called on the asio context of the connection.
+     * 
+     * @returns Whether the message should still be queued. If not, it replaced a queued
+     * message, or the connection was closed.
+    */
+    bool RelieveBackpressure(frame& msg, size_t size) {
+        if (!IsConnected()) return false;
+
+        if (!m_queueUsage.m_overHighWater) {
+            m_queueUsage.m_overHighWater = true;
+            if (m_server) m_server->OnBackpressure(m_id, m_queueUsage.m_bytes + size);
+        }
+
+        switch (m_backpressure->m_policy) {
+        case backpressure_policy::disconnect: {
+            FLASH_LOG(warning, m_id, "Too Slow, Disconnecting.");
+
+            Close();
+            CountDropped();
+            return false;
+        }
+
+        case backpressure_policy::latest_wins:
+            if (ReplaceQueued(msg, size)) {
+                CountDropped();
+                return false;
+            }
+            break;
+
+        case backpressure_policy::drop_oldest:
+            break;
+        }
+
+        DropOldest(size);
+        return true;
+    }
+
+    /**
+     * Replaces the oldest queued message of the same type as the given one with it.
+     * 
+     * @returns Whether there was such a message.
+    */
+    bool ReplaceQueued(frame& msg, size_t size) {
+        T type = msg.get().get_header().m_type;
+
+        for (size_t lane = 0; lane < NUM_PRIORITIES; ++lane) {
+            bool replaced = m_qMessagesOut.lane(static_cast<priority>(lane)).visit([&](frame& queued) {
+                if (queued.get().get_header().m_type != type) return false;
+
+                m_queueUsage.m_bytes = m_queueUsage.m_bytes - queued.get().size() + size;
+                queued = std::move(msg);
+                return true;
+            });
+
+            if (replaced) return true;
+        }
+
+        return false;
+    }
+
+    /**
+     * Drops queued messages, the oldest of the least urgent ones first,
+     * until a message of the given size fits under the high-water mark.
+    */
+    void DropOldest(size_t size) {
+        for (size_t lane = NUM_PRIORITIES; lane-- > 0 && m_queueUsage.exceeds(size, *m_backpressure);) {
+            auto& queue = m_qMessagesOut.lane(static_cast<priority>(lane));
+
+            while (!queue.empty() && m_queueUsage.exceeds(size, *m_backpressure)) {
+                m_queueUsage.remove(queue.pop_front().get().size(), *m_backpressure);
+                CountDropped();
+            }
+        }
+    }
+
+    /**
+     * Counts a message received, of the given size on the wire, header included.
+    */
+    void CountIn(T type, size_t bytes) {
+        m_traffic.count_in(bytes);
+        if (m_counters) m_counters->count_in(type, bytes);
+    }
+
+    /**
+     * Counts a message dropped before being written.
+    */
+    void CountDropped() {
+        if (m_counters) m_counters->m_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
     /**
      * Asynchronous task for the asio context.
      * 
@@ -212,38 +685,198 @@ private:
     void ReadValidation(iserverext<T>* server = nullptr) {
         boost::asio::async_read(
             m_socket, boost::asio::buffer(&m_handshakeIn, sizeof(uint64_t)),
-            [this, server](std::error_code ec, std::size_t length) {
+            [this, self = this->shared_from_this(), server](std::error_code ec, std::size_t length) {
                 if (!ec) {
-                    m_handshakeIn = boost::endian::big_to_native(m_handshakeIn);
-
-                    if (m_ownerType == owner::server) {
-                        // Server has received the validation data.
-                        // Check it against the expected value.
-                        if (m_handshakeIn == m_handshakeCheck) {
-                            std::stringstream ss;
-                            ss << "[" << m_id << "] Client Validated.\n";
-                            std::cout << ss.str();
+                    if (!CheckValidation()) return;
 
-                            if (server) server->OnClientValidate(m_id);
-
-                            ReadHeader();
-                            
-                        } else {
-                            std::stringstream ss;
-                            ss << "[" << m_id << "] Client Failed Validation.\n";
-                            std::cout << ss.str();
+                    if (m_ownerType == owner::client) {
+                        WriteValidation();
 
-                            m_socket.close();
-                        }
+                    } else if (m_sessionAgreed) {
+                        ReadSessionRequest(server);
 
                     } else {
-                        // Client has received the validation data, send response.
-                        m_handshakeOut = Scramble(m_handshakeIn);
-                        WriteValidation();
+                        Validated(server);
+                        StartWriting();
+                        ReadMessages();
                     }
 
                 } else {
-                    m_socket.close();
+                    Close();
+                }
+            }
+        );
+    }
+
+    /**
+     * Handles the validation data that was read: the server checks the response
+     * against the expected value, the client prepares its response to the challenge.
+     * Either way, this settles whether both sides use sessions.
+     * 
+     * @returns Whether the handshake may go on. If not, the connection was closed.
+    */
+    bool CheckValidation() {
+        m_handshakeIn = boost::endian::big_to_native(m_handshakeIn);
+
+        if (m_ownerType == owner::client) {
+            m_handshakeOut = Scramble(m_handshakeIn);
+            m_sessionAgreed = m_sessions && (m_handshakeIn & SESSION_OFFER_BIT);
+
+            if (m_sessionAgreed) {
+                m_handshakeOut ^= SESSION_RESPONSE_MASK;
+
+                session_token presented = GetSession();
+                session_request_schema::encode_into(m_sessionWire.data(), presented.m_id, presented.m_secret);
+
+            } else if (m_sessions) {
+                // The server doesn't offer sessions, so there is none to keep.
+                m_sessionId.store(INVALID_USER_ID, std::memory_order_relaxed);
+                m_sessionSecret.store(0, std::memory_order_relaxed);
+            }
+
+            return true;
+        }
+
+        m_sessionAgreed = m_sessions && m_handshakeIn == (m_handshakeCheck ^ SESSION_RESPONSE_MASK);
+
+        if (m_handshakeIn != m_handshakeCheck && !m_sessionAgreed) {
+            FLASH_LOG(warning, m_id, "Client Failed Validation.");
+
+            if (m_counters) m_counters->m_validationFailures.fetch_add(1, std::memory_order_relaxed);
+
+            Close();
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Finishes the validation of a client on the server, once its session request, if any,
+     * was read: resumes or grants its session, and tells the server of a new client.
+    */
+    void Validated(iserverext<T>* server) {
+        bool resumed = m_sessionAgreed && GrantSession();
+
+        FLASH_LOG(info, m_id, (resumed ? "Client Resumed." : "Client Validated."));
+
+        // A resumed client was validated already, under the ID it got back.
+        if (server && !resumed) server->OnClientValidate(m_id);
+    }
+
+    /**
+     * Resumes the session presented by a validated client, if the server still holds it,
+     * or grants it a new one, and prepares the grant to be written.
+     * 
+     * @returns Whether the session was resumed.
+    */
+    bool GrantSession() {
+        session_token presented;
+        session_request_schema::decode_from(m_sessionWire.data(), presented.m_id, presented.m_secret);
+
+        bool resumed = presented.valid() && m_resume && (*m_resume)(this->shared_from_this(), presented);
+
+        if (!resumed) {
+            m_sessionId.store(m_id, std::memory_order_relaxed);
+            m_sessionSecret.store(make_session_secret(), std::memory_order_relaxed);
+        }
+
+        m_resumed.store(resumed, std::memory_order_relaxed);
+        session_grant_schema::encode_into(m_sessionWire.data(), static_cast<uint8_t>(resumed), m_id, GetSession().m_secret);
+
+        return resumed;
+    }
+
+    /**
+     * Takes the session granted by the server, once read.
+     * 
+     * @returns Whether the grant is well-formed. If not, the connection was closed.
+    */
+    bool TakeGrant() {
+        uint8_t resumed;
+        session_token granted;
+        session_grant_schema::decode_from(m_sessionWire.data(), resumed, granted.m_id, granted.m_secret);
+
+        if (!granted.valid()) {
+            Close();
+            return false;
+        }
+
+        m_sessionId.store(granted.m_id, std::memory_order_relaxed);
+        m_sessionSecret.store(granted.m_secret, std::memory_order_relaxed);
+        m_resumed.store(resumed != 0, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    /**
+     * @returns The buffers the validation data is written from: the challenge or response,
+     * followed by the session request when the client takes up the offer of sessions.
+    */
+    std::array<boost::asio::const_buffer, 2> ValidationOut() {
+        size_t sessionBytes = m_sessionAgreed && m_ownerType == owner::client ? session_request_schema::SIZE : 0;
+
+        return { boost::asio::buffer(&m_handshakeWire, sizeof(uint64_t)),
+                 boost::asio::buffer(m_sessionWire.data(), sessionBytes) };
+    }
+
+    /**
+     * Asynchronous task for the asio context.
+     * 
+     * Reads the session request that follows the response of a client taking up the
+     * offer of sessions, then finishes its validation and grants it its session.
+    */
+    void ReadSessionRequest(iserverext<T>* server) {
+        boost::asio::async_read(
+            m_socket, boost::asio::buffer(m_sessionWire.data(), session_request_schema::SIZE),
+            [this, self = this->shared_from_this(), server](std::error_code ec, std::size_t length) {
+                if (!ec) {
+                    Validated(server);
+                    WriteGrant();
+                    ReadMessages();
+
+                } else {
+                    Close();
+                }
+            }
+        );
+    }
+
+    /**
+     * Asynchronous task for the asio context.
+     * 
+     * Writes the session granted to the client, then the messages queued meanwhile.
+    */
+    void WriteGrant() {
+        boost::asio::async_write(
+            m_socket, boost::asio::buffer(m_sessionWire),
+            [this, self = this->shared_from_this()](std::error_code ec, std::size_t length) {
+                if (!ec) {
+                    StartWriting();
+                } else {
+                    Close();
+                }
+            }
+        );
+    }
+
+    /**
+     * Asynchronous task for the asio context.
+     * 
+     * Reads the session granted by the server, then messages.
+    */
+    void ReadGrant() {
+        boost::asio::async_read(
+            m_socket, boost::asio::buffer(m_sessionWire),
+            [this, self = this->shared_from_this()](std::error_code ec, std::size_t length) {
+                if (!ec) {
+                    if (!TakeGrant()) return;
+
+                    StartWriting();
+                    ReadMessages();
+
+                } else {
+                    Close();
                 }
             }
         );
@@ -255,19 +888,25 @@ private:
      * Writes a validation challenge or response.
     */
     void WriteValidation() {
-        uint64_t handshakeOut = boost::endian::native_to_big(m_handshakeOut);
+        // Must outlive the write, so it can't live on the stack.
+        m_handshakeWire = boost::endian::native_to_big(m_handshakeOut);
 
         boost::asio::async_write(
-            m_socket, boost::asio::buffer(&handshakeOut, sizeof(uint64_t)),
-            [this](std::error_code ec, std::size_t length) {
+            m_socket, ValidationOut(),
+            [this, self = this->shared_from_this()](std::error_code ec, std::size_t length) {
                 if (!ec) {
-                    if (m_ownerType == owner::client) {
+                    if (m_ownerType == owner::client && m_sessionAgreed) {
+                        // Sent the validation data, wait for the session granted in return.
+                        ReadGrant();
+
+                    } else if (m_ownerType == owner::client) {
                         // Sent the validation data, just wait for messages (or closure)
-                        ReadHeader();
+                        StartWriting();
+                        ReadMessages();
                     }
 
                 } else {
-                    m_socket.close();
+                    Close();
                 }
             }
         );
@@ -276,60 +915,168 @@ private:
     /**
      * Asynchronous task for the asio context.
      * 
-     * Reads a message header of appropriate size.
+     * Reads whatever is available on the socket into the receive buffer,
+     * and then parses every complete message in it before reading again.
+     * Many small messages thus cost a single read and a single handler.
     */
-    void ReadHeader() {
-        // Tell asio to wait for the header to fill the buffer and then run a callback.
-        boost::asio::async_read(
-            m_socket, boost::asio::buffer(&m_msgTemporaryIn.get_header(), sizeof(header<T>)),
-            [this](std::error_code ec, std::size_t length) {
+    void ReadMessages() {
+        CompactBufferIn();
+
+        // Tell asio to read as much as fits and then run a callback.
+        m_socket.async_read_some(
+            boost::asio::buffer(m_bufferIn.data() + m_bufferInEnd, m_bufferIn.size() - m_bufferInEnd),
+            [this, self = this->shared_from_this()](std::error_code ec, std::size_t length) {
                 if (!ec) {
-                    m_msgTemporaryIn.get_header().m_size = boost::endian::big_to_native(m_msgTemporaryIn.get_header().m_size);
+                    m_bufferInEnd += length;
+                    MarkReceived();
 
-                    // Resize the temporary body to the right size. Crucial if the
-                    // body is empty now and you need to clear the old temporary!
-                    m_msgTemporaryIn.get_body().resize(m_msgTemporaryIn.get_header().m_size);
+                    switch (ParseMessages()) {
+                    case parse_result::read_more:
+                        ReadMessages();
+                        break;
 
-                    if (m_msgTemporaryIn.get_header().m_size > 0) {
-                        // If the message has a body, wait for it.
+                    case parse_result::read_body:
                         ReadBody();
+                        break;
 
-                    } else {
-                        // If the message has no body, add it to the incoming message queue.
-                        AddToIncomingMessageQueue();
+                    case parse_result::failed:
+                        break;
                     }
 
                 } else {
-                    std::stringstream ss;
-                    ss << "[" << m_id << "] Read Header Fail: " << ec.message() << '\n';
-                    std::cout << ss.str();
-                    
-                    m_socket.close();
+                    FLASH_LOG(warning, m_id, "Read Fail: " << ec.message());
+
+                    Close();
                 }
             }
         );
     }
 
+    /**
+     * Moves the leftover partial message to the front of the receive buffer to make room behind it.
+    */
+    void CompactBufferIn() {
+        if (m_bufferInStart > 0) {
+            std::memmove(m_bufferIn.data(), m_bufferIn.data() + m_bufferInStart, m_bufferInEnd - m_bufferInStart);
+            m_bufferInEnd -= m_bufferInStart;
+            m_bufferInStart = 0;
+        }
+    }
+
+    /**
+     * Records that data was just received, for idle timeouts.
+    */
+    void MarkReceived() {
+        m_lastReceive.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    }
+
+    /**
+     * Adds every complete message in the receive buffer to the incoming message queue.
+     * 
+     * If the next message is too large to ever fit in the buffer, the part of its body
+     * that has arrived is moved into a message and the rest is read directly into it.
+     * 
+     * @returns What to read next, if anything.
+    */
+    parse_result ParseMessages() {
+        while (m_bufferInEnd - m_bufferInStart >= sizeof(header<T>)) {
+            const uint8_t* frame = m_bufferIn.data() + m_bufferInStart;
+            size_t available = m_bufferInEnd - m_bufferInStart - sizeof(header<T>);
+
+            header<T> hdr;
+            std::memcpy(&hdr, frame, sizeof(header<T>));
+
+            uint32_t wireSize = boost::endian::big_to_native(hdr.m_size);
+            hdr.m_size = wireSize & WIRE_SIZE_MASK;
+            bool compressed = wireSize & WIRE_FLAG_COMPRESSED;
+
+            if (available < hdr.m_size) {
+                if (sizeof(header<T>) + hdr.m_size <= m_bufferIn.size()) {
+                    // The rest of the message will fit once it arrives.
+                    return parse_result::read_more;
+                }
+
+                m_msgTemporaryIn = message<T> { hdr.m_type };
+                m_msgTemporaryIn.get_header().m_size = hdr.m_size;
+                m_msgTemporaryInCompressed = compressed;
+                acquire_body(m_bodyPool, m_msgTemporaryIn.get_body(), hdr.m_size);
+                std::memcpy(m_msgTemporaryIn.get_body().data(), frame + sizeof(header<T>), available);
+
+                m_msgTemporaryInReceived = available;
+                m_bufferInStart = m_bufferInEnd = 0;
+
+                return parse_result::read_body;
+            }
+
+            message<T> msg { hdr.m_type };
+            CountIn(hdr.m_type, sizeof(header<T>) + hdr.m_size);
+
+            if (compressed) {
+                // Decompressed straight out of the receive buffer.
+                if (!Decompress(frame + sizeof(header<T>), hdr.m_size, msg)) {
+                    FLASH_LOG(warning, m_id, "Decompression Fail.");
+
+                    if (m_counters) m_counters->m_malformed.fetch_add(1, std::memory_order_relaxed);
+
+                    Close();
+                    return parse_result::failed;
+                }
+
+            } else {
+                msg.get_header().m_size = hdr.m_size;
+                acquire_body(m_bodyPool, msg.get_body(), hdr.m_size);
+                std::memcpy(msg.get_body().data(), frame + sizeof(header<T>), hdr.m_size);
+            }
+
+            Deliver(std::move(msg));
+
+            m_bufferInStart += sizeof(header<T>) + hdr.m_size;
+        }
+
+        return parse_result::read_more;
+    }
+
+    /**
+     * Decompresses a compressed body into the body of a message, and sets its size.
+     * 
+     * @returns Whether the body was decompressed. Fails if it is malformed,
+     * or if this side of the connection has no compressor.
+    */
+    bool Decompress(const uint8_t* data, size_t size, message<T>& msg) {
+        if (!m_compression || !m_compression->m_compressor) return false;
+
+        size_t originalSize;
+        if (!decompressed_size(data, size, originalSize)) return false;
+
+        acquire_body(m_bodyPool, msg.get_body(), originalSize);
+        msg.get_header().m_size = static_cast<uint32_t>(originalSize);
+
+        return decompress_body(*m_compression->m_compressor, data, size, msg.get_body().data(), originalSize);
+    }
+
     /**
      * Asynchronous task for the asio context.
      * 
-     * Reads a message body.
+     * Reads the remainder of a large message body, bypassing the receive buffer.
     */
     void ReadBody() {
         // Tell asio to wait for the body to fill the buffer and then run a callback.
         boost::asio::async_read(
-            m_socket, boost::asio::buffer(m_msgTemporaryIn.get_body().data(), m_msgTemporaryIn.get_body().size()),
-            [this](std::error_code ec, std::size_t length) {
+            m_socket, RemainingBody(),
+            [this, self = this->shared_from_this()](std::error_code ec, std::size_t length) {
                 if (!ec) {
+                    MarkReceived();
+
                     // Header and body have both been read, so add the message to incoming queue.
-                    AddToIncomingMessageQueue();
+                    if (AddToIncomingMessageQueue()) {
+                        // Need to keep the asio context busy.
+                        ReadMessages();
+                    }
 
                 } else {
-                    std::stringstream ss;
-                    ss << "[" << m_id << "] Read Body Fail: " << ec.message() << '\n';
-                    std::cout << ss.str();
+                    FLASH_LOG(warning, m_id, "Read Body Fail: " << ec.message());
                     
-                    m_socket.close();
+                    Close();
                 }
             }
         );
@@ -338,82 +1085,309 @@ private:
     /**
      * Asynchronous task for the asio context.
      * 
-     * Writes a message header.
+     * Writes every queued message with a single gathered write, where the headers
+     * and bodies are passed to the socket as one buffer sequence (i.e. `writev`).
+     * Messages queued while the write is in flight go out together in the next one,
+     * the most urgent first.
     */
-    void WriteHeader() {
-        // Tell asio to wait for the header to be written and then run a callback.
+    void WriteMessages() {
+        GatherMessages();
+
+#ifdef FLASH_WITH_COROUTINES
+        // Writes until the queue runs dry, `m_msgsInFlight` staying non-empty meanwhile.
+        boost::asio::co_spawn(m_asioContext, WriteLoop(this->shared_from_this()), boost::asio::detached);
+#else
+        // Tell asio to wait for all the buffers to be written and then run a callback.
         boost::asio::async_write(
-            m_socket, boost::asio::buffer(&m_qMessagesOut.front().get_header(), sizeof(header<T>)),
-            [this](std::error_code ec, std::size_t length) {
+            m_socket, m_buffersOut,
+            [this, self = this->shared_from_this()](std::error_code ec, std::size_t length) {
                 if (!ec) {
-                    if (m_qMessagesOut.front().get_body().size() > 0) {
-                        // If the message has a body, write it as well.
-                        WriteBody();
-
-                    } else {
-                        // If the message has no body, remove it from the queue.
-                        m_qMessagesOut.pop_front();
+                    // Everything in flight has been written, so drop it.
+                    m_msgsInFlight.clear();
 
-                        // Keep writing if there are more messages to send.
-                        if (!m_qMessagesOut.empty()) {
-                            WriteHeader();
-                        }
+                    // Keep writing if more messages were queued in the meantime.
+                    if (!m_qMessagesOut.empty()) {
+                        WriteMessages();
                     }
 
                 } else {
-                    std::stringstream ss;
-                    ss << "[" << m_id << "] Write Header Fail: " << ec.message() << '\n';
-                    std::cout << ss.str();
+                    FLASH_LOG(warning, m_id, "Write Fail: " << ec.message());
 
-                    m_socket.close();
+                    Close();
                 }
             }
         );
+#endif
     }
 
     /**
-     * Asynchronous task for the asio context.
+     * Takes queued messages for the next write, the most urgent first, and lays out
+     * their headers and bodies in `m_buffersOut`.
+    */
+    void GatherMessages() {
+        size_t count = m_qMessagesOut.lane(priority::realtime).drain_into(m_msgsInFlight, MAX_MESSAGES_PER_WRITE);
+        count += m_qMessagesOut.lane(priority::normal).drain_into(m_msgsInFlight, MAX_MESSAGES_PER_WRITE - count);
+
+        // Bulk messages one at a time, up to a budget, since a large write can't be interrupted.
+        auto& bulk = m_qMessagesOut.lane(priority::bulk);
+        size_t bulkBytes = 0;
+
+        for (; count < MAX_MESSAGES_PER_WRITE && bulkBytes < MAX_BULK_BYTES_PER_WRITE && !bulk.empty(); ++count) {
+            m_msgsInFlight.push_back(bulk.pop_front());
+            bulkBytes += m_msgsInFlight.back().get().size();
+        }
+
+        std::chrono::steady_clock::time_point now;
+        std::chrono::steady_clock::duration totalLag {}, longestLag {};
+        if (m_counters) now = std::chrono::steady_clock::now();
+
+        m_buffersOut.clear();
+        for (const frame& pending : m_msgsInFlight) {
+            const message<T>& msg = pending.get();
+            m_buffersOut.emplace_back(&msg.get_header(), sizeof(header<T>));
+
+            if (m_backpressure) m_queueUsage.remove(msg.size(), *m_backpressure);
+
+            m_traffic.count_out(msg.size());
+
+            if (m_counters) {
+                totalLag += now - pending.m_queued;
+                longestLag = std::max(longestLag, now - pending.m_queued);
+            }
+
+            if (msg.get_body().size() > 0) {
+                m_buffersOut.emplace_back(msg.get_body().data(), msg.get_body().size());
+            }
+        }
+
+        if (m_counters) m_counters->count_sent(m_msgsInFlight.size(), totalLag, longestLag);
+    }
+
+    /**
+     * Adds the large message that was read to the incoming message queue.
      * 
-     * Writes a message body.
+     * @returns Whether reading may go on. If not, the connection was closed.
     */
-    void WriteBody() {
-        // Tell asio to wait for the body to be written and then run a callback.
-        boost::asio::async_write(
-            m_socket, boost::asio::buffer(m_qMessagesOut.front().get_body().data(),
-                                          m_qMessagesOut.front().get_body().size()),
+    bool AddToIncomingMessageQueue() {
+        CountIn(m_msgTemporaryIn.get_header().m_type, m_msgTemporaryIn.size());
 
-            [this](std::error_code ec, std::size_t length) {
-                if (!ec) {
-                    // The header and body have both be written, so remove from the queue.
-                    m_qMessagesOut.pop_front();
+        if (m_msgTemporaryInCompressed) {
+            message<T> msg { m_msgTemporaryIn.get_header().m_type };
 
-                    // Keep writing if there are more messages to send.
-                    if (!m_qMessagesOut.empty()) {
-                        WriteHeader();
-                    }
+            if (!Decompress(m_msgTemporaryIn.get_body().data(), m_msgTemporaryIn.get_body().size(), msg)) {
+                FLASH_LOG(warning, m_id, "Decompression Fail.");
 
-                } else {
-                    std::stringstream ss;
-                    ss << "[" << m_id << "] Write Body Fail: " << ec.message() << '\n';
-                    std::cout << ss.str();
-                    
-                    m_socket.close();
-                }
+                if (m_counters) m_counters->m_malformed.fetch_add(1, std::memory_order_relaxed);
+
+                Close();
+                return false;
             }
-        );
+
+            // The compressed body is no longer needed, so recycle it.
+            if (m_bodyPool) m_bodyPool->release(m_msgTemporaryIn.get_body().release());
+            m_msgTemporaryIn = std::move(msg);
+        }
+
+        Deliver(std::move(m_msgTemporaryIn));
+        return true;
     }
 
     /**
-     * Asynchronous task for the asio context.
+     * Hands an incoming message to the server right away if its type is dispatched
+     * immediately, or adds it to the incoming message queue.
+    */
+    void Deliver(message<T>&& msg) {
+        if (m_server && m_dispatch && m_dispatch->get(msg.get_header().m_type) == dispatch_mode::immediate) {
+            dispatch_immediately(*m_server, m_id, std::move(msg), m_bodyPool, m_counters);
+            return;
+        }
+
+        m_qMessagesIn.push_back(tagged_message<T>{ GetId(), std::move(msg) });
+    }
+
+    /**
+     * @returns The part of the large message body that is still to be read.
+    */
+    boost::asio::mutable_buffer RemainingBody() {
+        return boost::asio::buffer(m_msgTemporaryIn.get_body().data() + m_msgTemporaryInReceived,
+                                   m_msgTemporaryIn.get_body().size() - m_msgTemporaryInReceived);
+    }
+
+#ifdef FLASH_WITH_COROUTINES
+    /**
+     * Coroutine of a server connection: sends the validation challenge, checks the
+     * response, then reads messages until the connection closes.
+     * 
+     * @param self keeps the connection alive for as long as the coroutine runs.
+    */
+    boost::asio::awaitable<void> Serve([[maybe_unused]] std::shared_ptr<connection> self, iserverext<T>* server) {
+        boost::system::error_code ec;
+
+        m_handshakeWire = boost::endian::native_to_big(m_handshakeOut);
+        co_await boost::asio::async_write(m_socket, boost::asio::buffer(&m_handshakeWire, sizeof(uint64_t)),
+                                          boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+
+        if (!ec) {
+            co_await boost::asio::async_read(m_socket, boost::asio::buffer(&m_handshakeIn, sizeof(uint64_t)),
+                                             boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        }
+
+        if (ec) {
+            Close();
+            co_return;
+        }
+
+        if (!CheckValidation()) co_return;
+
+        // A client taking up the offer of sessions sends its session request after its response.
+        if (m_sessionAgreed) {
+            co_await boost::asio::async_read(m_socket, boost::asio::buffer(m_sessionWire.data(), session_request_schema::SIZE),
+                                             boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+
+            if (ec) {
+                Close();
+                co_return;
+            }
+        }
+
+        Validated(server);
+
+        if (m_sessionAgreed) {
+            co_await boost::asio::async_write(m_socket, boost::asio::buffer(m_sessionWire),
+                                              boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+
+            if (ec) {
+                Close();
+                co_return;
+            }
+        }
+
+        StartWriting();
+        co_await ReadLoop();
+    }
+
+    /**
+     * Coroutine of a client connection: connects, answers the validation challenge,
+     * then reads messages until the connection closes.
+     * 
+     * @param self keeps the connection alive for as long as the coroutine runs.
+    */
+    boost::asio::awaitable<void> Connect([[maybe_unused]] std::shared_ptr<connection> self,
+                                         boost::asio::ip::tcp::resolver::results_type endpoints,
+                                         socket_options options) {
+        boost::system::error_code ec;
+
+        co_await boost::asio::async_connect(m_socket, endpoints, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+
+        if (ec) {
+            FLASH_LOG(error, INVALID_USER_ID, "Connect to server failed: " << ec.message());
+
+            Close();
+            co_return;
+        }
+
+        m_id = SERVER_USER_ID;
+        apply_socket_options(m_socket, options);
+
+        // Wait for the validation challenge from the server, and answer it.
+        co_await boost::asio::async_read(m_socket, boost::asio::buffer(&m_handshakeIn, sizeof(uint64_t)),
+                                         boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+
+        if (!ec && CheckValidation()) {
+            m_handshakeWire = boost::endian::native_to_big(m_handshakeOut);
+            co_await boost::asio::async_write(m_socket, ValidationOut(),
+                                              boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        }
+
+        // Then the session granted in return, if the offer was taken up.
+        if (!ec && m_sessionAgreed) {
+            co_await boost::asio::async_read(m_socket, boost::asio::buffer(m_sessionWire),
+                                             boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+
+            if (!ec && !TakeGrant()) co_return;
+        }
+
+        if (ec) {
+            Close();
+            co_return;
+        }
+
+        StartWriting();
+        co_await ReadLoop();
+    }
+
+    /**
+     * Reads whatever is available on the socket into the receive buffer, and parses every
+     * complete message in it, until the connection closes. Large bodies are read directly.
+    */
+    boost::asio::awaitable<void> ReadLoop() {
+        boost::system::error_code ec;
+
+        while (true) {
+            CompactBufferIn();
+
+            size_t length = co_await m_socket.async_read_some(
+                boost::asio::buffer(m_bufferIn.data() + m_bufferInEnd, m_bufferIn.size() - m_bufferInEnd),
+                boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+
+            if (ec) {
+                FLASH_LOG(warning, m_id, "Read Fail: " << ec.message());
+
+                Close();
+                co_return;
+            }
+
+            m_bufferInEnd += length;
+            MarkReceived();
+
+            parse_result result = ParseMessages();
+            if (m_waiter) m_waiter->notify();
+
+            if (result == parse_result::failed) co_return;
+            if (result == parse_result::read_more) continue;
+
+            co_await boost::asio::async_read(m_socket, RemainingBody(), boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+
+            if (ec) {
+                FLASH_LOG(warning, m_id, "Read Body Fail: " << ec.message());
+
+                Close();
+                co_return;
+            }
+
+            MarkReceived();
+
+            if (!AddToIncomingMessageQueue()) co_return;
+            if (m_waiter) m_waiter->notify();
+        }
+    }
+
+    /**
+     * Writes the messages in flight, and the ones queued meanwhile, until the queue runs dry.
      * 
-     * Adds a message to the incoming message queue.
+     * @param self keeps the connection alive for as long as the coroutine runs.
     */
-    void AddToIncomingMessageQueue() {
-        m_qMessagesIn.push_back(tagged_message<T>{ GetId(), std::move(m_msgTemporaryIn) });
+    boost::asio::awaitable<void> WriteLoop([[maybe_unused]] std::shared_ptr<connection> self) {
+        boost::system::error_code ec;
 
-        // Need to keep the asio context busy.
-        ReadHeader();
+        while (true) {
+            co_await boost::asio::async_write(m_socket, m_buffersOut, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+
+            if (ec) {
+                FLASH_LOG(warning, m_id, "Write Fail: " << ec.message());
+
+                Close();
+                co_return;
+            }
+
+            // Everything in flight has been written, so drop it.
+            m_msgsInFlight.clear();
+
+            if (m_qMessagesOut.empty()) co_return;
+            GatherMessages();
+        }
     }
+#endif
 };
 
 } // namespace tcp
@@ -7,14 +7,37 @@
  * Server class that wraps asio networking code using TCP.
  */
 
+#include <flash/backpressure.hpp>
+#include <flash/buffer_pool.hpp>
+#include <flash/compression.hpp>
+#include <flash/dispatch.hpp>
+#include <flash/groups.hpp>
+#include <flash/log.hpp>
 #include <flash/message.hpp>
-#include <flash/ts_deque.hpp>
+#include <flash/priority.hpp>
+#include <flash/queues.hpp>
+#include <flash/session.hpp>
+#include <flash/slot_map.hpp>
+#include <flash/socket_options.hpp>
+#include <flash/stats.hpp>
+#include <flash/io_pool.hpp>
+#include <flash/periodic_timer.hpp>
 #include <flash/iserver.hpp>
 #include <flash/iserverext.hpp>
 
 #include <flash/tcp/connection.hpp>
 
-#include <iostream>
+#ifdef FLASH_WITH_COROUTINES
+#include <flash/coroutine.hpp>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 namespace flash {
 
@@ -29,16 +52,50 @@ namespace tcp {
  * 
  * Should be inherited for custom functionality.
  * 
+ * The networking work is spread over a pool of asio contexts, each run by its own thread.
+ * Every accepted connection is assigned to one of the contexts in turn, so each connection
+ * is only ever touched by a single thread. As a consequence, `OnClientConnect` and
+ * `OnClientValidate` may be called from any of these threads, possibly concurrently.
+ * 
+ * Connections whose socket was closed, or that have been idle for too long, are dropped
+ * by a periodic sweep, which calls `OnClientDisconnect` for them. With sessions, they are
+ * held for the grace period first, in case their client resumes its session.
+ * 
  * @tparam T the message type to send and receive.
+ * @tparam Q the queue policy, see `flash/queues.hpp`.
 */
-template <typename T>
+template <typename T, typename Q = locking_queues>
 class server : public iserver<T>, protected iserverext<T> {
 public:
+    /// Interval at which closed and idle connections are looked for.
+    static constexpr std::chrono::milliseconds SWEEP_INTERVAL { 100 };
+
     /**
      * Constructor for the server. Sets up the acceptor to listen for incoming connections.
+     * 
+     * @param port        the port to listen on.
+     * @param numThreads  the number of networking threads, each with its own asio context.
+     * @param idleTimeout the time in ms without receiving anything after which a client is dropped,
+     *                    or 0 to never drop clients for being idle.
+     * @param options     the options of the acceptor and of every accepted socket.
     */
-    server(uint16_t port) 
-        : m_asioAcceptor(m_asioContext, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port)) { }
+    server(uint16_t port, size_t numThreads = 1, uint32_t idleTimeout = 0, const socket_options& options = {})
+        : m_ioPool { numThreads },
+          m_asioAcceptor(m_ioPool.Get(0)),
+          m_sweepTimer { m_ioPool.Get(0) },
+          m_statsTimer { m_ioPool.Get(0) },
+          m_idleTimeout { idleTimeout },
+          m_socketOptions { options } {
+
+        // Some options must be set before binding.
+        boost::asio::ip::tcp::endpoint endpoint { boost::asio::ip::tcp::v4(), port };
+        m_asioAcceptor.open(endpoint.protocol());
+        m_asioAcceptor.set_option(boost::asio::socket_base::reuse_address { true });
+        apply_socket_options(m_asioAcceptor, m_socketOptions);
+
+        m_asioAcceptor.bind(endpoint);
+        m_asioAcceptor.listen();
+    }
 
     virtual ~server() { }
 
@@ -48,8 +105,8 @@ public:
      * @returns Whether the server started successfully.
     */
     bool Start() final {
-        if (m_threadContext.joinable() && !m_asioContext.stopped()) {
-            std::cout << "[SERVER] Already running!\n";
+        if (m_ioPool.IsRunning()) {
+            FLASH_LOG(warning, INVALID_USER_ID, "[SERVER] Already running!");
             return false;
         }
 
@@ -57,40 +114,142 @@ public:
             // Issue a task to the asio context to listen for clients.
             WaitForClientConnection();
 
-            // Start the asio context in its own thread. We issue the work before
-            // to guarantee that the thread doesn't immediately stop.
-            m_threadContext = std::thread([this]() { m_asioContext.run(); });
+            // Look for dead connections periodically.
+            m_sweepTimer.Start(SWEEP_INTERVAL, [this]() { CleanupConnections(); });
+
+            if (m_statsCallback) {
+                m_statsTimer.Start(m_statsInterval, [this]() { m_statsCallback(GetStats()); });
+            }
+
+            // Start the asio contexts in their own threads.
+            m_ioPool.Run();
 
         } catch (std::exception& e) {
             // Something prohibited the server from starting, print the error.
-            std::cerr << "[SERVER] Start Exception: " << e.what() << "\n";
+            FLASH_LOG(error, INVALID_USER_ID, "[SERVER] Start Exception: " << e.what());
             return false;
         }
 
-        std::cout << "[SERVER] Started on port " << m_asioAcceptor.local_endpoint().port() << "\n";
+        FLASH_LOG(info, INVALID_USER_ID, "[SERVER] Started on port " << m_asioAcceptor.local_endpoint().port());
         return true;
     }
 
     /**
-     * Stop the server. Request the context to close, and then wait on the thread to join it.
+     * Stop the server. Close all the sockets, request the contexts to stop,
+     * and then wait on the threads to join them.
     */
     void Stop() final {
-        // Request the context to close.
-        boost::asio::post(m_asioContext, [this]() { m_asioContext.stop(); });
+        {
+            std::scoped_lock lock { m_mutexConnections };
 
-        // Close all the sockets.
-        for (auto& [id, conn] : m_activeConnections) {
-            if (conn && conn->IsConnected()) {
-                conn->Disconnect();
-            }
+            // Close all the sockets. These are posted before the stop requests, so they still run.
+            m_activeConnections.for_each([](UserId /* id */, std::shared_ptr<connection<T, Q>>& conn) {
+                if (conn && conn->IsConnected()) {
+                    conn->Disconnect();
+                }
+            });
         }
 
-        // Wait for the context thread to finish.
-        if (m_threadContext.joinable()) m_threadContext.join();
+        // Request the contexts to stop and wait for the threads to finish.
+        m_ioPool.Stop();
+        m_sweepTimer.Stop();
+        m_statsTimer.Stop();
+
+        FLASH_LOG(info, INVALID_USER_ID, "[SERVER] Stopped!");
+    }
+
+    /**
+     * Grants a session to every client it validates, so that a client that loses its
+     * connection may reconnect under its previous ID, see `flash/session.hpp`.
+     * 
+     * A connection that is lost is held for the grace period, and messages sent to it meanwhile
+     * are queued, except with backpressure, to be written once its client resumes the session.
+     * `OnClientDisconnect` is only called once the grace period is over. A resumed client is not
+     * validated again. Clients must enable sessions as well. Must be called before `Start`.
+     * 
+     * @param grace the time a lost connection is held for.
+    */
+    void EnableSessions(std::chrono::milliseconds grace = DEFAULT_SESSION_GRACE) {
+        m_sessionGrace = grace;
+        m_resumeHandler = [this](const std::shared_ptr<connection<T, Q>>& conn, const session_token& token) {
+            return ResumeSession(conn, token);
+        };
+    }
+
+    /**
+     * Compresses the bodies of outgoing messages from the given size, and decompresses
+     * incoming ones. Clients must use a compressor for the same algorithm.
+     * Must be called before `Start`.
+     * 
+     * @param comp      the compression algorithm, or null to disable compression.
+     * @param threshold the body size from which messages are compressed.
+    */
+    void SetCompression(std::shared_ptr<const compressor> comp, size_t threshold = DEFAULT_COMPRESSION_THRESHOLD) {
+        m_compression = compression_settings { std::move(comp), threshold };
+    }
+
+    /**
+     * Sets the priority class of the messages of the given type, e.g. `priority::realtime`
+     * for position updates, so they are written before messages of less urgent types that
+     * are waiting on the same connection. Must be called before `Start`.
+    */
+    void SetPriority(T type, priority p) {
+        m_priorities.set(type, p);
+    }
+
+    /**
+     * Sets where the messages of the given type are handled. With `dispatch_mode::immediate`,
+     * `OnMessage` is called right away on the networking thread of the client, skipping the
+     * incoming queue, so it must be thread-safe, and may run concurrently for different clients,
+     * and before queued messages that arrived earlier. Must be called before `Start`.
+    */
+    void SetDispatch(T type, dispatch_mode mode) {
+        m_dispatch.set(type, mode);
+    }
+
+    /**
+     * Bounds the bytes queued to each client, so that a client that can't keep up doesn't
+     * make the server queue unbounded memory. Beyond the mark, `OnBackpressure` is called,
+     * from the networking thread of the client, and the policy applies. Must be called before `Start`.
+     * 
+     * @param highWaterBytes the bytes queued to a client from which the policy applies, 0 for no bound.
+     * @param policy         what to do with messages beyond the mark.
+    */
+    void SetBackpressure(size_t highWaterBytes, backpressure_policy policy = backpressure_policy::drop_oldest) {
+        m_backpressure = backpressure_settings { highWaterBytes, policy };
+    }
+
+    /**
+     * Pushes the stats to the given function periodically, from a networking thread,
+     * e.g. to export them. Must be called before `Start`.
+     * 
+     * @param callback the function to call with the stats, or null to not push them.
+     * @param interval the time between calls.
+    */
+    void SetStatsCallback(stats_callback callback, std::chrono::milliseconds interval = DEFAULT_STATS_INTERVAL) {
+        m_statsCallback = std::move(callback);
+        m_statsInterval = interval;
+    }
+
+    /**
+     * @returns A snapshot of the counters of the server and of every connection.
+     * Safe to call from any thread.
+    */
+    server_stats GetStats() final {
+        server_stats stats;
+        m_counters.snapshot(stats);
+        stats.m_incomingDepth = m_qMessagesIn.size();
+
+        std::scoped_lock lock { m_mutexConnections };
+
+        m_activeConnections.for_each([&stats](UserId id, const std::shared_ptr<connection<T, Q>>& conn) {
+            if (!conn) return;
 
-        std::cout << "[SERVER] Stopped!\n";
+            stats.m_byClient[id] = conn->GetTraffic();
+            stats.m_outgoingDepth += conn->GetQueueDepth();
+        });
 
-        m_asioContext.reset();
+        return stats;
     }
 
     /**
@@ -98,57 +257,190 @@ public:
      * 
      * If the client is not connected, remove them from the server's active connections.
      * 
-     * @note that this is the only way we can tell if a client has disconnected,
-     * as we don't receive an explicit notification of such a fact.
+     * @note that this only finds a disconnection sooner: closed and idle connections are
+     * otherwise dropped by the periodic sweep, every `SWEEP_INTERVAL`.
     */
     void MessageClient(UserId clientId, message<T>&& msg) final {
-        // Find the client connection in the active connections.
-        auto conn = m_activeConnections.find(clientId);
-        
-        // If the client is found and connected, send a message
-        if (conn != m_activeConnections.end() && conn->second && conn->second->IsConnected()) {
-            conn->second->Send(std::move(msg));
-
-        } else {
-            // If the client socket is no longer valid, assume that the client has disconnected.
-            m_activeConnections.erase(conn);
-            OnClientDisconnect(clientId);
+        priority p = m_priorities.get(msg.get_header().m_type);
+        MessageClient(clientId, std::move(msg), p);
+    }
+
+    /**
+     * Message a client directly, with the given priority class rather than the one of its type.
+    */
+    void MessageClient(UserId clientId, message<T>&& msg, priority p) {
+        bool disconnected = false;
+
+        {
+            std::scoped_lock lock { m_mutexConnections };
+
+            // Find the client connection in the active connections.
+            std::shared_ptr<connection<T, Q>>* conn = m_activeConnections.find(clientId);
+            if (!conn) return;
+
+            // If the client is connected, or may resume its session, send a message.
+            if (Reachable(*conn)) {
+                (*conn)->Send(std::move(msg), p);
+
+            } else {
+                // If the client socket is no longer valid, assume that the client has disconnected.
+                m_activeConnections.erase(clientId);
+                disconnected = true;
+            }
         }
+
+        // Called without holding the lock, so the handler may message clients itself.
+        if (disconnected) Disconnected(clientId);
     }
 
     /**
      * Message all clients, optionally ignoring a specific client.
      * 
+     * The message is encoded once and shared by all the connections, instead of copied.
      * If any client is not connected, they are removed from the server's active connections.
     */
     void MessageAllClients(message<T>&& msg, UserId ignoreClient = INVALID_USER_ID) final {
+        priority p = m_priorities.get(msg.get_header().m_type);
+
+        // Compressed once here, rather than on every connection.
+        compress_message(m_compression, msg);
+        shared_message<T> sharedMsg = make_shared_message(std::move(msg));
         std::vector<UserId> disconnectedClients;
 
-        for (auto& [id, conn] : m_activeConnections) {
-            if (id == ignoreClient) continue;
+        {
+            std::scoped_lock lock { m_mutexConnections };
 
-            if (conn && conn->IsConnected()) {
-                message<T> msgCopy = msg;
-                conn->Send(std::move(msgCopy));
+            m_activeConnections.for_each([&](UserId id, std::shared_ptr<connection<T, Q>>& conn) {
+                if (id == ignoreClient) return;
 
-            } else {
-                // If the client socket is no longer valid, assume that the client has disconnected.
-                disconnectedClients.push_back(id);
+                if (Reachable(conn)) {
+                    conn->Send(sharedMsg, p);
+
+                } else {
+                    // If the client socket is no longer valid, assume that the client has disconnected.
+                    disconnectedClients.push_back(id);
+                }
+            });
+
+            for (auto id : disconnectedClients) {
+                m_activeConnections.erase(id);
             }
         }
 
         for (auto id : disconnectedClients) {
-            m_activeConnections.erase(id);
+            Disconnected(id);
+        }
+    }
+
+    /**
+     * Message a number of clients at once, e.g. the players near some event.
+     * 
+     * The message is encoded once and shared by all the connections, instead of copied.
+     * Unknown clients are ignored, and clients that are not connected are removed.
+    */
+    void MessageClients(const std::vector<UserId>& clientIds, message<T>&& msg) final {
+        priority p = m_priorities.get(msg.get_header().m_type);
+
+        // Compressed once here, rather than on every connection.
+        compress_message(m_compression, msg);
+        shared_message<T> sharedMsg = make_shared_message(std::move(msg));
+        std::vector<UserId> disconnectedClients;
+
+        {
+            std::scoped_lock lock { m_mutexConnections };
+
+            for (UserId id : clientIds) {
+                std::shared_ptr<connection<T, Q>>* conn = m_activeConnections.find(id);
+                if (!conn) continue;
+
+                if (Reachable(*conn)) {
+                    (*conn)->Send(sharedMsg, p);
+
+                } else {
+                    m_activeConnections.erase(id);
+                    disconnectedClients.push_back(id);
+                }
+            }
         }
 
         for (auto id : disconnectedClients) {
-            OnClientDisconnect(id);
+            Disconnected(id);
+        }
+    }
+
+    /**
+     * Creates an empty group of clients, to be messaged at once with `MessageGroup`.
+     * 
+     * @returns The ID of the group, or `INVALID_GROUP_ID` if there are too many groups.
+    */
+    GroupId CreateGroup() final {
+        std::scoped_lock lock { m_mutexGroups };
+        return m_groups.create();
+    }
+
+    /**
+     * Destroys a group, which its members leave.
+     * 
+     * @returns Whether there was such a group.
+    */
+    bool DestroyGroup(GroupId groupId) final {
+        std::scoped_lock lock { m_mutexGroups };
+        return m_groups.destroy(groupId);
+    }
+
+    /**
+     * Adds a client to a group. Clients leave their groups when they disconnect.
+     * 
+     * @returns Whether the client was added, false if either is unknown, or the client was already in the group.
+    */
+    bool AddToGroup(GroupId groupId, UserId clientId) final {
+        // Both held, so that a client disconnecting meanwhile is not added after leaving its groups.
+        std::scoped_lock lock { m_mutexConnections, m_mutexGroups };
+
+        if (!m_activeConnections.contains(clientId)) return false;
+        return m_groups.add(groupId, clientId);
+    }
+
+    /**
+     * Removes a client from a group.
+     * 
+     * @returns Whether the client was in the group.
+    */
+    bool RemoveFromGroup(GroupId groupId, UserId clientId) final {
+        std::scoped_lock lock { m_mutexGroups };
+        return m_groups.remove(groupId, clientId);
+    }
+
+    /**
+     * Message the members of a group, optionally ignoring a specific client, e.g. the players
+     * in some zone of the world.
+     * 
+     * The message is encoded once and shared by all the connections, as with `MessageClients`.
+    */
+    void MessageGroup(GroupId groupId, message<T>&& msg, UserId ignoreClient = INVALID_USER_ID) final {
+        std::vector<UserId> members;
+
+        {
+            // Copied out, so that the lock is not held while messaging, which may disconnect members.
+            std::scoped_lock lock { m_mutexGroups };
+
+            const std::vector<UserId>* group = m_groups.members(groupId);
+            if (!group) return;
+
+            members.reserve(group->size());
+            std::copy_if(group->begin(), group->end(), std::back_inserter(members),
+                [ignoreClient](UserId id) { return id != ignoreClient; });
         }
+
+        MessageClients(members, std::move(msg));
     }
 
     /**
      * Process messages from the incoming message queue, optionally up to a maximum number.
      * 
+     * The whole backlog (up to the maximum) is taken from the queue at once,
+     * and then processed locally, so the asio thread is only contended with once.
+     * 
      * @note that the default is to process the maximum unsigned integer.
      * 
      * @param maxMessages the maximum number of messages to process.
@@ -158,15 +450,53 @@ public:
         // Wait until something is deposited into the queue.
         if (wait) m_qMessagesIn.wait();
 
-        size_t messageCount = 0;
-        while (messageCount < maxMessages && !m_qMessagesIn.empty()) {
-            // A tagged message has arrived, so we process it.
-            auto taggedMsg = m_qMessagesIn.pop_front();
+        m_qMessagesIn.drain_into(m_batchIn, maxMessages);
+
+        std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point start = batchStart;
+        std::chrono::steady_clock::duration longest {};
+
+        for (auto& taggedMsg : m_batchIn) {
             OnMessage(taggedMsg.m_remote, std::move(taggedMsg.m_msg));
-            ++messageCount;
+
+            // Recycle the body, unless the handler kept it.
+            m_bodyPool.release(taggedMsg.m_msg.get_body().release());
+
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            longest = std::max(longest, end - start);
+            start = end;
+        }
+
+        if (!m_batchIn.empty()) {
+            m_counters.count_handled(m_batchIn.size(), start - batchStart, longest);
         }
+
+        // Keeps the capacity around for the next batch.
+        m_batchIn.clear();
+    }
+
+#ifdef FLASH_WITH_COROUTINES
+    /**
+     * Waits for messages to arrive without blocking a thread, then processes them as `Update` does.
+     * Must be awaited from a coroutine spawned on `GetExecutor()`, e.g.
+     * `while (running) co_await server.NextMessages();`.
+     * 
+     * @param maxMessages the maximum number of messages to process.
+    */
+    boost::asio::awaitable<void> NextMessages(size_t maxMessages = -1) {
+        co_await m_messageWaiter.wait([this]() { return !m_qMessagesIn.empty(); });
+
+        Update(maxMessages, false);
     }
 
+    /**
+     * @returns The executor of the first asio context, which accepts the connections.
+     * With a single networking thread, it also runs them all, so coroutines spawned on it
+     * get their messages without any hop between threads.
+    */
+    boost::asio::any_io_executor GetExecutor() { return m_messageWaiter.get_executor(); }
+#endif
+
 protected:
     /**
      * Called when a client connected, returns whether to accept the connection.
@@ -199,58 +529,210 @@ protected:
     */
     void OnMessage(UserId clientId, message<T>&& msg) override = 0;
 
-    ts_deque<tagged_message<T>> m_qMessagesIn;      // Incoming message queue.
+    typename Q::template incoming<tagged_message<T>> m_qMessagesIn;  // Incoming message queue.
+    std::vector<tagged_message<T>> m_batchIn;                        // Messages being processed by Update.
+    buffer_pool m_bodyPool;                                          // Recycled bodies of incoming messages.
+    compression_settings m_compression;                              // Compression of the messages, if any.
+    backpressure_settings m_backpressure;                            // Bound on the bytes queued to each client.
+    priority_map<T> m_priorities;                                    // Priority class of each message type.
+    dispatch_map<T> m_dispatch;                                      // Dispatch mode of each message type.
+    server_counters m_counters;                                      // Counters of the server, from any thread.
 
-    boost::asio::io_context m_asioContext;          // Shared asio context for the server.
-    std::thread m_threadContext;                    // Thread that runs the asio context.
-    boost::asio::ip::tcp::acceptor m_asioAcceptor;  // Accepts incoming connections.
+    io_context_pool m_ioPool;                       // Asio contexts and their threads, owned.
+    boost::asio::ip::tcp::acceptor m_asioAcceptor;  // Accepts incoming connections, on the first context.
 
-    UserId m_uidCounter = 100000;                   // Used to assign unique 6-digit IDs to clients.
+    periodic_timer m_sweepTimer;                    // Drops closed and idle connections.
+    periodic_timer m_statsTimer;                    // Pushes the stats to the callback, if any.
+#ifdef FLASH_WITH_COROUTINES
+    message_waiter m_messageWaiter { m_ioPool.Get(0).get_executor() };  // Wakes the coroutine awaiting messages.
+#endif
+    uint32_t m_idleTimeout;                         // Idle timeout for clients in ms, 0 if disabled.
+    socket_options m_socketOptions;                 // Options of the acceptor and the accepted sockets.
 
-    /// Container for validated connections.    
-    std::unordered_map<UserId, std::unique_ptr<connection<T>>> m_activeConnections;
+    stats_callback m_statsCallback;                                        // Function the stats are pushed to, or null.
+    std::chrono::milliseconds m_statsInterval { DEFAULT_STATS_INTERVAL };  // Time between pushes.
 
-    friend class connection<T>;
+    /// Container for validated connections, which issues their IDs.
+    slot_map<std::shared_ptr<connection<T, Q>>> m_activeConnections;
+    std::mutex m_mutexConnections;  // Lock around the active connections.
+
+    std::chrono::milliseconds m_sessionGrace { 0 };                                 // Time a lost connection is held, 0 without sessions.
+    typename connection<T, Q>::resume_handler m_resumeHandler;                      // Resumes sessions, given to the connections.
+    std::unordered_map<UserId, std::chrono::steady_clock::time_point> m_lostSince;  // When each held connection was lost.
+
+    client_groups m_groups;    // Groups of clients, by ID.
+    std::mutex m_mutexGroups;  // Lock around the groups, taken after the one around the connections.
+
+    friend class connection<T, Q>;
 
 private:
+    /**
+     * Removes a client that has gone away from its groups, then tells the handler.
+     * Must be called without holding the locks.
+    */
+    void Disconnected(UserId clientId) {
+        {
+            std::scoped_lock lock { m_mutexGroups };
+            m_groups.remove_user(clientId);
+        }
+
+        OnClientDisconnect(clientId);
+    }
+
+    /**
+     * @returns Whether messages may be sent to the connection: it is connected, or it holds
+     * a session that its client may resume. Must be called with the lock held.
+    */
+    bool Reachable(const std::shared_ptr<connection<T, Q>>& conn) const {
+        return conn && (conn->IsConnected() || (m_sessionGrace.count() > 0 && conn->GetSession().valid()));
+    }
+
+    /**
+     * Moves the session of a token to the validated connection presenting it, if the token
+     * matches a session still held. The previous connection of the session is closed, and
+     * hands over what it has queued. Runs on the asio context of the new connection.
+     * 
+     * @returns Whether the session was resumed.
+    */
+    bool ResumeSession(const std::shared_ptr<connection<T, Q>>& conn, const session_token& token) {
+        std::shared_ptr<connection<T, Q>> previous;
+
+        {
+            std::scoped_lock lock { m_mutexConnections };
+
+            std::shared_ptr<connection<T, Q>>* held = m_activeConnections.find(token.m_id);
+            if (!held || !*held || *held == conn || !same_session_secret((*held)->GetSession().m_secret, token.m_secret)) return false;
+
+            previous = std::move(*held);
+            *held = conn;
+
+            // The ID the connection was given when accepted was never announced.
+            m_activeConnections.erase(conn->GetId());
+            m_lostSince.erase(token.m_id);
+        }
+
+        conn->Reattach(token);
+        previous->HandOver(conn);
+
+        m_counters.m_resumed.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * Drops the connections whose socket was closed, e.g. by the client going away,
+     * and those that have been idle for longer than the timeout, once the grace period
+     * of their session is over, if any. Runs on the sweep timer.
+    */
+    void CleanupConnections() {
+        std::chrono::steady_clock::time_point now = m_sweepTimer.Now();
+        std::vector<UserId> disconnectedClients;
+
+        {
+            std::scoped_lock lock { m_mutexConnections };
+
+            m_activeConnections.erase_if([&](UserId id, std::shared_ptr<connection<T, Q>>& conn) {
+                bool idle = m_idleTimeout > 0 && conn && std::chrono::duration_cast<std::chrono::milliseconds>(
+                    now - conn->GetLastReceiveTime()).count() > m_idleTimeout;
+
+                if (conn && conn->IsConnected() && !idle) {
+                    return false;
+                }
+
+                auto lost = m_lostSince.find(id);
+
+                if (idle && lost == m_lostSince.end()) {
+                    FLASH_LOG(info, id, "Client Timed Out.");
+
+                    conn->Disconnect();
+                    m_counters.m_timeouts.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                // Held for the client to resume its session, until the grace period is over.
+                if (m_sessionGrace.count() > 0 && conn && conn->GetSession().valid()) {
+                    if (lost == m_lostSince.end()) {
+                        FLASH_LOG(info, id, "Client Lost, Holding Session.");
+
+                        m_lostSince.emplace(id, now);
+                        return false;
+                    }
+
+                    if (now - lost->second <= m_sessionGrace) return false;
+                }
+
+                if (lost != m_lostSince.end()) m_lostSince.erase(lost);
+
+                disconnectedClients.push_back(id);
+                return true;
+            });
+        }
+
+        for (auto id : disconnectedClients) {
+            Disconnected(id);
+        }
+    }
+
     /**
      * Asynchronous task for the asio context thread, waiting for a client to connect.
      * 
      * This task should be constantly running on the server, even if no clients are around.
     */
     void WaitForClientConnection() {
+        // The socket of the next connection lives on the next context in turn.
+        boost::asio::io_context& connContext = m_ioPool.Next();
+
         m_asioAcceptor.async_accept(
-            [this](std::error_code ec, boost::asio::ip::tcp::socket socket) {
+            connContext,
+            [this, &connContext](std::error_code ec, boost::asio::ip::tcp::socket socket) {
                 if (!ec) {
-                    std::cout << "[SERVER] New Connection from IP: " << socket.remote_endpoint() << "\n";
+                    FLASH_LOG(info, INVALID_USER_ID, "[SERVER] New Connection from IP: " << socket.remote_endpoint());
+
+                    apply_socket_options(socket, m_socketOptions);
 
                     // Make a new connection.
-                    std::unique_ptr<connection<T>> new_connection = std::make_unique<connection<T>>(
-                        connection<T>::owner::server,
-                        m_asioContext,     // Provide the connection with the surrounding asio context.
+                    std::shared_ptr<connection<T, Q>> newConnection = std::make_shared<connection<T, Q>>(
+                        connection<T, Q>::owner::server,
+                        connContext,       // Provide the connection with the asio context of its socket.
                         std::move(socket), // Move the new socket into the connection.
-                        m_qMessagesIn      // Reference to the server's incoming message queue.
+                        m_qMessagesIn,     // Reference to the server's incoming message queue.
+                        &m_bodyPool,       // Pool of bodies for the incoming messages.
+                        &m_compression,    // How the messages are compressed.
+                        &m_backpressure,   // Bound on the bytes queued to the client.
+                        &m_counters,       // Counters of the server.
+                        &m_dispatch        // Which messages are handled on the networking thread.
                     );
 
-                    // Give the custom server a chance to deny connection by overriding OnClientConnect.
-                    if (OnClientConnect(new_connection->GetSocket().remote_endpoint().address())) {
-                        // Assign a unique ID to this connection.
-                        UserId newId = m_uidCounter++;
+#ifdef FLASH_WITH_COROUTINES
+                    newConnection->SetMessageWaiter(&m_messageWaiter);
+#endif
 
-                        // Transfer ownership of the new connection to the server.
-                        m_activeConnections.emplace(newId, std::move(new_connection));
+                    if (m_sessionGrace.count() > 0) {
+                        newConnection->SetResumeHandler(&m_resumeHandler);
+                    }
+
+                    UserId newId = INVALID_USER_ID;
+
+                    // Give the custom server a chance to deny connection by overriding OnClientConnect.
+                    if (OnClientConnect(newConnection->GetSocket().remote_endpoint().address())) {
+                        // Transfer ownership of the new connection to the server, which assigns it a unique ID,
+                        // unless the server is full.
+                        std::scoped_lock lock { m_mutexConnections };
+                        newId = m_activeConnections.insert(std::shared_ptr<connection<T, Q>>(newConnection));
+                    }
 
-                        // Tell the connection to connect to the client.
-                        m_activeConnections.at(newId)->ConnectToClient(newId, this);
+                    if (newId != INVALID_USER_ID) {
+                        // Tell the connection to connect to the client, on its own context.
+                        boost::asio::post(connContext, [this, newConnection, newId]() {
+                            newConnection->ConnectToClient(newId, this);
+                        });
 
-                        std::cout << "[" << newId << "] Connection Approved\n";
+                        FLASH_LOG(info, newId, "Connection Approved");
 
                     } else {
-                        std::cout << "[------] Connection Denied\n";
+                        FLASH_LOG(warning, INVALID_USER_ID, "[------] Connection Denied");
                     }
 
                 } else {
-                    std::cout << "[SERVER] New Connection Error: " << ec.message() << "\n";
+                    FLASH_LOG(error, INVALID_USER_ID, "[SERVER] New Connection Error: " << ec.message());
                 }
 
                 // No matter what happens, make sure the asio context still has more work.
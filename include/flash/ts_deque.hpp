@@ -8,9 +8,12 @@
  * e.g. for storing messages waiting to be processed.
 */
 
+#include <algorithm>
 #include <condition_variable>
 #include <deque>
+#include <iterator>
 #include <mutex>
+#include <vector>
 
 namespace flash {
 
@@ -97,6 +100,17 @@ public:
         m_cvBlocking.notify_one();
     }
 
+    /**
+     * Moves and pushes an element to the back of the deque, extending it.
+     * 
+     * @returns Always true, since the deque is unbounded. Exists so that the deque
+     * can be used interchangeably with the bounded queues in `ring_queue.hpp`.
+    */
+    bool try_push_back(T&& value) {
+        push_back(std::move(value));
+        return true;
+    }
+
     /**
      * Moves and pushes an element to the front of the deque, extending it.
     */
@@ -137,6 +151,47 @@ public:
         return value;
     }
 
+    /**
+     * Moves elements from the front of the deque to the back of `out`,
+     * up to a maximum number, under a single lock.
+     * 
+     * If the whole backlog fits, the deque is emptied in one go, which
+     * is much cheaper than repeated calls to `empty` and `pop_front`.
+     * 
+     * @param out         the vector to append the elements to.
+     * @param maxElements the maximum number of elements to move.
+     * 
+     * @returns The number of elements that were moved.
+    */
+    size_t drain_into(std::vector<T>& out, size_t maxElements = -1) {
+        std::scoped_lock lock { m_mutexDeque };
+
+        size_t count = std::min(maxElements, m_deque.size());
+        auto last = m_deque.begin() + count;
+
+        out.insert(out.end(), std::make_move_iterator(m_deque.begin()), std::make_move_iterator(last));
+        m_deque.erase(m_deque.begin(), last);
+
+        return count;
+    }
+
+    /**
+     * Calls `f` with a reference to every element from the front, until it returns true,
+     * e.g. to find a queued element and replace it in place. `f` must not use the deque.
+     * 
+     * @returns Whether `f` returned true for some element.
+    */
+    template <typename F>
+    bool visit(F&& f) {
+        std::scoped_lock lock { m_mutexDeque };
+
+        for (T& elem : m_deque) {
+            if (f(elem)) return true;
+        }
+
+        return false;
+    }
+
     /**
      * Blocks the current thread until the deque is no longer empty.
     */
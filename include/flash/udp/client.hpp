@@ -7,19 +7,26 @@
  * Client class that wraps asio networking code using UDP.
  */
 
-
+#include <flash/compression.hpp>
+#include <flash/delta.hpp>
+#include <flash/log.hpp>
 #include <flash/message.hpp>
-#include <flash/ts_deque.hpp>
+#include <flash/periodic_timer.hpp>
+#include <flash/priority.hpp>
+#include <flash/queues.hpp>
 #include <flash/scramble.hpp>
+#include <flash/session.hpp>
+#include <flash/socket_options.hpp>
 #include <flash/iclient.hpp>
 
 #include <flash/udp/common.hpp>
+#include <flash/udp/reliable.hpp>
 
 #include <boost/asio.hpp>
 #include <boost/endian/conversion.hpp>
 
-#include <iostream>
-#include <sstream>
+#include <array>
+#include <atomic>
 
 namespace flash {
 
@@ -34,12 +41,17 @@ namespace udp {
  * Should be inherited for custom functionality.
  * 
  * @tparam T the message type to send and receive.
+ * @tparam Q the queue policy, see `flash/queues.hpp`.
 */
-template <typename T>
-class client : public iclient<T> {
+template <typename T, typename Q = locking_queues>
+class client : public iclient<T, Q> {
 public:
-    client(uint32_t clientTimeout = 5000)
-        : m_socket(m_asioContext), m_clientTimeout { clientTimeout } {
+    /**
+     * @param clientTimeout the time in ms without messages after which the server is considered gone.
+     * @param options       the options of the socket.
+    */
+    client(uint32_t clientTimeout = 5000, const socket_options& options = {})
+        : m_socket(m_asioContext), m_clientTimeout { clientTimeout }, m_socketOptions { options } {
 
         m_tempBufferIn.resize(MAX_MESSAGE_SIZE_IN_BYTES);
 
@@ -58,9 +70,7 @@ public:
      * @returns Whether the connection was successful.
     */
     bool Connect(const std::string& host, const uint16_t port) final {
-        std::stringstream ss;
-        ss << "Connecting to " << host << ':' << port << '\n';
-        std::cout << ss.str();
+        FLASH_LOG(info, INVALID_USER_ID, "Connecting to " << host << ':' << port);
 
         try {
             // Resolve the host name and port number into a list of endpoints to try.
@@ -68,18 +78,29 @@ public:
             boost::asio::ip::udp::resolver::results_type endpoints
                 = resolver.resolve(host, std::to_string(port));
 
+            // The context was stopped if the client was connected before.
+            m_asioContext.restart();
+
             m_socket = boost::asio::ip::udp::socket(m_asioContext);
+            m_writing = false;
+            m_lastMessageTime = std::chrono::steady_clock::now();
 
             // Connect to the server.
             ConnectToServer(endpoints);
 
+            if (m_coalescingMtu > 0) {
+                m_flushTimer.Start(m_flushInterval, [this]() { FlushPacket(); });
+            }
+
+            if (m_reliable) {
+                m_reliableTimer.Start(RELIABLE_TICK_INTERVAL, [this]() { PollReliable(); });
+            }
+
             // Start running the context in its own thread.
             m_threadContext = std::thread([this]() { m_asioContext.run(); });
 
         } catch (std::exception& e) {
-            std::stringstream ss;
-            ss << "Client Exception: " << e.what() << '\n';
-            std::cout << ss.str();
+            FLASH_LOG(error, INVALID_USER_ID, "Client Exception: " << e.what());
 
             return false;
         }
@@ -94,17 +115,23 @@ public:
      * also releases the unique pointer to the connection.
     */
     void Disconnect() final {
-        boost::asio::post(m_asioContext, [this]() { m_asioContext.stop(); });
-        
+        // Closed before stopping, so that it can't be left to run on the next socket.
         if (m_socket.is_open()) {
             boost::asio::post(m_asioContext, [this]() { m_socket.close(); });
         }
 
+        boost::asio::post(m_asioContext, [this]() { m_asioContext.stop(); });
+
         if (m_threadContext.joinable()) {
             m_threadContext.join();
         }
 
-        std::cout << "Client Disconnected.\n";
+        m_flushTimer.Stop();
+        m_reliableTimer.Stop();
+
+        DrainContext();
+
+        FLASH_LOG(info, INVALID_USER_ID, "Client Disconnected.");
     }
 
     /**
@@ -122,12 +149,135 @@ public:
         return true;
     }
 
+    /**
+     * Compresses the bodies of outgoing messages from the given size, and decompresses
+     * incoming ones, so that messages too large for a datagram may still fit once compressed.
+     * The server must use a compressor for the same algorithm. Must be called before `Connect`.
+     * 
+     * @param comp      the compression algorithm, or null to disable compression.
+     * @param threshold the body size from which messages are compressed.
+    */
+    void SetCompression(std::shared_ptr<const compressor> comp, size_t threshold = DEFAULT_COMPRESSION_THRESHOLD) {
+        m_compression = compression_settings { std::move(comp), threshold };
+    }
+
+    /**
+     * Packs messages into datagrams of up to the given size, instead of sending
+     * a datagram per message. The server unpacks them transparently.
+     * 
+     * Messages wait to be packed until their datagram is full, until `Flush` is called,
+     * e.g. at the end of a frame, or for at most the flush interval.
+     * Must be called before `Connect`.
+     * 
+     * @param mtu           the largest datagram to send, headers included.
+     * @param flushInterval the longest time a message waits to be packed.
+    */
+    void EnableCoalescing(size_t mtu = DEFAULT_COALESCING_MTU,
+                          std::chrono::milliseconds flushInterval = DEFAULT_FLUSH_INTERVAL) {
+        m_coalescingMtu = mtu;
+        m_flushInterval = flushInterval;
+        m_packerOut = datagram_packer<T> { mtu };
+    }
+
+    /**
+     * Sends the messages waiting to be packed right away, when coalescing.
+    */
+    void Flush() {
+        if (m_coalescingMtu > 0) {
+            boost::asio::post(m_asioContext, [this]() { FlushPacket(); });
+        }
+    }
+
+    /**
+     * Sets the priority class of the messages of the given type, so they are sent before
+     * messages of less urgent types that are waiting. Must be called before `Connect`.
+    */
+    void SetPriority(T type, priority p) {
+        m_priorities.set(type, p);
+    }
+
+    /**
+     * Enables `SendReliable`, and the delivery of reliable messages from the server.
+     * The server must enable reliability as well. Must be called before `Connect`.
+    */
+    void EnableReliability() {
+        m_reliable = true;
+    }
+
+    /**
+     * Keeps the session the server grants, and resumes it when connecting again, with
+     * a single datagram from the new endpoint, so as to get the same ID back, along with
+     * the datagrams the server kept meanwhile. If the server no longer holds the session,
+     * the client connects anew. See `flash/session.hpp`.
+     * The server must enable sessions as well. Must be called before `Connect`.
+    */
+    void EnableSessions() {
+        m_sessions = true;
+    }
+
+    /**
+     * @returns The session granted by the server, e.g. to learn the ID of the client,
+     * or the one being resumed while connecting. Safe to call from any thread.
+    */
+    session_token GetSession() const {
+        return session_token { m_sessionId.load(std::memory_order_relaxed), m_sessionSecret.load(std::memory_order_relaxed) };
+    }
+
+    /**
+     * @returns Whether the server resumed the previous session on the last `Connect`.
+     * Safe to call from any thread.
+    */
+    bool IsResumed() const {
+        return m_resumed.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Sends a message that is resent until the server acknowledges it, and delivered
+     * in order with the other reliable messages, e.g. for chat or game events.
+     * Plain messages sent with `Send` are not ordered with respect to these.
+     * 
+     * @param msg the message to send.
+    */
+    void SendReliable(message<T>&& msg) {
+        assert(m_reliable);
+        compress_message(m_compression, msg);
+
+        // Message is too long once wrapped, reject.
+        if (msg.size() + RELIABLE_OVERHEAD > MAX_MESSAGE_SIZE_IN_BYTES) {
+            assert(false);
+            return;
+        }
+
+        boost::asio::post(
+            m_asioContext,
+            [this, msg = std::move(msg)]() mutable {
+                msg.get_header().m_size = boost::endian::native_to_big(msg.get_header().m_size);
+                m_reliableChannel.send(std::move(msg));
+
+                PollReliable();
+            }
+        );
+    }
+
     /**
      * Sends a message to the server.
      * 
      * @param msg the message to send.
     */
     void Send(message<T>&& msg) final {
+        priority p = m_priorities.get(msg.get_header().m_type);
+        Send(std::move(msg), p);
+    }
+
+    /**
+     * Sends a message to the server, with the given priority class rather than the one of its type.
+     * 
+     * @param msg the message to send.
+     * @param p   the priority class of the message.
+    */
+    void Send(message<T>&& msg, priority p) {
+        compress_message(m_compression, msg);
+
         // Message is too long, reject.
         if (msg.size() > MAX_MESSAGE_SIZE_IN_BYTES) {
             assert(false);
@@ -140,14 +290,8 @@ public:
             // Black magic generalized lambda capture from
             // https://stackoverflow.com/questions/8640393/move-capture-in-lambda
 
-            [this, msg = std::move(msg)]() mutable {
-                bool writing = !m_qMessagesOut.empty();
-                msg.get_header().m_size = boost::endian::native_to_big(msg.get_header().m_size);
-                m_qMessagesOut.push_back(std::move(msg));
-
-                if (!writing) {
-                    SendMessages();
-                }
+            [this, msg = std::move(msg), p]() mutable {
+                QueueMessage(std::move(msg), p);
             }
         );
     }
@@ -155,7 +299,7 @@ public:
     /**
      * Returns a reference to the incoming message queue.
     */
-    ts_deque<tagged_message<T>>& Incoming() {
+    typename Q::template incoming<tagged_message<T>>& Incoming() {
         return m_qMessagesIn;
     }
 
@@ -167,24 +311,182 @@ protected:
     std::vector<uint8_t> m_tempBufferIn;    // Buffer to store incoming messages.
     std::vector<uint8_t> m_tempBufferOut;   // Buffer to store outgoing messages.
 
-    uint64_t m_magicNumOut;       // Magic number for connection.
-    uint64_t m_tempHandshakeIn;   // Temporary handshake value for receiving.
-    uint64_t m_tempHandshakeOut;  // Temporary handshake value for sending.
+    uint64_t m_magicNumOut;                                // Magic number for connection.
+    std::array<uint8_t, RESUME_REQUEST_SIZE> m_resumeOut;  // Request to resume the session.
+    uint64_t m_tempHandshakeIn;                            // Temporary handshake value for receiving.
+    uint64_t m_tempHandshakeOut;                           // Temporary handshake value for sending.
 
-    uint32_t m_clientTimeout;  // Timeout for client connection.
+    uint32_t m_clientTimeout;        // Timeout for client connection.
+    socket_options m_socketOptions;  // Options of the socket.
 
     std::chrono::steady_clock::time_point m_lastMessageTime;  // Time of last message received.
 
 private:
-    ts_deque<tagged_message<T>> m_qMessagesIn;  // Queue of incoming messages.
-    ts_deque<message<T>> m_qMessagesOut;        // Queue of outgoing messages.
+    typename Q::template incoming<tagged_message<T>> m_qMessagesIn;  // Queue of incoming messages.
+    priority_lanes<Q, message<T>> m_qMessagesOut;                    // Queues of outgoing messages by priority.
+    priority_map<T> m_priorities;                                    // Priority class of each message type.
+    bool m_writing { false };                                        // Whether a datagram is being sent.
+
+    delta_decoder<T> m_deltaDecoder;     // Delta streams from the server.
+    compression_settings m_compression;  // Compression of the messages, if any.
+
+    size_t m_coalescingMtu { 0 };                                          // Largest packed datagram, 0 if not coalescing.
+    std::chrono::milliseconds m_flushInterval { DEFAULT_FLUSH_INTERVAL };  // Longest wait to be packed.
+    datagram_packer<T> m_packerOut { 0 };                                  // Datagram being packed.
+    priority m_packerPriority { priority::bulk };                          // Most urgent priority of the packed messages.
+    periodic_timer m_flushTimer { m_asioContext };                         // Sends the datagram being packed.
+
+    bool m_reliable { false };                         // Whether the reliable channel is enabled.
+    reliable_channel<T> m_reliableChannel;             // Reliable channel to the server.
+    periodic_timer m_reliableTimer { m_asioContext };  // Resends, and sends owed acks, on the channel.
+
+    bool m_sessions { false };                            // Whether sessions are enabled.
+    std::atomic<UserId> m_sessionId { INVALID_USER_ID };  // ID of the session, readable from any thread.
+    std::atomic<uint64_t> m_sessionSecret { 0 };          // Secret of the session, 0 if none.
+    std::atomic<bool> m_resumed { false };                // Whether the session was resumed on connecting.
+    bool m_refused { false };                             // Whether the server refused to resume the session.
+
+    /**
+     * Runs what was left on the context once its thread is joined, e.g. the close and the
+     * stop if the context had run out of work before they were posted, so that none of it
+     * runs on the next connection, where the stop would end the context straight away.
+    */
+    void DrainContext() {
+        m_asioContext.restart();
+
+        while (m_asioContext.poll() > 0) {
+            m_asioContext.restart();
+        }
+    }
+
+    /**
+     * Queues a message to be sent, with its size and flags in host order.
+     * Must be called from the context thread.
+    */
+    void QueueMessage(message<T>&& msg, priority p) {
+        msg.get_header().m_size = boost::endian::native_to_big(msg.get_header().m_size);
+        QueueFrame(std::move(msg), p);
+    }
+
+    /**
+     * Queues a frame to be sent, with its header already in network byte order.
+     * Must be called from the context thread.
+    */
+    void QueueFrame(message<T>&& msg, priority p) {
+        if (m_coalescingMtu > 0) {
+            // Send what was packed first if this doesn't fit, or can't be packed at all.
+            if (!m_packerOut.empty() && !m_packerOut.has_room(msg)) {
+                FlushPacket();
+            }
+
+            if (m_packerOut.fits(msg)) {
+                m_packerOut.append(msg);
+                m_packerPriority = std::min(m_packerPriority, p);
+                return;
+            }
+        }
+
+        PushMessage(std::move(msg), p);
+    }
+
+    /**
+     * Sends the datagram being packed, if any. Must be called from the context thread.
+    */
+    void FlushPacket() {
+        if (!m_packerOut.empty()) {
+            PushMessage(m_packerOut.take(), m_packerPriority);
+            m_packerPriority = priority::bulk;
+        }
+    }
+
+    /**
+     * Pushes a message, ready to be sent, to the outgoing queue.
+     * Must be called from the context thread.
+    */
+    void PushMessage(message<T>&& msg, priority p) {
+        // We are the consumer of the outgoing queue as well, so never block on it.
+        if (!m_qMessagesOut.try_push_back(std::move(msg), p)) {
+            FLASH_LOG(warning, INVALID_USER_ID, "Outgoing Queue Full, Message Dropped.");
+            return;
+        }
+
+        if (!m_writing) {
+            SendMessages();
+        }
+    }
+
+    /**
+     * Acknowledges a frame of a delta stream, so the server can encode against it.
+    */
+    void SendDeltaAck(T type, uint16_t seq) {
+        message<T> ack { type };
+        ack.get_body().resize(delta_ack_schema::SIZE);
+        delta_ack_schema::encode_into(ack.get_body().data(), CONTROL_DELTA_ACK, static_cast<uint32_t>(type), seq);
+        ack.get_header().m_size = static_cast<uint32_t>(delta_ack_schema::SIZE) | WIRE_FLAG_CONTROL;
+
+        QueueMessage(std::move(ack), m_priorities.get(type));
+    }
+
+    /**
+     * Sends what the reliable channel has due: new messages, resends and acks.
+     * Must be called from the context thread.
+    */
+    void PollReliable() {
+        m_reliableChannel.poll(std::chrono::steady_clock::now(),
+            [this](message<T>&& frame) {
+                priority p = m_priorities.get(frame.get_header().m_type);
+                QueueFrame(std::move(frame), p);
+            });
+    }
 
     void ConnectToServer(const boost::asio::ip::udp::resolver::results_type& endpoints) {
         // Try connecting via the first endpoint.
         boost::asio::ip::udp::endpoint endpoint = *endpoints.begin();
         m_socket.open(endpoint.protocol());
+        apply_socket_options(m_socket, m_socketOptions);
         m_socket.connect(endpoint);
 
+        m_resumed.store(false, std::memory_order_relaxed);
+
+        if (m_sessions && GetSession().valid()) {
+            ResumeSession();
+        } else {
+            RequestConnection();
+        }
+    }
+
+    /**
+     * Asks the server to resume the session, with a single datagram, then receives messages
+     * right away, the grant of the session first, unless the server refuses it.
+    */
+    void ResumeSession() {
+        session_token token = GetSession();
+
+        uint64_t magicNumber = boost::endian::native_to_big(RESUME_REQUEST_MAGIC_NUMBER);
+        std::memcpy(m_resumeOut.data(), &magicNumber, sizeof(uint64_t));
+        session_request_schema::encode_into(m_resumeOut.data() + sizeof(uint64_t), token.m_id, token.m_secret);
+
+        m_socket.async_send(
+            boost::asio::buffer(m_resumeOut),
+            [this](std::error_code ec, std::size_t length) {
+            if (!ec) {
+                ReceiveMessages();
+            }
+        });
+    }
+
+    /**
+     * Forgets the state shared with the server under the previous session, if any,
+     * and connects anew. Must be called from the context thread, or before it runs.
+    */
+    void RequestConnection() {
+        m_sessionId.store(INVALID_USER_ID, std::memory_order_relaxed);
+        m_sessionSecret.store(0, std::memory_order_relaxed);
+
+        // The server starts a new channel and new delta streams for the new user.
+        m_reliableChannel = reliable_channel<T> {};
+        m_deltaDecoder = delta_decoder<T> {};
+
         // Send the magic number
         m_magicNumOut = boost::endian::native_to_big(CONNECTION_REQUEST_MAGIC_NUMBER);
         m_socket.async_send(
@@ -205,6 +507,16 @@ private:
             if (!ec) {
                 m_tempHandshakeIn = boost::endian::big_to_native(m_tempHandshakeIn);
                 m_tempHandshakeOut = Scramble(m_tempHandshakeIn);
+
+                if (m_sessions && (m_tempHandshakeIn & SESSION_OFFER_BIT)) {
+                    m_tempHandshakeOut ^= SESSION_RESPONSE_MASK;
+
+                } else if (m_sessions) {
+                    // The server doesn't offer sessions, so there is none to keep.
+                    m_sessionId.store(INVALID_USER_ID, std::memory_order_relaxed);
+                    m_sessionSecret.store(0, std::memory_order_relaxed);
+                }
+
                 m_tempHandshakeOut = boost::endian::native_to_big(m_tempHandshakeOut);
 
                 // Send the response back to the server.
@@ -212,7 +524,7 @@ private:
                     boost::asio::buffer(&m_tempHandshakeOut, sizeof(uint64_t)),
                     [this](std::error_code ec, std::size_t length) {
                     if (!ec) {
-                        std::cout << "Connected to server.\n";
+                        FLASH_LOG(info, INVALID_USER_ID, "Connected to server.");
 
                         // Start receiving messages from the server.
                         ReceiveMessages();
@@ -226,40 +538,137 @@ private:
         // Message is too short to be in the canonical format, ignore
         if (length < sizeof(header<T>)) return;
 
-        message<T> msg { static_cast<T>(0) };
-        std::memcpy(&msg.get_header(), m_tempBufferIn.data(), sizeof(header<T>));
-        msg.get_header().m_size = boost::endian::big_to_native(msg.get_header().m_size);
+        const uint8_t* data = m_tempBufferIn.data();
 
-        // Size of message body does not match the size in the header, ignore
-        if (length - sizeof(header<T>) != msg.get_header().m_size) return;
+        header<T> hdr;
+        std::memcpy(&hdr, data, sizeof(header<T>));
+        uint32_t wireSize = boost::endian::big_to_native(hdr.m_size);
 
-        msg.get_body().resize(msg.get_header().m_size);
-        std::memcpy(msg.get_body().data(), m_tempBufferIn.data() + sizeof(header<T>), msg.get_header().m_size);
+        // Size of message body does not match the size in the header, ignore
+        if (length - sizeof(header<T>) != (wireSize & WIRE_SIZE_MASK)) return;
 
         m_lastMessageTime = std::chrono::steady_clock::now();
+
+        if (wireSize & WIRE_FLAG_PACKED) {
+            for_each_packed_frame<T>(data + sizeof(header<T>), length - sizeof(header<T>),
+                [this](const uint8_t* frame, std::size_t frameLength) { ProcessFrame(frame, frameLength); });
+        } else {
+            ProcessFrame(data, length);
+        }
+    }
+
+    /**
+     * Processes a single frame from the server, with a body of the size in its header.
+    */
+    void ProcessFrame(const uint8_t* data, std::size_t length) {
+        message<T> msg { static_cast<T>(0) };
+        std::memcpy(&msg.get_header(), data, sizeof(header<T>));
+
+        uint32_t wireSize = boost::endian::big_to_native(msg.get_header().m_size);
+        msg.get_header().m_size = wireSize & WIRE_SIZE_MASK;
+
+        // Packed frames are never nested, ignore
+        if (wireSize & WIRE_FLAG_PACKED) return;
+
+        const uint8_t* body = data + sizeof(header<T>);
+
+        if (wireSize & WIRE_FLAG_CONTROL) {
+            if (m_sessions && msg.get_header().m_size == session_control_schema::SIZE && body[0] == CONTROL_SESSION) {
+                TakeGrant(body);
+                return;
+            }
+
+            // Messages of the reliable channel come back here once they can be delivered in order.
+            if (m_reliable) {
+                m_reliableChannel.receive(body, msg.get_header().m_size, std::chrono::steady_clock::now(),
+                    [this](const uint8_t* frame, std::size_t frameLength) { ProcessFrame(frame, frameLength); });
+            }
+
+            return;
+        }
+
+        if (wireSize & WIRE_FLAG_DELTA) {
+            uint16_t seq;
+
+            // The baseline is gone, drop the frame; the server will move on to a newer one.
+            if (!m_deltaDecoder.decode(msg.get_header().m_type, body, msg.get_header().m_size, msg.get_body(), seq)) return;
+
+            SendDeltaAck(msg.get_header().m_type, seq);
+            msg.get_header().m_size = static_cast<uint32_t>(msg.get_body().size());
+
+        } else if (wireSize & WIRE_FLAG_COMPRESSED) {
+            size_t originalSize;
+
+            // Malformed, or we have no compressor, ignore
+            if (!m_compression.m_compressor || !decompressed_size(body, msg.get_header().m_size, originalSize)) return;
+
+            msg.get_body().resize(originalSize);
+            if (!decompress_body(*m_compression.m_compressor, body, msg.get_header().m_size, msg.get_body().data(), originalSize)) return;
+
+            msg.get_header().m_size = static_cast<uint32_t>(originalSize);
+
+        } else {
+            msg.get_body().resize(msg.get_header().m_size);
+            std::memcpy(msg.get_body().data(), body, msg.get_header().m_size);
+        }
+
         m_qMessagesIn.push_back(tagged_message<T> { SERVER_USER_ID, std::move(msg) });
     }
 
+    /**
+     * Takes the session granted by the server, or connects anew if it refused to resume one.
+    */
+    void TakeGrant(const uint8_t* body) {
+        uint8_t kind, resumed;
+        session_token granted;
+        session_control_schema::decode_from(body, kind, resumed, granted.m_id, granted.m_secret);
+
+        if (!granted.valid()) {
+            FLASH_LOG(info, INVALID_USER_ID, "Session not resumed, connecting anew.");
+
+            m_refused = true;
+            return;
+        }
+
+        m_sessionId.store(granted.m_id, std::memory_order_relaxed);
+        m_sessionSecret.store(granted.m_secret, std::memory_order_relaxed);
+
+        if (resumed) {
+            FLASH_LOG(info, granted.m_id, "Session resumed.");
+
+            m_resumed.store(true, std::memory_order_relaxed);
+        }
+    }
+
     void ReceiveMessages() {
         m_socket.async_receive(
             boost::asio::buffer(m_tempBufferIn.data(), m_tempBufferIn.size()),
             [this](std::error_code ec, std::size_t length) {
             if (!ec) {
                 ProcessMessage(length);
+
+                // The handshake takes over the socket from the refusal on.
+                if (m_refused) {
+                    m_refused = false;
+                    RequestConnection();
+                    return;
+                }
+
                 ReceiveMessages();
 
-            } else {
-                std::stringstream ss;
-                ss << "Client Exception: " << ec.message() << '\n';
-                std::cout << ss.str();
+            } else if (ec != std::errc::operation_canceled) {
+                // Aborted by the socket closing on disconnecting, which is no error.
+                FLASH_LOG(error, INVALID_USER_ID, "Client Exception: " << ec.message());
             }
         });
     }
 
     void SendMessages() {
-        if (m_qMessagesOut.empty()) return;
+        m_writing = !m_qMessagesOut.empty();
+        if (!m_writing) return;
 
-        message<T> msg = m_qMessagesOut.front();
+        // Taken off the queue right away, since more urgent messages may be queued meanwhile.
+        message<T> msg = m_qMessagesOut.pop_front();
 
         m_tempBufferOut.resize(msg.size());
 
@@ -270,15 +679,13 @@ private:
             boost::asio::buffer(m_tempBufferOut.data(), m_tempBufferOut.size()),
             [this](std::error_code ec, std::size_t length) {
             if (!ec) {
-                m_qMessagesOut.pop_front();
+                SendMessages();
+            } else {
+                m_writing = false;
 
-                if (!m_qMessagesOut.empty()) {
-                    SendMessages();
+                if (ec != std::errc::operation_canceled) {
+                    FLASH_LOG(error, INVALID_USER_ID, "Client Exception: " << ec.message());
                 }
-            } else {
-                std::stringstream ss;
-                ss << "Client Exception: " << ec.message() << '\n';
-                std::cout << ss.str();
             }
         });
     }
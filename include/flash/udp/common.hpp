@@ -1,7 +1,22 @@
 #ifndef FLASH_UDP_COMMON_HPP
 #define FLASH_UDP_COMMON_HPP
 
+#include <flash/message.hpp>
+#include <flash/schema.hpp>
+#include <flash/session.hpp>
+
+#include <boost/endian/conversion.hpp>
+
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+
+// Batched datagram I/O with `recvmmsg` and `sendmmsg` is only available on Linux.
+// Define FLASH_NO_MMSG to leave it out regardless.
+#if defined(__linux__) && !defined(FLASH_NO_MMSG)
+#define FLASH_HAS_MMSG 1
+#endif
 
 namespace flash {
 
@@ -9,6 +24,113 @@ namespace udp {
 
 constexpr uint32_t MAX_MESSAGE_SIZE_IN_BYTES = 64000;
 constexpr uint64_t CONNECTION_REQUEST_MAGIC_NUMBER = 0x26E55500;
+constexpr uint64_t RESUME_REQUEST_MAGIC_NUMBER = 0x26E55501;  // Followed by a `session_request_schema`.
+
+constexpr size_t MAX_DATAGRAMS_PER_BATCH = 32;  // Datagrams per system call in batched mode.
+
+// Control frames are sent with `WIRE_FLAG_CONTROL`, and their body starts with their kind.
+constexpr uint8_t CONTROL_DELTA_ACK = 1;     // Acknowledges a frame of a delta stream.
+constexpr uint8_t CONTROL_RELIABLE = 2;      // Message of the reliable channel, see `flash/udp/reliable.hpp`.
+constexpr uint8_t CONTROL_RELIABLE_ACK = 3;  // Acknowledges messages of the reliable channel.
+constexpr uint8_t CONTROL_SESSION = 4;       // Session granted to the client, or refused, see `flash/session.hpp`.
+
+/// Body of a delta acknowledgement: kind, message type, sequence number of the frame.
+using delta_ack_schema = schema<uint8_t, uint32_t, uint16_t>;
+
+/// Body of a session grant: kind, then as `session_grant_schema`, with a null secret when refused.
+using session_control_schema = schema<uint8_t, uint8_t, int32_t, uint64_t>;
+
+/// Size of a resume request: the magic number, in network byte order, then the session to resume.
+constexpr size_t RESUME_REQUEST_SIZE = sizeof(uint64_t) + session_request_schema::SIZE;
+
+constexpr size_t DEFAULT_COALESCING_MTU = 1200;                    // Safe datagram size on most paths.
+constexpr std::chrono::milliseconds DEFAULT_FLUSH_INTERVAL { 5 };  // Longest time a message waits to be packed.
+
+
+/**
+ * Packs messages to the same endpoint into a single datagram with `WIRE_FLAG_PACKED`,
+ * whose body is the frames of the messages one after the other, headers included.
+ * 
+ * @tparam T an enum class containing possible types of messages to be sent.
+*/
+template <typename T>
+class datagram_packer {
+public:
+    /**
+     * @param mtu the largest datagram to build, headers included.
+    */
+    explicit datagram_packer(size_t mtu) : m_mtu { mtu } { }
+
+    size_t num_frames() const { return m_numFrames; }
+    bool empty() const { return m_numFrames == 0; }
+
+    /**
+     * @returns Whether the message is small enough to be packed at all.
+    */
+    bool fits(const message<T>& msg) const { return sizeof(header<T>) + msg.size() <= m_mtu; }
+
+    /**
+     * @returns Whether the message can be added without going over the MTU.
+    */
+    bool has_room(const message<T>& msg) const { return m_packed.size() + msg.size() <= m_mtu; }
+
+    /**
+     * Adds a message, with its header already in network byte order.
+    */
+    void append(const message<T>& msg) {
+        m_packed.get_body().append(&msg.get_header(), sizeof(header<T>));
+        m_packed.get_body().append(msg.get_body().data(), msg.get_body().size());
+        ++m_numFrames;
+    }
+
+    /**
+     * Takes the packed datagram, with its header in network byte order, and starts a new one.
+     * A single message is given back as it was, since packing it would only add a header.
+    */
+    message<T> take() {
+        message<T> result { static_cast<T>(0) };
+
+        if (m_numFrames == 1) {
+            const uint8_t* frame = m_packed.get_body().data();
+            std::memcpy(&result.get_header(), frame, sizeof(header<T>));
+            result.get_body().assign(frame + sizeof(header<T>), frame + m_packed.get_body().size());
+        } else {
+            result = std::move(m_packed);
+            result.get_header().m_size = boost::endian::native_to_big(
+                static_cast<uint32_t>(result.get_body().size()) | WIRE_FLAG_PACKED);
+        }
+
+        m_packed = message<T> { static_cast<T>(0) };
+        m_numFrames = 0;
+
+        return result;
+    }
+
+private:
+    size_t m_mtu;                               // Largest datagram to build.
+    message<T> m_packed { static_cast<T>(0) };  // Frames packed so far.
+    size_t m_numFrames { 0 };                   // Number of frames packed so far.
+};
+
+/**
+ * Calls `f(frame, length)` for every frame packed into the body of a datagram
+ * with `WIRE_FLAG_PACKED`, header included. Stops at the first truncated frame.
+*/
+template <typename T, typename F>
+void for_each_packed_frame(const uint8_t* body, size_t length, F&& f) {
+    size_t offset = 0;
+
+    while (length - offset >= sizeof(header<T>)) {
+        header<T> hdr;
+        std::memcpy(&hdr, body + offset, sizeof(header<T>));
+
+        size_t frameLength = sizeof(header<T>) + (boost::endian::big_to_native(hdr.m_size) & WIRE_SIZE_MASK);
+        if (length - offset < frameLength) return;
+
+        f(body + offset, frameLength);
+        offset += frameLength;
+    }
+}
 
 } // namespace udp
 
@@ -0,0 +1,167 @@
+#ifndef FLASH_UDP_ENDPOINT_MAP_HPP
+#define FLASH_UDP_ENDPOINT_MAP_HPP
+
+/**
+ * @file endpoint_map.hpp
+ * 
+ * Flat hash table from the endpoints of the UDP users to their IDs, looked up for
+ * every datagram received. It doesn't need `std::hash` of endpoints, which older
+ * versions of asio don't have.
+*/
+
+#include <flash/message.hpp>
+
+#include <boost/asio.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace flash {
+
+namespace udp {
+
+/**
+ * Maps endpoints to user IDs, with open addressing and linear probing in a single array,
+ * kept at most half full, so a lookup usually reads a single entry.
+ * 
+ * Not thread-safe.
+*/
+class endpoint_map {
+public:
+    /**
+     * @returns The ID mapped to the endpoint, or `INVALID_USER_ID` if there is none.
+    */
+    UserId find(const boost::asio::ip::udp::endpoint& endpoint) const {
+        if (m_size == 0) return INVALID_USER_ID;
+
+        for (size_t i = Hash(endpoint) & m_mask; ; i = (i + 1) & m_mask) {
+            const entry& e = m_entries[i];
+
+            if (e.m_id == INVALID_USER_ID) return INVALID_USER_ID;
+            if (e.m_endpoint == endpoint) return e.m_id;
+        }
+    }
+
+    bool contains(const boost::asio::ip::udp::endpoint& endpoint) const {
+        return find(endpoint) != INVALID_USER_ID;
+    }
+
+    /**
+     * Maps the endpoint to the ID, replacing the ID it was mapped to, if any.
+    */
+    void insert(const boost::asio::ip::udp::endpoint& endpoint, UserId id) {
+        if ((m_size + 1) * 2 > m_entries.size()) Grow();
+
+        for (size_t i = Hash(endpoint) & m_mask; ; i = (i + 1) & m_mask) {
+            entry& e = m_entries[i];
+
+            if (e.m_id == INVALID_USER_ID) {
+                e = entry { endpoint, id };
+                ++m_size;
+                return;
+            }
+
+            if (e.m_endpoint == endpoint) {
+                e.m_id = id;
+                return;
+            }
+        }
+    }
+
+    /**
+     * Removes the mapping of the endpoint, if any.
+     * 
+     * @returns Whether there was one.
+    */
+    bool erase(const boost::asio::ip::udp::endpoint& endpoint) {
+        if (m_size == 0) return false;
+
+        size_t i = Hash(endpoint) & m_mask;
+        for (; ; i = (i + 1) & m_mask) {
+            if (m_entries[i].m_id == INVALID_USER_ID) return false;
+            if (m_entries[i].m_endpoint == endpoint) break;
+        }
+
+        // Shift the following entries of the run back, rather than leaving a tombstone,
+        // unless they sit between the hole and their home, where they can't move.
+        for (size_t j = (i + 1) & m_mask; m_entries[j].m_id != INVALID_USER_ID; j = (j + 1) & m_mask) {
+            size_t home = Hash(m_entries[j].m_endpoint) & m_mask;
+
+            if (((j - home) & m_mask) >= ((j - i) & m_mask)) {
+                m_entries[i] = m_entries[j];
+                i = j;
+            }
+        }
+
+        m_entries[i] = entry {};
+        --m_size;
+        return true;
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    void clear() {
+        m_entries.assign(m_entries.size(), entry {});
+        m_size = 0;
+    }
+
+    /**
+     * @returns The hash of the endpoint, from its address and port.
+    */
+    static size_t Hash(const boost::asio::ip::udp::endpoint& endpoint) {
+        uint64_t h;
+        const boost::asio::ip::address& address = endpoint.address();
+
+        if (address.is_v4()) {
+            h = address.to_v4().to_uint();
+        } else {
+            boost::asio::ip::address_v6::bytes_type bytes = address.to_v6().to_bytes();
+            uint64_t halves[2];
+            std::memcpy(halves, bytes.data(), sizeof(halves));
+            h = halves[0] ^ (halves[1] * 0x9E3779B97F4A7C15ull);
+        }
+
+        h = (h << 16) ^ endpoint.port();
+
+        // Mixes the bits, so that close addresses and ports spread over the table.
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ull;
+        h ^= h >> 33;
+
+        return static_cast<size_t>(h);
+    }
+
+private:
+    static constexpr size_t INITIAL_CAPACITY = 64;
+
+    struct entry {
+        boost::asio::ip::udp::endpoint m_endpoint;
+        UserId m_id { INVALID_USER_ID };  // INVALID_USER_ID for an empty entry.
+    };
+
+    void Grow() {
+        std::vector<entry> old = std::move(m_entries);
+
+        m_entries.assign(old.empty() ? INITIAL_CAPACITY : old.size() * 2, entry {});
+        m_mask = m_entries.size() - 1;
+        m_size = 0;
+
+        for (const entry& e : old) {
+            if (e.m_id != INVALID_USER_ID) insert(e.m_endpoint, e.m_id);
+        }
+    }
+
+    std::vector<entry> m_entries;  // Power of two in size, at most half full.
+    size_t m_mask { 0 };           // Size of the entries minus one.
+    size_t m_size { 0 };           // Number of endpoints mapped.
+};
+
+} // namespace udp
+
+} // namespace flash
+
+#endif
@@ -0,0 +1,382 @@
+#ifndef FLASH_UDP_RELIABLE_HPP
+#define FLASH_UDP_RELIABLE_HPP
+
+/**
+ * @file reliable.hpp
+ * 
+ * Optional reliable, ordered channel on top of the unreliable datagrams.
+ * 
+ * Every reliable message is wrapped in a control frame with a sequence number, and
+ * with the acknowledgement of what the other side has sent so far: a cumulative
+ * sequence number, below which everything has been received, and a bitfield of the
+ * following ones that have been received out of order. Messages that aren't acknowledged
+ * within the retransmission timeout, estimated from the round-trip time, are resent
+ * individually. Acknowledgements ride along with reliable messages, and are only sent
+ * on their own when there is nothing to carry them.
+*/
+
+#include <flash/message.hpp>
+#include <flash/schema.hpp>
+
+#include <flash/udp/common.hpp>
+
+#include <boost/endian/conversion.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+namespace flash {
+
+namespace udp {
+
+constexpr size_t RELIABLE_WINDOW_SIZE = 64;  // Messages in flight, or buffered out of order, per direction.
+
+static_assert(RELIABLE_WINDOW_SIZE > 32, "The acknowledgement bitfield must fit in the window.");
+
+constexpr std::chrono::milliseconds RELIABLE_TICK_INTERVAL { 10 };  // Interval of resends and standalone acks.
+constexpr std::chrono::milliseconds INITIAL_RTO { 200 };            // Retransmission timeout before any RTT sample.
+constexpr std::chrono::milliseconds MIN_RTO { 20 };
+constexpr std::chrono::milliseconds MAX_RTO { 2000 };
+
+/// Prefix of a reliable frame: kind, sequence number, cumulative ack, ack bitfield.
+using reliable_frame_prefix = schema<uint8_t, uint16_t, uint16_t, uint32_t>;
+
+/// Body of a standalone acknowledgement: kind, cumulative ack, ack bitfield.
+using reliable_ack_schema = schema<uint8_t, uint16_t, uint32_t>;
+
+/// Number of bytes that a reliable frame adds to a message.
+constexpr size_t RELIABLE_OVERHEAD = sizeof(header<uint32_t>) + reliable_frame_prefix::SIZE;
+
+
+/**
+ * Reliable, ordered channel to a single peer, in both directions.
+ * 
+ * Does no I/O itself: frames to send are handed out by `poll`, and frames received
+ * are handed in to `receive`. Not thread-safe; meant to be used from wherever the
+ * datagrams of the peer are queued.
+ * 
+ * @tparam T an enum class containing possible types of messages to be sent.
+*/
+template <typename T>
+class reliable_channel {
+public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * Queues a message to be sent reliably, with its header in network byte order.
+     * It goes out at the next `poll`, as soon as there is room in the window.
+    */
+    void send(message<T>&& msg) { m_backlog.push_back(std::move(msg)); }
+
+    /**
+     * Hands out the frames to send now, with their headers in network byte order: resends
+     * that are due, queued messages that fit in the window, and an acknowledgement if one
+     * is owed and nothing else carried it.
+     * 
+     * @param now the current time.
+     * @param out called with every frame to send, as a `message<T>&&`.
+    */
+    template <typename F>
+    void poll(clock::time_point now, F&& out) {
+        // Resend whatever has been in flight for too long, oldest first.
+        for (uint16_t seq = m_oldestUnacked; seq != m_nextSeq; ++seq) {
+            sent_slot& slot = m_sent[seq % RELIABLE_WINDOW_SIZE];
+            if (!slot.m_inFlight || now - slot.m_sentAt < Backoff(slot.m_transmissions)) continue;
+
+            slot.m_sentAt = now;
+            ++slot.m_transmissions;
+            out(MakeFrame(slot));
+        }
+
+        while (!m_backlog.empty() && static_cast<uint16_t>(m_nextSeq - m_oldestUnacked) < RELIABLE_WINDOW_SIZE) {
+            const message<T>& msg = m_backlog.front();
+
+            sent_slot& slot = m_sent[m_nextSeq % RELIABLE_WINDOW_SIZE];
+            slot.m_seq = m_nextSeq++;
+            slot.m_inFlight = true;
+            slot.m_sentAt = now;
+            slot.m_transmissions = 1;
+
+            // Keeps the storage of the slot, so a steady stream of messages doesn't allocate here.
+            const uint8_t* hdr = reinterpret_cast<const uint8_t*>(&msg.get_header());
+            slot.m_frame.assign(hdr, hdr + sizeof(header<T>));
+            slot.m_frame.insert(slot.m_frame.end(), msg.get_body().data(), msg.get_body().data() + msg.get_body().size());
+
+            m_backlog.pop_front();
+            out(MakeFrame(slot));
+        }
+
+        if (m_ackOwed) {
+            out(MakeAck());
+        }
+    }
+
+    /**
+     * Handles a reliable frame, or a standalone acknowledgement, from the peer.
+     * 
+     * @param body    the body of the control frame.
+     * @param size    the size of the body.
+     * @param now     the current time.
+     * @param deliver called with every message that can now be delivered in order,
+     *                as `(const uint8_t* frame, size_t length)`, header included.
+     * 
+     * @returns Whether the frame was well-formed.
+    */
+    template <typename F>
+    bool receive(const uint8_t* body, size_t size, clock::time_point now, F&& deliver) {
+        if (size == 0) return false;
+
+        if (body[0] == CONTROL_RELIABLE_ACK) {
+            if (size != reliable_ack_schema::SIZE) return false;
+
+            uint8_t kind;
+            uint16_t ack;
+            uint32_t ackBits;
+            reliable_ack_schema::decode_from(body, kind, ack, ackBits);
+
+            HandleAck(ack, ackBits, now);
+            return true;
+        }
+
+        if (body[0] != CONTROL_RELIABLE || size < reliable_frame_prefix::SIZE + sizeof(header<T>)) return false;
+
+        uint8_t kind;
+        uint16_t seq, ack;
+        uint32_t ackBits;
+        reliable_frame_prefix::decode_from(body, kind, seq, ack, ackBits);
+
+        const uint8_t* frame = body + reliable_frame_prefix::SIZE;
+        size_t length = size - reliable_frame_prefix::SIZE;
+
+        // The wrapped message must be a plain one, of the size in its header.
+        header<T> hdr;
+        std::memcpy(&hdr, frame, sizeof(header<T>));
+        uint32_t wireSize = boost::endian::big_to_native(hdr.m_size);
+
+        if ((wireSize & (WIRE_FLAG_CONTROL | WIRE_FLAG_PACKED)) || (wireSize & WIRE_SIZE_MASK) != length - sizeof(header<T>)) {
+            return false;
+        }
+
+        HandleAck(ack, ackBits, now);
+
+        // Acknowledge even duplicates, in case our acknowledgement was lost.
+        m_ackOwed = true;
+
+        uint16_t ahead = static_cast<uint16_t>(seq - m_nextExpected);
+
+        // Already delivered, or too far ahead for the peer to have sent it legitimately.
+        if (ahead >= RELIABLE_WINDOW_SIZE) return true;
+
+        if (ahead > 0) {
+            // Keep it until the messages before it arrive.
+            received_slot& slot = m_received[seq % RELIABLE_WINDOW_SIZE];
+
+            if (!slot.m_valid || slot.m_seq != seq) {
+                slot.m_valid = true;
+                slot.m_seq = seq;
+                slot.m_frame.assign(frame, frame + length);
+            }
+
+            return true;
+        }
+
+        deliver(frame, length);
+        ++m_nextExpected;
+
+        // Then whatever was waiting for it.
+        for (;;) {
+            received_slot& slot = m_received[m_nextExpected % RELIABLE_WINDOW_SIZE];
+            if (!slot.m_valid || slot.m_seq != m_nextExpected) break;
+
+            slot.m_valid = false;
+            deliver(static_cast<const uint8_t*>(slot.m_frame.data()), slot.m_frame.size());
+            ++m_nextExpected;
+        }
+
+        return true;
+    }
+
+    /**
+     * @returns The smoothed round-trip time, or zero before the first sample.
+    */
+    clock::duration rtt() const { return m_srtt; }
+
+    /**
+     * @returns The current retransmission timeout, before backoff.
+    */
+    clock::duration rto() const { return m_rto; }
+
+    /**
+     * @returns The number of messages sent but not acknowledged yet.
+    */
+    size_t num_in_flight() const {
+        size_t count = 0;
+
+        for (uint16_t seq = m_oldestUnacked; seq != m_nextSeq; ++seq) {
+            if (m_sent[seq % RELIABLE_WINDOW_SIZE].m_inFlight) ++count;
+        }
+
+        return count;
+    }
+
+    /**
+     * @returns The number of messages waiting for room in the window.
+    */
+    size_t backlog_size() const { return m_backlog.size(); }
+
+private:
+    struct sent_slot {
+        uint16_t m_seq { 0 };
+        bool m_inFlight { false };
+        clock::time_point m_sentAt;
+        uint32_t m_transmissions { 0 };
+        std::vector<uint8_t> m_frame;  // The message, header included.
+    };
+
+    struct received_slot {
+        uint16_t m_seq { 0 };
+        bool m_valid { false };
+        std::vector<uint8_t> m_frame;  // The message, header included.
+    };
+
+    /**
+     * @returns The time to wait before resending a message that was sent the given number of times.
+    */
+    clock::duration Backoff(uint32_t transmissions) const {
+        clock::duration timeout = m_rto;
+
+        for (uint32_t i = 1; i < transmissions && timeout < MAX_RTO; ++i) {
+            timeout *= 2;
+        }
+
+        return std::min<clock::duration>(timeout, MAX_RTO);
+    }
+
+    /**
+     * @returns The bitfield of the messages after the next expected one that have been received.
+    */
+    uint32_t AckBits() const {
+        uint32_t bits = 0;
+
+        for (uint16_t i = 0; i < 32; ++i) {
+            uint16_t seq = static_cast<uint16_t>(m_nextExpected + 1 + i);
+            const received_slot& slot = m_received[seq % RELIABLE_WINDOW_SIZE];
+
+            if (slot.m_valid && slot.m_seq == seq) bits |= 1u << i;
+        }
+
+        return bits;
+    }
+
+    /**
+     * Wraps a message in flight into a reliable frame, carrying the current acknowledgement.
+    */
+    message<T> MakeFrame(const sent_slot& slot) {
+        header<T> inner;
+        std::memcpy(&inner, slot.m_frame.data(), sizeof(header<T>));
+
+        message<T> frame { inner.m_type };
+        frame.get_body().resize(reliable_frame_prefix::SIZE + slot.m_frame.size());
+
+        reliable_frame_prefix::encode_into(frame.get_body().data(), CONTROL_RELIABLE, slot.m_seq, m_nextExpected, AckBits());
+        std::memcpy(frame.get_body().data() + reliable_frame_prefix::SIZE, slot.m_frame.data(), slot.m_frame.size());
+
+        frame.get_header().m_size = boost::endian::native_to_big(
+            static_cast<uint32_t>(frame.get_body().size()) | WIRE_FLAG_CONTROL);
+
+        m_ackOwed = false;
+        return frame;
+    }
+
+    /**
+     * Builds a standalone acknowledgement.
+    */
+    message<T> MakeAck() {
+        message<T> frame { static_cast<T>(0) };
+        frame.get_body().resize(reliable_ack_schema::SIZE);
+
+        reliable_ack_schema::encode_into(frame.get_body().data(), CONTROL_RELIABLE_ACK, m_nextExpected, AckBits());
+
+        frame.get_header().m_size = boost::endian::native_to_big(
+            static_cast<uint32_t>(frame.get_body().size()) | WIRE_FLAG_CONTROL);
+
+        m_ackOwed = false;
+        return frame;
+    }
+
+    /**
+     * Marks the messages acknowledged by the peer as delivered.
+    */
+    void HandleAck(uint16_t ack, uint32_t ackBits, clock::time_point now) {
+        uint16_t inFlight = static_cast<uint16_t>(m_nextSeq - m_oldestUnacked);
+
+        // Older than what was acknowledged already, or acknowledges what was never sent.
+        if (static_cast<uint16_t>(ack - m_oldestUnacked) > inFlight) return;
+
+        for (; m_oldestUnacked != ack; ++m_oldestUnacked) {
+            Acknowledge(m_sent[m_oldestUnacked % RELIABLE_WINDOW_SIZE], now);
+        }
+
+        for (uint16_t i = 0; i < 32; ++i) {
+            uint16_t seq = static_cast<uint16_t>(ack + 1 + i);
+            if (static_cast<uint16_t>(seq - m_oldestUnacked) >= static_cast<uint16_t>(m_nextSeq - m_oldestUnacked)) break;
+
+            if (ackBits & (1u << i)) {
+                Acknowledge(m_sent[seq % RELIABLE_WINDOW_SIZE], now);
+            }
+        }
+    }
+
+    void Acknowledge(sent_slot& slot, clock::time_point now) {
+        if (!slot.m_inFlight) return;
+
+        // Only messages sent once give a meaningful sample, per Karn's algorithm.
+        if (slot.m_transmissions == 1) {
+            SampleRtt(now - slot.m_sentAt);
+        }
+
+        slot.m_inFlight = false;
+    }
+
+    /**
+     * Updates the round-trip time estimate and the retransmission timeout, as in RFC 6298.
+    */
+    void SampleRtt(clock::duration sample) {
+        if (m_srtt == clock::duration::zero()) {
+            m_srtt = sample;
+            m_rttvar = sample / 2;
+        } else {
+            clock::duration error = m_srtt > sample ? m_srtt - sample : sample - m_srtt;
+            m_rttvar = (3 * m_rttvar + error) / 4;
+            m_srtt = (7 * m_srtt + sample) / 8;
+        }
+
+        m_rto = std::clamp<clock::duration>(m_srtt + 4 * m_rttvar, MIN_RTO, MAX_RTO);
+    }
+
+    // Sending side.
+    uint16_t m_nextSeq { 0 };        // Sequence number of the next message.
+    uint16_t m_oldestUnacked { 0 };  // Everything before this has been acknowledged.
+    std::array<sent_slot, RELIABLE_WINDOW_SIZE> m_sent;
+    std::deque<message<T>> m_backlog;  // Messages waiting for room in the window.
+
+    clock::duration m_srtt { clock::duration::zero() };    // Smoothed round-trip time.
+    clock::duration m_rttvar { clock::duration::zero() };  // Round-trip time variation.
+    clock::duration m_rto { INITIAL_RTO };                 // Retransmission timeout.
+
+    // Receiving side.
+    uint16_t m_nextExpected { 0 };  // Everything before this has been delivered.
+    std::array<received_slot, RELIABLE_WINDOW_SIZE> m_received;
+    bool m_ackOwed { false };       // Whether something was received since the last acknowledgement.
+};
+
+} // namespace udp
+
+} // namespace flash
+
+#endif
@@ -1,23 +1,53 @@
 #ifndef FLASH_UDP_SERVER_HPP
 #define FLASH_UDP_SERVER_HPP
 
+#include <flash/backpressure.hpp>
+#include <flash/buffer_pool.hpp>
+#include <flash/compression.hpp>
+#include <flash/delta.hpp>
+#include <flash/dispatch.hpp>
+#include <flash/log.hpp>
+#include <flash/groups.hpp>
 #include <flash/message.hpp>
-#include <flash/ts_deque.hpp>
+#include <flash/priority.hpp>
+#include <flash/queues.hpp>
+#include <flash/session.hpp>
+#include <flash/slot_map.hpp>
 
+#include <flash/io_pool.hpp>
+#include <flash/periodic_timer.hpp>
 #include <flash/iserver.hpp>
 #include <flash/iserverext.hpp>
 #include <flash/scramble.hpp>
+#include <flash/socket_options.hpp>
+#include <flash/stats.hpp>
 
 #include <flash/udp/common.hpp>
+#include <flash/udp/endpoint_map.hpp>
+#include <flash/udp/reliable.hpp>
+
+#ifdef FLASH_WITH_COROUTINES
+#include <flash/coroutine.hpp>
+#endif
 
 #include <boost/asio.hpp>
 #include <boost/endian/conversion.hpp>
 
+#ifdef FLASH_HAS_MMSG
+#include <sys/socket.h>
+#endif
+
 #include <algorithm>
+#include <array>
 #include <cassert>
-#include <iostream>
-#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace flash {
@@ -31,81 +61,514 @@ struct User {
     bool m_validated { false };       // Whether the user has passed the basic validation handshake.
     uint64_t m_handshake { 0 };       // The input handshake value.
     uint64_t m_handshakeCheck { 0 };  // The correct output handshake value.
+
+    traffic_stats m_traffic;  // Datagrams and bytes received from and sent to the user.
+
+    uint64_t m_sessionSecret { 0 };  // Secret of the session granted to the user, 0 if none.
+    bool m_lost { false };           // Whether it timed out, and is held for its client to resume the session.
+    bool m_resuming { false };       // Whether its session was resumed, and the datagrams held for it are yet to go out.
 };
 
-template <typename T>
+/**
+ * Server class that handles datagrams from clients.
+ * 
+ * Provides the same interface as the TCP server: to start listening for clients,
+ * to message clients individually or all at once, and to receive messages
+ * through a thread-safe queue.
+ * 
+ * The single socket is shared by a number of networking threads, each running its own
+ * receive loop with its own buffer, so incoming datagrams are processed concurrently.
+ * Every operation on the socket is started from a strand, and the user tables are
+ * protected by a lock. As a consequence, `OnClientConnect`, `OnClientValidate` and
+ * `OnClientDisconnect` may be called from any of these threads, possibly concurrently.
+ * 
+ * With `socket_options::m_reusePort`, each networking thread instead gets a shard of its
+ * own: a socket bound to the same port, which the kernel hands a share of the clients to,
+ * a context and buffers, and the tables of the users it received first, behind a lock
+ * of their own. Receiving then scales with the threads, as nothing is shared on the way
+ * to the incoming queue. Datagrams are still sent from the strand, on the first socket.
+ * 
+ * With sessions, a user that times out is held for the grace period, and the datagrams
+ * to it are kept, until its client resumes the session from a new endpoint, or the grace
+ * period is over, at which point `OnClientDisconnect` is called.
+ * 
+ * Should be inherited for custom functionality.
+ * 
+ * @tparam T the message type to send and receive.
+ * @tparam Q the queue policy, see `flash/queues.hpp`.
+*/
+template <typename T, typename Q = locking_queues>
 class server : public iserver<T>, protected iserverext<T> {
 public:
-    server(uint16_t port, uint32_t serverTimeout = 5000)
-        : m_socket { m_asioContext, boost::asio::ip::udp::endpoint { boost::asio::ip::udp::v4(), port } },
+    /// Interval at which timed out users are looked for.
+    static constexpr std::chrono::milliseconds SWEEP_INTERVAL { 100 };
+
+    /// Most datagrams kept for a lost user, the oldest being dropped beyond.
+    static constexpr size_t MAX_RETAINED_DATAGRAMS = 1024;
+
+    /**
+     * Constructor for the server. Binds the socket to the given port.
+     * 
+     * @param port          the port to listen on.
+     * @param serverTimeout the time in ms without messages after which a client is dropped.
+     * @param numThreads    the number of networking threads sharing the socket, or each with
+     *                      a socket of its own, if `options.m_reusePort` is set.
+     * @param batchedIo     whether to receive and send up to `MAX_DATAGRAMS_PER_BATCH`
+     *                      datagrams per system call. Only supported on Linux, ignored elsewhere.
+     * @param options       the options of the sockets.
+    */
+    server(uint16_t port, uint32_t serverTimeout = 5000, size_t numThreads = 1, bool batchedIo = false,
+           const socket_options& options = {})
+        : m_ioPool { NumShards(numThreads, options), numThreads / NumShards(numThreads, options) },
+          m_strand { boost::asio::make_strand(m_ioPool.Get(0)) },
+          m_sweepTimer { m_ioPool.Get(0) },
+          m_flushTimer { m_ioPool.Get(0) },
+          m_reliableTimer { m_ioPool.Get(0) },
+          m_statsTimer { m_ioPool.Get(0) },
+          m_receiveSlots(numThreads > 0 ? numThreads : 1),
           m_serverTimeout { serverTimeout } {
 
-        m_tempBufferIn.resize(MAX_MESSAGE_SIZE_IN_BYTES);
+        size_t numShards = m_ioPool.Size();
+        boost::asio::ip::udp::endpoint endpoint { boost::asio::ip::udp::v4(), port };
+
+        for (size_t i = 0; i < numShards; ++i) {
+            m_shards.push_back(std::make_unique<shard>(m_ioPool.Get(i), i, numShards));
+            boost::asio::ip::udp::socket& socket = m_shards[i]->m_socket;
+
+            // Some options must be set before binding.
+            socket.open(endpoint.protocol());
+            apply_socket_options(socket, options);
+            socket.bind(endpoint);
+
+            // The other shards join the port the first one got, e.g. when any port would do.
+            endpoint.port(socket.local_endpoint().port());
+        }
+
+        if (numShards > 1 && options.m_cpuSteering) {
+            attach_cpu_steering(m_shards[0]->m_socket, numShards);
+        }
+
+#ifdef FLASH_HAS_MMSG
+        m_batchedIo = batchedIo;
+#endif
+        size_t datagramsPerSlot = m_batchedIo ? MAX_DATAGRAMS_PER_BATCH : 1;
+
+        for (size_t i = 0; i < m_receiveSlots.size(); ++i) {
+            receive_slot& slot = m_receiveSlots[i];
+            slot.m_shard = m_shards[i % numShards].get();
+            slot.m_buffer.resize(datagramsPerSlot * MAX_MESSAGE_SIZE_IN_BYTES);
+            slot.m_remoteEndpoints.resize(datagramsPerSlot);
+        }
+
+#ifdef FLASH_HAS_MMSG
+        if (m_batchedIo) {
+            // The system calls are made directly on the sockets, and must never block.
+            for (auto& shard : m_shards) {
+                shard->m_socket.non_blocking(true);
+            }
+
+            for (auto& slot : m_receiveSlots) {
+                SetupBatch(slot);
+            }
+        }
+#endif
     }
 
     virtual ~server() { }
 
     bool Start() final {
-        if (m_threadContext.joinable() && !m_asioContext.stopped()) {
-            std::cout << "[SERVER] Already running!\n";
+        if (m_ioPool.IsRunning()) {
+            FLASH_LOG(warning, INVALID_USER_ID, "[SERVER] Already running!");
             return false;
         }
 
         try {
-            WaitForMessages();
+            for (auto& slot : m_receiveSlots) {
+                WaitForMessages(slot);
+            }
 
-            m_threadContext = std::thread([this]() { m_asioContext.run(); });
+            m_sweepTimer.Start(SWEEP_INTERVAL, [this]() { CleanupUsers(); });
+
+            if (m_coalescingMtu > 0) {
+                m_flushTimer.Start(m_flushInterval, [this]() { Flush(); });
+            }
+
+            if (m_reliable) {
+                m_reliableTimer.Start(RELIABLE_TICK_INTERVAL, [this]() {
+                    boost::asio::post(m_strand, [this]() { PollReliable(); });
+                });
+            }
+
+            if (m_statsCallback) {
+                m_statsTimer.Start(m_statsInterval, [this]() { m_statsCallback(GetStats()); });
+            }
+
+            m_ioPool.Run();
 
         } catch (std::exception& e) {
-            std::stringstream ss;
-            ss << "[SERVER] Exception: " << e.what() << "\n";
-            std::cout << ss.str();
+            FLASH_LOG(error, INVALID_USER_ID, "[SERVER] Exception: " << e.what());
 
             return false;
         }
 
-        std::stringstream ss;
-        ss << "[SERVER] Started on port " << m_socket.local_endpoint().port() << "\n";
-        std::cout << ss.str();
+        FLASH_LOG(info, INVALID_USER_ID, "[SERVER] Started on port " << SendSocket().local_endpoint().port());
 
         return true;
     }
 
     void Stop() final {
-        boost::asio::post(m_asioContext, [this]() { m_asioContext.stop(); });
-        
-        if (m_threadContext.joinable()) {
-            m_threadContext.join();
+        m_ioPool.Stop();
+        m_sweepTimer.Stop();
+        m_flushTimer.Stop();
+        m_reliableTimer.Stop();
+        m_statsTimer.Stop();
+
+        FLASH_LOG(info, INVALID_USER_ID, "[SERVER] Stopped!");
+    }
+
+    /**
+     * Sends the messages of the given type as delta streams, e.g. for world snapshots:
+     * each one is encoded against the last one the client acknowledged, when smaller.
+     * Clients decode them transparently, so they receive the original messages.
+     * 
+     * Every message of the type is then encoded separately for every client,
+     * including broadcasts. Must be called before `Start`.
+    */
+    void EnableDeltaEncoding(T type) {
+        m_deltaTypes.insert(type);
+    }
+
+    /**
+     * Compresses the bodies of outgoing messages from the given size, and decompresses
+     * incoming ones, so that messages too large for a datagram may still fit once compressed.
+     * Clients must use a compressor for the same algorithm. Messages of types sent as
+     * delta streams are never compressed. Must be called before `Start`.
+     * 
+     * @param comp      the compression algorithm, or null to disable compression.
+     * @param threshold the body size from which messages are compressed.
+    */
+    void SetCompression(std::shared_ptr<const compressor> comp, size_t threshold = DEFAULT_COMPRESSION_THRESHOLD) {
+        m_compression = compression_settings { std::move(comp), threshold };
+    }
+
+    /**
+     * Packs the messages to the same client into datagrams of up to the given size,
+     * instead of sending a datagram per message. Clients unpack them transparently.
+     * 
+     * Messages wait to be packed until their datagram is full, until `Flush` is called,
+     * e.g. at the end of a tick, or for at most the flush interval.
+     * Must be called before `Start`.
+     * 
+     * @param mtu           the largest datagram to send, headers included.
+     * @param flushInterval the longest time a message waits to be packed.
+    */
+    void EnableCoalescing(size_t mtu = DEFAULT_COALESCING_MTU,
+                          std::chrono::milliseconds flushInterval = DEFAULT_FLUSH_INTERVAL) {
+        m_coalescingMtu = mtu;
+        m_flushInterval = flushInterval;
+    }
+
+    /**
+     * Sends the messages waiting to be packed right away, when coalescing.
+    */
+    void Flush() {
+        if (m_coalescingMtu > 0) {
+            boost::asio::post(m_strand, [this]() { FlushPackets(); });
+        }
+    }
+
+    /**
+     * Enables `SendReliable`, and the delivery of reliable messages from clients.
+     * Clients must enable reliability as well. Must be called before `Start`.
+    */
+    void EnableReliability() {
+        m_reliable = true;
+    }
+
+    /**
+     * Grants a session to every client with sessions it validates, so that a client that
+     * loses its connection, or changes address, may resume it from a new endpoint with
+     * a single datagram, see `flash/session.hpp`. A resumed client keeps its ID, its delta streams
+     * and reliable channel, and is not validated again.
+     * 
+     * Users that time out are held for the grace period: datagrams to them are kept,
+     * up to `MAX_RETAINED_DATAGRAMS`, and sent once the session is resumed.
+     * `OnClientDisconnect` is only called once the grace period is over.
+     * Clients without sessions are served as before, and not held.
+     * Must be called before `Start`.
+     * 
+     * @param grace the time a user that timed out is held for.
+    */
+    void EnableSessions(std::chrono::milliseconds grace = DEFAULT_SESSION_GRACE) {
+        m_sessionGrace = grace;
+    }
+
+    /**
+     * Sends a message that is resent until the client acknowledges it, and delivered
+     * in order with the other reliable messages to the client, e.g. for game events.
+     * Plain messages are not ordered with respect to these, and reliable messages
+     * are never delta-encoded.
+    */
+    void SendReliable(UserId clientId, message<T>&& msg) {
+        assert(m_reliable);
+        compress_message(m_compression, msg);
+
+        // Message is too long once wrapped, reject.
+        if (msg.size() + RELIABLE_OVERHEAD > MAX_MESSAGE_SIZE_IN_BYTES) {
+            assert(false);
+            return;
         }
 
-        std::cout << "[SERVER] Stopped!\n";
+        m_counters.count_out(msg.get_header().m_type, msg.size());
+
+        boost::asio::post(
+            m_strand,
+            [this, clientId, msg = std::move(msg)]() mutable {
+                reliable_channel<T>* channel = GetChannel(clientId);
+                if (!channel) return;
+
+                msg.get_header().m_size = boost::endian::native_to_big(msg.get_header().m_size);
+                channel->send(std::move(msg));
+                PollChannel(clientId, *channel, std::chrono::steady_clock::now());
+
+                if (!m_sending) {
+                    SendMessages();
+                }
+            }
+        );
+    }
+
+    /**
+     * Sets the priority class of the messages of the given type, e.g. `priority::realtime`
+     * for position updates, so they are sent before messages of less urgent types that
+     * are waiting. Must be called before `Start`.
+    */
+    void SetPriority(T type, priority p) {
+        m_priorities.set(type, p);
+    }
+
+    /**
+     * Sets where the messages of the given type are handled. With `dispatch_mode::immediate`,
+     * `OnMessage` is called right away on the networking thread that received the datagram,
+     * skipping the incoming queue, so it must be thread-safe, and may run concurrently with
+     * several threads, and before queued messages that arrived earlier. Must be called before `Start`.
+    */
+    void SetDispatch(T type, dispatch_mode mode) {
+        m_dispatch.set(type, mode);
+    }
+
+    /**
+     * Bounds the bytes queued to each client, so that one client being sent more than
+     * the socket keeps up with can't make the server queue unbounded memory. Beyond the mark,
+     * `OnBackpressure` is called, from the strand, and the policy applies. Must be called before `Start`.
+     * 
+     * @param highWaterBytes the bytes queued to a client from which the policy applies, 0 for no bound.
+     * @param policy         what to do with datagrams beyond the mark.
+    */
+    void SetBackpressure(size_t highWaterBytes, backpressure_policy policy = backpressure_policy::drop_oldest) {
+        m_backpressure = backpressure_settings { highWaterBytes, policy };
+    }
+
+    /**
+     * Pushes the stats to the given function periodically, from a networking thread,
+     * e.g. to export them. Must be called before `Start`.
+     * 
+     * @param callback the function to call with the stats, or null to not push them.
+     * @param interval the time between calls.
+    */
+    void SetStatsCallback(stats_callback callback, std::chrono::milliseconds interval = DEFAULT_STATS_INTERVAL) {
+        m_statsCallback = std::move(callback);
+        m_statsInterval = interval;
+    }
+
+    /**
+     * @returns A snapshot of the counters of the server and of every user.
+     * Safe to call from any thread.
+    */
+    server_stats GetStats() final {
+        server_stats stats;
+        m_counters.snapshot(stats);
+        stats.m_incomingDepth = m_qMessagesIn.size();
+        stats.m_outgoingDepth = m_qMessagesOut.size();
+
+        for (auto& shard : m_shards) {
+            std::scoped_lock lock { shard->m_mutexUsers };
+
+            shard->m_userIdToUser.for_each([&stats](UserId userId, const User& user) {
+                if (user.m_validated) stats.m_byClient[userId] = user.m_traffic;
+            });
+        }
 
-        m_asioContext.reset();
+        return stats;
     }
 
     void MessageClient(UserId clientId, message<T>&& msg) final {
-        Send(clientId, std::move(msg));
+        priority p = m_priorities.get(msg.get_header().m_type);
+        Send(clientId, std::move(msg), p);
+    }
+
+    /**
+     * Message a client directly, with the given priority class rather than the one of its type.
+    */
+    void MessageClient(UserId clientId, message<T>&& msg, priority p) {
+        Send(clientId, std::move(msg), p);
     }
 
+    /**
+     * Message all validated clients, optionally ignoring a specific client.
+     * 
+     * The datagram is encoded once and shared by all the recipients, instead of copied.
+    */
     void MessageAllClients(message<T>&& msg, UserId ignoreId = INVALID_USER_ID) final {
-        for (auto& user : m_userIdToUser) {
-            if (user.first != ignoreId) {
-                Send(user.first, std::move(msg));
-            }
+        std::vector<UserId> recipients;
+
+        for (auto& shard : m_shards) {
+            std::scoped_lock lock { shard->m_mutexUsers };
+
+            recipients.reserve(recipients.size() + shard->m_userIdToUser.size());
+
+            shard->m_userIdToUser.for_each([&recipients, ignoreId](UserId userId, const User& user) {
+                if (userId != ignoreId && user.m_validated) {
+                    recipients.push_back(userId);
+                }
+            });
+        }
+
+        priority p = m_priorities.get(msg.get_header().m_type);
+        SendShared(std::move(recipients), std::move(msg), p);
+    }
+
+    /**
+     * Message a number of clients at once, e.g. the players near some event.
+     * 
+     * The datagram is encoded once and shared by all the recipients, instead of copied.
+     * Unknown clients are skipped when sending.
+    */
+    void MessageClients(const std::vector<UserId>& clientIds, message<T>&& msg) final {
+        priority p = m_priorities.get(msg.get_header().m_type);
+        SendShared(std::vector<UserId>(clientIds), std::move(msg), p);
+    }
+
+    /**
+     * Creates an empty group of clients, to be messaged at once with `MessageGroup`.
+     * 
+     * @returns The ID of the group, or `INVALID_GROUP_ID` if there are too many groups.
+    */
+    GroupId CreateGroup() final {
+        std::scoped_lock lock { m_mutexGroups };
+        return m_groups.create();
+    }
+
+    /**
+     * Destroys a group, which its members leave.
+     * 
+     * @returns Whether there was such a group.
+    */
+    bool DestroyGroup(GroupId groupId) final {
+        std::scoped_lock lock { m_mutexGroups };
+        return m_groups.destroy(groupId);
+    }
+
+    /**
+     * Adds a validated client to a group. Clients leave their groups when they disconnect.
+     * 
+     * @returns Whether the client was added, false if either is unknown, or the client was already in the group.
+    */
+    bool AddToGroup(GroupId groupId, UserId clientId) final {
+        shard& owner = ShardOf(clientId);
+
+        // Both held, so that a client disconnecting meanwhile is not added after leaving its groups.
+        std::scoped_lock lock { owner.m_mutexUsers, m_mutexGroups };
+
+        const User* user = owner.m_userIdToUser.find(clientId);
+        if (!user || !user->m_validated) return false;
+
+        return m_groups.add(groupId, clientId);
+    }
+
+    /**
+     * Removes a client from a group.
+     * 
+     * @returns Whether the client was in the group.
+    */
+    bool RemoveFromGroup(GroupId groupId, UserId clientId) final {
+        std::scoped_lock lock { m_mutexGroups };
+        return m_groups.remove(groupId, clientId);
+    }
+
+    /**
+     * Message the members of a group, optionally ignoring a specific client, e.g. the players
+     * in some zone of the world.
+     * 
+     * The datagram is encoded once and shared by all the recipients, as with `MessageClients`.
+    */
+    void MessageGroup(GroupId groupId, message<T>&& msg, UserId ignoreId = INVALID_USER_ID) final {
+        std::vector<UserId> recipients;
+
+        {
+            std::scoped_lock lock { m_mutexGroups };
+
+            const std::vector<UserId>* group = m_groups.members(groupId);
+            if (!group) return;
+
+            recipients.reserve(group->size());
+            std::copy_if(group->begin(), group->end(), std::back_inserter(recipients),
+                [ignoreId](UserId userId) { return userId != ignoreId; });
         }
+
+        priority p = m_priorities.get(msg.get_header().m_type);
+        SendShared(std::move(recipients), std::move(msg), p);
     }
 
     void Update(size_t maxMessages = -1, bool wait = false) final {
         if (wait) m_qMessagesIn.wait();
 
-        size_t messageCount = 0;
-        while (messageCount < maxMessages && !m_qMessagesIn.empty()) {
-            auto taggedMsg = m_qMessagesIn.pop_front();
+        // Take the whole backlog at once, then process it without touching the queue.
+        m_qMessagesIn.drain_into(m_batchIn, maxMessages);
+
+        std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point start = batchStart;
+        std::chrono::steady_clock::duration longest {};
+
+        for (auto& taggedMsg : m_batchIn) {
             OnMessage(taggedMsg.m_remote, std::move(taggedMsg.m_msg));
-            ++messageCount;
+
+            // Recycle the body, unless the handler kept it.
+            m_bodyPool.release(taggedMsg.m_msg.get_body().release());
+
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            longest = std::max(longest, end - start);
+            start = end;
+        }
+
+        if (!m_batchIn.empty()) {
+            m_counters.count_handled(m_batchIn.size(), start - batchStart, longest);
         }
+
+        m_batchIn.clear();
     }
 
+#ifdef FLASH_WITH_COROUTINES
+    /**
+     * Waits for messages to arrive without blocking a thread, then processes them as `Update` does.
+     * Must be awaited from a coroutine spawned on `GetExecutor()`, e.g.
+     * `while (running) co_await server.NextMessages();`.
+     * 
+     * @param maxMessages the maximum number of messages to process.
+    */
+    boost::asio::awaitable<void> NextMessages(size_t maxMessages = -1) {
+        co_await m_messageWaiter.wait([this]() { return !m_qMessagesIn.empty(); });
+
+        Update(maxMessages, false);
+    }
+
+    /**
+     * @returns The strand that the socket is served on. Coroutines spawned on it get their
+     * messages without any hop between threads, and are serialized with the networking.
+    */
+    boost::asio::any_io_executor GetExecutor() { return m_messageWaiter.get_executor(); }
+#endif
+
 protected:
     /**
      * Called when a client connected, returns whether to accept the connection.
@@ -138,166 +601,712 @@ protected:
     */
     void OnMessage(UserId clientId, message<T>&& msg) override = 0;
 
-    ts_deque<tagged_message<T>> m_qMessagesIn;   // Queue of incoming messages.
-    ts_deque<tagged_message<T>> m_qMessagesOut;  // Queue of outgoing messages.
+    /**
+     * Socket, and tables of the users it received first. The user of an ID is in the shard
+     * whose position is the index of the ID modulo the number of shards.
+    */
+    struct shard {
+        shard(boost::asio::io_context& context, size_t position, size_t numShards)
+            : m_socket { context },
+              m_userIdToUser { static_cast<uint32_t>(position), static_cast<uint32_t>(numShards) } { }
+
+        boost::asio::ip::udp::socket m_socket;  // Socket to listen for incoming messages.
+
+        /// Maps remote endpoints to user IDs.
+        endpoint_map m_endpointToUserId;
+
+        /// Maps user IDs, which it issues, to user data.
+        slot_map<User> m_userIdToUser;
+
+        std::mutex m_mutexUsers;  // Lock around the user tables.
+    };
+
+    /**
+     * State of one receive loop, so that each thread can receive into its own buffers.
+     * In batched mode, there is one buffer and endpoint for every datagram of a batch.
+    */
+    struct receive_slot {
+        shard* m_shard { nullptr };                                     // Shard whose socket it receives from.
+        std::vector<uint8_t> m_buffer;                                  // Buffers to store incoming datagrams.
+        std::vector<boost::asio::ip::udp::endpoint> m_remoteEndpoints;  // Remote endpoint of each datagram.
+
+#ifdef FLASH_HAS_MMSG
+        std::vector<mmsghdr> m_headers;  // Headers for `recvmmsg`, pointing into the buffers.
+        std::vector<iovec> m_iovecs;     // Buffer descriptions for `recvmmsg`.
+#endif
+    };
+
+    /**
+     * Datagram waiting to be sent to a user, either owned or shared with other users.
+     * Either way, its header is in network byte order.
+    */
+    struct datagram {
+        UserId m_remote;            // ID of the user to send to.
+        message<T> m_owned;         // Message owned by this datagram, unless shared.
+        shared_message<T> m_shared; // Message shared with other datagrams, or null.
+        bool m_dropped { false };   // Whether it was dropped by backpressure while queued.
+
+        std::chrono::steady_clock::time_point m_queued {};  // When it was pushed to the outgoing queue.
+        priority m_priority { priority::normal };           // Class it was pushed with, to push it again.
+
+        const message<T>& get() const { return m_shared ? *m_shared : m_owned; }
+    };
+
+    typename Q::template incoming<tagged_message<T>> m_qMessagesIn;  // Queue of incoming messages.
+    priority_lanes<Q, datagram> m_qMessagesOut;                      // Queues of outgoing datagrams by priority, on the strand.
+    std::vector<tagged_message<T>> m_batchIn;                        // Messages being processed by Update.
+    buffer_pool m_bodyPool;                                          // Recycled bodies of incoming messages.
+    compression_settings m_compression;                              // Compression of the messages, if any.
+    priority_map<T> m_priorities;                                    // Priority class of each message type.
+    dispatch_map<T> m_dispatch;                                      // Dispatch mode of each message type.
+    server_counters m_counters;                                      // Counters of the server, from any thread.
+
+    io_context_pool m_ioPool;  // The asio context for the server and its threads.
+
+    /// Serializes the operations on the socket and the outgoing queue.
+    boost::asio::strand<boost::asio::io_context::executor_type> m_strand;
+
+#ifdef FLASH_WITH_COROUTINES
+    message_waiter m_messageWaiter { m_strand };  // Wakes the coroutine awaiting messages, on the strand.
+#endif
+
+    std::vector<std::unique_ptr<shard>> m_shards;  // One per context, the first one sends.
+    periodic_timer m_sweepTimer;                   // Drops timed out users, and timestamps datagrams.
+    periodic_timer m_flushTimer;                   // Sends the datagrams being packed, when coalescing.
+    periodic_timer m_reliableTimer;                // Resends, and sends owed acks, on the reliable channels.
+    periodic_timer m_statsTimer;                   // Pushes the stats to the callback, if any.
+    bool m_batchedIo { false };                    // Whether datagrams are received and sent in batches.
+
+    std::vector<receive_slot> m_receiveSlots;  // One receive loop per thread.
+
+    /// Datagram being sent, taken off the queue since more urgent ones may be queued meanwhile.
+    datagram m_datagramOut { INVALID_USER_ID, message<T> { static_cast<T>(0) }, nullptr };
+
+    std::array<boost::asio::const_buffer, 2> m_buffersOut;  // Header and body of the datagram being sent.
+    bool m_sending { false };                               // Whether datagrams are being sent, on the strand.
+
+#ifdef FLASH_HAS_MMSG
+    std::vector<datagram> m_batchOut;                            // Datagrams of the batch being sent.
+    size_t m_batchOutSent { 0 };                                 // Number of datagrams of the batch already sent.
+    std::vector<boost::asio::ip::udp::endpoint> m_endpointsOut;  // Endpoint of each datagram of the batch.
+    std::vector<mmsghdr> m_headersOut;                           // Headers for `sendmmsg`.
+    std::vector<iovec> m_iovecsOut;                              // Header and body of each datagram of the batch.
+#endif
+
+    uint32_t m_serverTimeout;  // Disconnection timeout for clients in ms.
+
+    std::unordered_set<T> m_deltaTypes;                            // Types sent as delta streams.
+    std::unordered_map<UserId, delta_encoder<T>> m_deltaEncoders;  // Delta streams of each user, on the strand.
+
+    size_t m_coalescingMtu { 0 };                                          // Largest packed datagram, 0 if not coalescing.
+    std::chrono::milliseconds m_flushInterval { DEFAULT_FLUSH_INTERVAL };  // Longest wait to be packed.
+    /**
+     * Datagram being packed for a user, sent with the most urgent priority of its messages.
+    */
+    struct packet_out {
+        datagram_packer<T> m_packer;
+        priority m_priority { priority::bulk };
+    };
 
-    boost::asio::io_context m_asioContext;  // The asio context for the server.
-    boost::asio::ip::udp::socket m_socket;  // Socket to listen for incoming messages.
-    std::thread m_threadContext;            // Thread that runs the asio context.
+    std::unordered_map<UserId, packet_out> m_packetsOut;  // Datagram being packed for each user, on the strand.
 
-    boost::asio::ip::udp::endpoint m_remoteEndpoint;  // Holds the remote endpoint that last sent a message.
+    bool m_reliable { false };                                           // Whether the reliable channels are enabled.
+    std::unordered_map<UserId, reliable_channel<T>> m_reliableChannels;  // Reliable channel of each user, on the strand.
 
-    std::vector<uint8_t> m_tempBufferIn;    // Buffer to store incoming messages.
-    std::vector<uint8_t> m_tempBufferOut;   // Buffer to store outgoing messages.
+    backpressure_settings m_backpressure;  // Bound on the bytes queued to each user.
+    std::unordered_map<UserId, queue_usage> m_queueUsage;  // Bytes queued to each user, on the strand.
 
-    uint64_t m_tempHandshakeOut;            // Temporary handshake value for sending.
+    std::chrono::milliseconds m_sessionGrace { 0 };  // Time a user that timed out is held, 0 without sessions.
+    std::unordered_map<UserId, std::deque<datagram>> m_retained;  // Datagrams kept for each lost user, on the strand.
 
-    UserId m_uidCounter = 100000;  // Used to assign unique 6-digit IDs to clients.
-    uint32_t m_serverTimeout;      // Disconnection timeout for clients in ms.
+    client_groups m_groups;    // Groups of clients, by ID.
+    std::mutex m_mutexGroups;  // Lock around the groups, taken after the one of any shard.
 
-    /// Maps remote endpoints to user IDs.
-    std::unordered_map<boost::asio::ip::udp::endpoint, UserId> m_endpointToUserId;
-    
-    /// Maps user IDs to user data.
-    std::unordered_map<UserId, User> m_userIdToUser;
+    stats_callback m_statsCallback;                                        // Function the stats are pushed to, or null.
+    std::chrono::milliseconds m_statsInterval { DEFAULT_STATS_INTERVAL };  // Time between pushes.
 
 private:
-    void HandleNewConnection(std::size_t length) {
+    /**
+     * @returns The number of shards: one per thread with `m_reusePort`, if supported, one otherwise.
+    */
+    static size_t NumShards(size_t numThreads, const socket_options& options) {
+#ifdef SO_REUSEPORT
+        if (options.m_reusePort && numThreads > 1) return numThreads;
+#endif
+        return 1;
+    }
+
+    /**
+     * @returns The socket that datagrams are sent on, from the strand.
+    */
+    boost::asio::ip::udp::socket& SendSocket() { return m_shards[0]->m_socket; }
+
+    /**
+     * @returns The shard holding the user of the given ID, if any.
+    */
+    shard& ShardOf(UserId userId) {
+        return *m_shards[slot_map<User>::index_of(userId) % m_shards.size()];
+    }
+
+    /**
+     * Removes a user that has gone away from its groups, then tells the handler.
+     * Must be called without holding the locks.
+    */
+    void Disconnected(UserId userId) {
+        {
+            std::scoped_lock lock { m_mutexGroups };
+            m_groups.remove_user(userId);
+        }
+
+        OnClientDisconnect(userId);
+    }
+
+    /**
+     * Finds a user while going through a number of them, only locking another shard when
+     * the user is in one, so that the lock is held throughout with a single shard.
+     * 
+     * @param lock   the lock held, if any, replaced by the one of the shard of the user.
+     * @param locked the shard whose lock is held, if any.
+     * @returns The user, valid while the lock is held, or null if it has gone away.
+    */
+    User* LockedFind(UserId userId, std::unique_lock<std::mutex>& lock, shard*& locked) {
+        shard& owner = ShardOf(userId);
+
+        if (&owner != locked) {
+            if (lock) lock.unlock();
+            lock = std::unique_lock<std::mutex> { owner.m_mutexUsers };
+            locked = &owner;
+        }
+
+        return owner.m_userIdToUser.find(userId);
+    }
+
+    /**
+     * Runs the given function where it may use the socket of a shard. When every socket is
+     * served by a single thread, every handler of the shard already runs on it, strand
+     * included, so there is no need to go through the strand.
+    */
+    template <typename F>
+    void DispatchOnSocket(F&& f) {
+        if (m_receiveSlots.size() == m_shards.size()) {
+            f();
+        } else {
+            boost::asio::dispatch(m_strand, std::forward<F>(f));
+        }
+    }
+
+    void HandleNewConnection(const uint8_t* data, std::size_t length, const boost::asio::ip::udp::endpoint& remote, shard& receiver) {
+        if (length == RESUME_REQUEST_SIZE && m_sessionGrace.count() > 0) {
+            HandleResume(data, remote, receiver);
+            return;
+        }
+
         // Message is not correct size, ignore.
-        if (length != sizeof(uint64_t)) return;
+        if (length != sizeof(uint64_t)) {
+            CountMalformed();
+            return;
+        }
 
         // Read the magic number.
         uint64_t magicNumber;
-        std::memcpy(&magicNumber, m_tempBufferIn.data(), sizeof(uint64_t));
+        std::memcpy(&magicNumber, data, sizeof(uint64_t));
         magicNumber = boost::endian::big_to_native(magicNumber);
 
         // Magic number does not match, ignore.
-        if (magicNumber != CONNECTION_REQUEST_MAGIC_NUMBER) return;
+        if (magicNumber != CONNECTION_REQUEST_MAGIC_NUMBER) {
+            CountMalformed();
+            return;
+        }
 
         // Give the custom server a chance to deny connection by overriding OnClientConnect.
-        if (OnClientConnect(m_remoteEndpoint.address())) {
-            UserId newId = m_uidCounter++;
+        if (OnClientConnect(remote.address())) {
+            UserId newId;
             std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
 
-            // Generate validation data
-            uint64_t handshake = Scramble(uint64_t(now.time_since_epoch().count()));
+            // Generate validation data, offering sessions if enabled.
+            uint64_t handshake = Scramble(uint64_t(now.time_since_epoch().count())) & ~SESSION_OFFER_BIT;
+            if (m_sessionGrace.count() > 0) handshake |= SESSION_OFFER_BIT;
+
             uint64_t handshakeCheck = Scramble(handshake);
 
-            // Assign the user to the endpoint.
-            m_endpointToUserId[m_remoteEndpoint] = newId;
-            m_userIdToUser[newId] = User { m_remoteEndpoint, now, false, handshake, handshakeCheck };
+            {
+                std::scoped_lock lock { receiver.m_mutexUsers };
+
+                // Another thread got a request from the same endpoint first, ignore.
+                if (receiver.m_endpointToUserId.contains(remote)) return;
+
+                newId = receiver.m_userIdToUser.insert(User { remote, now, false, handshake, handshakeCheck, {} });
+
+                // Assign the user to the endpoint, unless the server is full.
+                if (newId != INVALID_USER_ID) receiver.m_endpointToUserId.insert(remote, newId);
+            }
+
+            if (newId == INVALID_USER_ID) {
+                FLASH_LOG(warning, INVALID_USER_ID, "[------] Connection Denied, Server Full");
+                return;
+            }
 
             // Send the validation handshake.
-            SendValidation(newId);
+            SendValidation(receiver, remote, handshake);
 
-            std::stringstream ss;
-            ss << "[" << newId << "] Connection Approved\n";
-            std::cout << ss.str();
+            FLASH_LOG(info, newId, "Connection Approved");
 
         } else {
-            std::cout << "[------] Connection Denied\n";
+            FLASH_LOG(warning, INVALID_USER_ID, "[------] Connection Denied");
         }
     }
 
-    void HandleValidation(UserId userId, std::size_t length) {
-        if (length != sizeof(uint64_t)) {
-            // Message is not correct size, kill the user.
-            std::stringstream ss;
-            ss << "[" << userId << "] Client Handshake Failed.\n";
-            std::cout << ss.str();
-
-            m_endpointToUserId.erase(m_remoteEndpoint);
-            m_userIdToUser.erase(userId);
+    /**
+     * Handles a request to resume a session from a new endpoint: moves the user of the session
+     * to the endpoint if the server still holds it, or tells the client that it is gone,
+     * so that it connects anew.
+    */
+    void HandleResume(const uint8_t* data, const boost::asio::ip::udp::endpoint& remote, shard& receiver) {
+        uint64_t magicNumber;
+        std::memcpy(&magicNumber, data, sizeof(uint64_t));
+        magicNumber = boost::endian::big_to_native(magicNumber);
 
+        // Magic number does not match, ignore.
+        if (magicNumber != RESUME_REQUEST_MAGIC_NUMBER) {
+            CountMalformed();
             return;
         }
 
-        uint64_t handshakeIn;
-        std::memcpy(&handshakeIn, m_tempBufferIn.data(), sizeof(uint64_t));
-        handshakeIn = boost::endian::big_to_native(handshakeIn);
-
-        if (handshakeIn != m_userIdToUser[userId].m_handshakeCheck) {
-            // Handshake does not match, kill the user.
-            std::stringstream ss;
-            ss << "[" << userId << "] Client Handshake Failed.\n";
-            std::cout << ss.str();
-
-            m_endpointToUserId.erase(m_remoteEndpoint);
-            m_userIdToUser.erase(userId);
+        session_token token;
+        session_request_schema::decode_from(data + sizeof(uint64_t), token.m_id, token.m_secret);
 
+        // Give the custom server a chance to deny connection by overriding OnClientConnect.
+        if (!OnClientConnect(remote.address())) {
+            FLASH_LOG(warning, INVALID_USER_ID, "[------] Connection Denied");
             return;
         }
 
-        m_userIdToUser[userId].m_validated = true;
-        m_userIdToUser[userId].m_lastMessageTime = std::chrono::steady_clock::now();
+        bool resumed = false;
 
-        std::stringstream ss;
-        ss << "[" << userId << "] Client Validated.\n";
-        std::cout << ss.str();
+        if (token.valid()) {
+            shard& owner = ShardOf(token.m_id);
+            std::scoped_lock lock { owner.m_mutexUsers };
 
-        OnClientValidate(userId);
-    }
+            User* user = owner.m_userIdToUser.find(token.m_id);
 
-    void ProcessMessage(UserId userId, std::size_t length) {
-        // Message is too short to be in the canonical format, ignore
-        if (length < sizeof(header<T>)) return;
+            // The endpoint may have been given to the user by another thread first.
+            if (user && user->m_validated && same_session_secret(user->m_sessionSecret, token.m_secret) && !owner.m_endpointToUserId.contains(remote)) {
+                // A lost user no longer has its endpoint, which may be someone else's by now.
+                if (!user->m_lost) owner.m_endpointToUserId.erase(user->m_endpoint);
 
-        message<T> msg { static_cast<T>(0) };
-        std::memcpy(&msg.get_header(), m_tempBufferIn.data(), sizeof(header<T>));
-        msg.get_header().m_size = boost::endian::big_to_native(msg.get_header().m_size);
+                user->m_endpoint = remote;
+                user->m_lastMessageTime = m_sweepTimer.Now();
+                user->m_lost = false;
+                user->m_resuming = true;
+                owner.m_endpointToUserId.insert(remote, token.m_id);
 
-        // Size of message body does not match the size in the header, ignore
-        if (length - sizeof(header<T>) != msg.get_header().m_size) return;
+                resumed = true;
+            }
+        }
+
+        if (!resumed) {
+            FLASH_LOG(info, INVALID_USER_ID, "[------] Session Not Resumed");
 
-        msg.get_body().resize(msg.get_header().m_size);
-        std::memcpy(msg.get_body().data(), m_tempBufferIn.data() + sizeof(header<T>), msg.get_header().m_size);
+            SendRefusal(receiver, remote);
+            return;
+        }
 
-        m_userIdToUser[userId].m_lastMessageTime = std::chrono::steady_clock::now();
+        FLASH_LOG(info, token.m_id, "Client Resumed.");
 
-        // Push the message to the incoming queue.
-        m_qMessagesIn.push_back(tagged_message<T> { userId, std::move(msg) });
+        m_counters.m_resumed.fetch_add(1, std::memory_order_relaxed);
+        SendGrant(token, true);
     }
-    
-    void WaitForMessages() {
-        m_socket.async_receive_from(
-            boost::asio::buffer(m_tempBufferIn.data(), m_tempBufferIn.size()), m_remoteEndpoint,
-            [this](std::error_code ec, std::size_t length) {
-                if (!ec) {
-                    CleanupUsers();
 
-                    // Handles the case that the endpoint is new
-                    if (m_endpointToUserId.find(m_remoteEndpoint) == m_endpointToUserId.end()) {
-                        HandleNewConnection(length);
+    void HandleValidation(const uint8_t* data, std::size_t length, const boost::asio::ip::udp::endpoint& remote, UserId userId) {
+        bool validated = false;
+        shard& owner = ShardOf(userId);
+        uint64_t secret = 0;
 
-                        WaitForMessages();
-                        return;
-                    }
+        if (length == sizeof(uint64_t)) {
+            uint64_t handshakeIn;
+            std::memcpy(&handshakeIn, data, sizeof(uint64_t));
+            handshakeIn = boost::endian::big_to_native(handshakeIn);
 
-                    // The endpoint is known and has been assigned an ID.
-                    UserId userId = m_endpointToUserId[m_remoteEndpoint];
+            std::scoped_lock lock { owner.m_mutexUsers };
 
-                    if (m_userIdToUser[userId].m_validated == false) {
-                        HandleValidation(userId, length);
+            User* user = owner.m_userIdToUser.find(userId);
+            if (!user) return;
 
-                        WaitForMessages();
-                        return;
-                    }
+            // Only clients that took up the offer get a session, the others are not held.
+            bool sessionAgreed = m_sessionGrace.count() > 0 && handshakeIn == (user->m_handshakeCheck ^ SESSION_RESPONSE_MASK);
 
-                    // The user is validated and we will process their messages.
-                    ProcessMessage(userId, length);
+            if (handshakeIn == user->m_handshakeCheck || sessionAgreed) {
+                user->m_validated = true;
+                user->m_lastMessageTime = m_sweepTimer.Now();
+                validated = true;
 
-                } else {
-                    std::stringstream ss;
-                    ss << "[SERVER] Error receiving message: " << ec.message() << "\n";
-                    std::cout << ss.str();
+                if (sessionAgreed) {
+                    secret = user->m_sessionSecret = make_session_secret();
                 }
+            }
+        }
+
+        if (!validated) {
+            // Message is not correct size or handshake does not match, kill the user.
+            FLASH_LOG(warning, userId, "Client Handshake Failed.");
+
+            m_counters.m_validationFailures.fetch_add(1, std::memory_order_relaxed);
+
+            std::scoped_lock lock { owner.m_mutexUsers };
+            owner.m_endpointToUserId.erase(remote);
+            owner.m_userIdToUser.erase(userId);
+
+            return;
+        }
+
+        FLASH_LOG(info, userId, "Client Validated.");
+
+        if (secret != 0) {
+            SendGrant(session_token { userId, secret }, false);
+        }
+
+        OnClientValidate(userId);
+    }
 
-                WaitForMessages();
+    void ProcessMessage(const uint8_t* data, std::size_t length, UserId userId) {
+        // Message is too short to be in the canonical format, ignore
+        if (length < sizeof(header<T>)) {
+            CountMalformed();
+            return;
+        }
+
+        header<T> hdr;
+        std::memcpy(&hdr, data, sizeof(header<T>));
+        uint32_t wireSize = boost::endian::big_to_native(hdr.m_size);
+
+        // Size of message body does not match the size in the header, ignore
+        if (length - sizeof(header<T>) != (wireSize & WIRE_SIZE_MASK)) {
+            CountMalformed();
+            return;
+        }
+
+        {
+            shard& owner = ShardOf(userId);
+            std::scoped_lock lock { owner.m_mutexUsers };
+
+            // The user may have timed out on another thread in the meantime.
+            User* user = owner.m_userIdToUser.find(userId);
+            if (!user) return;
+
+            user->m_lastMessageTime = m_sweepTimer.Now();
+            user->m_traffic.count_in(length);
+        }
+
+        if (wireSize & WIRE_FLAG_PACKED) {
+            for_each_packed_frame<T>(data + sizeof(header<T>), length - sizeof(header<T>),
+                [this, userId](const uint8_t* frame, std::size_t frameLength) {
+                    ProcessFrame(frame, frameLength, userId);
+                });
+        } else {
+            ProcessFrame(data, length, userId);
+        }
+    }
+
+    /**
+     * Processes a single frame from a validated user, with a body of the size in its header.
+    */
+    void ProcessFrame(const uint8_t* data, std::size_t length, UserId userId) {
+        message<T> msg { static_cast<T>(0) };
+        std::memcpy(&msg.get_header(), data, sizeof(header<T>));
+
+        uint32_t wireSize = boost::endian::big_to_native(msg.get_header().m_size);
+        msg.get_header().m_size = wireSize & WIRE_SIZE_MASK;
+
+        // Packed frames are never nested, ignore
+        if (wireSize & WIRE_FLAG_PACKED) {
+            CountMalformed();
+            return;
+        }
+
+        if (wireSize & WIRE_FLAG_CONTROL) {
+            HandleControl(data + sizeof(header<T>), msg.get_header().m_size, userId);
+            return;
+        }
+
+        m_counters.count_in(msg.get_header().m_type, sizeof(header<T>) + msg.get_header().m_size);
+
+        if (wireSize & WIRE_FLAG_COMPRESSED) {
+            if (!Decompress(data + sizeof(header<T>), msg.get_header().m_size, msg)) {
+                CountMalformed();
+                return;
             }
-        );
+
+            QueueIncoming(userId, std::move(msg));
+            return;
+        }
+
+        acquire_body(&m_bodyPool, msg.get_body(), msg.get_header().m_size);
+        std::memcpy(msg.get_body().data(), data + sizeof(header<T>), msg.get_header().m_size);
+
+        // Push the message to the incoming queue.
+        QueueIncoming(userId, std::move(msg));
+    }
+
+    /**
+     * Pushes a message to the incoming queue, and wakes the coroutine awaiting it, if any,
+     * unless its type is dispatched immediately, in which case it is handled right away.
+    */
+    void QueueIncoming(UserId userId, message<T>&& msg) {
+        if (m_dispatch.get(msg.get_header().m_type) == dispatch_mode::immediate) {
+            dispatch_immediately<T>(*this, userId, std::move(msg), &m_bodyPool, &m_counters);
+            return;
+        }
+
+        m_qMessagesIn.push_back(tagged_message<T> { userId, std::move(msg) });
+
+#ifdef FLASH_WITH_COROUTINES
+        m_messageWaiter.notify();
+#endif
+    }
+
+    /**
+     * Counts an incoming datagram, or frame, ignored as malformed.
+    */
+    void CountMalformed() {
+        m_counters.m_malformed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Decompresses a compressed body into the body of a message, and sets its size.
+     * 
+     * @returns Whether the body was decompressed. Fails if it is malformed,
+     * or if the server has no compressor.
+    */
+    bool Decompress(const uint8_t* data, std::size_t length, message<T>& msg) {
+        if (!m_compression.m_compressor) return false;
+
+        size_t originalSize;
+        if (!decompressed_size(data, length, originalSize)) return false;
+
+        acquire_body(&m_bodyPool, msg.get_body(), originalSize);
+        msg.get_header().m_size = static_cast<uint32_t>(originalSize);
+
+        return decompress_body(*m_compression.m_compressor, data, length, msg.get_body().data(), originalSize);
+    }
+
+    /**
+     * Handles a control frame from a user, which is never delivered to the queue.
+    */
+    void HandleControl(const uint8_t* data, std::size_t length, UserId userId) {
+        if (length == delta_ack_schema::SIZE && data[0] == CONTROL_DELTA_ACK) {
+            uint8_t kind;
+            uint32_t type;
+            uint16_t seq;
+            delta_ack_schema::decode_from(data, kind, type, seq);
+
+            // The delta streams belong to the strand, like the outgoing queue.
+            boost::asio::post(m_strand, [this, userId, type, seq]() {
+                auto encoder = m_deltaEncoders.find(userId);
+                if (encoder != m_deltaEncoders.end()) {
+                    encoder->second.ack(static_cast<T>(type), seq);
+                }
+            });
+
+        } else if (m_reliable && length > 0 && (data[0] == CONTROL_RELIABLE || data[0] == CONTROL_RELIABLE_ACK)) {
+            // The channels belong to the strand too, so the frame is copied there.
+            boost::asio::post(m_strand, [this, userId, frame = std::vector<uint8_t>(data, data + length)]() {
+                reliable_channel<T>* channel = GetChannel(userId);
+                if (!channel) return;
+
+                channel->receive(frame.data(), frame.size(), std::chrono::steady_clock::now(),
+                    [this, userId](const uint8_t* inner, std::size_t innerLength) {
+                        ProcessFrame(inner, innerLength, userId);
+                    });
+            });
+        }
     }
 
-    void Send(UserId userId, message<T>&& msg) {
+    /**
+     * @returns The reliable channel of a user, created on first use, or null if the user
+     * has gone away. Must be called on the strand.
+    */
+    reliable_channel<T>* GetChannel(UserId userId) {
+        auto channel = m_reliableChannels.find(userId);
+        if (channel != m_reliableChannels.end()) return &channel->second;
+
+        {
+            shard& owner = ShardOf(userId);
+            std::scoped_lock lock { owner.m_mutexUsers };
+
+            // Users that time out after this are forgotten on the strand, after us.
+            if (!owner.m_userIdToUser.contains(userId)) return nullptr;
+        }
+
+        return &m_reliableChannels[userId];
+    }
+
+    /**
+     * Queues what the reliable channel of a user has due: new messages, resends and acks.
+     * Must be called on the strand.
+    */
+    void PollChannel(UserId userId, reliable_channel<T>& channel, std::chrono::steady_clock::time_point now) {
+        channel.poll(now, [this, userId](message<T>&& frame) {
+            priority p = m_priorities.get(frame.get_header().m_type);
+            QueueDatagram(datagram { userId, std::move(frame), nullptr }, p);
+        });
+    }
+
+    /**
+     * Polls every reliable channel, on the reliable timer. Must be called on the strand.
+    */
+    void PollReliable() {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+        for (auto& [userId, channel] : m_reliableChannels) {
+            PollChannel(userId, channel, now);
+        }
+
+        if (!m_sending) {
+            SendMessages();
+        }
+    }
+
+    /**
+     * Looks up the user of an endpoint in a shard.
+     * 
+     * @returns Whether the shard holds it, in which case its ID and whether it is validated are set.
+    */
+    bool FindUser(shard& owner, const boost::asio::ip::udp::endpoint& remote, UserId& userId, bool& validated) {
+        std::scoped_lock lock { owner.m_mutexUsers };
+
+        userId = owner.m_endpointToUserId.find(remote);
+        if (userId == INVALID_USER_ID) return false;
+
+        validated = owner.m_userIdToUser.find(userId)->m_validated;
+        return true;
+    }
+
+    /**
+     * Handles a datagram from the given endpoint, depending on the state of its user.
+     * May be called from any thread.
+     * 
+     * @param receiver the shard whose socket received the datagram.
+    */
+    void HandleDatagram(const uint8_t* data, std::size_t length, const boost::asio::ip::udp::endpoint& remote, shard& receiver) {
+        UserId userId = INVALID_USER_ID;
+        bool validated = false;
+
+        // The kernel keeps handing an endpoint to the same socket, unless the sockets of the port
+        // change, e.g. when another process joins, so the other shards are only looked up after.
+        if (!FindUser(receiver, remote, userId, validated)) {
+            for (auto& other : m_shards) {
+                if (other.get() != &receiver && FindUser(*other, remote, userId, validated)) break;
+            }
+        }
+
+        if (userId == INVALID_USER_ID) {
+            // Handles the case that the endpoint is new
+            HandleNewConnection(data, length, remote, receiver);
+
+        } else if (!validated) {
+            // The endpoint is known and has been assigned an ID.
+            HandleValidation(data, length, remote, userId);
+
+        } else {
+            // The user is validated and we will process their messages.
+            ProcessMessage(data, length, userId);
+        }
+    }
+
+    void WaitForMessages(receive_slot& slot) {
+#ifdef FLASH_HAS_MMSG
+        if (m_batchedIo) {
+            WaitForMessageBatch(slot);
+            return;
+        }
+#endif
+
+        // The socket may be shared by the threads, in which case operations on it are only started
+        // from the strand. The completion handler itself may run on any thread of the shard.
+        DispatchOnSocket([this, &slot]() {
+            slot.m_shard->m_socket.async_receive_from(
+                boost::asio::buffer(slot.m_buffer.data(), slot.m_buffer.size()), slot.m_remoteEndpoints[0],
+                [this, &slot](std::error_code ec, std::size_t length) {
+                    if (!ec) {
+                        HandleDatagram(slot.m_buffer.data(), length, slot.m_remoteEndpoints[0], *slot.m_shard);
+
+                    } else {
+                        FLASH_LOG(error, INVALID_USER_ID, "[SERVER] Error receiving message: " << ec.message());
+                    }
+
+                    WaitForMessages(slot);
+                }
+            );
+        });
+    }
+
+#ifdef FLASH_HAS_MMSG
+    /**
+     * Prepares the `recvmmsg` headers of a receive slot to point into its buffers.
+    */
+    void SetupBatch(receive_slot& slot) {
+        slot.m_headers.resize(MAX_DATAGRAMS_PER_BATCH);
+        slot.m_iovecs.resize(MAX_DATAGRAMS_PER_BATCH);
+
+        for (size_t i = 0; i < MAX_DATAGRAMS_PER_BATCH; ++i) {
+            slot.m_iovecs[i].iov_base = slot.m_buffer.data() + i * MAX_MESSAGE_SIZE_IN_BYTES;
+            slot.m_iovecs[i].iov_len = MAX_MESSAGE_SIZE_IN_BYTES;
+
+            slot.m_headers[i] = mmsghdr {};
+            slot.m_headers[i].msg_hdr.msg_name = slot.m_remoteEndpoints[i].data();
+            slot.m_headers[i].msg_hdr.msg_iov = &slot.m_iovecs[i];
+            slot.m_headers[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+
+    /**
+     * Batched version of `WaitForMessages`: waits for the socket to become readable,
+     * and then takes as many datagrams as are available with a single `recvmmsg`.
+    */
+    void WaitForMessageBatch(receive_slot& slot) {
+        DispatchOnSocket([this, &slot]() {
+            slot.m_shard->m_socket.async_wait(
+                boost::asio::ip::udp::socket::wait_read,
+                [this, &slot](std::error_code ec) {
+                    if (ec) {
+                        FLASH_LOG(error, INVALID_USER_ID, "[SERVER] Error receiving message: " << ec.message());
+
+                        WaitForMessages(slot);
+                        return;
+                    }
+
+                    for (auto& header : slot.m_headers) {
+                        header.msg_hdr.msg_namelen = static_cast<socklen_t>(slot.m_remoteEndpoints[0].capacity());
+                        header.msg_hdr.msg_flags = 0;
+                    }
+
+                    // Another thread may have taken the datagrams first, in which case there are none.
+                    int received = ::recvmmsg(slot.m_shard->m_socket.native_handle(), slot.m_headers.data(),
+                                              static_cast<unsigned int>(slot.m_headers.size()), MSG_DONTWAIT, nullptr);
+
+                    if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                        FLASH_LOG(error, INVALID_USER_ID, "[SERVER] Error receiving messages: " << std::strerror(errno));
+                    }
+
+                    for (int i = 0; i < received; ++i) {
+                        // Datagram didn't fit in the buffer, ignore.
+                        if (slot.m_headers[i].msg_hdr.msg_flags & MSG_TRUNC) continue;
+
+                        slot.m_remoteEndpoints[i].resize(slot.m_headers[i].msg_hdr.msg_namelen);
+                        HandleDatagram(static_cast<const uint8_t*>(slot.m_iovecs[i].iov_base),
+                                       slot.m_headers[i].msg_len, slot.m_remoteEndpoints[i], *slot.m_shard);
+                    }
+
+                    WaitForMessages(slot);
+                }
+            );
+        });
+    }
+#endif
+
+    void Send(UserId userId, message<T>&& msg, priority p) {
+        Compress(msg);
+
         // Message is too long, reject.
         if (msg.size() > MAX_MESSAGE_SIZE_IN_BYTES) {
             assert(false);
@@ -305,99 +1314,698 @@ private:
         }
 
         boost::asio::post(
-            m_asioContext,
+            m_strand,
 
             // Black magic generalized lambda capture from
             // https://stackoverflow.com/questions/8640393/move-capture-in-lambda
 
-            [this, userId, msg = std::move(msg)] () mutable {
-                bool writing = !m_qMessagesOut.empty();
+            [this, userId, msg = std::move(msg), p] () mutable {
                 msg.get_header().m_size = boost::endian::native_to_big(msg.get_header().m_size);
-                m_qMessagesOut.push_back({ userId, std::move(msg) });
+                QueueDatagram(datagram { userId, std::move(msg), nullptr }, p);
 
-                if (!writing) {
+                if (!m_sending) {
                     SendMessages();
                 }
             }
         );
     }
 
-    void SendValidation(UserId userId) {
-        m_tempHandshakeOut = boost::endian::native_to_big(m_userIdToUser[userId].m_handshake);
+    /**
+     * Sends the same message to a number of users. The message is encoded once,
+     * and all the datagrams are queued with a single trip to the strand.
+    */
+    void SendShared(std::vector<UserId>&& userIds, message<T>&& msg, priority p) {
+        Compress(msg);
 
-        m_socket.async_send_to(
-            boost::asio::buffer(&m_tempHandshakeOut, sizeof(uint64_t)), m_userIdToUser[userId].m_endpoint,
-            [this](std::error_code ec, std::size_t length) {
-                if (ec) {
-                    std::stringstream ss;
-                    ss << "[SERVER] Error sending validation: " << ec.message() << "\n";
-                    std::cout << ss.str();
+        // Message is too long, reject.
+        if (msg.size() > MAX_MESSAGE_SIZE_IN_BYTES) {
+            assert(false);
+            return;
+        }
+
+        if (userIds.empty()) return;
+
+        boost::asio::post(
+            m_strand,
+            [this, userIds = std::move(userIds), sharedMsg = make_shared_message(std::move(msg)), p]() {
+                for (UserId userId : userIds) {
+                    QueueDatagram(datagram { userId, message<T> { static_cast<T>(0) }, sharedMsg }, p);
+                }
+
+                if (!m_sending) {
+                    SendMessages();
                 }
             }
         );
     }
 
-    void SendMessages() {
-        if (m_qMessagesOut.empty()) return;
+    /**
+     * Compresses the body of a message if it is large enough and its type is not sent
+     * as a delta stream. Done by the caller, so that the strand isn't held up by it.
+    */
+    void Compress(message<T>& msg) {
+        if (!m_compression.m_compressor) return;
+        if (m_deltaTypes.find(msg.get_header().m_type) != m_deltaTypes.end()) return;
+
+        compress_message(m_compression, msg);
+    }
+
+    /**
+     * Queues a datagram to be sent with the given priority. Must be called on the strand.
+    */
+    void QueueDatagram(datagram&& dgram, priority p) {
+        if (!m_deltaTypes.empty()) {
+            EncodeDelta(dgram);
+        }
+
+        // Control frames carry messages counted when sent reliably, or nothing.
+        const header<T>& hdr = dgram.get().get_header();
+        if (!(boost::endian::big_to_native(hdr.m_size) & WIRE_FLAG_CONTROL)) {
+            m_counters.count_out(hdr.m_type, dgram.get().size());
+        }
+
+        if (m_coalescingMtu > 0 && PackDatagram(dgram, p)) return;
+
+        PushDatagram(std::move(dgram), p);
+    }
+
+    /**
+     * Pushes a datagram, ready to be sent, to the outgoing queue. Must be called on the strand.
+    */
+    void PushDatagram(datagram&& dgram, priority p) {
+        UserId userId = dgram.m_remote;
+        size_t size = dgram.get().size();
+
+        if (m_backpressure.m_highWaterBytes > 0 && !RelieveBackpressure(dgram, size)) {
+            CountDropped();
+            return;
+        }
 
-        CleanupUsers();
+        dgram.m_queued = std::chrono::steady_clock::now();
+        dgram.m_priority = p;
 
-        // Make sure that the user for the message is valid.
-        while (m_userIdToUser.find(m_qMessagesOut.front().m_remote) == m_userIdToUser.end()) {
-            m_qMessagesOut.pop_front();
-            if (m_qMessagesOut.empty()) return;
+        // We are the consumer of the outgoing queue as well, so never block on it.
+        if (!m_qMessagesOut.try_push_back(std::move(dgram), p)) {
+            FLASH_LOG(warning, userId, "Outgoing Queue Full, Message Dropped.");
+
+            CountDropped();
+            return;
         }
 
-        tagged_message<T> taggedMsg = m_qMessagesOut.front();
-        UserId userId = taggedMsg.m_remote;
-        message<T>& msg = taggedMsg.m_msg;
+        if (m_backpressure.m_highWaterBytes > 0) m_queueUsage[userId].m_bytes += size;
+    }
 
-        m_tempBufferOut.resize(msg.size());
+    /**
+     * Counts a datagram dropped before being sent.
+    */
+    void CountDropped() {
+        m_counters.m_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
 
-        std::memcpy(m_tempBufferOut.data(), &msg.get_header(), sizeof(header<T>));
-        std::memcpy(m_tempBufferOut.data() + sizeof(header<T>), msg.get_body().data(), msg.get_body().size());
+    /**
+     * Accounts for a datagram leaving the outgoing queue to be sent. Must be called on the strand.
+    */
+    void Dequeued(const datagram& dgram) {
+        if (m_backpressure.m_highWaterBytes == 0) return;
 
-        m_socket.async_send_to(
-            boost::asio::buffer(m_tempBufferOut.data(), m_tempBufferOut.size()), m_userIdToUser[userId].m_endpoint,
-            [this](std::error_code ec, std::size_t length) {
-                if (!ec) {
-                    m_qMessagesOut.pop_front();
+        auto usage = m_queueUsage.find(dgram.m_remote);
+        if (usage != m_queueUsage.end()) {
+            usage->second.remove(dgram.get().size(), m_backpressure);
+        }
+    }
+
+    /**
+     * Applies the backpressure policy to a datagram, if it would take the bytes queued
+     * to its user over the high-water mark. Must be called on the strand.
+     * 
+     * @returns Whether the datagram should still be queued. If not, it replaced a queued
+     * datagram, or the user was dropped.
+    */
+    bool RelieveBackpressure(datagram& dgram, size_t size) {
+        UserId userId = dgram.m_remote;
+        queue_usage& usage = m_queueUsage[userId];
+
+        if (!usage.exceeds(size, m_backpressure)) return true;
 
-                    if (!m_qMessagesOut.empty()) {
-                        SendMessages();
+        if (!usage.m_overHighWater) {
+            usage.m_overHighWater = true;
+            this->OnBackpressure(userId, usage.m_bytes + size);
+        }
+
+        switch (m_backpressure.m_policy) {
+        case backpressure_policy::disconnect:
+            // Later, since the per-user state may be being iterated over.
+            boost::asio::post(m_strand, [this, userId]() { DropUser(userId); });
+            return false;
+
+        case backpressure_policy::latest_wins:
+            if (ReplaceQueued(dgram, size, usage)) return false;
+            break;
+
+        case backpressure_policy::drop_oldest:
+            break;
+        }
+
+        DropOldest(userId, size, usage);
+        return true;
+    }
+
+    /**
+     * Replaces the oldest datagram queued to the same user, with a plain message of the
+     * same type, with the given one. Packed and control datagrams are never replaced.
+     * 
+     * @returns Whether there was such a datagram.
+    */
+    bool ReplaceQueued(datagram& dgram, size_t size, queue_usage& usage) {
+        constexpr uint32_t UNMERGEABLE = WIRE_FLAG_PACKED | WIRE_FLAG_CONTROL;
+
+        const header<T>& hdr = dgram.get().get_header();
+        if (boost::endian::big_to_native(hdr.m_size) & UNMERGEABLE) return false;
+
+        for (size_t lane = 0; lane < NUM_PRIORITIES; ++lane) {
+            bool replaced = m_qMessagesOut.lane(static_cast<priority>(lane)).visit([&](datagram& queued) {
+                if (queued.m_remote != dgram.m_remote || queued.m_dropped) return false;
+
+                const header<T>& queuedHdr = queued.get().get_header();
+                if (queuedHdr.m_type != hdr.m_type || (boost::endian::big_to_native(queuedHdr.m_size) & UNMERGEABLE)) return false;
+
+                usage.m_bytes = usage.m_bytes - queued.get().size() + size;
+                queued = std::move(dgram);
+                return true;
+            });
+
+            if (replaced) return true;
+        }
+
+        return false;
+    }
+
+    /**
+     * Drops datagrams queued to a user, the oldest of the least urgent ones first, until
+     * a datagram of the given size fits under the high-water mark. They are only marked,
+     * and skipped when their turn comes, since the queue is shared by every user.
+    */
+    void DropOldest(UserId userId, size_t size, queue_usage& usage) {
+        for (size_t lane = NUM_PRIORITIES; lane-- > 0 && usage.exceeds(size, m_backpressure);) {
+            m_qMessagesOut.lane(static_cast<priority>(lane)).visit([&](datagram& queued) {
+                if (queued.m_remote == userId && !queued.m_dropped) {
+                    usage.remove(queued.get().size(), m_backpressure);
+
+                    // Release the message right away.
+                    CountDropped();
+                    queued.m_dropped = true;
+                    queued.m_owned = message<T> { static_cast<T>(0) };
+                    queued.m_shared = nullptr;
+                }
+
+                return !usage.exceeds(size, m_backpressure);
+            });
+        }
+    }
+
+    /**
+     * Drops a user that can't keep up, as if it had timed out. Must be called on the strand.
+    */
+    void DropUser(UserId userId) {
+        {
+            shard& owner = ShardOf(userId);
+            std::scoped_lock lock { owner.m_mutexUsers };
+
+            User* user = owner.m_userIdToUser.find(userId);
+            if (!user) return;
+
+            if (!user->m_lost) owner.m_endpointToUserId.erase(user->m_endpoint);
+            owner.m_userIdToUser.erase(userId);
+        }
+
+        FLASH_LOG(warning, userId, "Client Too Slow, Disconnected.");
+
+        ForgetUser(userId);
+        Disconnected(userId);
+    }
+
+    /**
+     * Adds a datagram to the one being packed for its user, sending that one first
+     * if it would overflow. Must be called on the strand.
+     * 
+     * @returns Whether the datagram was packed. If not, it is too large to be packed,
+     * and must be sent on its own, after the ones already packed for the user.
+    */
+    bool PackDatagram(const datagram& dgram, priority p) {
+        const message<T>& msg = dgram.get();
+        packet_out& packet = m_packetsOut.try_emplace(dgram.m_remote, packet_out { datagram_packer<T> { m_coalescingMtu } }).first->second;
+
+        if (!packet.m_packer.empty() && !packet.m_packer.has_room(msg)) {
+            PushPacket(dgram.m_remote, packet);
+        }
+
+        if (!packet.m_packer.fits(msg)) return false;
+
+        packet.m_packer.append(msg);
+        packet.m_priority = std::min(packet.m_priority, p);
+
+        return true;
+    }
+
+    /**
+     * Pushes the datagram being packed for a user to the outgoing queue. Must be called on the strand.
+    */
+    void PushPacket(UserId userId, packet_out& packet) {
+        PushDatagram(datagram { userId, packet.m_packer.take(), nullptr }, packet.m_priority);
+        packet.m_priority = priority::bulk;
+    }
+
+    /**
+     * Sends every datagram being packed. Must be called on the strand.
+    */
+    void FlushPackets() {
+        for (auto& [userId, packet] : m_packetsOut) {
+            if (!packet.m_packer.empty()) {
+                PushPacket(userId, packet);
+            }
+        }
+
+        if (!m_sending) {
+            SendMessages();
+        }
+    }
+
+    /**
+     * Forgets the per-user sending state of a user that has gone away. Must be called on the strand.
+    */
+    void ForgetUser(UserId userId) {
+        m_deltaEncoders.erase(userId);
+        m_packetsOut.erase(userId);
+        m_reliableChannels.erase(userId);
+        m_queueUsage.erase(userId);
+        m_retained.erase(userId);
+    }
+
+    /**
+     * Keeps a datagram taken off the queue for a lost user, to be sent if the session
+     * is resumed. Must be called on the strand.
+    */
+    void Retain(datagram&& dgram) {
+        Dequeued(dgram);
+
+        std::deque<datagram>& retained = m_retained[dgram.m_remote];
+        if (retained.size() == MAX_RETAINED_DATAGRAMS) {
+            retained.pop_front();
+            CountDropped();
+        }
+
+        retained.push_back(std::move(dgram));
+    }
+
+    /**
+     * Moves the datagrams still queued to a user behind the ones kept for it, which are older,
+     * so that they all go out in order once its session is resumed. Must be called on the strand.
+    */
+    void RetainQueued(UserId userId) {
+        if (m_retained.find(userId) == m_retained.end()) return;
+
+        std::vector<datagram> queued;
+        m_qMessagesOut.drain_into(queued);
+
+        for (datagram& dgram : queued) {
+            if (dgram.m_remote == userId && !dgram.m_dropped) {
+                Retain(std::move(dgram));
+                continue;
+            }
+
+            // Each goes back to its lane in the same order, where there was room for it.
+            priority p = dgram.m_priority;
+            m_qMessagesOut.try_push_back(std::move(dgram), p);
+        }
+    }
+
+    /**
+     * Pushes the datagrams kept for a user back to the outgoing queue, once its session
+     * is resumed. Must be called on the strand.
+    */
+    void ReleaseRetained(UserId userId) {
+        auto retained = m_retained.find(userId);
+        if (retained == m_retained.end()) return;
+
+        std::deque<datagram> datagrams = std::move(retained->second);
+        m_retained.erase(retained);
+
+        for (datagram& dgram : datagrams) {
+            priority p = dgram.m_priority;
+            PushDatagram(std::move(dgram), p);
+        }
+    }
+
+    /**
+     * @returns A control frame granting the session of the token, or refusing one with
+     * a null token, with its header in network byte order.
+    */
+    static message<T> MakeGrant(const session_token& token, bool resumed) {
+        message<T> grant { static_cast<T>(0) };
+        grant.get_body().resize(session_control_schema::SIZE);
+        session_control_schema::encode_into(grant.get_body().data(), CONTROL_SESSION, static_cast<uint8_t>(resumed),
+                                            token.m_id, token.m_secret);
+
+        uint32_t wireSize = static_cast<uint32_t>(session_control_schema::SIZE) | WIRE_FLAG_CONTROL;
+        grant.get_header().m_size = boost::endian::native_to_big(wireSize);
+
+        return grant;
+    }
+
+    /**
+     * Queues the grant of a session ahead of other datagrams to its user, followed by those
+     * kept for it while it was lost, if resumed.
+    */
+    void SendGrant(const session_token& token, bool resumed) {
+        boost::asio::post(m_strand, [this, token, resumed]() {
+            if (resumed) {
+                RetainQueued(token.m_id);
+
+                shard& owner = ShardOf(token.m_id);
+                std::scoped_lock lock { owner.m_mutexUsers };
+
+                User* user = owner.m_userIdToUser.find(token.m_id);
+                if (user) user->m_resuming = false;
+            }
+
+            QueueDatagram(datagram { token.m_id, MakeGrant(token, resumed), nullptr }, priority::realtime);
+
+            if (resumed) {
+                ReleaseRetained(token.m_id);
+            }
+
+            if (!m_sending) {
+                SendMessages();
+            }
+        });
+    }
+
+    /**
+     * Tells a client that the session it asked to resume is gone, from the socket of the shard
+     * that received the request, so that it connects anew.
+    */
+    void SendRefusal(shard& sender, const boost::asio::ip::udp::endpoint& endpoint) {
+        // Owned by the handler, like the validation handshake.
+        auto refusal = std::make_shared<message<T>>(MakeGrant(session_token {}, false));
+
+        DispatchOnSocket([&sender, endpoint, refusal]() {
+            std::array<boost::asio::const_buffer, 2> buffers {
+                boost::asio::buffer(&refusal->get_header(), sizeof(header<T>)),
+                boost::asio::buffer(refusal->get_body().data(), refusal->get_body().size())
+            };
+
+            sender.m_socket.async_send_to(
+                buffers, endpoint,
+                [refusal](std::error_code ec, std::size_t length) {
+                    if (ec) {
+                        FLASH_LOG(error, INVALID_USER_ID, "[SERVER] Error sending refusal: " << ec.message());
                     }
+                }
+            );
+        });
+    }
+
+    /**
+     * Replaces a datagram of a delta-encoded type with the next frame of the delta stream
+     * of its user, owned by the datagram. Must be called on the strand.
+    */
+    void EncodeDelta(datagram& dgram) {
+        const message<T>& msg = dgram.get();
+        T type = msg.get_header().m_type;
+
+        // Control frames, e.g. of the reliable channels, are never part of a stream.
+        if (boost::endian::big_to_native(msg.get_header().m_size) & WIRE_FLAG_CONTROL) return;
+        if (m_deltaTypes.find(type) == m_deltaTypes.end()) return;
+
+        std::vector<uint8_t> frame;
+        m_deltaEncoders[dgram.m_remote].encode(type, msg.get_body().data(), msg.get_body().size(), frame);
+
+        // The frame may not fit in a datagram, in which case the message is sent plain.
+        if (sizeof(header<T>) + frame.size() > MAX_MESSAGE_SIZE_IN_BYTES) return;
+
+        uint32_t wireSize = static_cast<uint32_t>(frame.size()) | WIRE_FLAG_DELTA;
+
+        message<T> encoded { type };
+        encoded.get_header().m_size = boost::endian::native_to_big(wireSize);
+        encoded.get_body() = std::move(frame);
+
+        dgram.m_owned = std::move(encoded);
+        dgram.m_shared = nullptr;
+    }
 
-                } else {
-                    std::stringstream ss;
-                    ss << "[SERVER] Error sending message: " << ec.message() << "\n";
-                    std::cout << ss.str();
+    /**
+     * Sends the validation handshake from the socket of the shard that received the request.
+    */
+    void SendValidation(shard& sender, const boost::asio::ip::udp::endpoint& endpoint, uint64_t handshake) {
+        // Owned by the handler, since several validations may be in flight at once.
+        auto handshakeOut = std::make_shared<uint64_t>(boost::endian::native_to_big(handshake));
+
+        DispatchOnSocket([&sender, endpoint, handshakeOut]() {
+            sender.m_socket.async_send_to(
+                boost::asio::buffer(handshakeOut.get(), sizeof(uint64_t)), endpoint,
+                [handshakeOut](std::error_code ec, std::size_t length) {
+                    if (ec) {
+                        FLASH_LOG(error, INVALID_USER_ID, "[SERVER] Error sending validation: " << ec.message());
+                    }
                 }
+            );
+        });
+    }
+
+    /**
+     * Sends the queued datagrams one after the other. Must be called on the strand.
+     * 
+     * The header and body are passed to the socket as a buffer sequence, so a shared
+     * datagram is never copied, no matter how many users it is sent to.
+    */
+    void SendMessages() {
+#ifdef FLASH_HAS_MMSG
+        if (m_batchedIo) {
+            SendMessageBatch();
+            return;
+        }
+#endif
+
+        m_sending = false;
+
+        boost::asio::ip::udp::endpoint endpoint;
+
+        {
+            std::unique_lock<std::mutex> lock;
+            shard* locked = nullptr;
+
+            // Skip the datagrams that were dropped, or of users that have gone away in the meantime.
+            while (!m_qMessagesOut.empty()) {
+                const datagram& next = m_qMessagesOut.front();
+
+                if (!next.m_dropped) {
+                    User* user = LockedFind(next.m_remote, lock, locked);
+
+                    if (user && !user->m_lost && !user->m_resuming) {
+                        endpoint = user->m_endpoint;
+                        user->m_traffic.count_out(next.get().size());
+                        break;
+                    }
+
+                    if (user) {
+                        Retain(m_qMessagesOut.pop_front());
+                        continue;
+                    }
+
+                    ForgetUser(next.m_remote);
+                }
+
+                m_qMessagesOut.pop_front();
             }
+        }
+
+        if (m_qMessagesOut.empty()) return;
+
+        m_sending = true;
+        m_datagramOut = m_qMessagesOut.pop_front();
+        Dequeued(m_datagramOut);
+
+        std::chrono::steady_clock::duration lag = std::chrono::steady_clock::now() - m_datagramOut.m_queued;
+        m_counters.count_sent(1, lag, lag);
+
+        const message<T>& msg = m_datagramOut.get();
+        m_buffersOut[0] = boost::asio::buffer(&msg.get_header(), sizeof(header<T>));
+        m_buffersOut[1] = boost::asio::buffer(msg.get_body().data(), msg.get_body().size());
+
+        SendSocket().async_send_to(
+            m_buffersOut, endpoint,
+            boost::asio::bind_executor(m_strand, [this](std::error_code ec, std::size_t length) {
+                if (ec) {
+                    FLASH_LOG(error, m_datagramOut.m_remote, "Error sending message: " << ec.message());
+                }
+
+                // A failed datagram only affects its own user, so move on either way.
+                SendMessages();
+            })
         );
     }
 
+#ifdef FLASH_HAS_MMSG
+    /**
+     * Batched version of `SendMessages`: takes up to `MAX_DATAGRAMS_PER_BATCH` datagrams
+     * from the queue, and sends as many as the socket accepts with a single `sendmmsg`.
+     * Must be called on the strand.
+    */
+    void SendMessageBatch() {
+        if (m_batchOutSent == m_batchOut.size()) {
+            m_batchOut.clear();
+            m_batchOutSent = 0;
+
+            m_qMessagesOut.drain_into(m_batchOut, MAX_DATAGRAMS_PER_BATCH);
+
+            // Skip the datagrams that were dropped, or of users that have gone away in the meantime.
+            size_t kept = 0;
+            m_endpointsOut.resize(m_batchOut.size());
+
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            std::chrono::steady_clock::duration totalLag {}, longestLag {};
+
+            {
+                std::unique_lock<std::mutex> lock;
+                shard* locked = nullptr;
+
+                for (size_t i = 0; i < m_batchOut.size(); ++i) {
+                    if (m_batchOut[i].m_dropped) continue;
+
+                    User* user = LockedFind(m_batchOut[i].m_remote, lock, locked);
+                    if (!user) {
+                        ForgetUser(m_batchOut[i].m_remote);
+                        continue;
+                    }
+
+                    if (user->m_lost || user->m_resuming) {
+                        Retain(std::move(m_batchOut[i]));
+                        continue;
+                    }
+
+                    Dequeued(m_batchOut[i]);
+                    user->m_traffic.count_out(m_batchOut[i].get().size());
+
+                    totalLag += now - m_batchOut[i].m_queued;
+                    longestLag = std::max(longestLag, now - m_batchOut[i].m_queued);
+
+                    m_endpointsOut[kept] = user->m_endpoint;
+                    if (kept != i) m_batchOut[kept] = std::move(m_batchOut[i]);
+                    ++kept;
+                }
+            }
+
+            m_batchOut.erase(m_batchOut.begin() + kept, m_batchOut.end());
+            m_counters.count_sent(kept, totalLag, longestLag);
+
+            if (m_batchOut.empty()) {
+                m_sending = false;
+                return;
+            }
+
+            m_headersOut.resize(m_batchOut.size());
+            m_iovecsOut.resize(2 * m_batchOut.size());
+
+            for (size_t i = 0; i < m_batchOut.size(); ++i) {
+                const message<T>& msg = m_batchOut[i].get();
+
+                m_iovecsOut[2 * i].iov_base = const_cast<header<T>*>(&msg.get_header());
+                m_iovecsOut[2 * i].iov_len = sizeof(header<T>);
+                m_iovecsOut[2 * i + 1].iov_base = const_cast<uint8_t*>(msg.get_body().data());
+                m_iovecsOut[2 * i + 1].iov_len = msg.get_body().size();
+
+                m_headersOut[i] = mmsghdr {};
+                m_headersOut[i].msg_hdr.msg_name = m_endpointsOut[i].data();
+                m_headersOut[i].msg_hdr.msg_namelen = static_cast<socklen_t>(m_endpointsOut[i].size());
+                m_headersOut[i].msg_hdr.msg_iov = &m_iovecsOut[2 * i];
+                m_headersOut[i].msg_hdr.msg_iovlen = 2;
+            }
+        }
+
+        m_sending = true;
+
+        int sent = ::sendmmsg(SendSocket().native_handle(), m_headersOut.data() + m_batchOutSent,
+                              static_cast<unsigned int>(m_batchOut.size() - m_batchOutSent), MSG_DONTWAIT);
+
+        if (sent > 0) {
+            m_batchOutSent += sent;
+
+        } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // The send buffer is full, try again once there is room.
+            SendSocket().async_wait(
+                boost::asio::ip::udp::socket::wait_write,
+                boost::asio::bind_executor(m_strand, [this](std::error_code ec) { SendMessageBatch(); })
+            );
+            return;
+
+        } else {
+            // A failed datagram only affects its own user, so move on.
+            FLASH_LOG(error, m_batchOut[m_batchOutSent].m_remote, "Error sending message: " << std::strerror(errno));
+
+            ++m_batchOutSent;
+        }
+
+        // Continue from the strand, so that other work can interleave with long queues.
+        boost::asio::post(m_strand, [this]() { SendMessageBatch(); });
+    }
+#endif
+
+    /**
+     * Drops the users that haven't sent anything for longer than the timeout.
+     * Runs periodically on the sweep timer, rather than on every datagram.
+    */
     void CleanupUsers() {
-        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point now = m_sweepTimer.Now();
 
         std::vector<UserId> disconnectedUsers;
+        std::vector<UserId> lostUsers;
 
-        for (auto it = m_userIdToUser.begin(); it != m_userIdToUser.end(); ++it) {
-            if (std::chrono::duration_cast<std::chrono::milliseconds>(now - it->second.m_lastMessageTime).count() > m_serverTimeout) {
-                disconnectedUsers.push_back(it->first);
-            }
+        for (auto& shard : m_shards) {
+            std::scoped_lock lock { shard->m_mutexUsers };
+
+            shard->m_userIdToUser.erase_if([&](UserId userId, User& user) {
+                auto silence = std::chrono::duration_cast<std::chrono::milliseconds>(now - user.m_lastMessageTime);
+                if (silence.count() <= m_serverTimeout) {
+                    return false;
+                }
+
+                // Held for the client to resume its session, until the grace period is over.
+                if (user.m_sessionSecret != 0 && silence - std::chrono::milliseconds(m_serverTimeout) <= m_sessionGrace) {
+                    if (!user.m_lost) {
+                        user.m_lost = true;
+                        shard->m_endpointToUserId.erase(user.m_endpoint);
+                        lostUsers.push_back(userId);
+                    }
+
+                    return false;
+                }
+
+                if (!user.m_lost) {
+                    shard->m_endpointToUserId.erase(user.m_endpoint);
+                    lostUsers.push_back(userId);
+                }
+
+                disconnectedUsers.push_back(userId);
+                return true;
+            });
         }
 
-        for (auto userId : disconnectedUsers) {
-            std::stringstream ss;
-            ss << "[" << userId << "] Client Timed Out.\n";
-            std::cout << ss.str();
+        for (auto userId : lostUsers) {
+            FLASH_LOG(info, userId, "Client Timed Out.");
+        }
+
+        m_counters.m_timeouts.fetch_add(lostUsers.size(), std::memory_order_relaxed);
 
-            m_endpointToUserId.erase(m_userIdToUser[userId].m_endpoint);
-            m_userIdToUser.erase(userId);
+        if (!disconnectedUsers.empty() && (!m_deltaTypes.empty() || m_coalescingMtu > 0 || m_reliable || m_backpressure.m_highWaterBytes > 0 || m_sessionGrace.count() > 0)) {
+            boost::asio::post(m_strand, [this, disconnectedUsers]() {
+                for (auto userId : disconnectedUsers) {
+                    ForgetUser(userId);
+                }
+            });
         }
 
         for (auto userId : disconnectedUsers) {
-            OnClientDisconnect(userId);
+            Disconnected(userId);
         }
     }
 };
@@ -406,4 +2014,4 @@ private:
 
 } // namespace flash
 
-#endif
\ No newline at end of file
+#endif
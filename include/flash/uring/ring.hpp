@@ -0,0 +1,338 @@
+#ifndef FLASH_URING_RING_HPP
+#define FLASH_URING_RING_HPP
+
+/**
+ * @file ring.hpp
+ * 
+ * Thin wrapper of an io_uring instance, made with the system calls directly, so that
+ * no library is needed: the submission and completion rings shared with the kernel,
+ * and the rings of provided buffers that multishot receives pick their buffers from.
+*/
+
+// Multishot receives and provided buffer rings need the headers of Linux 6.0 or later.
+// Define FLASH_NO_URING to leave the backend out regardless.
+#if defined(__linux__) && !defined(FLASH_NO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_RECV_MULTISHOT
+#define FLASH_HAS_URING 1
+#endif
+#endif
+#endif
+
+#ifdef FLASH_HAS_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+#include <vector>
+
+namespace flash {
+
+namespace uring {
+
+/**
+ * An io_uring instance, with its rings mapped into the process.
+ * 
+ * Submission entries are taken with `get_sqe`, filled, and handed to the kernel by `submit`
+ * or `submit_and_wait`, and the completions are then consumed with `for_each_cqe`.
+ * 
+ * Not thread-safe: meant to be used by one thread at a time.
+*/
+class ring {
+public:
+    /**
+     * Sets up the instance and maps its rings.
+     * 
+     * @param entries the number of submission entries, rounded up to a power of two by the kernel.
+     * @throws std::system_error if the kernel doesn't support io_uring, or denies it.
+    */
+    explicit ring(unsigned entries) {
+        // Completions are only reaped by the thread of the ring, so it needn't be interrupted for them.
+        io_uring_params params {};
+        params.flags = IORING_SETUP_COOP_TASKRUN;
+
+        m_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+
+        // Older kernels reject the flag, which is only a hint.
+        if (m_fd < 0 && errno == EINVAL) {
+            params = io_uring_params {};
+            m_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        }
+
+        if (m_fd < 0) throw std::system_error { errno, std::system_category(), "io_uring_setup" };
+
+        m_ringSize = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                              params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+        m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+        // Both rings share a single mapping on every kernel that has multishot receives.
+        m_ringMemory = ::mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        if (m_ringMemory == MAP_FAILED) Fail("mmap");
+
+        m_sqesMemory = ::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+        if (m_sqesMemory == MAP_FAILED) Fail("mmap");
+
+        uint8_t* base = static_cast<uint8_t*>(m_ringMemory);
+        m_sqHead = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+        m_sqTail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+        m_sqMask = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+        m_sqEntries = params.sq_entries;
+        m_cqHead = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+        m_cqTail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+        m_cqMask = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+        m_sqes = static_cast<io_uring_sqe*>(m_sqesMemory);
+
+        // Submission entries are always used in order, so the indirection array is the identity.
+        unsigned* array = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+        for (unsigned i = 0; i < m_sqEntries; ++i) array[i] = i;
+
+        m_sqeTail = *m_sqTail;
+        m_submitted = m_sqeTail;
+    }
+
+    ring(const ring&) = delete;
+    ring& operator=(const ring&) = delete;
+
+    ~ring() { Close(); }
+
+    /**
+     * @returns Whether io_uring can be used at all, e.g. it may be disabled by the system.
+    */
+    static bool supported() {
+        try {
+            ring probe { 1 };
+            return true;
+        } catch (std::system_error&) {
+            return false;
+        }
+    }
+
+    int fd() const { return m_fd; }
+
+    /**
+     * @returns A cleared submission entry, or null if the submission ring is full,
+     * in which case `submit` makes room.
+    */
+    io_uring_sqe* get_sqe() {
+        unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        if (m_sqeTail - head >= m_sqEntries) return nullptr;
+
+        io_uring_sqe* sqe = &m_sqes[m_sqeTail & m_sqMask];
+        ++m_sqeTail;
+
+        std::memset(sqe, 0, sizeof(io_uring_sqe));
+        return sqe;
+    }
+
+    /**
+     * Hands the submission entries filled since the last call to the kernel.
+     * 
+     * @returns The number of entries submitted, or a negative error code.
+    */
+    int submit() {
+        return Enter(0, 0, nullptr);
+    }
+
+    /**
+     * Submits as `submit` does, then waits until there are completions to consume.
+     * 
+     * @param waitFor the number of completions to wait for, 0 to not wait.
+     * @param timeout the longest time to wait for them.
+     * @returns The number of entries submitted, or a negative error code,
+     * `-ETIME` if the timeout expired first.
+    */
+    int submit_and_wait(unsigned waitFor, std::chrono::nanoseconds timeout) {
+        if (waitFor == 0) return submit();
+
+        __kernel_timespec ts {};
+        ts.tv_sec = static_cast<int64_t>(timeout.count() / 1000000000);
+        ts.tv_nsec = static_cast<long long>(timeout.count() % 1000000000);
+
+        io_uring_getevents_arg arg {};
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+
+        return Enter(waitFor, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg);
+    }
+
+    /**
+     * Consumes the completions available, in order.
+     * 
+     * @param f called with every completion, which is only valid during the call.
+     * @returns The number of completions consumed.
+    */
+    template <typename F>
+    unsigned for_each_cqe(F f) {
+        unsigned head = *m_cqHead;
+        unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+
+        unsigned count = tail - head;
+        for (; head != tail; ++head) {
+            f(m_cqes[head & m_cqMask]);
+        }
+
+        // The entries may be reused by the kernel from here on.
+        __atomic_store_n(m_cqHead, tail, __ATOMIC_RELEASE);
+        return count;
+    }
+
+private:
+    int Enter(unsigned waitFor, unsigned flags, io_uring_getevents_arg* arg) {
+        __atomic_store_n(m_sqTail, m_sqeTail, __ATOMIC_RELEASE);
+
+        unsigned toSubmit = m_sqeTail - m_submitted;
+        if (toSubmit == 0 && waitFor == 0) return 0;
+
+        int result = static_cast<int>(::syscall(__NR_io_uring_enter, m_fd, toSubmit, waitFor, flags,
+                                                arg, arg ? sizeof(io_uring_getevents_arg) : 0));
+        if (result < 0) return -errno;
+
+        m_submitted += static_cast<unsigned>(result);
+        return result;
+    }
+
+    [[noreturn]] void Fail(const char* what) {
+        int error = errno;
+        Close();
+        throw std::system_error { error, std::system_category(), what };
+    }
+
+    void Close() {
+        if (m_sqesMemory && m_sqesMemory != MAP_FAILED) ::munmap(m_sqesMemory, m_sqesSize);
+        if (m_ringMemory && m_ringMemory != MAP_FAILED) ::munmap(m_ringMemory, m_ringSize);
+        if (m_fd >= 0) ::close(m_fd);
+
+        m_sqesMemory = nullptr;
+        m_ringMemory = nullptr;
+        m_fd = -1;
+    }
+
+    int m_fd { -1 };                   // The instance.
+    void* m_ringMemory { nullptr };    // Submission and completion rings.
+    void* m_sqesMemory { nullptr };    // Submission entries.
+    size_t m_ringSize { 0 };           // Size of the mapping of the rings.
+    size_t m_sqesSize { 0 };           // Size of the mapping of the entries.
+
+    unsigned* m_sqHead { nullptr };    // First entry not yet consumed by the kernel.
+    unsigned* m_sqTail { nullptr };    // Entry after the last one handed to the kernel.
+    unsigned m_sqMask { 0 };           // Number of submission entries minus one.
+    unsigned m_sqEntries { 0 };        // Number of submission entries.
+    io_uring_sqe* m_sqes { nullptr };  // The submission entries.
+    unsigned m_sqeTail { 0 };          // Entry after the last one taken by `get_sqe`.
+    unsigned m_submitted { 0 };        // Entry after the last one the kernel accepted.
+
+    unsigned* m_cqHead { nullptr };    // First completion not yet consumed.
+    unsigned* m_cqTail { nullptr };    // Completion after the last one posted by the kernel.
+    unsigned m_cqMask { 0 };           // Number of completions minus one.
+    io_uring_cqe* m_cqes { nullptr };  // The completions.
+};
+
+/**
+ * Buffers registered with a ring as a group that receives pick from, rather than each
+ * receive bringing its own: a buffer is only taken once a datagram arrives, and given
+ * back with `recycle` once it has been handled.
+ * 
+ * Not thread-safe: used by the thread of its ring.
+*/
+class buffer_ring {
+public:
+    /**
+     * Allocates the buffers and registers them with the ring.
+     * 
+     * @param r          the ring that receives into them.
+     * @param groupId    the ID that receives select the group by.
+     * @param count      the number of buffers, a power of two up to 32768.
+     * @param bufferSize the size of each buffer.
+     * @throws std::system_error if the kernel doesn't support provided buffer rings.
+    */
+    buffer_ring(ring& r, uint16_t groupId, uint16_t count, size_t bufferSize)
+        : m_ring { r }, m_groupId { groupId }, m_count { count }, m_bufferSize { bufferSize },
+          m_storage(size_t(count) * bufferSize) {
+
+        // The entries must be page aligned, which a mapping of their own is.
+        m_entriesSize = count * sizeof(io_uring_buf);
+        m_entries = static_cast<io_uring_buf_ring*>(::mmap(nullptr, m_entriesSize, PROT_READ | PROT_WRITE,
+                                                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (m_entries == MAP_FAILED) {
+            throw std::system_error { errno, std::system_category(), "mmap" };
+        }
+
+        io_uring_buf_reg reg {};
+        reg.ring_addr = reinterpret_cast<uint64_t>(m_entries);
+        reg.ring_entries = count;
+        reg.bgid = groupId;
+
+        if (::syscall(__NR_io_uring_register, m_ring.fd(), IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            int error = errno;
+            ::munmap(m_entries, m_entriesSize);
+            throw std::system_error { error, std::system_category(), "io_uring_register" };
+        }
+
+        for (uint16_t id = 0; id < count; ++id) {
+            recycle(id);
+        }
+    }
+
+    buffer_ring(const buffer_ring&) = delete;
+    buffer_ring& operator=(const buffer_ring&) = delete;
+
+    ~buffer_ring() {
+        io_uring_buf_reg reg {};
+        reg.bgid = m_groupId;
+
+        ::syscall(__NR_io_uring_register, m_ring.fd(), IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        ::munmap(m_entries, m_entriesSize);
+    }
+
+    uint16_t group_id() const { return m_groupId; }
+    size_t buffer_size() const { return m_bufferSize; }
+
+    /**
+     * @returns The buffer of the given ID, as a completion reports it.
+    */
+    uint8_t* data(uint16_t bufferId) { return m_storage.data() + size_t(bufferId) * m_bufferSize; }
+
+    /**
+     * Gives a buffer back to the kernel, to be picked by a later receive.
+    */
+    void recycle(uint16_t bufferId) {
+        // Not through `bufs`, which the empty member the header declares it with shifts in C++.
+        io_uring_buf& entry = reinterpret_cast<io_uring_buf*>(m_entries)[m_tail & (m_count - 1)];
+        entry.addr = reinterpret_cast<uint64_t>(data(bufferId));
+        entry.len = static_cast<uint32_t>(m_bufferSize);
+        entry.bid = bufferId;
+
+        ++m_tail;
+        __atomic_store_n(&m_entries->tail, m_tail, __ATOMIC_RELEASE);
+    }
+
+private:
+    ring& m_ring;                    // The ring the buffers are registered with.
+    uint16_t m_groupId;              // ID of the group of buffers.
+    uint16_t m_count;                // Number of buffers.
+    size_t m_bufferSize;             // Size of each buffer.
+    std::vector<uint8_t> m_storage;  // The buffers, one after the other.
+
+    io_uring_buf_ring* m_entries { nullptr };  // Buffers available to the kernel, shared with it.
+    size_t m_entriesSize { 0 };                // Size of the mapping of the entries.
+    uint16_t m_tail { 0 };                     // Entry after the last buffer given back.
+};
+
+} // namespace uring
+
+} // namespace flash
+
+#endif
+
+#endif
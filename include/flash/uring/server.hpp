@@ -0,0 +1,1028 @@
+#ifndef FLASH_URING_SERVER_HPP
+#define FLASH_URING_SERVER_HPP
+
+/**
+ * @file server.hpp
+ * 
+ * Datagram server on io_uring, for Linux: a drop-in alternative to `udp::server`
+ * speaking the same protocol, so that `udp::client` connects to either, but
+ * receiving and sending through a ring of its own rather than through asio.
+*/
+
+#include <flash/uring/ring.hpp>
+
+#ifdef FLASH_HAS_URING
+
+#include <flash/buffer_pool.hpp>
+#include <flash/dispatch.hpp>
+#include <flash/groups.hpp>
+#include <flash/log.hpp>
+#include <flash/message.hpp>
+#include <flash/queues.hpp>
+#include <flash/slot_map.hpp>
+
+#include <flash/iserver.hpp>
+#include <flash/iserverext.hpp>
+#include <flash/priority.hpp>
+#include <flash/scramble.hpp>
+#include <flash/socket_options.hpp>
+#include <flash/stats.hpp>
+
+#include <flash/udp/common.hpp>
+#include <flash/udp/endpoint_map.hpp>
+#include <flash/udp/server.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/endian/conversion.hpp>
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace flash {
+
+namespace uring {
+
+/**
+ * Server class that handles datagrams from clients, through io_uring.
+ * 
+ * Provides the same interface and protocol as `udp::server`, so that switching
+ * is a matter of the type of the server only. A single thread runs the ring:
+ * 
+ * - Datagrams are received by a single multishot receive, which stays armed across
+ *   datagrams, into buffers registered with the kernel, picked as datagrams arrive,
+ *   so there is no system call per datagram, nor a buffer per pending receive.
+ * - Datagrams are sent by `sendmsg` entries straight from the messages, header and body,
+ *   as many at once as are queued, submitted with the next wait of the ring.
+ * 
+ * Other threads hand their datagrams to the ring thread through a queue, and wake it
+ * only if it is waiting. `OnClientConnect`, `OnClientValidate`, `OnClientDisconnect`
+ * and the messages dispatched immediately are called from the ring thread.
+ * 
+ * Delta encoding, compression, coalescing, reliability and backpressure are not
+ * supported, so clients must not enable them: such frames are counted as malformed.
+ * 
+ * Should be inherited for custom functionality.
+ * 
+ * @tparam T the message type to send and receive.
+ * @tparam Q the queue policy, see `flash/queues.hpp`.
+*/
+template <typename T, typename Q = locking_queues>
+class server : public iserver<T>, protected iserverext<T> {
+public:
+    /// Interval at which timed out users are looked for, and longest wait of the ring.
+    static constexpr std::chrono::milliseconds SWEEP_INTERVAL { 100 };
+
+    /// Most datagrams being sent at once, beyond which they wait in the queue.
+    static constexpr size_t MAX_SENDS_IN_FLIGHT = 256;
+
+    /// Buffers registered for receiving, each holding a datagram of any size.
+    static constexpr uint16_t NUM_RECEIVE_BUFFERS = 64;
+
+    /**
+     * Constructor for the server. Binds the socket to the given port, and sets up the ring.
+     * The parameters are those of `udp::server`, as a drop-in replacement.
+     * 
+     * @param port          the port to listen on.
+     * @param serverTimeout the time in ms without messages after which a client is dropped.
+     * @param numThreads    ignored, the ring is run by a single thread.
+     * @param batchedIo     ignored, the ring always batches its system calls.
+     * @param options       the options of the socket.
+     * @throws std::system_error if io_uring is not supported, see `ring::supported`.
+    */
+    server(uint16_t port, uint32_t serverTimeout = 5000,
+           [[maybe_unused]] size_t numThreads = 1, [[maybe_unused]] bool batchedIo = false,
+           const socket_options& options = {})
+        : m_socket { m_context },
+          m_sends(MAX_SENDS_IN_FLIGHT),
+          m_ring { static_cast<unsigned>(2 * MAX_SENDS_IN_FLIGHT) },
+          m_receiveBuffers { m_ring, RECEIVE_GROUP_ID, NUM_RECEIVE_BUFFERS,
+                             sizeof(io_uring_recvmsg_out) + NAME_CAPACITY + udp::MAX_MESSAGE_SIZE_IN_BYTES },
+          m_serverTimeout { serverTimeout } {
+
+        boost::asio::ip::udp::endpoint endpoint { boost::asio::ip::udp::v4(), port };
+
+        // Some options must be set before binding.
+        m_socket.open(endpoint.protocol());
+        apply_socket_options(m_socket, options);
+        m_socket.bind(endpoint);
+
+        m_wakeFd = ::eventfd(0, EFD_CLOEXEC);
+        if (m_wakeFd < 0) throw std::system_error { errno, std::system_category(), "eventfd" };
+
+        // The kernel writes the name of the sender before each datagram, up to this length.
+        m_receiveHeader.msg_namelen = NAME_CAPACITY;
+
+        for (size_t i = m_sends.size(); i-- > 0;) {
+            m_freeSends.push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    virtual ~server() {
+        Stop();
+        ::close(m_wakeFd);
+    }
+
+    bool Start() final {
+        if (m_thread.joinable()) {
+            FLASH_LOG(warning, INVALID_USER_ID, "[SERVER] Already running!");
+            return false;
+        }
+
+        try {
+            m_running.store(true, std::memory_order_release);
+            m_thread = std::thread { [this]() { Run(); } };
+
+        } catch (std::exception& e) {
+            FLASH_LOG(error, INVALID_USER_ID, "[SERVER] Exception: " << e.what());
+
+            return false;
+        }
+
+        FLASH_LOG(info, INVALID_USER_ID, "[SERVER] Started on port " << m_socket.local_endpoint().port());
+
+        return true;
+    }
+
+    void Stop() final {
+        if (!m_thread.joinable()) return;
+
+        m_running.store(false, std::memory_order_release);
+        Signal();
+        m_thread.join();
+
+        FLASH_LOG(info, INVALID_USER_ID, "[SERVER] Stopped!");
+    }
+
+    /**
+     * Accepted for compatibility with `udp::server`. Datagrams are sent in order of queueing.
+    */
+    void SetPriority([[maybe_unused]] T type, [[maybe_unused]] priority p) { }
+
+    /**
+     * Sets where the messages of the given type are handled. With `dispatch_mode::immediate`,
+     * `OnMessage` is called right away on the ring thread, skipping the incoming queue,
+     * so it must be thread-safe, and should be quick, since it holds up the ring.
+     * Must be called before `Start`.
+    */
+    void SetDispatch(T type, dispatch_mode mode) {
+        m_dispatch.set(type, mode);
+    }
+
+    /**
+     * Pushes the stats to the given function periodically, from the ring thread,
+     * e.g. to export them. Must be called before `Start`.
+     * 
+     * @param callback the function to call with the stats, or null to not push them.
+     * @param interval the time between calls.
+    */
+    void SetStatsCallback(stats_callback callback, std::chrono::milliseconds interval = DEFAULT_STATS_INTERVAL) {
+        m_statsCallback = std::move(callback);
+        m_statsInterval = interval;
+    }
+
+    /**
+     * @returns A snapshot of the counters of the server and of every user.
+     * Safe to call from any thread.
+    */
+    server_stats GetStats() final {
+        server_stats stats;
+        m_counters.snapshot(stats);
+        stats.m_incomingDepth = m_qMessagesIn.size();
+        stats.m_outgoingDepth = m_qMessagesOut.size();
+
+        std::scoped_lock lock { m_mutexUsers };
+
+        m_userIdToUser.for_each([&stats](UserId userId, const udp::User& user) {
+            if (user.m_validated) stats.m_byClient[userId] = user.m_traffic;
+        });
+
+        return stats;
+    }
+
+    void MessageClient(UserId clientId, message<T>&& msg) final {
+        // Message is too long, reject.
+        if (msg.size() > udp::MAX_MESSAGE_SIZE_IN_BYTES) {
+            assert(false);
+            return;
+        }
+
+        msg.get_header().m_size = boost::endian::native_to_big(msg.get_header().m_size);
+        QueueDatagram(datagram { clientId, std::move(msg), nullptr });
+        Wake();
+    }
+
+    /**
+     * Message all validated clients, optionally ignoring a specific client.
+     * 
+     * The datagram is encoded once and shared by all the recipients, instead of copied.
+    */
+    void MessageAllClients(message<T>&& msg, UserId ignoreId = INVALID_USER_ID) final {
+        std::vector<UserId> recipients;
+
+        {
+            std::scoped_lock lock { m_mutexUsers };
+
+            recipients.reserve(m_userIdToUser.size());
+
+            m_userIdToUser.for_each([&recipients, ignoreId](UserId userId, const udp::User& user) {
+                if (userId != ignoreId && user.m_validated) {
+                    recipients.push_back(userId);
+                }
+            });
+        }
+
+        SendShared(recipients, std::move(msg));
+    }
+
+    /**
+     * Message a number of clients at once, e.g. the players near some event.
+     * 
+     * The datagram is encoded once and shared by all the recipients, instead of copied.
+     * Unknown clients are skipped when sending.
+    */
+    void MessageClients(const std::vector<UserId>& clientIds, message<T>&& msg) final {
+        SendShared(clientIds, std::move(msg));
+    }
+
+    /**
+     * Creates an empty group of clients, to be messaged at once with `MessageGroup`.
+     * 
+     * @returns The ID of the group, or `INVALID_GROUP_ID` if there are too many groups.
+    */
+    GroupId CreateGroup() final {
+        std::scoped_lock lock { m_mutexGroups };
+        return m_groups.create();
+    }
+
+    /**
+     * Destroys a group, which its members leave.
+     * 
+     * @returns Whether there was such a group.
+    */
+    bool DestroyGroup(GroupId groupId) final {
+        std::scoped_lock lock { m_mutexGroups };
+        return m_groups.destroy(groupId);
+    }
+
+    /**
+     * Adds a validated client to a group. Clients leave their groups when they disconnect.
+     * 
+     * @returns Whether the client was added, false if either is unknown, or the client was already in the group.
+    */
+    bool AddToGroup(GroupId groupId, UserId clientId) final {
+        // Both held, so that a client disconnecting meanwhile is not added after leaving its groups.
+        std::scoped_lock lock { m_mutexUsers, m_mutexGroups };
+
+        const udp::User* user = m_userIdToUser.find(clientId);
+        if (!user || !user->m_validated) return false;
+
+        return m_groups.add(groupId, clientId);
+    }
+
+    /**
+     * Removes a client from a group.
+     * 
+     * @returns Whether the client was in the group.
+    */
+    bool RemoveFromGroup(GroupId groupId, UserId clientId) final {
+        std::scoped_lock lock { m_mutexGroups };
+        return m_groups.remove(groupId, clientId);
+    }
+
+    /**
+     * Message the members of a group, optionally ignoring a specific client, e.g. the players
+     * in some zone of the world.
+     * 
+     * The datagram is encoded once and shared by all the recipients, as with `MessageClients`.
+    */
+    void MessageGroup(GroupId groupId, message<T>&& msg, UserId ignoreId = INVALID_USER_ID) final {
+        std::vector<UserId> recipients;
+
+        {
+            std::scoped_lock lock { m_mutexGroups };
+
+            const std::vector<UserId>* group = m_groups.members(groupId);
+            if (!group) return;
+
+            recipients.reserve(group->size());
+            std::copy_if(group->begin(), group->end(), std::back_inserter(recipients),
+                [ignoreId](UserId userId) { return userId != ignoreId; });
+        }
+
+        SendShared(recipients, std::move(msg));
+    }
+
+    void Update(size_t maxMessages = -1, bool wait = false) final {
+        if (wait) m_qMessagesIn.wait();
+
+        // Take the whole backlog at once, then process it without touching the queue.
+        m_qMessagesIn.drain_into(m_batchIn, maxMessages);
+
+        std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point start = batchStart;
+        std::chrono::steady_clock::duration longest {};
+
+        for (auto& taggedMsg : m_batchIn) {
+            OnMessage(taggedMsg.m_remote, std::move(taggedMsg.m_msg));
+
+            // Recycle the body, unless the handler kept it.
+            m_bodyPool.release(taggedMsg.m_msg.get_body().release());
+
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            longest = std::max(longest, end - start);
+            start = end;
+        }
+
+        if (!m_batchIn.empty()) {
+            m_counters.count_handled(m_batchIn.size(), start - batchStart, longest);
+        }
+
+        m_batchIn.clear();
+    }
+
+protected:
+    /**
+     * Called when a client connected, returns whether to accept the connection.
+     * Can be used to ban IP addresses or limit the number of connections.
+     * 
+     * Must be overridden by derived class to accept any connections.
+    */
+    bool OnClientConnect(const boost::asio::ip::address& address) override = 0;
+
+    /**
+     * Called when a client is validated by the simple scramble check.
+     * 
+     * Must be overridden by derived class to handle validation.
+    */
+    void OnClientValidate(UserId clientId) override = 0;
+
+    /**
+     * Called when a client appears to have disconnected.
+     * Can be used to remove the user from the game state.
+     * 
+     * Must be overriden by derived class to handle disconnections.
+    */
+    void OnClientDisconnect(UserId clientId) override = 0;
+
+    /**
+     * Called when a message is received from a client,
+     * after we call Update to process from the queue.
+     * 
+     * Must be overriden by derived class to handle messages.
+    */
+    void OnMessage(UserId clientId, message<T>&& msg) override = 0;
+
+    /**
+     * Datagram waiting to be sent to a user, either owned or shared with other users.
+     * Either way, its header is in network byte order.
+    */
+    struct datagram {
+        UserId m_remote;            // ID of the user to send to.
+        message<T> m_owned;         // Message owned by this datagram, unless shared.
+        shared_message<T> m_shared; // Message shared with other datagrams, or null.
+
+        std::chrono::steady_clock::time_point m_queued {};  // When it was pushed to the outgoing queue.
+
+        const message<T>& get() const { return m_shared ? *m_shared : m_owned; }
+    };
+
+    /**
+     * A `sendmsg` in flight, and everything it points to, kept until its completion.
+    */
+    struct send_slot {
+        datagram m_datagram { INVALID_USER_ID, message<T> { static_cast<T>(0) }, nullptr };
+        boost::asio::ip::udp::endpoint m_endpoint;  // Where it is sent.
+        uint64_t m_handshake { 0 };                 // Body of a validation handshake, instead of the datagram.
+        std::array<iovec, 2> m_iovecs {};           // Header and body.
+        msghdr m_header {};                         // Points to the endpoint and buffers.
+    };
+
+    typename Q::template incoming<tagged_message<T>> m_qMessagesIn;  // Queue of incoming messages.
+    typename Q::template incoming<datagram> m_qMessagesOut;          // Datagrams handed to the ring thread.
+    std::vector<tagged_message<T>> m_batchIn;                        // Messages being processed by Update.
+    std::vector<datagram> m_batchOut;                                // Datagrams taken by the ring thread.
+    buffer_pool m_bodyPool;                                          // Recycled bodies of incoming messages.
+    dispatch_map<T> m_dispatch;                                      // Dispatch mode of each message type.
+    server_counters m_counters;                                      // Counters of the server, from any thread.
+
+    boost::asio::io_context m_context;      // Only owns the socket, never run.
+    boost::asio::ip::udp::socket m_socket;  // Socket to listen for incoming messages.
+
+    // Declared before the ring, so that they outlive whatever it still has in flight.
+    msghdr m_receiveHeader {};               // Layout of the received buffers, for the multishot receive.
+    std::vector<send_slot> m_sends;          // Slots of the datagrams being sent.
+    std::vector<uint32_t> m_freeSends;       // Free slots, by position.
+
+    ring m_ring;                             // The ring, only used by its thread.
+    buffer_ring m_receiveBuffers;            // Buffers the receive picks from.
+
+    int m_wakeFd { -1 };                     // Eventfd read by the ring, to wake it up.
+    uint64_t m_wakeValue { 0 };              // Value read from the eventfd.
+    std::atomic<bool> m_sleeping { false };  // Whether the ring thread is, or is about to be, waiting.
+    std::atomic<bool> m_running { false };   // Whether the ring thread should keep going.
+    std::thread m_thread;                    // The ring thread.
+
+    /// Maps remote endpoints to user IDs.
+    udp::endpoint_map m_endpointToUserId;
+
+    /// Maps user IDs, which it issues, to user data.
+    slot_map<udp::User> m_userIdToUser;
+
+    std::mutex m_mutexUsers;  // Lock around the user tables.
+
+    client_groups m_groups;    // Groups of clients, by ID.
+    std::mutex m_mutexGroups;  // Lock around the groups, taken after the one around the user tables.
+
+    uint32_t m_serverTimeout;  // Disconnection timeout for clients in ms.
+
+    stats_callback m_statsCallback;                                        // Function the stats are pushed to, or null.
+    std::chrono::milliseconds m_statsInterval { DEFAULT_STATS_INTERVAL };  // Time between pushes.
+
+private:
+    static constexpr uint16_t RECEIVE_GROUP_ID = 0;                   // Group of the receive buffers.
+    static constexpr socklen_t NAME_CAPACITY = sizeof(sockaddr_in6);  // Room for the name of any sender.
+    static constexpr uint64_t RECEIVE_TAG = uint64_t(-1);             // Tags the completions of the receive.
+    static constexpr uint64_t WAKE_TAG = uint64_t(-2);                // Tags the completions of the wake up read.
+    static constexpr uint64_t CANCEL_TAG = uint64_t(-3);              // Tags the completions of the cancellations.
+
+    /**
+     * Removes a user that has gone away from its groups, then tells the handler.
+     * Must be called without holding the locks.
+    */
+    void Disconnected(UserId userId) {
+        {
+            std::scoped_lock lock { m_mutexGroups };
+            m_groups.remove_user(userId);
+        }
+
+        OnClientDisconnect(userId);
+    }
+
+    /**
+     * Runs the ring until stopped: submits what is due, waits for completions,
+     * and handles them, then sends what other threads queued meanwhile.
+    */
+    void Run() {
+        std::chrono::steady_clock::time_point lastSweep = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point lastStats = lastSweep;
+
+        ArmReceive();
+        ArmWake();
+
+        while (m_running.load(std::memory_order_acquire)) {
+            // Only wait if nothing was queued before we said so, see `Wake`.
+            m_sleeping.store(true, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            // Nothing can be sent either while every send slot is in flight, until one completes.
+            bool idle = m_qMessagesOut.empty() || m_freeSends.empty();
+
+            int result = m_ring.submit_and_wait(idle ? 1 : 0, SWEEP_INTERVAL);
+            m_sleeping.store(false, std::memory_order_relaxed);
+
+            if (result < 0 && result != -ETIME && result != -EINTR && result != -EBUSY) {
+                FLASH_LOG(error, INVALID_USER_ID, "[SERVER] Error submitting to the ring: " << std::strerror(-result));
+            }
+
+            m_now = std::chrono::steady_clock::now();
+
+            m_ring.for_each_cqe([this](const io_uring_cqe& cqe) { HandleCompletion(cqe); });
+
+            SendQueued();
+
+            if (m_now - lastSweep >= SWEEP_INTERVAL) {
+                CleanupUsers();
+                lastSweep = m_now;
+            }
+
+            if (m_statsCallback && m_now - lastStats >= m_statsInterval) {
+                m_statsCallback(GetStats());
+                lastStats = m_now;
+            }
+        }
+
+        // Cancel the receive and the wake up read, and wait for the sends in flight, so that
+        // nothing is left pointing into the server, nor holding the socket, once stopped.
+        if (m_receiveArmed) Cancel(RECEIVE_TAG);
+        if (m_wakeArmed) Cancel(WAKE_TAG);
+
+        while (m_receiveArmed || m_wakeArmed || m_freeSends.size() < m_sends.size()) {
+            m_ring.submit_and_wait(1, SWEEP_INTERVAL);
+            m_ring.for_each_cqe([this](const io_uring_cqe& cqe) { HandleCompletion(cqe); });
+        }
+    }
+
+    /**
+     * Wakes the ring thread up after queueing something, if it is waiting.
+    */
+    void Wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (m_sleeping.exchange(false, std::memory_order_acq_rel)) Signal();
+    }
+
+    void Signal() {
+        uint64_t one = 1;
+        [[maybe_unused]] ssize_t written = ::write(m_wakeFd, &one, sizeof(one));
+    }
+
+    /**
+     * @returns A submission entry, submitting the pending ones first if the ring is full.
+    */
+    io_uring_sqe* NextSqe() {
+        io_uring_sqe* sqe = m_ring.get_sqe();
+
+        while (!sqe) {
+            m_ring.submit();
+            sqe = m_ring.get_sqe();
+        }
+
+        return sqe;
+    }
+
+    /**
+     * Cancels the operation of the given tag, which then completes with `-ECANCELED`.
+    */
+    void Cancel(uint64_t tag) {
+        io_uring_sqe* sqe = NextSqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = tag;
+        sqe->user_data = CANCEL_TAG;
+    }
+
+    /**
+     * Arms the multishot receive, which completes once per datagram until it runs out of buffers.
+    */
+    void ArmReceive() {
+        io_uring_sqe* sqe = NextSqe();
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = m_socket.native_handle();
+        sqe->addr = reinterpret_cast<uint64_t>(&m_receiveHeader);
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = m_receiveBuffers.group_id();
+        sqe->user_data = RECEIVE_TAG;
+
+        m_receiveArmed = true;
+    }
+
+    /**
+     * Reads the eventfd, which completes when another thread wakes the ring up.
+    */
+    void ArmWake() {
+        io_uring_sqe* sqe = NextSqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = m_wakeFd;
+        sqe->addr = reinterpret_cast<uint64_t>(&m_wakeValue);
+        sqe->len = sizeof(m_wakeValue);
+        sqe->user_data = WAKE_TAG;
+
+        m_wakeArmed = true;
+    }
+
+    void HandleCompletion(const io_uring_cqe& cqe) {
+        if (cqe.user_data == RECEIVE_TAG) {
+            HandleReceive(cqe);
+
+        } else if (cqe.user_data == WAKE_TAG) {
+            m_wakeArmed = false;
+
+            if (cqe.res < 0 && cqe.res != -ECANCELED) {
+                FLASH_LOG(error, INVALID_USER_ID, "[SERVER] Error waking up: " << std::strerror(-cqe.res));
+            }
+
+            if (m_running.load(std::memory_order_relaxed)) ArmWake();
+
+        } else if (cqe.user_data != CANCEL_TAG) {
+            HandleSent(cqe);
+        }
+    }
+
+    /**
+     * Handles a datagram picked up by the multishot receive, and rearms it if it ended.
+    */
+    void HandleReceive(const io_uring_cqe& cqe) {
+        if (!(cqe.flags & IORING_CQE_F_MORE)) m_receiveArmed = false;
+
+        if (cqe.res < 0) {
+            // Out of buffers, they are all given back by now, or stopping.
+            if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+                FLASH_LOG(error, INVALID_USER_ID, "[SERVER] Error receiving message: " << std::strerror(-cqe.res));
+            }
+
+        } else if (cqe.flags & IORING_CQE_F_BUFFER) {
+            uint16_t bufferId = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            uint8_t* buffer = m_receiveBuffers.data(bufferId);
+
+            io_uring_recvmsg_out out;
+            std::memcpy(&out, buffer, sizeof(out));
+
+            // Datagram didn't fit in the buffer, ignore.
+            if (!(out.flags & MSG_TRUNC) && out.namelen <= NAME_CAPACITY) {
+                boost::asio::ip::udp::endpoint remote;
+                std::memcpy(remote.data(), buffer + sizeof(out), out.namelen);
+                remote.resize(out.namelen);
+
+                HandleDatagram(buffer + sizeof(out) + NAME_CAPACITY, out.payloadlen, remote);
+            }
+
+            m_receiveBuffers.recycle(bufferId);
+        }
+
+        if (!m_receiveArmed && m_running.load(std::memory_order_relaxed)) ArmReceive();
+    }
+
+    /**
+     * Releases the slot of a datagram once the kernel is done with it.
+    */
+    void HandleSent(const io_uring_cqe& cqe) {
+        uint32_t position = static_cast<uint32_t>(cqe.user_data);
+        send_slot& slot = m_sends[position];
+
+        if (cqe.res < 0) {
+            FLASH_LOG(error, slot.m_datagram.m_remote, "Error sending message: " << std::strerror(-cqe.res));
+        }
+
+        slot.m_datagram = datagram { INVALID_USER_ID, message<T> { static_cast<T>(0) }, nullptr };
+        m_freeSends.push_back(position);
+    }
+
+    /**
+     * Handles a datagram from the given endpoint, depending on the state of its user.
+    */
+    void HandleDatagram(const uint8_t* data, std::size_t length, const boost::asio::ip::udp::endpoint& remote) {
+        UserId userId;
+        bool validated = false;
+
+        {
+            std::scoped_lock lock { m_mutexUsers };
+
+            userId = m_endpointToUserId.find(remote);
+            if (userId != INVALID_USER_ID) validated = m_userIdToUser.find(userId)->m_validated;
+        }
+
+        if (userId == INVALID_USER_ID) {
+            // Handles the case that the endpoint is new
+            HandleNewConnection(data, length, remote);
+
+        } else if (!validated) {
+            // The endpoint is known and has been assigned an ID.
+            HandleValidation(data, length, remote, userId);
+
+        } else {
+            // The user is validated and we will process their messages.
+            ProcessMessage(data, length, userId);
+        }
+    }
+
+    void HandleNewConnection(const uint8_t* data, std::size_t length, const boost::asio::ip::udp::endpoint& remote) {
+        // Message is not correct size, ignore.
+        if (length != sizeof(uint64_t)) {
+            CountMalformed();
+            return;
+        }
+
+        // Read the magic number.
+        uint64_t magicNumber;
+        std::memcpy(&magicNumber, data, sizeof(uint64_t));
+        magicNumber = boost::endian::big_to_native(magicNumber);
+
+        // Magic number does not match, ignore.
+        if (magicNumber != udp::CONNECTION_REQUEST_MAGIC_NUMBER) {
+            CountMalformed();
+            return;
+        }
+
+        // Give the custom server a chance to deny connection by overriding OnClientConnect.
+        if (OnClientConnect(remote.address())) {
+            UserId newId;
+
+            // Generate validation data
+            uint64_t handshake = Scramble(uint64_t(m_now.time_since_epoch().count()));
+            uint64_t handshakeCheck = Scramble(handshake);
+
+            {
+                std::scoped_lock lock { m_mutexUsers };
+
+                newId = m_userIdToUser.insert(udp::User { remote, m_now, false, handshake, handshakeCheck, {} });
+
+                // Assign the user to the endpoint, unless the server is full.
+                if (newId != INVALID_USER_ID) m_endpointToUserId.insert(remote, newId);
+            }
+
+            if (newId == INVALID_USER_ID) {
+                FLASH_LOG(warning, INVALID_USER_ID, "[------] Connection Denied, Server Full");
+                return;
+            }
+
+            // Send the validation handshake.
+            SendValidation(remote, handshake);
+
+            FLASH_LOG(info, newId, "Connection Approved");
+
+        } else {
+            FLASH_LOG(warning, INVALID_USER_ID, "[------] Connection Denied");
+        }
+    }
+
+    void HandleValidation(const uint8_t* data, std::size_t length, const boost::asio::ip::udp::endpoint& remote, UserId userId) {
+        bool validated = false;
+
+        if (length == sizeof(uint64_t)) {
+            uint64_t handshakeIn;
+            std::memcpy(&handshakeIn, data, sizeof(uint64_t));
+            handshakeIn = boost::endian::big_to_native(handshakeIn);
+
+            std::scoped_lock lock { m_mutexUsers };
+
+            udp::User* user = m_userIdToUser.find(userId);
+            if (!user) return;
+
+            if (handshakeIn == user->m_handshakeCheck) {
+                user->m_validated = true;
+                user->m_lastMessageTime = m_now;
+                validated = true;
+            }
+        }
+
+        if (!validated) {
+            // Message is not correct size or handshake does not match, kill the user.
+            FLASH_LOG(warning, userId, "Client Handshake Failed.");
+
+            m_counters.m_validationFailures.fetch_add(1, std::memory_order_relaxed);
+
+            std::scoped_lock lock { m_mutexUsers };
+            m_endpointToUserId.erase(remote);
+            m_userIdToUser.erase(userId);
+
+            return;
+        }
+
+        FLASH_LOG(info, userId, "Client Validated.");
+
+        OnClientValidate(userId);
+    }
+
+    void ProcessMessage(const uint8_t* data, std::size_t length, UserId userId) {
+        // Message is too short to be in the canonical format, ignore
+        if (length < sizeof(header<T>)) {
+            CountMalformed();
+            return;
+        }
+
+        header<T> hdr;
+        std::memcpy(&hdr, data, sizeof(header<T>));
+        uint32_t wireSize = boost::endian::big_to_native(hdr.m_size);
+
+        // Size of message body does not match the size in the header, ignore
+        if (length - sizeof(header<T>) != (wireSize & WIRE_SIZE_MASK)) {
+            CountMalformed();
+            return;
+        }
+
+        {
+            std::scoped_lock lock { m_mutexUsers };
+
+            udp::User* user = m_userIdToUser.find(userId);
+            if (!user) return;
+
+            user->m_lastMessageTime = m_now;
+            user->m_traffic.count_in(length);
+        }
+
+        if (wireSize & WIRE_FLAG_PACKED) {
+            udp::for_each_packed_frame<T>(data + sizeof(header<T>), length - sizeof(header<T>),
+                [this, userId](const uint8_t* frame, std::size_t) {
+                    ProcessFrame(frame, userId);
+                });
+        } else {
+            ProcessFrame(data, userId);
+        }
+    }
+
+    /**
+     * Processes a single frame from a validated user, with a body of the size in its header.
+    */
+    void ProcessFrame(const uint8_t* data, UserId userId) {
+        message<T> msg { static_cast<T>(0) };
+        std::memcpy(&msg.get_header(), data, sizeof(header<T>));
+
+        uint32_t wireSize = boost::endian::big_to_native(msg.get_header().m_size);
+        msg.get_header().m_size = wireSize & WIRE_SIZE_MASK;
+
+        // Packed frames are never nested, and the other kinds of frames are not supported, ignore
+        if (wireSize & ~WIRE_SIZE_MASK) {
+            CountMalformed();
+            return;
+        }
+
+        m_counters.count_in(msg.get_header().m_type, sizeof(header<T>) + msg.get_header().m_size);
+
+        acquire_body(&m_bodyPool, msg.get_body(), msg.get_header().m_size);
+        std::memcpy(msg.get_body().data(), data + sizeof(header<T>), msg.get_header().m_size);
+
+        QueueIncoming(userId, std::move(msg));
+    }
+
+    /**
+     * Pushes a message to the incoming queue, unless its type is dispatched immediately,
+     * in which case it is handled right away.
+    */
+    void QueueIncoming(UserId userId, message<T>&& msg) {
+        if (m_dispatch.get(msg.get_header().m_type) == dispatch_mode::immediate) {
+            dispatch_immediately<T>(*this, userId, std::move(msg), &m_bodyPool, &m_counters);
+            return;
+        }
+
+        m_qMessagesIn.push_back(tagged_message<T> { userId, std::move(msg) });
+    }
+
+    /**
+     * Counts an incoming datagram, or frame, ignored as malformed.
+    */
+    void CountMalformed() {
+        m_counters.m_malformed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Sends the same message to a number of users. The message is encoded once,
+     * and the ring thread is woken up once for all of them.
+    */
+    void SendShared(const std::vector<UserId>& userIds, message<T>&& msg) {
+        // Message is too long, reject.
+        if (msg.size() > udp::MAX_MESSAGE_SIZE_IN_BYTES) {
+            assert(false);
+            return;
+        }
+
+        if (userIds.empty()) return;
+
+        shared_message<T> sharedMsg = make_shared_message(std::move(msg));
+
+        for (UserId userId : userIds) {
+            QueueDatagram(datagram { userId, message<T> { static_cast<T>(0) }, sharedMsg });
+        }
+
+        Wake();
+    }
+
+    /**
+     * Hands a datagram over to the ring thread, from any thread.
+    */
+    void QueueDatagram(datagram&& dgram) {
+        dgram.m_queued = std::chrono::steady_clock::now();
+        m_qMessagesOut.push_back(std::move(dgram));
+    }
+
+    /**
+     * Sends the validation handshake to a new user.
+    */
+    void SendValidation(const boost::asio::ip::udp::endpoint& endpoint, uint64_t handshake) {
+        // Every slot is in flight, the client will have to connect again.
+        if (m_freeSends.empty()) {
+            FLASH_LOG(warning, INVALID_USER_ID, "[SERVER] Too many datagrams in flight, validation dropped.");
+
+            CountDropped();
+            return;
+        }
+
+        send_slot& slot = TakeSlot(endpoint);
+        slot.m_handshake = boost::endian::native_to_big(handshake);
+        slot.m_iovecs[0] = iovec { &slot.m_handshake, sizeof(uint64_t) };
+        slot.m_header.msg_iovlen = 1;
+
+        SubmitSend(slot);
+    }
+
+    /**
+     * Takes as many of the queued datagrams as there are free slots, and submits them.
+     * Must be called on the ring thread.
+    */
+    void SendQueued() {
+        if (m_freeSends.empty() || m_qMessagesOut.empty()) return;
+
+        m_qMessagesOut.drain_into(m_batchOut, m_freeSends.size());
+
+        size_t sent = 0;
+        std::chrono::steady_clock::duration totalLag {}, longestLag {};
+
+        {
+            std::scoped_lock lock { m_mutexUsers };
+
+            // Skip the datagrams of users that have gone away in the meantime.
+            for (datagram& dgram : m_batchOut) {
+                udp::User* user = m_userIdToUser.find(dgram.m_remote);
+                if (!user) continue;
+
+                const message<T>& msg = dgram.get();
+                user->m_traffic.count_out(msg.size());
+                m_counters.count_out(msg.get_header().m_type, msg.size());
+
+                totalLag += m_now - dgram.m_queued;
+                longestLag = std::max(longestLag, m_now - dgram.m_queued);
+
+                send_slot& slot = TakeSlot(user->m_endpoint);
+                slot.m_datagram = std::move(dgram);
+
+                const message<T>& out = slot.m_datagram.get();
+                slot.m_iovecs[0] = iovec { const_cast<header<T>*>(&out.get_header()), sizeof(header<T>) };
+                slot.m_iovecs[1] = iovec { const_cast<uint8_t*>(out.get_body().data()), out.get_body().size() };
+                slot.m_header.msg_iovlen = 2;
+
+                SubmitSend(slot);
+                ++sent;
+            }
+        }
+
+        m_batchOut.clear();
+
+        if (sent > 0) m_counters.count_sent(sent, totalLag, longestLag);
+    }
+
+    /**
+     * @returns A free slot, set to send to the given endpoint. There must be one.
+    */
+    send_slot& TakeSlot(const boost::asio::ip::udp::endpoint& endpoint) {
+        send_slot& slot = m_sends[m_freeSends.back()];
+        m_freeSends.pop_back();
+
+        slot.m_endpoint = endpoint;
+        slot.m_header = msghdr {};
+        slot.m_header.msg_name = slot.m_endpoint.data();
+        slot.m_header.msg_namelen = static_cast<socklen_t>(slot.m_endpoint.size());
+        slot.m_header.msg_iov = slot.m_iovecs.data();
+
+        return slot;
+    }
+
+    /**
+     * Queues the `sendmsg` of a slot, submitted with the next wait of the ring.
+    */
+    void SubmitSend(send_slot& slot) {
+        io_uring_sqe* sqe = NextSqe();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = m_socket.native_handle();
+        sqe->addr = reinterpret_cast<uint64_t>(&slot.m_header);
+        sqe->user_data = static_cast<uint64_t>(&slot - m_sends.data());
+    }
+
+    /**
+     * Counts a datagram dropped before being sent.
+    */
+    void CountDropped() {
+        m_counters.m_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Drops the users that haven't sent anything for longer than the timeout.
+     * Runs periodically on the ring thread, rather than on every datagram.
+    */
+    void CleanupUsers() {
+        std::vector<UserId> disconnectedUsers;
+
+        {
+            std::scoped_lock lock { m_mutexUsers };
+
+            m_userIdToUser.erase_if([&](UserId userId, const udp::User& user) {
+                if (std::chrono::duration_cast<std::chrono::milliseconds>(m_now - user.m_lastMessageTime).count() <= m_serverTimeout) {
+                    return false;
+                }
+
+                m_endpointToUserId.erase(user.m_endpoint);
+                disconnectedUsers.push_back(userId);
+                return true;
+            });
+        }
+
+        for (auto userId : disconnectedUsers) {
+            FLASH_LOG(info, userId, "Client Timed Out.");
+        }
+
+        m_counters.m_timeouts.fetch_add(disconnectedUsers.size(), std::memory_order_relaxed);
+
+        for (auto userId : disconnectedUsers) {
+            Disconnected(userId);
+        }
+    }
+
+    std::chrono::steady_clock::time_point m_now;  // Time of the last wake up of the ring thread.
+    bool m_receiveArmed { false };                 // Whether the multishot receive is armed.
+    bool m_wakeArmed { false };                    // Whether the eventfd is being read.
+};
+
+} // namespace uring
+
+} // namespace flash
+
+#endif
+
+#endif
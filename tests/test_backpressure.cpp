@@ -0,0 +1,325 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/backpressure.hpp>
+#include <flash/message.hpp>
+
+#include <flash/tcp/client.hpp>
+#include <flash/tcp/server.hpp>
+#include <flash/udp/client.hpp>
+#include <flash/udp/server.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+enum class PressureMsgTypes : uint32_t {
+    A,
+    B,
+    C,
+    D
+};
+
+/**
+ * Server that records the backpressure it goes through, and can hold its networking thread.
+ * Stops when it goes away, e.g. when a check fails.
+ * 
+ * @tparam Base the transport of the server, run by a single thread.
+*/
+template <typename Base>
+class pressure_server : public Base {
+public:
+    using Base::Base;
+
+    ~pressure_server() override { this->Stop(); }
+
+    std::atomic<flash::UserId> m_client { flash::INVALID_USER_ID };
+    std::atomic<int> m_disconnected { 0 };
+
+    /**
+     * Blocks the networking thread until `Release`, so that the messages sent meanwhile
+     * are all queued behind the first one, which is being written when it goes on.
+    */
+    void Hold() {
+        boost::asio::post(this->m_ioPool.Get(0), [held = m_release.get_future().share()]() { held.wait(); });
+    }
+
+    void Release() { m_release.set_value(); }
+
+    std::vector<std::pair<flash::UserId, size_t>> pressures() {
+        std::scoped_lock lock { m_mutex };
+        return m_pressures;
+    }
+
+protected:
+    bool OnClientConnect(const boost::asio::ip::address& /* address */) override { return true; }
+    void OnClientValidate(flash::UserId clientId) override { m_client = clientId; }
+    void OnClientDisconnect(flash::UserId /* clientId */) override { ++m_disconnected; }
+    void OnMessage(flash::UserId /* clientId */, flash::message<PressureMsgTypes>&& /* msg */) override { }
+
+    void OnBackpressure(flash::UserId clientId, size_t queuedBytes) override {
+        std::scoped_lock lock { m_mutex };
+        m_pressures.emplace_back(clientId, queuedBytes);
+    }
+
+private:
+    std::promise<void> m_release;
+    std::mutex m_mutex;
+    std::vector<std::pair<flash::UserId, size_t>> m_pressures;
+};
+
+/**
+ * Client that disconnects when it goes away, e.g. when a check fails.
+ * 
+ * @tparam Base the transport of the client.
+*/
+template <typename Base>
+class pressure_client : public Base {
+public:
+    ~pressure_client() override { this->Disconnect(); }
+};
+
+using tcp_server = pressure_server<flash::tcp::server<PressureMsgTypes>>;
+using udp_server = pressure_server<flash::udp::server<PressureMsgTypes>>;
+using tcp_client = pressure_client<flash::tcp::client<PressureMsgTypes>>;
+using udp_client = pressure_client<flash::udp::client<PressureMsgTypes>>;
+
+/**
+ * Handles the messages of the server until the condition holds, or two seconds.
+*/
+template <typename S>
+bool wait_until(S& server, const std::function<bool()>& condition) {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+
+        server.Update(-1, false);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    return true;
+}
+
+/**
+ * @param padding the bytes after the value, e.g. to make the message too large to be packed.
+*/
+flash::message<PressureMsgTypes> make_value(PressureMsgTypes type, uint32_t value, size_t padding = 0) {
+    flash::message<PressureMsgTypes> msg { type };
+    std::vector<uint8_t> pad(padding);
+    msg.write(pad.data(), pad.size());
+    msg << value;
+    return msg;
+}
+
+/// Size of a message made by `make_value` without padding, header included.
+const size_t VALUE_SIZE = make_value(PressureMsgTypes::A, 0).size();
+
+/**
+ * Sends the messages to the client of the server all at once, so that every one
+ * but the first is queued, as if the client couldn't keep up.
+*/
+template <typename S>
+void send_burst(S& server, std::vector<flash::message<PressureMsgTypes>>&& burst) {
+    server.Hold();
+    for (flash::message<PressureMsgTypes>& msg : burst) {
+        server.MessageClient(server.m_client, std::move(msg));
+    }
+    server.Release();
+}
+
+/**
+ * Waits for the client to receive the given number of messages, or more,
+ * and gives the values of every one it received in order.
+*/
+template <typename S, typename C>
+std::vector<uint32_t> receive(S& server, C& client, size_t count) {
+    std::vector<uint32_t> values;
+
+    auto drain = [&]() {
+        while (!client.Incoming().empty()) {
+            flash::message<PressureMsgTypes> msg = client.Incoming().pop_front().m_msg;
+
+            uint32_t value;
+            msg >> value;
+            values.push_back(value);
+        }
+    };
+
+    wait_until(server, [&] {
+        drain();
+        return values.size() >= count;
+    });
+
+    // Anything more would come right after.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    drain();
+
+    return values;
+}
+
+/**
+ * Checks that the oldest queued messages make room for the new ones.
+*/
+template <typename S, typename C>
+void check_drop_oldest(S& server, C& client) {
+    std::vector<flash::message<PressureMsgTypes>> burst;
+    for (uint32_t i = 0; i < 10; ++i) {
+        burst.push_back(make_value(PressureMsgTypes::A, i));
+    }
+
+    // The first one is written right away, and four more fit.
+    send_burst(server, std::move(burst));
+
+    REQUIRE( receive(server, client, 5) == std::vector<uint32_t> { 0, 6, 7, 8, 9 } );
+    REQUIRE( server.GetStats().m_dropped == 5 );
+
+    // Called once on going over the mark, with what the queue would have held.
+    REQUIRE( server.pressures() == std::vector<std::pair<flash::UserId, size_t>> { { server.m_client, 5 * VALUE_SIZE } } );
+}
+
+/**
+ * Checks that new messages replace the queued ones of their type, or else the oldest.
+*/
+template <typename S, typename C>
+void check_latest_wins(S& server, C& client) {
+    std::vector<flash::message<PressureMsgTypes>> burst;
+    burst.push_back(make_value(PressureMsgTypes::A, 0));
+    burst.push_back(make_value(PressureMsgTypes::A, 1));
+    burst.push_back(make_value(PressureMsgTypes::B, 2));
+    burst.push_back(make_value(PressureMsgTypes::C, 3));
+    burst.push_back(make_value(PressureMsgTypes::A, 4));  // Replaces 1.
+    burst.push_back(make_value(PressureMsgTypes::B, 5));  // Replaces 2.
+    burst.push_back(make_value(PressureMsgTypes::D, 6));  // Drops 4, the oldest.
+
+    send_burst(server, std::move(burst));
+
+    REQUIRE( receive(server, client, 4) == std::vector<uint32_t> { 0, 5, 3, 6 } );
+    REQUIRE( server.GetStats().m_dropped == 3 );
+    REQUIRE( server.pressures() == std::vector<std::pair<flash::UserId, size_t>> { { server.m_client, 4 * VALUE_SIZE } } );
+}
+
+/**
+ * Checks that the client is dropped on going over the mark.
+*/
+template <typename S>
+void check_disconnect(S& server) {
+    std::vector<flash::message<PressureMsgTypes>> burst;
+    for (uint32_t i = 0; i < 10; ++i) {
+        burst.push_back(make_value(PressureMsgTypes::A, i));
+    }
+
+    send_burst(server, std::move(burst));
+
+    REQUIRE( wait_until(server, [&] { return server.m_disconnected == 1; }) );
+    REQUIRE( server.GetStats().m_dropped >= 1 );
+    REQUIRE( server.pressures().size() == 1 );
+}
+
+} // namespace
+
+TEST_CASE( "Connections drop their oldest queued messages beyond the mark", "[backpressure]" ) {
+    tcp_server server { 40670 };
+    server.SetBackpressure(4 * VALUE_SIZE, flash::backpressure_policy::drop_oldest);
+    REQUIRE( server.Start() );
+
+    tcp_client client;
+    REQUIRE( client.Connect("127.0.0.1", 40670) );
+    REQUIRE( wait_until(server, [&] { return server.m_client != flash::INVALID_USER_ID; }) );
+
+    check_drop_oldest(server, client);
+}
+
+TEST_CASE( "Connections replace queued messages of the same type beyond the mark", "[backpressure]" ) {
+    tcp_server server { 40671 };
+    server.SetBackpressure(3 * VALUE_SIZE, flash::backpressure_policy::latest_wins);
+    REQUIRE( server.Start() );
+
+    tcp_client client;
+    REQUIRE( client.Connect("127.0.0.1", 40671) );
+    REQUIRE( wait_until(server, [&] { return server.m_client != flash::INVALID_USER_ID; }) );
+
+    check_latest_wins(server, client);
+}
+
+TEST_CASE( "Connections are closed beyond the mark when set to disconnect", "[backpressure]" ) {
+    tcp_server server { 40672 };
+    server.SetBackpressure(3 * VALUE_SIZE, flash::backpressure_policy::disconnect);
+    REQUIRE( server.Start() );
+
+    tcp_client client;
+    REQUIRE( client.Connect("127.0.0.1", 40672) );
+    REQUIRE( wait_until(server, [&] { return server.m_client != flash::INVALID_USER_ID; }) );
+
+    check_disconnect(server);
+    REQUIRE( wait_until(server, [&] { return !client.IsConnected(); }) );
+}
+
+TEST_CASE( "Datagram servers drop the oldest datagrams queued to a client beyond the mark", "[backpressure]" ) {
+    udp_server server { 40673 };
+    server.SetBackpressure(4 * VALUE_SIZE, flash::backpressure_policy::drop_oldest);
+    REQUIRE( server.Start() );
+
+    udp_client client;
+    REQUIRE( client.Connect("127.0.0.1", 40673) );
+    REQUIRE( wait_until(server, [&] { return server.m_client != flash::INVALID_USER_ID; }) );
+
+    check_drop_oldest(server, client);
+}
+
+TEST_CASE( "Datagram servers replace queued datagrams of the same type beyond the mark", "[backpressure]" ) {
+    udp_server server { 40674 };
+    server.SetBackpressure(3 * VALUE_SIZE, flash::backpressure_policy::latest_wins);
+    REQUIRE( server.Start() );
+
+    udp_client client;
+    REQUIRE( client.Connect("127.0.0.1", 40674) );
+    REQUIRE( wait_until(server, [&] { return server.m_client != flash::INVALID_USER_ID; }) );
+
+    check_latest_wins(server, client);
+}
+
+TEST_CASE( "Datagram servers never replace packed datagrams", "[backpressure]" ) {
+    udp_server server { 40675 };
+
+    // Room for two small messages per datagram, and no flush while the test runs.
+    server.EnableCoalescing(sizeof(flash::header<PressureMsgTypes>) + 2 * VALUE_SIZE, std::chrono::seconds(10));
+    server.SetBackpressure(VALUE_SIZE + 2 * (VALUE_SIZE + 100), flash::backpressure_policy::latest_wins);
+    REQUIRE( server.Start() );
+
+    udp_client client;
+    REQUIRE( client.Connect("127.0.0.1", 40675) );
+    REQUIRE( wait_until(server, [&] { return server.m_client != flash::INVALID_USER_ID; }) );
+
+    // Packed datagrams have the first type in their header, which must not make them look
+    // like the messages of that type: the large ones are too large to be packed.
+    std::vector<flash::message<PressureMsgTypes>> burst;
+    burst.push_back(make_value(PressureMsgTypes::B, 0, 100));
+    burst.push_back(make_value(PressureMsgTypes::A, 1));
+    burst.push_back(make_value(PressureMsgTypes::A, 2));
+    burst.push_back(make_value(PressureMsgTypes::A, 3, 100));  // Sends 1 and 2 packed.
+    burst.push_back(make_value(PressureMsgTypes::A, 4, 100));  // Replaces 3, not the packed datagram.
+
+    send_burst(server, std::move(burst));
+
+    REQUIRE( receive(server, client, 4) == std::vector<uint32_t> { 0, 1, 2, 4 } );
+    REQUIRE( server.GetStats().m_dropped == 1 );
+}
+
+TEST_CASE( "Datagram servers drop clients beyond the mark when set to disconnect", "[backpressure]" ) {
+    udp_server server { 40676 };
+    server.SetBackpressure(3 * VALUE_SIZE, flash::backpressure_policy::disconnect);
+    REQUIRE( server.Start() );
+
+    udp_client client;
+    REQUIRE( client.Connect("127.0.0.1", 40676) );
+    REQUIRE( wait_until(server, [&] { return server.m_client != flash::INVALID_USER_ID; }) );
+
+    check_disconnect(server);
+}
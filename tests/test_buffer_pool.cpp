@@ -0,0 +1,86 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/buffer_pool.hpp>
+
+#include <thread>
+#include <vector>
+
+TEST_CASE( "Buffer pool recycles buffers with their capacity", "[buffer_pool]" ) {
+    flash::buffer_pool pool;
+
+    REQUIRE( pool.size() == 0 );
+
+    std::vector<uint8_t> buffer = pool.acquire(100);
+    REQUIRE( buffer.size() == 100 );
+
+    const uint8_t* data = buffer.data();
+    pool.release(std::move(buffer));
+
+    REQUIRE( pool.size() == 1 );
+
+    std::vector<uint8_t> recycled = pool.acquire(50);
+
+    REQUIRE( pool.size() == 0 );
+    REQUIRE( recycled.size() == 50 );
+    REQUIRE( recycled.capacity() >= 100 );
+    REQUIRE( recycled.data() == data );
+}
+
+TEST_CASE( "Buffer pool drops empty and oversized buffers", "[buffer_pool]" ) {
+    flash::buffer_pool pool { 2, 1000 };
+
+    pool.release(std::vector<uint8_t> {});
+    REQUIRE( pool.size() == 0 );
+
+    pool.release(std::vector<uint8_t>(2000));
+    REQUIRE( pool.size() == 0 );
+
+    pool.release(std::vector<uint8_t>(10));
+    pool.release(std::vector<uint8_t>(10));
+    pool.release(std::vector<uint8_t>(10));
+    REQUIRE( pool.size() == 2 );
+}
+
+TEST_CASE( "Buffer pool is thread-safe", "[buffer_pool]" ) {
+    flash::buffer_pool pool;
+
+    auto work = [&pool]() {
+        for (int i = 0; i < 1000; ++i) {
+            std::vector<uint8_t> buffer = pool.acquire(64);
+            buffer[0] = 1;
+            pool.release(std::move(buffer));
+        }
+    };
+
+    std::thread t1 { work };
+    std::thread t2 { work };
+
+    t1.join();
+    t2.join();
+
+    REQUIRE( pool.size() >= 1 );
+    REQUIRE( pool.size() <= 2 );
+}
+
+TEST_CASE( "Bodies take a pooled buffer only when they don't fit inline", "[buffer_pool]" ) {
+    flash::buffer_pool pool;
+    pool.release(std::vector<uint8_t>(100));
+    pool.release(std::vector<uint8_t>(100));
+
+    flash::byte_buffer<16> small;
+    flash::acquire_body(&pool, small, 16);
+    REQUIRE( small.size() == 16 );
+    REQUIRE( small.is_inline() );
+    REQUIRE( pool.size() == 2 );
+
+    flash::byte_buffer<16> large;
+    flash::acquire_body(&pool, large, 50);
+    REQUIRE( large.size() == 50 );
+    REQUIRE( large.capacity() >= 100 );
+    REQUIRE( pool.size() == 1 );
+
+    flash::byte_buffer<16> unpooled;
+    flash::acquire_body(nullptr, unpooled, 50);
+    REQUIRE( unpooled.size() == 50 );
+    REQUIRE( pool.size() == 1 );
+}
@@ -0,0 +1,112 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/byte_buffer.hpp>
+
+#include <utility>
+#include <vector>
+
+TEST_CASE( "Byte buffer stores small sizes inline", "[byte_buffer]" ) {
+    flash::byte_buffer<16> buffer;
+
+    REQUIRE( buffer.empty() );
+    REQUIRE( buffer.is_inline() );
+    REQUIRE( buffer.capacity() == 16 );
+
+    buffer.resize(10);
+    buffer[9] = 42;
+
+    REQUIRE( buffer.size() == 10 );
+    REQUIRE( buffer.is_inline() );
+    REQUIRE( buffer[0] == 0 );
+    REQUIRE( buffer[9] == 42 );
+
+    buffer.resize(4);
+    buffer.resize(8);
+
+    REQUIRE( buffer.size() == 8 );
+    REQUIRE( buffer[7] == 0 );
+}
+
+TEST_CASE( "Byte buffer spills to the heap and keeps its contents", "[byte_buffer]" ) {
+    flash::byte_buffer<16> buffer;
+
+    for (int i = 0; i < 16; ++i) buffer.push_back(static_cast<uint8_t>(i));
+    REQUIRE( buffer.is_inline() );
+
+    buffer.push_back(16);
+
+    REQUIRE( !buffer.is_inline() );
+    REQUIRE( buffer.size() == 17 );
+    REQUIRE( buffer.capacity() >= 17 );
+
+    for (int i = 0; i < 17; ++i) REQUIRE( buffer[i] == i );
+
+    // Keeps the heap storage, like a vector keeps its capacity.
+    buffer.clear();
+    REQUIRE( buffer.empty() );
+    REQUIRE( !buffer.is_inline() );
+}
+
+TEST_CASE( "Byte buffer copies and moves in both states", "[byte_buffer]" ) {
+    flash::byte_buffer<8> small;
+    small.assign(4, 7);
+
+    flash::byte_buffer<8> large;
+    large.assign(100, 9);
+
+    flash::byte_buffer<8> smallCopy = small;
+    flash::byte_buffer<8> largeCopy = large;
+
+    REQUIRE( smallCopy == small );
+    REQUIRE( largeCopy == large );
+    REQUIRE( largeCopy.data() != large.data() );
+
+    const uint8_t* heap = large.data();
+    flash::byte_buffer<8> smallMoved = std::move(small);
+    flash::byte_buffer<8> largeMoved = std::move(large);
+
+    REQUIRE( smallMoved == smallCopy );
+    REQUIRE( largeMoved == largeCopy );
+    REQUIRE( largeMoved.data() == heap );
+
+    REQUIRE( small.empty() );
+    REQUIRE( large.empty() );
+    REQUIRE( large.is_inline() );
+}
+
+TEST_CASE( "Byte buffer adopts and releases vectors without copying", "[byte_buffer]" ) {
+    std::vector<uint8_t> vec(50, 3);
+    const uint8_t* data = vec.data();
+
+    flash::byte_buffer<8> buffer { std::move(vec) };
+
+    REQUIRE( buffer.size() == 50 );
+    REQUIRE( buffer.data() == data );
+
+    std::vector<uint8_t> released = buffer.release();
+
+    REQUIRE( released.data() == data );
+    REQUIRE( buffer.empty() );
+    REQUIRE( buffer.is_inline() );
+
+    // Nothing to release from inline storage.
+    buffer.resize(4);
+    REQUIRE( buffer.release().capacity() == 0 );
+}
+
+TEST_CASE( "Byte buffer appends across the inline limit", "[byte_buffer]" ) {
+    flash::byte_buffer<8> buffer;
+
+    uint8_t bytes[6] = { 1, 2, 3, 4, 5, 6 };
+    buffer.append(bytes, 6);
+
+    REQUIRE( buffer.is_inline() );
+
+    buffer.append(bytes, 6);
+
+    REQUIRE( !buffer.is_inline() );
+    REQUIRE( buffer.size() == 12 );
+    REQUIRE( buffer[5] == 6 );
+    REQUIRE( buffer[6] == 1 );
+    REQUIRE( buffer[11] == 6 );
+}
@@ -0,0 +1,136 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/compression.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+enum class CompressionId : uint32_t {
+    Level
+};
+
+/**
+ * Run-length encoding as (count, byte) pairs, which is enough to exercise the framing.
+*/
+class rle_compressor : public flash::compressor {
+public:
+    bool compress(const uint8_t* data, size_t size, std::vector<uint8_t>& out) const override {
+        for (size_t i = 0; i < size; ) {
+            size_t run = 1;
+            while (i + run < size && run < 255 && data[i + run] == data[i]) ++run;
+
+            out.push_back(static_cast<uint8_t>(run));
+            out.push_back(data[i]);
+            i += run;
+        }
+
+        return true;
+    }
+
+    bool decompress(const uint8_t* data, size_t size, uint8_t* out, size_t originalSize) const override {
+        size_t written = 0;
+
+        for (size_t i = 0; i + 1 < size; i += 2) {
+            if (originalSize - written < data[i]) return false;
+
+            for (size_t j = 0; j < data[i]; ++j) out[written++] = data[i + 1];
+        }
+
+        return written == originalSize;
+    }
+};
+
+TEST_CASE( "Compression only applies to large bodies that shrink", "[compression]" ) {
+    flash::compression_settings settings { std::make_shared<rle_compressor>(), 100 };
+
+    flash::message<CompressionId> small { CompressionId::Level };
+    small.get_body().assign(50, 0);
+    small.get_header().m_size = 50;
+
+    REQUIRE_FALSE( flash::compress_message(settings, small) );
+    REQUIRE( small.get_header().m_size == 50 );
+
+    // Every byte differs from the next, so run-length encoding doubles the size.
+    flash::message<CompressionId> noisy { CompressionId::Level };
+    for (size_t i = 0; i < 200; ++i) noisy.get_body().push_back(static_cast<uint8_t>(i));
+    noisy.get_header().m_size = 200;
+
+    REQUIRE_FALSE( flash::compress_message(settings, noisy) );
+    REQUIRE( noisy.get_body().size() == 200 );
+
+    // Without a compressor, nothing is compressed.
+    flash::message<CompressionId> level { CompressionId::Level };
+    level.get_body().assign(1000, 7);
+    level.get_header().m_size = 1000;
+
+    REQUIRE_FALSE( flash::compress_message(flash::compression_settings {}, level) );
+    REQUIRE( flash::compress_message(settings, level) );
+
+    REQUIRE( (level.get_header().m_size & flash::WIRE_FLAG_COMPRESSED) != 0 );
+    REQUIRE( (level.get_header().m_size & flash::WIRE_SIZE_MASK) == level.get_body().size() );
+    REQUIRE( level.get_body().size() < 1000 );
+}
+
+TEST_CASE( "Compressed bodies round-trip through the framing", "[compression]" ) {
+    flash::compression_settings settings { std::make_shared<rle_compressor>(), 100 };
+
+    flash::message<CompressionId> msg { CompressionId::Level };
+    msg.get_body().assign(300, 1);
+    msg.get_body()[150] = 2;
+    msg.get_header().m_size = 300;
+
+    flash::message<CompressionId> original = msg;
+    REQUIRE( flash::compress_message(settings, msg) );
+
+    size_t originalSize = 0;
+    REQUIRE( flash::decompressed_size(msg.get_body().data(), msg.get_body().size(), originalSize) );
+    REQUIRE( originalSize == 300 );
+
+    std::vector<uint8_t> out(originalSize);
+    REQUIRE( flash::decompress_body(*settings.m_compressor, msg.get_body().data(), msg.get_body().size(), out.data(), originalSize) );
+    REQUIRE( std::vector<uint8_t>(original.get_body().begin(), original.get_body().end()) == out );
+}
+
+TEST_CASE( "Compressed bodies with bad sizes are rejected", "[compression]" ) {
+    size_t originalSize = 0;
+
+    std::vector<uint8_t> truncated = { 1, 2 };
+    REQUIRE_FALSE( flash::decompressed_size(truncated.data(), truncated.size(), originalSize) );
+
+    // Claims to decompress to more than the limit, e.g. a decompression bomb.
+    std::vector<uint8_t> huge(flash::compressed_body_prefix::SIZE + 2);
+    flash::compressed_body_prefix::encode_into(huge.data(), uint32_t { 0xFFFFFFFF });
+    REQUIRE_FALSE( flash::decompressed_size(huge.data(), huge.size(), originalSize) );
+
+    // Claims another size than what the data decompresses to.
+    std::vector<uint8_t> mismatched(flash::compressed_body_prefix::SIZE);
+    flash::compressed_body_prefix::encode_into(mismatched.data(), uint32_t { 10 });
+    mismatched.push_back(5);
+    mismatched.push_back(9);
+
+    std::vector<uint8_t> out(10);
+    REQUIRE( flash::decompressed_size(mismatched.data(), mismatched.size(), originalSize) );
+    REQUIRE_FALSE( flash::decompress_body(rle_compressor {}, mismatched.data(), mismatched.size(), out.data(), originalSize) );
+}
+
+#ifdef FLASH_WITH_ZLIB
+TEST_CASE( "Zlib compressor round-trips bodies", "[compression]" ) {
+    flash::compression_settings settings { std::make_shared<flash::zlib_compressor>(), 100 };
+
+    flash::message<CompressionId> msg { CompressionId::Level };
+    for (size_t i = 0; i < 10000; ++i) msg.get_body().push_back(static_cast<uint8_t>(i % 17));
+    msg.get_header().m_size = 10000;
+
+    flash::message<CompressionId> original = msg;
+    REQUIRE( flash::compress_message(settings, msg) );
+    REQUIRE( msg.get_body().size() < 1000 );
+
+    size_t originalSize = 0;
+    REQUIRE( flash::decompressed_size(msg.get_body().data(), msg.get_body().size(), originalSize) );
+
+    std::vector<uint8_t> out(originalSize);
+    REQUIRE( flash::decompress_body(*settings.m_compressor, msg.get_body().data(), msg.get_body().size(), out.data(), originalSize) );
+    REQUIRE( std::vector<uint8_t>(original.get_body().begin(), original.get_body().end()) == out );
+}
+#endif
@@ -0,0 +1,118 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/coroutine.hpp>
+#include <flash/message.hpp>
+
+#include <flash/tcp/client.hpp>
+#include <flash/tcp/server.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+
+enum class CoroutineMsgTypes : uint32_t {
+    Echo,
+    Done
+};
+
+using namespace std::chrono_literals;
+
+TEST_CASE( "Message waiter wakes a coroutine from another thread", "[coroutine]" ) {
+    boost::asio::io_context context;
+    auto guard = boost::asio::make_work_guard(context);
+
+    flash::message_waiter waiter { context.get_executor() };
+    std::atomic<int> deposited { 0 };
+    std::promise<int> seen;
+
+    boost::asio::co_spawn(context, [&]() -> boost::asio::awaitable<void> {
+        co_await waiter.wait([&deposited]() { return deposited.load() > 0; });
+        seen.set_value(deposited.load());
+    }, boost::asio::detached);
+
+    std::thread runner([&context]() { context.run(); });
+
+    std::this_thread::sleep_for(20ms);
+    deposited.store(1);
+    waiter.notify();
+
+    std::future<int> result = seen.get_future();
+    REQUIRE( result.wait_for(5s) == std::future_status::ready );
+    REQUIRE( result.get() == 1 );
+
+    guard.reset();
+    runner.join();
+}
+
+class echo_server : public flash::tcp::server<CoroutineMsgTypes> {
+public:
+    using flash::tcp::server<CoroutineMsgTypes>::server;
+
+    std::atomic<size_t> m_handled { 0 };
+
+protected:
+    bool OnClientConnect(const boost::asio::ip::address& /* address */) override { return true; }
+    void OnClientValidate(flash::UserId /* clientId */) override { }
+    void OnClientDisconnect(flash::UserId /* clientId */) override { }
+
+    void OnMessage(flash::UserId clientId, flash::message<CoroutineMsgTypes>&& msg) override {
+        ++m_handled;
+        MessageClient(clientId, std::move(msg));
+    }
+};
+
+TEST_CASE( "Servers can be awaited for messages, small and large", "[coroutine]" ) {
+    echo_server server { 40650 };
+    REQUIRE( server.Start() );
+
+    boost::asio::co_spawn(server.GetExecutor(), [&server]() -> boost::asio::awaitable<void> {
+        while (server.m_handled < 101) co_await server.NextMessages();
+    }, boost::asio::detached);
+
+    flash::tcp::client<CoroutineMsgTypes> client;
+    REQUIRE( client.Connect("127.0.0.1", 40650) );
+
+    for (uint32_t i = 0; i < 100; ++i) {
+        flash::message<CoroutineMsgTypes> msg { CoroutineMsgTypes::Echo };
+        msg << i;
+        client.Send(std::move(msg));
+    }
+
+    // Too large for the receive buffer, so its body is read on its own.
+    std::vector<uint8_t> large(200000, 7);
+    flash::message<CoroutineMsgTypes> msg { CoroutineMsgTypes::Done };
+    msg.write(large.data(), large.size());
+    client.Send(std::move(msg));
+
+    uint32_t sum = 0, count = 0;
+    size_t largeSize = 0;
+
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + 5s;
+    while (largeSize == 0 && std::chrono::steady_clock::now() < deadline) {
+        if (client.Incoming().empty()) {
+            std::this_thread::sleep_for(1ms);
+            continue;
+        }
+
+        flash::message<CoroutineMsgTypes> echoed = client.Incoming().pop_front().m_msg;
+        if (echoed.get_header().m_type == CoroutineMsgTypes::Done) {
+            largeSize = echoed.get_body().size();
+            continue;
+        }
+
+        uint32_t i;
+        echoed >> i;
+        sum += i;
+        ++count;
+    }
+
+    REQUIRE( count == 100 );
+    REQUIRE( sum == 4950 );
+    REQUIRE( largeSize == large.size() );
+    REQUIRE( server.m_handled == 101 );
+
+    client.Disconnect();
+    server.Stop();
+}
@@ -0,0 +1,93 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/udp/common.hpp>
+
+#include <boost/endian/conversion.hpp>
+
+#include <cstdint>
+#include <vector>
+
+enum class PackerId : uint32_t {
+    Input,
+    Event
+};
+
+/**
+ * Builds a message of the given body size, with its header in network byte order.
+*/
+static flash::message<PackerId> wire_message(PackerId type, size_t size, uint8_t fill) {
+    flash::message<PackerId> msg { type };
+    msg.get_body().assign(size, fill);
+    msg.get_header().m_size = boost::endian::native_to_big(static_cast<uint32_t>(size));
+
+    return msg;
+}
+
+TEST_CASE( "Packer packs frames up to the MTU", "[packer]" ) {
+    flash::udp::datagram_packer<PackerId> packer { 100 };
+
+    auto input = wire_message(PackerId::Input, 20, 1);
+    auto event = wire_message(PackerId::Event, 30, 2);
+
+    REQUIRE( packer.empty() );
+    REQUIRE( packer.fits(input) );
+
+    packer.append(input);
+    packer.append(event);
+    REQUIRE( packer.num_frames() == 2 );
+
+    // Header of the packet, plus two frames of 28 and 38 bytes, leaves room for 26 more.
+    REQUIRE( packer.has_room(wire_message(PackerId::Input, 18, 0)) );
+    REQUIRE_FALSE( packer.has_room(wire_message(PackerId::Input, 19, 0)) );
+    REQUIRE_FALSE( packer.fits(wire_message(PackerId::Input, 85, 0)) );
+
+    flash::message<PackerId> packet = packer.take();
+    REQUIRE( packer.empty() );
+
+    uint32_t wireSize = boost::endian::big_to_native(packet.get_header().m_size);
+    REQUIRE( (wireSize & flash::WIRE_FLAG_PACKED) != 0 );
+    REQUIRE( (wireSize & flash::WIRE_SIZE_MASK) == packet.get_body().size() );
+
+    std::vector<PackerId> types;
+    std::vector<size_t> lengths;
+
+    flash::udp::for_each_packed_frame<PackerId>(packet.get_body().data(), packet.get_body().size(),
+        [&](const uint8_t* frame, size_t length) {
+            flash::header<PackerId> hdr;
+            std::memcpy(&hdr, frame, sizeof(hdr));
+
+            types.push_back(hdr.m_type);
+            lengths.push_back(length);
+            REQUIRE( frame[length - 1] == (hdr.m_type == PackerId::Input ? 1 : 2) );
+        });
+
+    REQUIRE( types == std::vector<PackerId> { PackerId::Input, PackerId::Event } );
+    REQUIRE( lengths == std::vector<size_t> { 28, 38 } );
+}
+
+TEST_CASE( "Packer gives back a single frame unpacked", "[packer]" ) {
+    flash::udp::datagram_packer<PackerId> packer { 1200 };
+
+    auto input = wire_message(PackerId::Input, 5, 7);
+    packer.append(input);
+
+    flash::message<PackerId> msg = packer.take();
+
+    REQUIRE( msg.get_header().m_type == PackerId::Input );
+    REQUIRE( msg.get_header().m_size == input.get_header().m_size );
+    REQUIRE( msg.get_body() == input.get_body() );
+}
+
+TEST_CASE( "Unpacking stops at a truncated frame", "[packer]" ) {
+    flash::udp::datagram_packer<PackerId> packer { 1200 };
+    packer.append(wire_message(PackerId::Input, 10, 1));
+    packer.append(wire_message(PackerId::Event, 10, 2));
+
+    flash::message<PackerId> packet = packer.take();
+
+    size_t count = 0;
+    flash::udp::for_each_packed_frame<PackerId>(packet.get_body().data(), packet.get_body().size() - 1,
+        [&](const uint8_t*, size_t) { ++count; });
+
+    REQUIRE( count == 1 );
+}
@@ -0,0 +1,120 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/delta.hpp>
+
+#include <cstdint>
+#include <vector>
+
+enum class DeltaId : uint32_t {
+    Snapshot,
+    Chat
+};
+
+TEST_CASE( "Delta encoding round-trips sparse changes", "[delta]" ) {
+    std::vector<uint8_t> baseline(1000);
+    for (size_t i = 0; i < baseline.size(); ++i) baseline[i] = static_cast<uint8_t>(i);
+
+    std::vector<uint8_t> current = baseline;
+    current[0] = 0xFF;
+    current[10] = 0xFF;
+    current[12] = 0xFF;
+    current[999] = 0xFF;
+
+    std::vector<uint8_t> delta;
+    REQUIRE( flash::delta_encode(baseline.data(), current.data(), current.size(), delta, current.size()) );
+
+    // Three runs, the close changes at 10 and 12 sharing one.
+    REQUIRE( delta.size() == 3 * 4 + 1 + 3 + 1 );
+
+    std::vector<uint8_t> decoded(baseline.size());
+    REQUIRE( flash::delta_decode(baseline.data(), baseline.size(), delta.data(), delta.size(), decoded.data()) );
+    REQUIRE( decoded == current );
+
+    // Unchanged bodies encode to nothing.
+    delta.clear();
+    REQUIRE( flash::delta_encode(baseline.data(), baseline.data(), baseline.size(), delta, baseline.size()) );
+    REQUIRE( delta.empty() );
+}
+
+TEST_CASE( "Delta encoding gives up on dense changes and rejects malformed input", "[delta]" ) {
+    std::vector<uint8_t> baseline(100, 0);
+    std::vector<uint8_t> current(100, 1);
+
+    std::vector<uint8_t> delta;
+    REQUIRE_FALSE( flash::delta_encode(baseline.data(), current.data(), current.size(), delta, current.size()) );
+
+    // A run past the end of the body.
+    std::vector<uint8_t> bad = { 90, 0, 20, 0 };
+    bad.resize(bad.size() + 20, 0xAA);
+
+    std::vector<uint8_t> decoded(baseline.size());
+    REQUIRE_FALSE( flash::delta_decode(baseline.data(), baseline.size(), bad.data(), bad.size(), decoded.data()) );
+
+    // A truncated run header.
+    std::vector<uint8_t> truncated = { 1, 0 };
+    REQUIRE_FALSE( flash::delta_decode(baseline.data(), baseline.size(), truncated.data(), truncated.size(), decoded.data()) );
+}
+
+TEST_CASE( "Delta streams only encode against acknowledged frames", "[delta]" ) {
+    flash::delta_encoder<DeltaId> encoder;
+    flash::delta_decoder<DeltaId> decoder;
+
+    flash::message<DeltaId>::body_type body;
+    std::vector<uint8_t> frame;
+    uint16_t seq;
+
+    std::vector<uint8_t> state(200, 0);
+
+    // Nothing acknowledged yet, so the first frame is full.
+    encoder.encode(DeltaId::Snapshot, state.data(), state.size(), frame);
+    REQUIRE( frame.size() == flash::delta_frame_prefix::SIZE + state.size() );
+    REQUIRE( decoder.decode(DeltaId::Snapshot, frame.data(), frame.size(), body, seq) );
+    REQUIRE( seq == 0 );
+
+    encoder.ack(DeltaId::Snapshot, seq);
+
+    // Small changes are sent as a delta against frame 0.
+    state[50] = 1;
+    encoder.encode(DeltaId::Snapshot, state.data(), state.size(), frame);
+    REQUIRE( frame.size() < state.size() );
+
+    // That frame is lost, and the next one still encodes against frame 0.
+    state[51] = 2;
+    encoder.encode(DeltaId::Snapshot, state.data(), state.size(), frame);
+    REQUIRE( decoder.decode(DeltaId::Snapshot, frame.data(), frame.size(), body, seq) );
+    REQUIRE( seq == 2 );
+    REQUIRE( std::vector<uint8_t>(body.begin(), body.end()) == state );
+
+    // Streams of other types are independent.
+    encoder.encode(DeltaId::Chat, state.data(), state.size(), frame);
+    REQUIRE( frame.size() == flash::delta_frame_prefix::SIZE + state.size() );
+}
+
+TEST_CASE( "Delta streams drop frames whose baseline is unknown", "[delta]" ) {
+    flash::delta_encoder<DeltaId> encoder;
+    flash::delta_decoder<DeltaId> decoder;
+    flash::delta_decoder<DeltaId> lateDecoder;
+
+    flash::message<DeltaId>::body_type body;
+    std::vector<uint8_t> frame;
+    uint16_t seq;
+
+    std::vector<uint8_t> state(200, 0);
+
+    encoder.encode(DeltaId::Snapshot, state.data(), state.size(), frame);
+    REQUIRE( decoder.decode(DeltaId::Snapshot, frame.data(), frame.size(), body, seq) );
+    encoder.ack(DeltaId::Snapshot, seq);
+
+    state[0] = 1;
+    encoder.encode(DeltaId::Snapshot, state.data(), state.size(), frame);
+    REQUIRE_FALSE( lateDecoder.decode(DeltaId::Snapshot, frame.data(), frame.size(), body, seq) );
+
+    // Without further acks, the baseline grows too old, and the stream falls back to full frames.
+    for (size_t i = 0; i < flash::DELTA_HISTORY_SIZE; ++i) {
+        encoder.encode(DeltaId::Snapshot, state.data(), state.size(), frame);
+    }
+
+    REQUIRE( frame.size() == flash::delta_frame_prefix::SIZE + state.size() );
+    REQUIRE( lateDecoder.decode(DeltaId::Snapshot, frame.data(), frame.size(), body, seq) );
+    REQUIRE( std::vector<uint8_t>(body.begin(), body.end()) == state );
+}
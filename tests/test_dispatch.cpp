@@ -0,0 +1,83 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/buffer_pool.hpp>
+#include <flash/dispatch.hpp>
+#include <flash/message.hpp>
+#include <flash/stats.hpp>
+
+#include <flash/iserverext.hpp>
+
+#include <vector>
+
+enum class DispatchMsgTypes : uint32_t {
+    Ping,
+    Chat
+};
+
+TEST_CASE( "Dispatch map defaults to queued", "[dispatch]" ) {
+    flash::dispatch_map<DispatchMsgTypes> dispatch;
+
+    REQUIRE( dispatch.get(DispatchMsgTypes::Ping) == flash::dispatch_mode::queued );
+
+    dispatch.set(DispatchMsgTypes::Ping, flash::dispatch_mode::immediate);
+    REQUIRE( dispatch.get(DispatchMsgTypes::Ping) == flash::dispatch_mode::immediate );
+    REQUIRE( dispatch.get(DispatchMsgTypes::Chat) == flash::dispatch_mode::queued );
+
+    dispatch.set(DispatchMsgTypes::Ping, flash::dispatch_mode::queued);
+    REQUIRE( dispatch.get(DispatchMsgTypes::Ping) == flash::dispatch_mode::queued );
+}
+
+class recording_server : public flash::iserverext<DispatchMsgTypes> {
+public:
+    bool OnClientConnect(const boost::asio::ip::address& /* address */) override { return true; }
+    void OnClientValidate(flash::UserId /* clientId */) override { }
+    void OnClientDisconnect(flash::UserId /* clientId */) override { }
+
+    void OnMessage(flash::UserId clientId, flash::message<DispatchMsgTypes>&& msg) override {
+        m_clients.push_back(clientId);
+        m_sizes.push_back(msg.get_body().size());
+
+        if (m_keep) m_kept.push_back(std::move(msg));
+    }
+
+    bool m_keep { false };
+    std::vector<flash::UserId> m_clients;
+    std::vector<size_t> m_sizes;
+    std::vector<flash::message<DispatchMsgTypes>> m_kept;
+};
+
+TEST_CASE( "Immediate dispatch hands the message over, and recycles its body", "[dispatch]" ) {
+    recording_server server;
+    flash::buffer_pool pool;
+    flash::server_counters counters;
+
+    flash::message<DispatchMsgTypes> msg { DispatchMsgTypes::Ping };
+    msg.get_body() = pool.acquire(4096);
+    msg.get_header().m_size = 4096;
+
+    flash::dispatch_immediately(server, 7, std::move(msg), &pool, &counters);
+
+    REQUIRE( server.m_clients == std::vector<flash::UserId> { 7 } );
+    REQUIRE( server.m_sizes == std::vector<size_t> { 4096 } );
+    REQUIRE( pool.size() == 1 );
+
+    flash::server_stats stats;
+    counters.snapshot(stats);
+    REQUIRE( stats.m_handled == 1 );
+}
+
+TEST_CASE( "Immediate dispatch leaves the bodies kept by the handler alone", "[dispatch]" ) {
+    recording_server server;
+    server.m_keep = true;
+    flash::buffer_pool pool;
+
+    flash::message<DispatchMsgTypes> msg { DispatchMsgTypes::Chat };
+    msg.get_body() = pool.acquire(4096);
+    msg.get_header().m_size = 4096;
+
+    flash::dispatch_immediately(server, 8, std::move(msg), &pool, nullptr);
+
+    REQUIRE( pool.size() == 0 );
+    REQUIRE( server.m_kept.size() == 1 );
+    REQUIRE( server.m_kept[0].get_body().size() == 4096 );
+}
@@ -0,0 +1,56 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/udp/endpoint_map.hpp>
+
+#include <vector>
+
+using boost::asio::ip::udp;
+
+static udp::endpoint make_endpoint(const char* address, unsigned short port) {
+    return udp::endpoint { boost::asio::ip::make_address(address), port };
+}
+
+TEST_CASE( "Endpoint map finds the IDs of the endpoints", "[endpoint_map]" ) {
+    flash::udp::endpoint_map map;
+
+    REQUIRE( map.find(make_endpoint("127.0.0.1", 5000)) == flash::INVALID_USER_ID );
+
+    map.insert(make_endpoint("127.0.0.1", 5000), 10);
+    map.insert(make_endpoint("127.0.0.1", 5001), 11);
+    map.insert(make_endpoint("::1", 5000), 12);
+
+    REQUIRE( map.size() == 3 );
+    REQUIRE( map.find(make_endpoint("127.0.0.1", 5000)) == 10 );
+    REQUIRE( map.find(make_endpoint("127.0.0.1", 5001)) == 11 );
+    REQUIRE( map.find(make_endpoint("::1", 5000)) == 12 );
+    REQUIRE_FALSE( map.contains(make_endpoint("127.0.0.2", 5000)) );
+
+    map.insert(make_endpoint("127.0.0.1", 5000), 20);
+    REQUIRE( map.size() == 3 );
+    REQUIRE( map.find(make_endpoint("127.0.0.1", 5000)) == 20 );
+}
+
+TEST_CASE( "Endpoint map keeps finding the others while growing and erasing", "[endpoint_map]" ) {
+    flash::udp::endpoint_map map;
+    std::vector<udp::endpoint> endpoints;
+
+    for (unsigned short port = 0; port < 1000; ++port) {
+        endpoints.push_back(make_endpoint("10.0.0.1", static_cast<unsigned short>(40000 + port)));
+        map.insert(endpoints.back(), port + 1);
+    }
+
+    // Erase every third endpoint, which makes the others shift back along their runs.
+    for (size_t i = 0; i < endpoints.size(); i += 3) {
+        REQUIRE( map.erase(endpoints[i]) );
+    }
+    REQUIRE_FALSE( map.erase(endpoints[0]) );
+
+    for (size_t i = 0; i < endpoints.size(); ++i) {
+        flash::UserId expected = i % 3 == 0 ? flash::INVALID_USER_ID : flash::UserId(i + 1);
+        REQUIRE( map.find(endpoints[i]) == expected );
+    }
+
+    map.clear();
+    REQUIRE( map.empty() );
+    REQUIRE( map.find(endpoints[1]) == flash::INVALID_USER_ID );
+}
@@ -0,0 +1,84 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/groups.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+std::vector<flash::UserId> sorted_members(const flash::client_groups& groups, flash::GroupId groupId) {
+    std::vector<flash::UserId> members = *groups.members(groupId);
+    std::sort(members.begin(), members.end());
+    return members;
+}
+
+} // namespace
+
+TEST_CASE( "Groups hold their members once each", "[groups]" ) {
+    flash::client_groups groups;
+
+    flash::GroupId zone = groups.create();
+    REQUIRE( zone > 0 );
+    REQUIRE( groups.members(zone)->empty() );
+
+    REQUIRE( groups.add(zone, 3) );
+    REQUIRE( groups.add(zone, 1) );
+    REQUIRE( groups.add(zone, 2) );
+    REQUIRE_FALSE( groups.add(zone, 2) );
+
+    REQUIRE( sorted_members(groups, zone) == std::vector<flash::UserId> { 1, 2, 3 } );
+
+    REQUIRE( groups.remove(zone, 3) );
+    REQUIRE_FALSE( groups.remove(zone, 3) );
+    REQUIRE( sorted_members(groups, zone) == std::vector<flash::UserId> { 1, 2 } );
+
+    REQUIRE_FALSE( groups.add(flash::INVALID_GROUP_ID, 1) );
+    REQUIRE( groups.members(flash::INVALID_GROUP_ID) == nullptr );
+}
+
+TEST_CASE( "Groups lose a user that leaves them all", "[groups]" ) {
+    flash::client_groups groups;
+
+    flash::GroupId a = groups.create();
+    flash::GroupId b = groups.create();
+    REQUIRE( a != b );
+
+    groups.add(a, 1);
+    groups.add(a, 2);
+    groups.add(b, 1);
+
+    std::vector<flash::GroupId> ofOne = groups.groups_of(1);
+    std::sort(ofOne.begin(), ofOne.end());
+    REQUIRE( ofOne == std::vector<flash::GroupId> { std::min(a, b), std::max(a, b) } );
+
+    groups.remove_user(1);
+
+    REQUIRE( sorted_members(groups, a) == std::vector<flash::UserId> { 2 } );
+    REQUIRE( groups.members(b)->empty() );
+    REQUIRE( groups.groups_of(1).empty() );
+
+    // Nothing to do for a user in no group.
+    groups.remove_user(7);
+    REQUIRE( groups.size() == 2 );
+}
+
+TEST_CASE( "Destroyed groups are never found by their ID again", "[groups]" ) {
+    flash::client_groups groups;
+
+    flash::GroupId old = groups.create();
+    groups.add(old, 1);
+    groups.add(old, 2);
+
+    REQUIRE( groups.destroy(old) );
+    REQUIRE_FALSE( groups.destroy(old) );
+    REQUIRE( groups.empty() );
+    REQUIRE( groups.groups_of(1).empty() );
+
+    // The new group takes the slot of the old one, under another ID.
+    flash::GroupId recent = groups.create();
+    REQUIRE( recent != old );
+    REQUIRE( groups.members(old) == nullptr );
+    REQUIRE_FALSE( groups.add(old, 3) );
+    REQUIRE( groups.members(recent)->empty() );
+}
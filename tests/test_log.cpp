@@ -0,0 +1,152 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/log.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+/**
+ * Keeps the records it is given, and optionally holds them until released.
+*/
+class capture_logger : public flash::logger {
+public:
+    void write(flash::log_record&& record) override {
+        std::unique_lock<std::mutex> lock { m_mutex };
+        m_released.wait(lock, [this]() { return !m_holding; });
+
+        m_records.push_back(std::move(record));
+        m_written.notify_all();
+    }
+
+    void hold() {
+        std::scoped_lock lock { m_mutex };
+        m_holding = true;
+    }
+
+    void release() {
+        std::scoped_lock lock { m_mutex };
+        m_holding = false;
+        m_released.notify_all();
+    }
+
+    bool wait_for(size_t count) {
+        std::unique_lock<std::mutex> lock { m_mutex };
+        return m_written.wait_for(lock, 5s, [this, count]() { return m_records.size() >= count; });
+    }
+
+    std::vector<flash::log_record> records() {
+        std::scoped_lock lock { m_mutex };
+        return m_records;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_written;
+    std::condition_variable m_released;
+    bool m_holding { false };
+    std::vector<flash::log_record> m_records;
+};
+
+TEST_CASE( "Log records go to the logger that is set, above the level", "[log]" ) {
+    capture_logger capture;
+    flash::set_logger(&capture);
+    flash::set_log_level(flash::log_level::info);
+
+    FLASH_LOG(debug, 7, "Hidden " << 1);
+    FLASH_LOG(info, 7, "Client " << "Validated.");
+    FLASH_LOG(error, flash::INVALID_USER_ID, "[SERVER] Error: " << 42);
+
+    flash::set_log_level(flash::log_level::error);
+    FLASH_LOG(warning, 7, "Hidden too");
+
+    flash::set_logger(nullptr);
+    flash::set_log_level(flash::log_level::info);
+
+    std::vector<flash::log_record> records = capture.records();
+    REQUIRE( records.size() == 2 );
+
+    REQUIRE( records[0].m_level == flash::log_level::info );
+    REQUIRE( records[0].m_user == 7 );
+    REQUIRE( records[0].m_text == "Client Validated." );
+
+    REQUIRE( records[1].m_level == flash::log_level::error );
+    REQUIRE( records[1].m_user == flash::INVALID_USER_ID );
+    REQUIRE( records[1].m_text == "[SERVER] Error: 42" );
+}
+
+TEST_CASE( "Log text is only formatted when the level is enabled", "[log]" ) {
+    capture_logger capture;
+    flash::set_logger(&capture);
+    flash::set_log_level(flash::log_level::warning);
+
+    int formatted = 0;
+    auto count = [&formatted]() { return ++formatted; };
+
+    FLASH_LOG(info, 1, "Skipped " << count());
+    FLASH_LOG(warning, 1, "Kept " << count());
+
+    flash::set_logger(nullptr);
+    flash::set_log_level(flash::log_level::info);
+
+    REQUIRE( formatted == 1 );
+    REQUIRE( capture.records().size() == 1 );
+    REQUIRE( capture.records()[0].m_text == "Kept 1" );
+}
+
+TEST_CASE( "The asynchronous logger writes records in order from another thread", "[log]" ) {
+    auto capture = std::make_shared<capture_logger>();
+    std::thread::id caller = std::this_thread::get_id();
+
+    {
+        flash::async_logger<64> async { capture };
+
+        for (int i = 0; i < 10; ++i) {
+            async.write(flash::log_record { flash::log_level::info, {}, 1, std::to_string(i) });
+        }
+
+        REQUIRE( capture->wait_for(10) );
+    }
+
+    std::vector<flash::log_record> records = capture->records();
+    REQUIRE( records.size() == 10 );
+
+    bool ordered = true;
+    for (int i = 0; i < 10; ++i) ordered = ordered && records[i].m_text == std::to_string(i);
+    REQUIRE( ordered );
+
+    REQUIRE( caller == std::this_thread::get_id() );
+}
+
+TEST_CASE( "The asynchronous logger drops records when full and reports them", "[log]" ) {
+    auto capture = std::make_shared<capture_logger>();
+    capture->hold();
+
+    {
+        flash::async_logger<4> async { capture };
+
+        // The background thread takes the first record, then blocks on the sink.
+        async.write(flash::log_record { flash::log_level::info, {}, 1, "first" });
+        std::this_thread::sleep_for(50ms);
+
+        // Never blocks, whatever the sink does.
+        for (int i = 0; i < 10; ++i) {
+            async.write(flash::log_record { flash::log_level::info, {}, 1, "more" });
+        }
+
+        capture->release();
+        REQUIRE( capture->wait_for(6) );
+    }
+
+    std::vector<flash::log_record> records = capture->records();
+    REQUIRE( records.size() == 6 );
+    REQUIRE( records[0].m_text == "first" );
+    REQUIRE( records[5].m_level == flash::log_level::warning );
+    REQUIRE( records[5].m_text == "[LOG] 6 Records Dropped." );
+}
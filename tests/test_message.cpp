@@ -108,4 +108,125 @@ TEST_CASE( "Tagged message holds data correctly" , "[message]" ) {
     REQUIRE( x == 1 );
 
     REQUIRE( tm.m_msg.size() == sizeof(flash::header<MessageId>) );
-}
\ No newline at end of file
+}
+
+TEST_CASE( "Shared message is encoded once in network byte order" , "[message]" ) {
+    enum class MessageId : uint32_t {
+        KId0,
+        KId1
+    };
+
+    flash::message<MessageId> msg { MessageId::KId1 };
+    msg << 1 << 2;
+
+    flash::shared_message<MessageId> shared = flash::make_shared_message(std::move(msg));
+    flash::shared_message<MessageId> other = shared;
+
+    REQUIRE( shared.use_count() == 2 );
+    REQUIRE( &other->get_body() == &shared->get_body() );
+
+    REQUIRE( shared->get_header().m_type == MessageId::KId1 );
+    REQUIRE( boost::endian::big_to_native(shared->get_header().m_size) == 2 * sizeof(int) );
+
+    REQUIRE( shared->size() == sizeof(flash::header<MessageId>) + 2 * sizeof(int) );
+}
+
+TEST_CASE( "Message stores small bodies inline and spills large ones" , "[message]" ) {
+    enum class MessageId : uint32_t {
+        KId0
+    };
+
+    flash::message<MessageId> msg { MessageId::KId0 };
+    msg << 1 << 2.0;
+
+    REQUIRE( msg.get_body().is_inline() );
+
+    std::array<uint8_t, FLASH_MESSAGE_INLINE_SIZE> payload {};
+    msg << payload;
+
+    REQUIRE( !msg.get_body().is_inline() );
+    REQUIRE( msg.get_header().m_size == sizeof(int) + sizeof(double) + payload.size() );
+
+    msg >> payload;
+
+    double d;
+    int x;
+    msg >> d >> x;
+
+    REQUIRE( d == 2.0 );
+    REQUIRE( x == 1 );
+}
+
+TEST_CASE( "Message writes arrays in bulk and reserves room for the body" , "[message]" ) {
+    enum class MessageId : uint32_t {
+        KId0
+    };
+
+    flash::message<MessageId> msg { MessageId::KId0 };
+    msg.reserve(1000);
+
+    const uint8_t* data = msg.get_body().data();
+    REQUIRE( msg.get_body().capacity() >= 1000 );
+
+    std::array<float, 200> values;
+    for (size_t i = 0; i < values.size(); ++i) values[i] = static_cast<float>(i);
+
+    msg.write(10).write(values.data(), values.size());
+
+    REQUIRE( msg.get_body().data() == data );
+    REQUIRE( msg.get_header().m_size == sizeof(int) + values.size() * sizeof(float) );
+}
+
+TEST_CASE( "Message reader reads front to back without modifying the message" , "[message]" ) {
+    enum class MessageId : uint32_t {
+        KId0
+    };
+
+    std::array<int, 3> values { 4, 5, 6 };
+
+    flash::message<MessageId> msg { MessageId::KId0 };
+    msg << 1 << 2.5f;
+    msg.write(values.data(), values.size());
+
+    size_t size = msg.size();
+
+    for (int pass = 0; pass < 2; ++pass) {
+        flash::message_reader reader { msg };
+
+        int x;
+        float f;
+        std::array<int, 3> read {};
+
+        reader >> x >> f;
+        REQUIRE( reader.read(read.data(), read.size()) );
+
+        REQUIRE( reader );
+        REQUIRE( x == 1 );
+        REQUIRE( f == 2.5f );
+        REQUIRE( read == values );
+        REQUIRE( reader.remaining() == 0 );
+    }
+
+    REQUIRE( msg.size() == size );
+}
+
+TEST_CASE( "Message reader fails on reading past the end" , "[message]" ) {
+    enum class MessageId : uint32_t {
+        KId0
+    };
+
+    flash::message<MessageId> msg { MessageId::KId0 };
+    msg << 7;
+
+    flash::message_reader reader { msg };
+
+    double d = 1.0;
+    REQUIRE( !reader.read(d) );
+    REQUIRE( d == 1.0 );
+    REQUIRE( !reader );
+
+    // The failed read didn't move the cursor.
+    REQUIRE( reader.offset() == 0 );
+    REQUIRE( reader.skip(sizeof(int)) );
+    REQUIRE( !reader.skip(1) );
+}
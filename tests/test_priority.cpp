@@ -0,0 +1,71 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/priority.hpp>
+#include <flash/queues.hpp>
+
+#include <vector>
+
+enum class PriorityId : uint32_t {
+    Position,
+    Chat,
+    Asset
+};
+
+TEST_CASE( "Priority map defaults to normal", "[priority]" ) {
+    flash::priority_map<PriorityId> priorities;
+    REQUIRE( priorities.get(PriorityId::Position) == flash::priority::normal );
+
+    priorities.set(PriorityId::Position, flash::priority::realtime);
+    priorities.set(PriorityId::Asset, flash::priority::bulk);
+
+    REQUIRE( priorities.get(PriorityId::Position) == flash::priority::realtime );
+    REQUIRE( priorities.get(PriorityId::Chat) == flash::priority::normal );
+    REQUIRE( priorities.get(PriorityId::Asset) == flash::priority::bulk );
+}
+
+TEST_CASE( "Priority lanes pop the most urgent first", "[priority]" ) {
+    flash::priority_lanes<flash::locking_queues, int> lanes;
+    REQUIRE( lanes.empty() );
+
+    lanes.try_push_back(1, flash::priority::bulk);
+    lanes.try_push_back(2, flash::priority::bulk);
+    lanes.try_push_back(3, flash::priority::normal);
+    lanes.try_push_back(4, flash::priority::realtime);
+    lanes.try_push_back(5);
+
+    REQUIRE( lanes.size() == 5 );
+    REQUIRE( lanes.front() == 4 );
+    REQUIRE( lanes.pop_front() == 4 );
+
+    // Normal ones come next, in order, then the bulk ones.
+    REQUIRE( lanes.pop_front() == 3 );
+    REQUIRE( lanes.pop_front() == 5 );
+
+    // A more urgent element overtakes what is left.
+    lanes.try_push_back(6, flash::priority::realtime);
+    REQUIRE( lanes.pop_front() == 6 );
+    REQUIRE( lanes.pop_front() == 1 );
+    REQUIRE( lanes.pop_front() == 2 );
+    REQUIRE( lanes.empty() );
+}
+
+TEST_CASE( "Priority lanes drain the most urgent first", "[priority]" ) {
+    flash::priority_lanes<flash::lockfree_queues<8, 4>, int> lanes;
+
+    for (int i = 0; i < 4; ++i) {
+        REQUIRE( lanes.try_push_back(100 + i, flash::priority::bulk) );
+    }
+
+    // Each lane is bounded on its own.
+    REQUIRE_FALSE( lanes.try_push_back(104, flash::priority::bulk) );
+    REQUIRE( lanes.try_push_back(0, flash::priority::realtime) );
+    REQUIRE( lanes.try_push_back(10, flash::priority::normal) );
+
+    std::vector<int> out;
+    REQUIRE( lanes.drain_into(out, 3) == 3 );
+    REQUIRE( out == std::vector<int> { 0, 10, 100 } );
+
+    REQUIRE( lanes.drain_into(out) == 3 );
+    REQUIRE( out == std::vector<int> { 0, 10, 100, 101, 102, 103 } );
+    REQUIRE( lanes.empty() );
+}
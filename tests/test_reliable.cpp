@@ -0,0 +1,206 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/udp/reliable.hpp>
+
+#include <boost/endian/conversion.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+enum class ReliableId : uint32_t {
+    Event
+};
+
+using channel_type = flash::udp::reliable_channel<ReliableId>;
+using clock_type = channel_type::clock;
+using namespace std::chrono_literals;
+
+/**
+ * Builds a message holding a single number, with its header in network byte order.
+*/
+static flash::message<ReliableId> numbered(uint32_t number) {
+    flash::message<ReliableId> msg { ReliableId::Event };
+    msg << number;
+    msg.get_header().m_size = boost::endian::native_to_big(msg.get_header().m_size);
+
+    return msg;
+}
+
+/**
+ * Collects the frames that a channel has due.
+*/
+static std::vector<flash::message<ReliableId>> poll(channel_type& channel, clock_type::time_point now) {
+    std::vector<flash::message<ReliableId>> frames;
+    channel.poll(now, [&](flash::message<ReliableId>&& frame) { frames.push_back(std::move(frame)); });
+
+    return frames;
+}
+
+/**
+ * Hands a frame to a channel, and appends the numbers of the messages delivered.
+*/
+static bool receive(channel_type& channel, const flash::message<ReliableId>& frame,
+                    clock_type::time_point now, std::vector<uint32_t>& delivered) {
+    return channel.receive(frame.get_body().data(), frame.get_body().size(), now,
+        [&](const uint8_t* data, size_t length) {
+            REQUIRE( length == sizeof(flash::header<ReliableId>) + sizeof(uint32_t) );
+
+            uint32_t number;
+            std::memcpy(&number, data + sizeof(flash::header<ReliableId>), sizeof(number));
+            delivered.push_back(number);
+        });
+}
+
+/**
+ * @returns Whether the frame is a standalone acknowledgement.
+*/
+static bool is_ack(const flash::message<ReliableId>& frame) {
+    return frame.get_body()[0] == flash::udp::CONTROL_RELIABLE_ACK;
+}
+
+TEST_CASE( "Reliable messages are delivered and acknowledged", "[reliable]" ) {
+    channel_type sender, receiver;
+    clock_type::time_point now = clock_type::now();
+    std::vector<uint32_t> delivered;
+
+    for (uint32_t i = 0; i < 3; ++i) sender.send(numbered(i));
+
+    auto frames = poll(sender, now);
+    REQUIRE( frames.size() == 3 );
+    REQUIRE( sender.num_in_flight() == 3 );
+
+    uint32_t wireSize = boost::endian::big_to_native(frames[0].get_header().m_size);
+    REQUIRE( (wireSize & flash::WIRE_FLAG_CONTROL) != 0 );
+    REQUIRE( (wireSize & flash::WIRE_SIZE_MASK) == frames[0].get_body().size() );
+
+    for (auto& frame : frames) REQUIRE( receive(receiver, frame, now, delivered) );
+    REQUIRE( delivered == std::vector<uint32_t> { 0, 1, 2 } );
+
+    // Nothing to carry the acknowledgement, so it goes on its own.
+    auto acks = poll(receiver, now + 5ms);
+    REQUIRE( acks.size() == 1 );
+    REQUIRE( is_ack(acks[0]) );
+
+    REQUIRE( receive(sender, acks[0], now + 10ms, delivered) );
+    REQUIRE( sender.num_in_flight() == 0 );
+    REQUIRE( sender.rtt() == clock_type::duration { 10ms } );
+
+    // Nothing left to send, on either side.
+    REQUIRE( poll(sender, now + 1s).empty() );
+    REQUIRE( poll(receiver, now + 1s).empty() );
+}
+
+TEST_CASE( "Lost reliable messages are resent selectively", "[reliable]" ) {
+    channel_type sender, receiver;
+    clock_type::time_point now = clock_type::now();
+    std::vector<uint32_t> delivered;
+
+    for (uint32_t i = 0; i < 4; ++i) sender.send(numbered(i));
+    auto frames = poll(sender, now);
+
+    // The second one is lost, so the last two wait for it.
+    receive(receiver, frames[0], now, delivered);
+    receive(receiver, frames[2], now, delivered);
+    receive(receiver, frames[3], now, delivered);
+    REQUIRE( delivered == std::vector<uint32_t> { 0 } );
+
+    auto acks = poll(receiver, now);
+    receive(sender, acks[0], now, delivered);
+    REQUIRE( sender.num_in_flight() == 1 );
+
+    // Not resent before the timeout, and only the missing one after it.
+    REQUIRE( poll(sender, now + sender.rto() / 2).empty() );
+
+    auto resent = poll(sender, now + sender.rto());
+    REQUIRE( resent.size() == 1 );
+
+    receive(receiver, resent[0], now, delivered);
+    REQUIRE( delivered == std::vector<uint32_t> { 0, 1, 2, 3 } );
+
+    // The acknowledgement rides along with the next reliable message instead.
+    receiver.send(numbered(100));
+    auto reply = poll(receiver, now);
+    REQUIRE( reply.size() == 1 );
+    REQUIRE_FALSE( is_ack(reply[0]) );
+
+    std::vector<uint32_t> replies;
+    receive(sender, reply[0], now, replies);
+    REQUIRE( replies == std::vector<uint32_t> { 100 } );
+    REQUIRE( sender.num_in_flight() == 0 );
+}
+
+TEST_CASE( "Reliable channel drops duplicates and limits the window", "[reliable]" ) {
+    channel_type sender, receiver;
+    clock_type::time_point now = clock_type::now();
+    std::vector<uint32_t> delivered;
+
+    for (uint32_t i = 0; i < flash::udp::RELIABLE_WINDOW_SIZE + 10; ++i) sender.send(numbered(i));
+
+    auto frames = poll(sender, now);
+    REQUIRE( frames.size() == flash::udp::RELIABLE_WINDOW_SIZE );
+    REQUIRE( sender.backlog_size() == 10 );
+
+    receive(receiver, frames[0], now, delivered);
+    receive(receiver, frames[0], now, delivered);
+    REQUIRE( delivered.size() == 1 );
+
+    // Acknowledging the first one makes room for one more.
+    receive(sender, poll(receiver, now)[0], now, delivered);
+    REQUIRE( poll(sender, now).size() == 1 );
+    REQUIRE( sender.backlog_size() == 9 );
+
+    // Malformed frames are rejected.
+    flash::message<ReliableId> bogus = numbered(0);
+    REQUIRE_FALSE( receive(receiver, bogus, now, delivered) );
+
+    frames[1].get_body().resize(frames[1].get_body().size() - 1);
+    REQUIRE_FALSE( receive(receiver, frames[1], now, delivered) );
+    REQUIRE( delivered.size() == 1 );
+}
+
+TEST_CASE( "Reliable channel delivers everything in order over a lossy link", "[reliable]" ) {
+    channel_type a, b;
+    clock_type::time_point now = clock_type::now();
+    std::vector<uint32_t> deliveredToB, deliveredToA;
+
+    std::mt19937 rng { 17 };
+    std::uniform_int_distribution<int> percent { 0, 99 };
+
+    constexpr uint32_t COUNT = 500;
+    uint32_t sent = 0;
+
+    for (int tick = 0; tick < 20000 && deliveredToB.size() < COUNT; ++tick) {
+        now += 10ms;
+
+        if (sent < COUNT) a.send(numbered(sent++));
+        if (tick % 3 == 0) b.send(numbered(tick));
+
+        // A third of the frames are lost in each direction, and the rest arrive shuffled.
+        auto fromA = poll(a, now);
+        auto fromB = poll(b, now);
+        std::shuffle(fromA.begin(), fromA.end(), rng);
+
+        for (auto& frame : fromA) {
+            if (percent(rng) >= 33) REQUIRE( receive(b, frame, now, deliveredToB) );
+        }
+
+        for (auto& frame : fromB) {
+            if (percent(rng) >= 33) REQUIRE( receive(a, frame, now, deliveredToA) );
+        }
+    }
+
+    REQUIRE( deliveredToB.size() == COUNT );
+
+    for (uint32_t i = 0; i < COUNT; ++i) {
+        REQUIRE( deliveredToB[i] == i );
+    }
+
+    // What the other side sent arrives in order too.
+    for (size_t i = 1; i < deliveredToA.size(); ++i) {
+        REQUIRE( deliveredToA[i] == deliveredToA[i - 1] + 3 );
+    }
+}
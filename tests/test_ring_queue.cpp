@@ -0,0 +1,236 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/message.hpp>
+#include <flash/ring_queue.hpp>
+
+#include <thread>
+#include <vector>
+
+TEST_CASE( "SPSC ring queue supports pushing and popping in order", "[ring_queue]" ) {
+    flash::spsc_ring_queue<int, 4> queue {};
+
+    REQUIRE( queue.empty() == true );
+    REQUIRE( queue.capacity() == 4 );
+
+    queue.push_back(1);
+    queue.push_back(2);
+
+    REQUIRE( queue.size() == 2 );
+    REQUIRE( queue.front() == 1 );
+
+    REQUIRE( queue.pop_front() == 1 );
+    REQUIRE( queue.pop_front() == 2 );
+
+    REQUIRE( queue.empty() == true );
+
+    int x;
+    REQUIRE( queue.try_pop_front(x) == false );
+}
+
+TEST_CASE( "SPSC ring queue rejects pushes when full and wraps around", "[ring_queue]" ) {
+    flash::spsc_ring_queue<int, 4> queue {};
+
+    for (int i = 0; i < 4; ++i) {
+        REQUIRE( queue.try_push_back(int { i }) == true );
+    }
+
+    REQUIRE( queue.try_push_back(4) == false );
+    REQUIRE( queue.size() == 4 );
+
+    REQUIRE( queue.pop_front() == 0 );
+    REQUIRE( queue.try_push_back(4) == true );
+
+    for (int i = 1; i <= 4; ++i) {
+        int x;
+        REQUIRE( queue.try_pop_front(x) == true );
+        REQUIRE( x == i );
+    }
+
+    REQUIRE( queue.empty() == true );
+}
+
+TEST_CASE( "MPSC ring queue rejects pushes when full and wraps around", "[ring_queue]" ) {
+    flash::mpsc_ring_queue<int, 4> queue {};
+
+    REQUIRE( queue.empty() == true );
+
+    for (int i = 0; i < 4; ++i) {
+        REQUIRE( queue.try_push_back(int { i }) == true );
+    }
+
+    REQUIRE( queue.try_push_back(4) == false );
+    REQUIRE( queue.size() == 4 );
+
+    for (int lap = 0; lap < 3; ++lap) {
+        REQUIRE( queue.pop_front() == lap );
+        REQUIRE( queue.try_push_back(int { lap + 4 }) == true );
+    }
+
+    REQUIRE( queue.front() == 3 );
+
+    queue.clear();
+
+    REQUIRE( queue.empty() == true );
+}
+
+TEST_CASE( "Ring queues support non-default-constructible messages", "[ring_queue]" ) {
+    enum class MessageId : uint32_t {
+        KId0,
+        KId1
+    };
+
+    flash::spsc_ring_queue<flash::message<MessageId>, 8> spsc {};
+    flash::mpsc_ring_queue<flash::tagged_message<MessageId>, 8> mpsc {};
+
+    flash::message<MessageId> msg { MessageId::KId1 };
+    msg << 1.0 << 2.0;
+
+    spsc.push_back(std::move(msg));
+
+    REQUIRE( spsc.front().size() == 8 + 2 * sizeof(double) );
+
+    mpsc.push_back({ 100000, spsc.pop_front() });
+
+    flash::tagged_message<MessageId> tm = mpsc.pop_front();
+
+    REQUIRE( tm.m_remote == 100000 );
+    REQUIRE( tm.m_msg.get_header().m_type == MessageId::KId1 );
+
+    double a, b;
+    tm.m_msg >> b >> a;
+
+    REQUIRE( a == 1.0 );
+    REQUIRE( b == 2.0 );
+
+    // Left in the queues to check that the destructors clean them up.
+    spsc.push_back({ MessageId::KId0 });
+    mpsc.push_back({ 100001, { MessageId::KId0 } });
+}
+
+TEST_CASE( "SPSC ring queue passes elements between threads in order", "[ring_queue]" ) {
+    flash::spsc_ring_queue<int, 64> queue {};
+
+    std::thread producer([&] {
+        for (int i = 0; i < 10000; ++i) {
+            queue.push_back(int { i });
+        }
+    });
+
+    bool ordered = true;
+
+    for (int i = 0; i < 10000; ++i) {
+        queue.wait();
+        if (queue.pop_front() != i) ordered = false;
+    }
+
+    producer.join();
+
+    REQUIRE( ordered == true );
+    REQUIRE( queue.empty() == true );
+}
+
+TEST_CASE( "MPSC ring queue handles concurrent producers safely", "[ring_queue]" ) {
+    flash::mpsc_ring_queue<int, 128> queue {};
+
+    constexpr int PRODUCERS = 4;
+    constexpr int PER_PRODUCER = 5000;
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; ++p) {
+        producers.emplace_back([&, p] {
+            for (int i = 0; i < PER_PRODUCER; ++i) {
+                queue.push_back(int { p * PER_PRODUCER + i });
+            }
+        });
+    }
+
+    // Each producer's elements must come out in the order it pushed them.
+    std::vector<int> last(PRODUCERS, -1);
+    bool ordered = true;
+
+    for (int received = 0; received < PRODUCERS * PER_PRODUCER; ++received) {
+        queue.wait();
+
+        int x = queue.pop_front();
+        int p = x / PER_PRODUCER;
+
+        if (x <= last[p]) ordered = false;
+        last[p] = x;
+    }
+
+    for (auto& t : producers) t.join();
+
+    REQUIRE( ordered == true );
+    REQUIRE( queue.empty() == true );
+}
+
+TEST_CASE( "Ring queue correctly waits when empty", "[ring_queue]" ) {
+    flash::mpsc_ring_queue<int, 4> queue {};
+
+    int x { 0 };
+
+    std::thread t1([&] {
+        queue.wait();
+        x = queue.pop_front();
+    });
+
+    std::thread t2([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        queue.push_back(1);
+    });
+
+    t1.join();
+    t2.join();
+
+    REQUIRE( x == 1 );
+}
+
+TEST_CASE( "Ring queues drain into a vector in order, up to a maximum", "[ring_queue]" ) {
+    flash::spsc_ring_queue<int, 8> spsc {};
+    flash::mpsc_ring_queue<int, 8> mpsc {};
+
+    for (int i = 0; i < 5; ++i) {
+        spsc.push_back(int { i });
+        mpsc.push_back(int { i });
+    }
+
+    std::vector<int> batch;
+
+    REQUIRE( spsc.drain_into(batch, 3) == 3 );
+    REQUIRE( batch == std::vector<int> { 0, 1, 2 } );
+    REQUIRE( spsc.drain_into(batch) == 2 );
+    REQUIRE( spsc.empty() == true );
+
+    batch.clear();
+
+    REQUIRE( mpsc.drain_into(batch, 3) == 3 );
+    REQUIRE( batch == std::vector<int> { 0, 1, 2 } );
+    REQUIRE( mpsc.drain_into(batch) == 2 );
+    REQUIRE( batch == std::vector<int> { 0, 1, 2, 3, 4 } );
+    REQUIRE( mpsc.empty() == true );
+
+    // Space freed by the drain must be reusable.
+    for (int i = 0; i < 8; ++i) {
+        REQUIRE( spsc.try_push_back(int { i }) == true );
+    }
+    REQUIRE( spsc.try_push_back(8) == false );
+}
+
+TEST_CASE( "SPSC ring queue visits elements in order until found", "[ring_queue]" ) {
+    flash::spsc_ring_queue<int, 4> queue {};
+
+    // Start past the end of the storage, so the elements wrap around.
+    for (int i = 0; i < 3; ++i) queue.push_back(int { i });
+    for (int i = 0; i < 3; ++i) queue.pop_front();
+    for (int i = 0; i < 4; ++i) queue.push_back(int { i });
+
+    std::vector<int> seen;
+    REQUIRE_FALSE( queue.visit([&](int& x) { seen.push_back(x); return false; }) );
+    REQUIRE( seen == std::vector<int> { 0, 1, 2, 3 } );
+
+    REQUIRE( queue.visit([](int& x) { if (x != 2) return false; x = 20; return true; }) );
+
+    std::vector<int> batch;
+    queue.drain_into(batch);
+    REQUIRE( batch == std::vector<int> { 0, 1, 20, 3 } );
+}
@@ -0,0 +1,88 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/schema.hpp>
+
+#include <array>
+
+enum class SchemaId : uint32_t {
+    Move,
+    Snapshot,
+    Ping
+};
+
+template <>
+struct flash::message_schema<SchemaId, SchemaId::Move> : flash::schema<uint32_t, float, float, uint8_t> { };
+
+template <>
+struct flash::message_schema<SchemaId, SchemaId::Snapshot> : flash::schema<uint16_t, std::array<int32_t, 4>> { };
+
+TEST_CASE( "Schema has compile-time offsets without padding", "[schema]" ) {
+    using move = flash::message_schema<SchemaId, SchemaId::Move>;
+
+    static_assert( move::NUM_FIELDS == 4 );
+    static_assert( move::SIZE == 13 );
+    static_assert( move::offset<0>() == 0 );
+    static_assert( move::offset<1>() == 4 );
+    static_assert( move::offset<2>() == 8 );
+    static_assert( move::offset<3>() == 12 );
+
+    using snapshot = flash::message_schema<SchemaId, SchemaId::Snapshot>;
+
+    static_assert( snapshot::SIZE == 18 );
+    static_assert( snapshot::offset<1>() == 2 );
+}
+
+TEST_CASE( "Schema round-trips fields through a message", "[schema]" ) {
+    flash::message<SchemaId> msg = flash::encode_message<SchemaId::Move>(uint32_t { 7 }, 1.5f, -2.0f, uint8_t { 3 });
+
+    REQUIRE( msg.get_header().m_type == SchemaId::Move );
+    REQUIRE( msg.get_header().m_size == 13 );
+    REQUIRE( flash::message_schema<SchemaId, SchemaId::Move>::validate(msg.get_header()) );
+
+    uint32_t id;
+    float x, y;
+    uint8_t flags;
+
+    REQUIRE( flash::decode_message<SchemaId::Move>(msg, id, x, y, flags) );
+
+    REQUIRE( id == 7 );
+    REQUIRE( x == 1.5f );
+    REQUIRE( y == -2.0f );
+    REQUIRE( flags == 3 );
+}
+
+TEST_CASE( "Schema encodes in little-endian byte order", "[schema]" ) {
+    std::array<int32_t, 4> values { 1, -1, 256, 0 };
+    flash::message<SchemaId> msg = flash::encode_message<SchemaId::Snapshot>(uint16_t { 0x0102 }, values);
+
+    const auto& body = msg.get_body();
+
+    REQUIRE( body[0] == 0x02 );
+    REQUIRE( body[1] == 0x01 );
+    REQUIRE( body[2] == 0x01 );
+    REQUIRE( body[6] == 0xFF );
+    REQUIRE( body[11] == 0x01 );
+
+    uint16_t tick;
+    std::array<int32_t, 4> decoded {};
+
+    REQUIRE( flash::decode_message<SchemaId::Snapshot>(msg, tick, decoded) );
+    REQUIRE( tick == 0x0102 );
+    REQUIRE( decoded == values );
+}
+
+TEST_CASE( "Schema rejects messages of the wrong type or size", "[schema]" ) {
+    uint32_t id = 0;
+    float x = 0, y = 0;
+    uint8_t flags = 0;
+
+    flash::message<SchemaId> ping { SchemaId::Ping };
+    REQUIRE( !flash::decode_message<SchemaId::Move>(ping, id, x, y, flags) );
+
+    flash::message<SchemaId> truncated { SchemaId::Move };
+    truncated << uint32_t { 7 };
+
+    REQUIRE( !flash::message_schema<SchemaId, SchemaId::Move>::validate(truncated.get_header()) );
+    REQUIRE( !flash::decode_message<SchemaId::Move>(truncated, id, x, y, flags) );
+    REQUIRE( id == 0 );
+}
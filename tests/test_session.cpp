@@ -0,0 +1,406 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/session.hpp>
+#include <flash/udp/common.hpp>
+
+#include <flash/tcp/client.hpp>
+#include <flash/tcp/server.hpp>
+#include <flash/udp/client.hpp>
+#include <flash/udp/server.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace {
+
+enum class SessionMsgTypes : uint32_t {
+    Echo,
+    News
+};
+
+/// Grace period long enough for a test to resume a session.
+constexpr std::chrono::milliseconds LONG_GRACE { 2000 };
+
+/// Grace period short enough for a test to wait for it to be over.
+constexpr std::chrono::milliseconds SHORT_GRACE { 200 };
+
+/// Timeout of the datagram servers, which only notice a lost client by its silence.
+constexpr uint32_t SILENCE_TIMEOUT = 200;
+
+/**
+ * Server that echoes every message back to its sender, and counts who came and went.
+ * Stops when it goes away, e.g. when a check fails.
+ * 
+ * @tparam Base the transport of the server.
+*/
+template <typename Base>
+class session_server : public Base {
+public:
+    using Base::Base;
+
+    ~session_server() override { this->Stop(); }
+
+    std::atomic<int> m_validated { 0 };
+    std::atomic<int> m_disconnected { 0 };
+    std::atomic<flash::UserId> m_lastValidated { flash::INVALID_USER_ID };
+    std::atomic<flash::UserId> m_lastSender { flash::INVALID_USER_ID };
+
+protected:
+    bool OnClientConnect(const boost::asio::ip::address& /* address */) override { return true; }
+
+    void OnClientValidate(flash::UserId clientId) override {
+        m_lastValidated = clientId;
+        ++m_validated;
+    }
+
+    void OnClientDisconnect(flash::UserId /* clientId */) override { ++m_disconnected; }
+
+    void OnMessage(flash::UserId clientId, flash::message<SessionMsgTypes>&& msg) override {
+        m_lastSender = clientId;
+        this->MessageClient(clientId, std::move(msg));
+    }
+};
+
+/**
+ * Stream server that tells when it holds the session of a client it lost.
+*/
+class tcp_server : public session_server<flash::tcp::server<SessionMsgTypes>> {
+public:
+    using session_server<flash::tcp::server<SessionMsgTypes>>::session_server;
+
+    bool holds(flash::UserId clientId) {
+        std::scoped_lock lock { m_mutexConnections };
+        return m_lostSince.count(clientId) > 0;
+    }
+};
+
+/**
+ * Datagram server that tells when it holds the session of a client it lost.
+*/
+class udp_server : public session_server<flash::udp::server<SessionMsgTypes>> {
+public:
+    using session_server<flash::udp::server<SessionMsgTypes>>::session_server;
+
+    // The only client of a test, which is held once it times out.
+    bool holds(flash::UserId /* clientId */) { return GetStats().m_timeouts == 1; }
+};
+
+/**
+ * Client that disconnects when it goes away, e.g. when a check fails.
+ * 
+ * @tparam Base the transport of the client.
+*/
+template <typename Base>
+class session_client : public Base {
+public:
+    explicit session_client(bool sessions = true) {
+        if (sessions) this->EnableSessions();
+    }
+
+    ~session_client() override { this->Disconnect(); }
+};
+
+using tcp_client = session_client<flash::tcp::client<SessionMsgTypes>>;
+using udp_client = session_client<flash::udp::client<SessionMsgTypes>>;
+
+/**
+ * Handles the messages of the server until the condition holds, or three seconds.
+*/
+template <typename S>
+bool wait_until(S& server, const std::function<bool()>& condition) {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+
+        server.Update(-1, false);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    return true;
+}
+
+flash::message<SessionMsgTypes> make_value(SessionMsgTypes type, uint32_t value) {
+    flash::message<SessionMsgTypes> msg { type };
+    msg << value;
+    return msg;
+}
+
+/**
+ * Waits for the client to receive the given number of messages, and gives their values in order.
+*/
+template <typename S, typename C>
+std::vector<uint32_t> receive(S& server, C& client, size_t count) {
+    std::vector<uint32_t> values;
+
+    wait_until(server, [&] {
+        while (!client.Incoming().empty()) {
+            flash::message<SessionMsgTypes> msg = client.Incoming().pop_front().m_msg;
+
+            uint32_t value;
+            msg >> value;
+            values.push_back(value);
+        }
+
+        return values.size() >= count;
+    });
+
+    return values;
+}
+
+/**
+ * @returns Whether a message sent by the client comes back to it.
+*/
+template <typename S, typename C>
+bool echoes(S& server, C& client, uint32_t value) {
+    client.Send(make_value(SessionMsgTypes::Echo, value));
+    return receive(server, client, 1) == std::vector<uint32_t> { value };
+}
+
+/**
+ * Connects the client, and waits for the server to validate it.
+*/
+template <typename S, typename C>
+void connect(S& server, C& client, uint16_t port) {
+    int validated = server.m_validated;
+
+    REQUIRE( client.Connect("127.0.0.1", port) );
+    REQUIRE( wait_until(server, [&] { return server.m_validated == validated + 1; }) );
+}
+
+/**
+ * Checks that a client that lost its connection gets its ID back when it reconnects,
+ * along with the messages sent to it meanwhile, without being validated again.
+*/
+template <typename S, typename C>
+void check_resume(S& server, C& client, uint16_t port) {
+    connect(server, client, port);
+    REQUIRE( wait_until(server, [&] { return client.GetSession().valid(); }) );
+    REQUIRE_FALSE( client.IsResumed() );
+
+    flash::UserId id = client.GetSession().m_id;
+    REQUIRE( id == server.m_lastValidated );
+
+    client.Disconnect();
+    REQUIRE( wait_until(server, [&] { return server.holds(id); }) );
+
+    for (uint32_t i = 1; i <= 3; ++i) {
+        server.MessageClient(id, make_value(SessionMsgTypes::News, i));
+    }
+
+    REQUIRE( client.Connect("127.0.0.1", port) );
+    REQUIRE( receive(server, client, 3) == std::vector<uint32_t> { 1, 2, 3 } );
+    REQUIRE( client.IsResumed() );
+    REQUIRE( client.GetSession().m_id == id );
+
+    // Messages go both ways under the same ID.
+    REQUIRE( echoes(server, client, 4) );
+    REQUIRE( server.m_lastSender == id );
+
+    REQUIRE( server.m_validated == 1 );
+    REQUIRE( server.m_disconnected == 0 );
+    REQUIRE( server.GetStats().m_resumed == 1 );
+}
+
+/**
+ * Checks that a client that comes back after the grace period gets a new session.
+*/
+template <typename S, typename C>
+void check_expiry(S& server, C& client, uint16_t port) {
+    connect(server, client, port);
+    REQUIRE( wait_until(server, [&] { return client.GetSession().valid(); }) );
+
+    flash::UserId id = client.GetSession().m_id;
+
+    client.Disconnect();
+    REQUIRE( wait_until(server, [&] { return server.m_disconnected == 1; }) );
+
+    connect(server, client, port);
+    REQUIRE( wait_until(server, [&] { return client.GetSession().valid() && client.GetSession().m_id != id; }) );
+    REQUIRE_FALSE( client.IsResumed() );
+    REQUIRE( client.GetSession().m_id == server.m_lastValidated );
+
+    REQUIRE( echoes(server, client, 1) );
+    REQUIRE( server.GetStats().m_resumed == 0 );
+}
+
+/**
+ * Checks that a server with sessions serves clients without them as before, and holds
+ * the sessions of the others only.
+*/
+template <typename S, typename C>
+void check_mixed_clients(S& server, C& withSessions, C& without, uint16_t port) {
+    connect(server, withSessions, port);
+    connect(server, without, port);
+
+    REQUIRE( echoes(server, withSessions, 1) );
+    REQUIRE( echoes(server, without, 2) );
+    REQUIRE( withSessions.GetSession().valid() );
+    REQUIRE_FALSE( without.GetSession().valid() );
+
+    // Nothing to hold for the client without a session.
+    without.Disconnect();
+    REQUIRE( wait_until(server, [&] { return server.m_disconnected == 1; }) );
+
+    withSessions.Disconnect();
+    REQUIRE( withSessions.Connect("127.0.0.1", port) );
+    REQUIRE( wait_until(server, [&] { return withSessions.IsResumed(); }) );
+    REQUIRE( echoes(server, withSessions, 3) );
+
+    REQUIRE( server.m_validated == 2 );
+    REQUIRE( server.m_disconnected == 1 );
+}
+
+/**
+ * Checks that a client with sessions is served as before by a server without them,
+ * including when it connects again.
+*/
+template <typename S, typename C>
+void check_plain_server(S& server, C& client, uint16_t port) {
+    connect(server, client, port);
+    REQUIRE( echoes(server, client, 1) );
+    REQUIRE_FALSE( client.GetSession().valid() );
+
+    client.Disconnect();
+    connect(server, client, port);
+    REQUIRE( echoes(server, client, 2) );
+    REQUIRE_FALSE( client.GetSession().valid() );
+    REQUIRE_FALSE( client.IsResumed() );
+}
+
+} // namespace
+
+TEST_CASE( "Session wire formats have fixed sizes", "[session]" ) {
+    static_assert( flash::session_request_schema::SIZE == 12 );
+    static_assert( flash::session_grant_schema::SIZE == 13 );
+    static_assert( flash::udp::session_control_schema::SIZE == 14 );
+    static_assert( flash::udp::RESUME_REQUEST_SIZE == 20 );
+}
+
+TEST_CASE( "Session secrets are never 0 and don't repeat", "[session]" ) {
+    std::set<uint64_t> secrets;
+
+    for (int i = 0; i < 1000; ++i) {
+        uint64_t secret = flash::make_session_secret();
+
+        REQUIRE( secret != 0 );
+        secrets.insert(secret);
+    }
+
+    REQUIRE( secrets.size() == 1000 );
+}
+
+TEST_CASE( "Session token is valid only with a secret", "[session]" ) {
+    flash::session_token token;
+    REQUIRE_FALSE( token.valid() );
+    REQUIRE( token.m_id == flash::INVALID_USER_ID );
+
+    token.m_id = 42;
+    REQUIRE_FALSE( token.valid() );
+
+    token.m_secret = flash::make_session_secret();
+    REQUIRE( token.valid() );
+}
+
+TEST_CASE( "Session grant round-trips through its wire format", "[session]" ) {
+    std::array<uint8_t, flash::session_grant_schema::SIZE> wire;
+    uint64_t secret = flash::make_session_secret();
+
+    flash::session_grant_schema::encode_into(wire.data(), uint8_t { 1 }, int32_t { (3 << 20) | 17 }, secret);
+
+    uint8_t resumed;
+    int32_t id;
+    uint64_t decoded;
+    flash::session_grant_schema::decode_from(wire.data(), resumed, id, decoded);
+
+    REQUIRE( resumed == 1 );
+    REQUIRE( id == ((3 << 20) | 17) );
+    REQUIRE( decoded == secret );
+}
+
+TEST_CASE( "Session secrets only match the same secret, and never 0", "[session]" ) {
+    uint64_t secret = flash::make_session_secret();
+
+    REQUIRE( flash::same_session_secret(secret, secret) );
+    REQUIRE_FALSE( flash::same_session_secret(secret, secret ^ 1) );
+    REQUIRE_FALSE( flash::same_session_secret(secret, 0) );
+    REQUIRE_FALSE( flash::same_session_secret(0, 0) );
+}
+
+TEST_CASE( "Stream clients resume their session with their ID and the messages held", "[session]" ) {
+    tcp_server server { 40680 };
+    server.EnableSessions(LONG_GRACE);
+    REQUIRE( server.Start() );
+
+    tcp_client client;
+    check_resume(server, client, 40680);
+}
+
+TEST_CASE( "Stream clients get a new session once the grace period is over", "[session]" ) {
+    tcp_server server { 40681 };
+    server.EnableSessions(SHORT_GRACE);
+    REQUIRE( server.Start() );
+
+    tcp_client client;
+    check_expiry(server, client, 40681);
+}
+
+TEST_CASE( "Stream servers with sessions serve clients without them", "[session]" ) {
+    tcp_server server { 40682 };
+    server.EnableSessions(LONG_GRACE);
+    REQUIRE( server.Start() );
+
+    tcp_client withSessions;
+    tcp_client without { false };
+    check_mixed_clients(server, withSessions, without, 40682);
+}
+
+TEST_CASE( "Stream servers without sessions serve clients with them", "[session]" ) {
+    tcp_server server { 40683 };
+    REQUIRE( server.Start() );
+
+    tcp_client client;
+    check_plain_server(server, client, 40683);
+}
+
+TEST_CASE( "Datagram clients resume their session with their ID and the datagrams held", "[session]" ) {
+    udp_server server { 40684, SILENCE_TIMEOUT };
+    server.EnableSessions(LONG_GRACE);
+    REQUIRE( server.Start() );
+
+    udp_client client;
+    check_resume(server, client, 40684);
+}
+
+TEST_CASE( "Datagram clients get a new session once the grace period is over", "[session]" ) {
+    udp_server server { 40685, SILENCE_TIMEOUT };
+    server.EnableSessions(SHORT_GRACE);
+    REQUIRE( server.Start() );
+
+    udp_client client;
+    check_expiry(server, client, 40685);
+}
+
+TEST_CASE( "Datagram servers with sessions serve clients without them", "[session]" ) {
+    udp_server server { 40686, SILENCE_TIMEOUT };
+    server.EnableSessions(LONG_GRACE);
+    REQUIRE( server.Start() );
+
+    udp_client withSessions;
+    udp_client without { false };
+    check_mixed_clients(server, withSessions, without, 40686);
+}
+
+TEST_CASE( "Datagram servers without sessions serve clients with them", "[session]" ) {
+    udp_server server { 40687, SILENCE_TIMEOUT };
+    REQUIRE( server.Start() );
+
+    udp_client client;
+    check_plain_server(server, client, 40687);
+}
@@ -0,0 +1,106 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/slot_map.hpp>
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+TEST_CASE( "Slot map issues distinct positive IDs and finds their values", "[slot_map]" ) {
+    flash::slot_map<std::string> map;
+
+    flash::UserId a = map.insert("a");
+    flash::UserId b = map.insert("b");
+
+    REQUIRE( a > 0 );
+    REQUIRE( b > 0 );
+    REQUIRE( a != b );
+    REQUIRE( map.size() == 2 );
+
+    REQUIRE( *map.find(a) == "a" );
+    REQUIRE( *map.find(b) == "b" );
+    REQUIRE( map.find(flash::INVALID_USER_ID) == nullptr );
+    REQUIRE( map.find(flash::SERVER_USER_ID) == nullptr );
+}
+
+TEST_CASE( "Slot map never finds a value by the ID of one erased before", "[slot_map]" ) {
+    flash::slot_map<std::string> map;
+
+    flash::UserId old = map.insert("old");
+    REQUIRE( map.erase(old) );
+    REQUIRE_FALSE( map.erase(old) );
+
+    // The only slot is reused, with the next generation.
+    flash::UserId reused = map.insert("new");
+    REQUIRE( reused != old );
+    REQUIRE( map.find(old) == nullptr );
+    REQUIRE( *map.find(reused) == "new" );
+}
+
+TEST_CASE( "Slot map keeps the values contiguous when erasing", "[slot_map]" ) {
+    flash::slot_map<int> map;
+    std::vector<flash::UserId> ids;
+
+    for (int i = 0; i < 10; ++i) ids.push_back(map.insert(int(i)));
+
+    REQUIRE( map.erase(ids[0]) );
+    REQUIRE( map.erase(ids[5]) );
+    REQUIRE( map.erase_if([](flash::UserId, int& value) { return value % 2 == 1; }) == 4 );
+
+    std::set<int> left;
+    map.for_each([&](flash::UserId id, int& value) {
+        REQUIRE( map.find(id) == &value );
+        left.insert(value);
+    });
+
+    REQUIRE( left == std::set<int> { 2, 4, 6, 8 } );
+    REQUIRE( map.size() == 4 );
+}
+
+TEST_CASE( "Slot map reuses the oldest free slot first", "[slot_map]" ) {
+    flash::slot_map<std::unique_ptr<int>> map;
+    std::set<flash::UserId> issued;
+
+    std::vector<flash::UserId> ids;
+    for (int i = 0; i < 4; ++i) ids.push_back(map.insert(std::make_unique<int>(i)));
+    issued.insert(ids.begin(), ids.end());
+
+    // Churning through the slots never issues an ID twice.
+    for (int round = 0; round < 100; ++round) {
+        for (flash::UserId& id : ids) {
+            REQUIRE( map.erase(id) );
+            id = map.insert(std::make_unique<int>(round));
+            REQUIRE( issued.insert(id).second );
+        }
+    }
+
+    REQUIRE( map.size() == 4 );
+    map.clear();
+    REQUIRE( map.empty() );
+    REQUIRE( map.find(ids[0]) == nullptr );
+}
+
+TEST_CASE( "Slot maps with the same stride share the ID space", "[slot_map]" ) {
+    flash::slot_map<int> even { 0, 2 };
+    flash::slot_map<int> odd { 1, 2 };
+
+    std::vector<flash::UserId> evenIds, oddIds;
+    for (int i = 0; i < 5; ++i) {
+        evenIds.push_back(even.insert(int(i)));
+        oddIds.push_back(odd.insert(int(i)));
+    }
+
+    for (int i = 0; i < 5; ++i) {
+        REQUIRE( flash::slot_map<int>::index_of(evenIds[i]) % 2 == 0 );
+        REQUIRE( flash::slot_map<int>::index_of(oddIds[i]) % 2 == 1 );
+
+        REQUIRE( *even.find(evenIds[i]) == i );
+        REQUIRE( even.find(oddIds[i]) == nullptr );
+        REQUIRE( odd.find(evenIds[i]) == nullptr );
+    }
+
+    REQUIRE( even.erase(evenIds[2]) );
+    REQUIRE_FALSE( odd.erase(evenIds[3]) );
+    REQUIRE( *odd.find(oddIds[3]) == 3 );
+}
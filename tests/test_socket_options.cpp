@@ -0,0 +1,146 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/socket_options.hpp>
+
+#include <boost/asio.hpp>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+TEST_CASE( "Socket options default to Nagle disabled only", "[socket_options]" ) {
+    boost::asio::io_context context;
+    boost::asio::ip::tcp::socket socket { context };
+    socket.open(boost::asio::ip::tcp::v4());
+
+    boost::asio::socket_base::send_buffer_size defaultSize;
+    socket.get_option(defaultSize);
+
+    flash::apply_socket_options(socket, flash::socket_options {});
+
+    boost::asio::ip::tcp::no_delay noDelay;
+    socket.get_option(noDelay);
+    REQUIRE( noDelay.value() );
+
+    boost::asio::socket_base::send_buffer_size size;
+    socket.get_option(size);
+    REQUIRE( size.value() == defaultSize.value() );
+}
+
+TEST_CASE( "Socket options are applied to TCP sockets", "[socket_options]" ) {
+    boost::asio::io_context context;
+    boost::asio::ip::tcp::socket socket { context };
+    socket.open(boost::asio::ip::tcp::v4());
+
+    flash::socket_options options;
+    options.m_noDelay = false;
+    options.m_sendBufferSize = 64 * 1024;
+    options.m_receiveBufferSize = 96 * 1024;
+    options.m_dscp = 46;
+
+    flash::apply_socket_options(socket, options);
+
+    boost::asio::ip::tcp::no_delay noDelay;
+    socket.get_option(noDelay);
+    REQUIRE_FALSE( noDelay.value() );
+
+    // Some systems double the sizes for their bookkeeping.
+    boost::asio::socket_base::send_buffer_size sendSize;
+    socket.get_option(sendSize);
+    REQUIRE( sendSize.value() >= options.m_sendBufferSize );
+
+    boost::asio::socket_base::receive_buffer_size receiveSize;
+    socket.get_option(receiveSize);
+    REQUIRE( receiveSize.value() >= options.m_receiveBufferSize );
+
+#ifdef IP_TOS
+    flash::type_of_service tos;
+    socket.get_option(tos);
+    REQUIRE( tos.value() == 46 << 2 );
+#endif
+}
+
+TEST_CASE( "Socket options are applied to UDP sockets and acceptors before binding", "[socket_options]" ) {
+    boost::asio::io_context context;
+
+    flash::socket_options options;
+    options.m_reusePort = true;
+    options.m_receiveBufferSize = 128 * 1024;
+
+    boost::asio::ip::udp::endpoint endpoint { boost::asio::ip::make_address("127.0.0.1"), 0 };
+    boost::asio::ip::udp::socket first { context };
+    first.open(endpoint.protocol());
+    flash::apply_socket_options(first, options);
+    first.bind(endpoint);
+
+    boost::asio::socket_base::receive_buffer_size receiveSize;
+    first.get_option(receiveSize);
+    REQUIRE( receiveSize.value() >= options.m_receiveBufferSize );
+
+#ifdef SO_REUSEPORT
+    // Another socket may then share the port.
+    boost::asio::ip::udp::socket second { context };
+    second.open(endpoint.protocol());
+    flash::apply_socket_options(second, options);
+
+    boost::system::error_code ec;
+    second.bind(first.local_endpoint(), ec);
+    REQUIRE_FALSE( ec );
+
+    boost::asio::ip::tcp::acceptor acceptor { context };
+    acceptor.open(boost::asio::ip::tcp::v4());
+    flash::apply_socket_options(acceptor, options);
+
+    flash::reuse_port reusePort;
+    acceptor.get_option(reusePort);
+    REQUIRE( reusePort.value() );
+#endif
+}
+
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+class recording_logger : public flash::logger {
+public:
+    void write(flash::log_record&& record) override { m_records.push_back(std::move(record)); }
+
+    std::vector<flash::log_record> m_records;
+};
+
+TEST_CASE( "CPU steering is attached to a reuse-port group, which keeps receiving", "[socket_options]" ) {
+    boost::asio::io_context context;
+
+    flash::socket_options options;
+    options.m_reusePort = true;
+
+    boost::asio::ip::udp::endpoint endpoint { boost::asio::ip::make_address("127.0.0.1"), 0 };
+    boost::asio::ip::udp::socket first { context }, second { context };
+
+    first.open(endpoint.protocol());
+    flash::apply_socket_options(first, options);
+    first.bind(endpoint);
+
+    second.open(endpoint.protocol());
+    flash::apply_socket_options(second, options);
+    second.bind(first.local_endpoint());
+
+    recording_logger log;
+    flash::set_logger(&log);
+    flash::attach_cpu_steering(first, 2);
+    flash::set_logger(nullptr);
+
+    REQUIRE( log.m_records.empty() );
+
+    boost::asio::ip::udp::socket sender { context };
+    sender.open(endpoint.protocol());
+    uint32_t payload = 42;
+    sender.send_to(boost::asio::buffer(&payload, sizeof(payload)), first.local_endpoint());
+
+    // Exactly one socket of the group gets the datagram, whichever CPU received it.
+    size_t available = 0;
+    for (int i = 0; i < 100 && available == 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        available = first.available() + second.available();
+    }
+
+    REQUIRE( available == sizeof(payload) );
+}
+#endif
@@ -0,0 +1,104 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/stats.hpp>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+enum class StatsId : uint32_t {
+    Position,
+    Chat,
+    Last = 1000
+};
+
+using namespace std::chrono_literals;
+
+TEST_CASE( "Server counters count messages by type", "[stats]" ) {
+    flash::server_counters counters;
+
+    counters.count_in(StatsId::Position, 20);
+    counters.count_in(StatsId::Position, 30);
+    counters.count_out(StatsId::Chat, 100, 3);
+
+    // Types beyond the counted ones share the last slot.
+    counters.count_in(StatsId::Last, 8);
+
+    flash::server_stats stats;
+    counters.snapshot(stats);
+
+    REQUIRE( stats.m_byType[0].m_messagesIn == 2 );
+    REQUIRE( stats.m_byType[0].m_bytesIn == 50 );
+    REQUIRE( stats.m_byType[1].m_messagesOut == 3 );
+    REQUIRE( stats.m_byType[1].m_bytesOut == 300 );
+    REQUIRE( stats.m_byType[flash::MAX_COUNTED_TYPES - 1].m_messagesIn == 1 );
+
+    REQUIRE( stats.m_total.m_messagesIn == 3 );
+    REQUIRE( stats.m_total.m_bytesIn == 58 );
+    REQUIRE( stats.m_total.m_messagesOut == 3 );
+    REQUIRE( stats.m_total.m_bytesOut == 300 );
+}
+
+TEST_CASE( "Server counters reset the maxima at every snapshot", "[stats]" ) {
+    flash::server_counters counters;
+
+    counters.count_handled(2, 30us, 20us);
+    counters.count_handled(1, 5us, 5us);
+    counters.count_sent(4, 100us, 70us);
+
+    flash::server_stats first;
+    counters.snapshot(first);
+
+    REQUIRE( first.m_handled == 3 );
+    REQUIRE( first.m_handlerTime == 35us );
+    REQUIRE( first.m_maxHandlerTime == 20us );
+    REQUIRE( first.m_sent == 4 );
+    REQUIRE( first.m_sendLag == 100us );
+    REQUIRE( first.m_maxSendLag == 70us );
+
+    counters.count_handled(1, 10us, 10us);
+
+    flash::server_stats second;
+    counters.snapshot(second);
+
+    // Totals keep growing, maxima only cover the time since the previous snapshot.
+    REQUIRE( second.m_handlerTime == 45us );
+    REQUIRE( second.m_maxHandlerTime == 10us );
+    REQUIRE( second.m_maxSendLag == 0us );
+}
+
+TEST_CASE( "Server counters may be bumped from several threads", "[stats]" ) {
+    flash::server_counters counters;
+    flash::traffic_counters traffic;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&counters]() {
+            for (int i = 0; i < 10000; ++i) {
+                counters.count_in(StatsId::Position, 10);
+                counters.m_malformed.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+
+    // A single thread counts the traffic of a connection, while others read it.
+    threads.emplace_back([&traffic]() {
+        for (int i = 0; i < 10000; ++i) traffic.count_out(5);
+    });
+
+    bool consistent = true;
+    while (traffic.load().m_messagesOut < 10000) {
+        consistent = consistent && traffic.load().m_bytesOut <= 50000;
+    }
+    REQUIRE( consistent );
+
+    for (auto& thread : threads) thread.join();
+
+    flash::server_stats stats;
+    counters.snapshot(stats);
+
+    REQUIRE( stats.m_byType[0].m_messagesIn == 40000 );
+    REQUIRE( stats.m_byType[0].m_bytesIn == 400000 );
+    REQUIRE( stats.m_malformed == 40000 );
+    REQUIRE( traffic.load().m_bytesOut == 50000 );
+}
@@ -0,0 +1,165 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/message.hpp>
+
+#include <flash/tcp/client.hpp>
+#include <flash/tcp/server.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <thread>
+#include <vector>
+
+namespace {
+
+enum class StreamMsgTypes : uint32_t {
+    Small,
+    Large
+};
+
+/// Number of small messages in a burst.
+constexpr uint32_t NUM_SMALL = 1000;
+
+/// Position of the large message in a burst.
+constexpr uint32_t LARGE_AT = 500;
+
+/// Size of the large body, too large for the receive buffer.
+constexpr size_t LARGE_SIZE = 200000;
+
+/**
+ * @returns The body of the message at the given position of a burst, of sizes
+ * on both sides of the inline capacity, with bytes that tell the messages apart.
+*/
+std::vector<uint8_t> body_at(uint32_t i) {
+    size_t size = i == LARGE_AT ? LARGE_SIZE : (i * 7) % 200;
+
+    std::vector<uint8_t> body(size);
+    for (size_t j = 0; j < size; ++j) {
+        body[j] = static_cast<uint8_t>(i * 31 + j);
+    }
+
+    return body;
+}
+
+flash::message<StreamMsgTypes> message_at(uint32_t i) {
+    flash::message<StreamMsgTypes> msg { i == LARGE_AT ? StreamMsgTypes::Large : StreamMsgTypes::Small };
+
+    std::vector<uint8_t> body = body_at(i);
+    msg.write(body.data(), body.size());
+    return msg;
+}
+
+/**
+ * @returns Whether the messages are the burst, in order and byte for byte.
+*/
+bool is_burst(const std::vector<flash::message<StreamMsgTypes>>& messages) {
+    if (messages.size() != NUM_SMALL + 1) return false;
+
+    for (uint32_t i = 0; i < messages.size(); ++i) {
+        const flash::message<StreamMsgTypes>& msg = messages[i];
+        std::vector<uint8_t> expected = body_at(i);
+
+        if (msg.get_header().m_type != (i == LARGE_AT ? StreamMsgTypes::Large : StreamMsgTypes::Small)) return false;
+        if (msg.get_header().m_size != expected.size()) return false;
+        if (std::vector<uint8_t>(msg.get_body().begin(), msg.get_body().end()) != expected) return false;
+    }
+
+    return true;
+}
+
+/**
+ * Server that keeps the messages it handles, and can hold its networking thread.
+*/
+class recording_server : public flash::tcp::server<StreamMsgTypes> {
+public:
+    using flash::tcp::server<StreamMsgTypes>::server;
+
+    std::vector<flash::message<StreamMsgTypes>> m_received;
+    std::atomic<flash::UserId> m_client { flash::INVALID_USER_ID };
+
+    /**
+     * Blocks the networking thread until `Release`, so that the messages sent meanwhile
+     * are all queued by the time it goes on.
+    */
+    void Hold() {
+        boost::asio::post(m_ioPool.Get(0), [held = m_release.get_future().share()]() { held.wait(); });
+    }
+
+    void Release() { m_release.set_value(); }
+
+protected:
+    bool OnClientConnect(const boost::asio::ip::address& /* address */) override { return true; }
+    void OnClientValidate(flash::UserId clientId) override { m_client = clientId; }
+    void OnClientDisconnect(flash::UserId /* clientId */) override { }
+
+    void OnMessage(flash::UserId /* clientId */, flash::message<StreamMsgTypes>&& msg) override {
+        m_received.push_back(std::move(msg));
+    }
+
+private:
+    std::promise<void> m_release;
+};
+
+/**
+ * Handles the messages of the server until the condition holds, or five seconds.
+*/
+bool wait_until(recording_server& server, const std::function<bool()>& condition) {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+
+        server.Update(-1, false);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    return true;
+}
+
+} // namespace
+
+TEST_CASE( "Connections parse many messages per read, and large bodies on their own", "[tcp]" ) {
+    recording_server server { 40660 };
+    REQUIRE( server.Start() );
+
+    flash::tcp::client<StreamMsgTypes> client;
+    REQUIRE( client.Connect("127.0.0.1", 40660) );
+
+    for (uint32_t i = 0; i <= NUM_SMALL; ++i) {
+        client.Send(message_at(i));
+    }
+
+    REQUIRE( wait_until(server, [&] { return server.m_received.size() == NUM_SMALL + 1; }) );
+    REQUIRE( is_burst(server.m_received) );
+
+    client.Disconnect();
+    server.Stop();
+}
+
+TEST_CASE( "Connections write queued messages together, in order", "[tcp]" ) {
+    recording_server server { 40661 };
+    REQUIRE( server.Start() );
+
+    flash::tcp::client<StreamMsgTypes> client;
+    REQUIRE( client.Connect("127.0.0.1", 40661) );
+    REQUIRE( wait_until(server, [&] { return server.m_client != flash::INVALID_USER_ID; }) );
+
+    // The whole burst is queued before the first write, so it takes several gathered writes.
+    server.Hold();
+    for (uint32_t i = 0; i <= NUM_SMALL; ++i) {
+        server.MessageClient(server.m_client, message_at(i));
+    }
+    server.Release();
+
+    std::vector<flash::message<StreamMsgTypes>> received;
+    REQUIRE( wait_until(server, [&] {
+        while (!client.Incoming().empty()) received.push_back(client.Incoming().pop_front().m_msg);
+        return received.size() == NUM_SMALL + 1;
+    }) );
+    REQUIRE( is_burst(received) );
+
+    client.Disconnect();
+    server.Stop();
+}
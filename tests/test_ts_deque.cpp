@@ -5,6 +5,7 @@
 
 #include <iostream>
 #include <thread>
+#include <vector>
 
 TEST_CASE( "Deque supports correct pushing and popping at back", "[ts_deque]" ) {
     flash::ts_deque<int> deque {};
@@ -154,4 +155,45 @@ TEST_CASE( "Deque correctly waits when empty", "[ts_deque]" ) {
     t2.join();
 
     REQUIRE( x == 1 );
-}
\ No newline at end of file
+}
+
+TEST_CASE( "Deque drains into a vector in order, up to a maximum", "[ts_deque]" ) {
+    flash::ts_deque<int> deque {};
+
+    for (int i = 0; i < 5; ++i) {
+        deque.push_back(int { i });
+    }
+
+    std::vector<int> batch;
+
+    REQUIRE( deque.drain_into(batch, 3) == 3 );
+    REQUIRE( batch == std::vector<int> { 0, 1, 2 } );
+    REQUIRE( deque.size() == 2 );
+
+    REQUIRE( deque.drain_into(batch) == 2 );
+    REQUIRE( batch == std::vector<int> { 0, 1, 2, 3, 4 } );
+    REQUIRE( deque.empty() == true );
+
+    REQUIRE( deque.drain_into(batch) == 0 );
+    REQUIRE( batch.size() == 5 );
+}
+
+TEST_CASE( "Deque visits elements in order until found", "[ts_deque]" ) {
+    flash::ts_deque<int> deque {};
+
+    for (int i = 0; i < 5; ++i) {
+        deque.push_back(int { i });
+    }
+
+    std::vector<int> seen;
+    REQUIRE( deque.visit([&](int& x) { seen.push_back(x); return x == 2; }) );
+    REQUIRE( seen == std::vector<int> { 0, 1, 2 } );
+
+    // Replace an element in place.
+    deque.visit([](int& x) { if (x != 3) return false; x = 30; return true; });
+    REQUIRE_FALSE( deque.visit([](int& x) { return x == 3; }) );
+
+    std::vector<int> batch;
+    deque.drain_into(batch);
+    REQUIRE( batch == std::vector<int> { 0, 1, 2, 30, 4 } );
+}
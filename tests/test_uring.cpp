@@ -0,0 +1,352 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <flash/uring/ring.hpp>
+
+#ifdef FLASH_HAS_URING
+
+#include <flash/udp/client.hpp>
+#include <flash/uring/server.hpp>
+
+#include <boost/asio.hpp>
+
+#include <sys/socket.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+/**
+ * Loopback socket for the ring to receive on, and one to send to it from.
+*/
+struct loopback {
+    boost::asio::io_context context;
+    boost::asio::ip::udp::socket receiver { context, boost::asio::ip::udp::endpoint { boost::asio::ip::address_v4::loopback(), 0 } };
+    boost::asio::ip::udp::socket sender { context, boost::asio::ip::udp::endpoint { boost::asio::ip::address_v4::loopback(), 0 } };
+
+    void send(const std::string& text) {
+        sender.send_to(boost::asio::buffer(text), receiver.local_endpoint());
+    }
+};
+
+constexpr uint64_t RECEIVE_TAG = 7;
+constexpr socklen_t NAME_CAPACITY = sizeof(sockaddr_in6);
+
+void arm_receive(flash::uring::ring& r, flash::uring::buffer_ring& buffers, int fd, msghdr& hdr) {
+    io_uring_sqe* sqe = r.get_sqe();
+    REQUIRE( sqe != nullptr );
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&hdr);
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = buffers.group_id();
+    sqe->user_data = RECEIVE_TAG;
+}
+
+/**
+ * Waits for the given number of completions, or a second.
+*/
+std::vector<io_uring_cqe> reap(flash::uring::ring& r, size_t count) {
+    std::vector<io_uring_cqe> cqes;
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+
+    while (cqes.size() < count && std::chrono::steady_clock::now() < deadline) {
+        r.submit_and_wait(1, std::chrono::milliseconds(100));
+        r.for_each_cqe([&cqes](const io_uring_cqe& cqe) { cqes.push_back(cqe); });
+    }
+
+    return cqes;
+}
+
+std::string payload_of(flash::uring::buffer_ring& buffers, const io_uring_cqe& cqe) {
+    uint8_t* buffer = buffers.data(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+
+    io_uring_recvmsg_out out;
+    std::memcpy(&out, buffer, sizeof(out));
+
+    const char* payload = reinterpret_cast<const char*>(buffer + sizeof(out) + NAME_CAPACITY);
+    return std::string(payload, out.payloadlen);
+}
+
+enum class RingMsg : uint32_t {
+    Echo,
+    News
+};
+
+/**
+ * Server that echoes every message back to its sender, and records who came and went,
+ * and who sent each value.
+*/
+class echo_server : public flash::uring::server<RingMsg> {
+public:
+    using flash::uring::server<RingMsg>::server;
+
+    std::vector<flash::UserId> validated() {
+        std::scoped_lock lock { m_mutex };
+        return m_validated;
+    }
+
+    flash::UserId sender_of(uint32_t value) {
+        std::scoped_lock lock { m_mutex };
+        return m_senders[value];
+    }
+
+    std::atomic<int> m_disconnected { 0 };
+
+protected:
+    bool OnClientConnect(const boost::asio::ip::address&) override { return true; }
+
+    void OnClientValidate(flash::UserId clientId) override {
+        std::scoped_lock lock { m_mutex };
+        m_validated.push_back(clientId);
+    }
+
+    void OnClientDisconnect(flash::UserId) override { ++m_disconnected; }
+
+    void OnMessage(flash::UserId clientId, flash::message<RingMsg>&& msg) override {
+        flash::message_reader<RingMsg> reader { msg };
+
+        uint32_t value;
+        reader >> value;
+
+        {
+            std::scoped_lock lock { m_mutex };
+            m_senders[value] = clientId;
+        }
+
+        MessageClient(clientId, std::move(msg));
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector<flash::UserId> m_validated;
+    std::unordered_map<uint32_t, flash::UserId> m_senders;
+};
+
+/**
+ * Datagram client that disconnects when it goes away, e.g. when a check fails.
+*/
+class ring_client : public flash::udp::client<RingMsg> {
+public:
+    ~ring_client() override { Disconnect(); }
+};
+
+/**
+ * Handles the messages of the server until the condition holds, or two seconds.
+*/
+bool wait_until(echo_server& server, const std::function<bool()>& condition) {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+
+        server.Update(-1, false);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    return true;
+}
+
+flash::message<RingMsg> make_news(uint32_t value) {
+    flash::message<RingMsg> msg { RingMsg::News };
+    msg << value;
+    return msg;
+}
+
+/**
+ * @returns The values of the messages the client received so far, in order.
+*/
+std::vector<uint32_t> received(ring_client& client) {
+    std::vector<uint32_t> values;
+
+    while (!client.Incoming().empty()) {
+        flash::message<RingMsg> msg = client.Incoming().pop_front().m_msg;
+
+        uint32_t value;
+        msg >> value;
+        values.push_back(value);
+    }
+
+    return values;
+}
+
+} // namespace
+
+TEST_CASE( "Ring server talks to datagram clients", "[uring]" ) {
+    if (!flash::uring::ring::supported()) {
+        WARN( "io_uring is not available, skipped" );
+        return;
+    }
+
+    constexpr uint16_t PORT = 40731;
+
+    echo_server server { PORT };
+    REQUIRE( server.Start() );
+
+    std::vector<std::unique_ptr<ring_client>> clients;
+    for (int i = 0; i < 3; ++i) {
+        clients.push_back(std::make_unique<ring_client>());
+        REQUIRE( clients.back()->Connect("127.0.0.1", PORT) );
+    }
+
+    REQUIRE( wait_until(server, [&] { return server.validated().size() == 3; }) );
+
+    // Messages come back to their sender only, which tells the ID of every client.
+    for (uint32_t i = 0; i < 3; ++i) {
+        flash::message<RingMsg> echo { RingMsg::Echo };
+        echo << i;
+        clients[i]->Send(std::move(echo));
+    }
+
+    std::vector<flash::UserId> ids;
+    for (uint32_t i = 0; i < 3; ++i) {
+        REQUIRE( wait_until(server, [&] { return !clients[i]->Incoming().empty(); }) );
+        REQUIRE( received(*clients[i]) == std::vector<uint32_t> { i } );
+        ids.push_back(server.sender_of(i));
+    }
+
+    // Broadcasts reach everyone but the ignored client.
+    server.MessageAllClients(make_news(10), ids[2]);
+
+    REQUIRE( wait_until(server, [&] { return !clients[0]->Incoming().empty() && !clients[1]->Incoming().empty(); }) );
+    REQUIRE( received(*clients[0]) == std::vector<uint32_t> { 10 } );
+    REQUIRE( received(*clients[1]) == std::vector<uint32_t> { 10 } );
+
+    // A group reaches its members only.
+    flash::GroupId group = server.CreateGroup();
+    REQUIRE( server.AddToGroup(group, ids[1]) );
+    REQUIRE( server.AddToGroup(group, ids[2]) );
+    server.MessageGroup(group, make_news(20));
+
+    REQUIRE( wait_until(server, [&] { return !clients[1]->Incoming().empty() && !clients[2]->Incoming().empty(); }) );
+    REQUIRE( received(*clients[1]) == std::vector<uint32_t> { 20 } );
+    REQUIRE( received(*clients[2]) == std::vector<uint32_t> { 20 } );
+    REQUIRE( clients[0]->Incoming().empty() );
+
+    server.Stop();
+}
+
+TEST_CASE( "Ring server times out silent clients, and starts again once stopped", "[uring]" ) {
+    if (!flash::uring::ring::supported()) {
+        WARN( "io_uring is not available, skipped" );
+        return;
+    }
+
+    constexpr uint16_t PORT = 40732;
+
+    echo_server server { PORT, 200 };
+    REQUIRE( server.Start() );
+
+    ring_client client;
+    REQUIRE( client.Connect("127.0.0.1", PORT) );
+    REQUIRE( wait_until(server, [&] { return server.validated().size() == 1; }) );
+
+    // The client sends nothing, so the server drops it.
+    REQUIRE( wait_until(server, [&] { return server.m_disconnected == 1; }) );
+    client.Disconnect();
+
+    server.Stop();
+    REQUIRE( server.Start() );
+
+    REQUIRE( client.Connect("127.0.0.1", PORT) );
+    REQUIRE( wait_until(server, [&] { return server.validated().size() == 2; }) );
+
+    flash::message<RingMsg> echo { RingMsg::Echo };
+    echo << uint32_t { 9 };
+    client.Send(std::move(echo));
+
+    REQUIRE( wait_until(server, [&] { return !client.Incoming().empty(); }) );
+    REQUIRE( received(client) == std::vector<uint32_t> { 9 } );
+
+    server.Stop();
+}
+
+TEST_CASE( "Ring receives datagrams into provided buffers with a single multishot receive", "[uring]" ) {
+    if (!flash::uring::ring::supported()) {
+        WARN( "io_uring is not available, skipped" );
+        return;
+    }
+
+    flash::uring::ring r { 8 };
+    flash::uring::buffer_ring buffers { r, 0, 8, 1024 };
+    loopback sockets;
+
+    msghdr hdr {};
+    hdr.msg_namelen = NAME_CAPACITY;
+    arm_receive(r, buffers, sockets.receiver.native_handle(), hdr);
+    REQUIRE( r.submit() == 1 );
+
+    sockets.send("one");
+    sockets.send("two");
+    sockets.send("three");
+
+    std::vector<io_uring_cqe> cqes = reap(r, 3);
+    REQUIRE( cqes.size() == 3 );
+
+    std::vector<std::string> payloads;
+    for (const io_uring_cqe& cqe : cqes) {
+        REQUIRE( cqe.user_data == RECEIVE_TAG );
+        REQUIRE( cqe.res > 0 );
+        REQUIRE( (cqe.flags & IORING_CQE_F_BUFFER) );
+        REQUIRE( (cqe.flags & IORING_CQE_F_MORE) );
+
+        payloads.push_back(payload_of(buffers, cqe));
+    }
+
+    REQUIRE( payloads == std::vector<std::string> { "one", "two", "three" } );
+
+    // Every datagram got a buffer of its own.
+    REQUIRE( (cqes[0].flags >> IORING_CQE_BUFFER_SHIFT) != (cqes[1].flags >> IORING_CQE_BUFFER_SHIFT) );
+    REQUIRE( (cqes[1].flags >> IORING_CQE_BUFFER_SHIFT) != (cqes[2].flags >> IORING_CQE_BUFFER_SHIFT) );
+}
+
+TEST_CASE( "Ring stops receiving when out of buffers, until they are recycled", "[uring]" ) {
+    if (!flash::uring::ring::supported()) {
+        WARN( "io_uring is not available, skipped" );
+        return;
+    }
+
+    flash::uring::ring r { 8 };
+    flash::uring::buffer_ring buffers { r, 3, 2, 1024 };
+    loopback sockets;
+
+    msghdr hdr {};
+    hdr.msg_namelen = NAME_CAPACITY;
+    arm_receive(r, buffers, sockets.receiver.native_handle(), hdr);
+    r.submit();
+
+    sockets.send("a");
+    sockets.send("b");
+    sockets.send("c");
+
+    // Two datagrams fill the two buffers, and the receive ends on the third.
+    std::vector<io_uring_cqe> cqes = reap(r, 3);
+    REQUIRE( cqes.size() == 3 );
+    REQUIRE( payload_of(buffers, cqes[0]) == "a" );
+    REQUIRE( payload_of(buffers, cqes[1]) == "b" );
+    REQUIRE( cqes[2].res == -ENOBUFS );
+    REQUIRE_FALSE( (cqes[2].flags & IORING_CQE_F_MORE) );
+
+    buffers.recycle(static_cast<uint16_t>(cqes[0].flags >> IORING_CQE_BUFFER_SHIFT));
+    buffers.recycle(static_cast<uint16_t>(cqes[1].flags >> IORING_CQE_BUFFER_SHIFT));
+
+    // The datagram that found no buffer is still waiting in the socket.
+    arm_receive(r, buffers, sockets.receiver.native_handle(), hdr);
+    r.submit();
+
+    cqes = reap(r, 1);
+    REQUIRE( cqes.size() == 1 );
+    REQUIRE( payload_of(buffers, cqes[0]) == "c" );
+}
+
+#endif